@@ -1,8 +1,8 @@
 #include "Breakpoint.h"
-
-uint8_t br_count = 0; //breakpoint count
-uint8_t wa_count = 0; //watchpoing count
-bool started_exception_server = false;
+#include "Image.h"
+#include "Coverage.h"
+#include "Output.h"
+#include <stddef.h>
 
 /*
 starts exception server to catch breakpoints / watchpoints
@@ -12,14 +12,14 @@ kern_return_t start_exception_server(Machium* machium) {
     mach_port_t server;
     kern_return_t kret;
 
-    if (started_exception_server)
+    if (machium->target->started_exception_server)
         return KERN_FAILURE; //only run this once
 
     //allocate mach port with a receive right for our remote task
-    kret = mach_port_allocate(machium->debug_task, MACH_PORT_RIGHT_RECEIVE, &server);
+    kret = mach_port_allocate(machium->target->debug_task, MACH_PORT_RIGHT_RECEIVE, &server);
 
     if (kret != KERN_SUCCESS) {
-        printf(ERROR"Could not start exception server with error: %s\n", mach_error_string(kret));
+        output_error(kret, "Could not start exception server");
         return KERN_FAILURE;
     }
 
@@ -29,20 +29,47 @@ kern_return_t start_exception_server(Machium* machium) {
 
 
     if (kret != KERN_SUCCESS) {
-        printf(ERROR"Could not insert rights to server with error: %s\n", mach_error_string(kret));
+        output_error(kret, "Could not insert rights to server");
         return KERN_FAILURE;
     }
 
     //this makes our exception server an ARM64 exception handler. currently only supporting breakpoints!
-    kret = task_set_exception_ports(machium->debug_task, EXC_MASK_BREAKPOINT, server, EXCEPTION_STATE, ARM_THREAD_STATE64);
+    kret = task_set_exception_ports(machium->target->debug_task, EXC_MASK_BREAKPOINT, server, EXCEPTION_STATE, ARM_THREAD_STATE64);
     if (kret != KERN_SUCCESS) {
-        printf(ERROR"Could not set task exception port with error: %s\n", mach_error_string(kret));
+        output_error(kret, "Could not set task exception port");
         return KERN_FAILURE;
     }
-    started_exception_server = true;
+    machium->target->started_exception_server = true;
     return KERN_SUCCESS;
 }
 
+arm_thread_state64_t* exception_state(ExceptionRequest* request, ExceptionReply* reply) {
+    memset(reply, 0, offsetof(ExceptionReply, state));
+    reply->head.msgh_bits = MACH_MSGH_BITS(MACH_MSGH_BITS_REMOTE(request->head.msgh_bits), 0);
+    reply->head.msgh_remote_port = request->head.msgh_remote_port;
+    reply->head.msgh_local_port = MACH_PORT_NULL;
+    reply->head.msgh_id = request->head.msgh_id + 100;
+    reply->head.msgh_size = offsetof(ExceptionReply, flavor);
+    reply->ndr = NDR_record;
+    reply->result = KERN_FAILURE;
+
+    if (request->head.msgh_id != EXCEPTION_RAISE_STATE) {
+        reply->result = MIG_BAD_ID;
+        return NULL;
+    }
+    if (request->flavor != ARM_THREAD_STATE64 || request->state_count < ARM_THREAD_STATE64_COUNT || request->state_count > THREAD_STATE_MAX)
+        return NULL;
+    return (arm_thread_state64_t*) request->state;
+}
+
+void exception_reply_state(ExceptionRequest* request, ExceptionReply* reply) {
+    reply->result = KERN_SUCCESS;
+    reply->flavor = request->flavor;
+    reply->state_count = request->state_count;
+    memcpy(reply->state, request->state, request->state_count * sizeof(natural_t));
+    reply->head.msgh_size = (mach_msg_size_t) (offsetof(ExceptionReply, state) + reply->state_count * sizeof(natural_t));
+}
+
 /*
 sets a hardware breakpoint
 the max amount of hardware breakpoints is 6
@@ -61,29 +88,36 @@ machium_command_t m_breakpoint(Machium* machium) {
     mach_msg_type_number_t state_count;
 
     uint64_t address;
+    char annotation[IMAGE_DESCRIPTION_MAX];
 
     if (machium->args_count < 2) {
-        printf(ERROR"Not enough arguments for 'breakpoint', 2 minimum\n");
+        output_error(KERN_SUCCESS, "Not enough arguments for 'breakpoint', 2 minimum");
         return MACHIUM_FAILURE;
     }
     else if (machium->args_count > 3) {
-        printf(ERROR"Too many arguments for 'breakpoint', 3 maximum\n");
+        output_error(KERN_SUCCESS, "Too many arguments for 'breakpoint', 3 maximum");
+        return MACHIUM_FAILURE;
+    }
+
+    //coverage owns the breakpoint exception port while it runs, and 'coverage stop' would put this one's port back over ours
+    if (machium->target->coverage && machium->target->coverage->running) {
+        output_error(KERN_SUCCESS, "Coverage is running, 'coverage stop' first");
         return MACHIUM_FAILURE;
     }
 
     //handle mach exceptions
-    if (!started_exception_server) {
+    if (!machium->target->started_exception_server) {
         kret = start_exception_server(machium);
         if (kret != KERN_SUCCESS) {
-            printf(ERROR"Could not start breakpoint exception server!\n");
+            output_error(KERN_SUCCESS, "Could not start breakpoint exception server!");
         }
     }
 
 
     //task_threads gets an array of active threads for the task indicated by the first argument
-    kret = task_threads(machium->debug_task, &thread_list, &thread_count);
+    kret = task_threads(machium->target->debug_task, &thread_list, &thread_count);
     if (kret != KERN_SUCCESS) {
-        printf(ERROR"Could not get task_threads with error: %s\n", mach_error_string(kret));
+        output_error(kret, "Could not get task_threads");
         return MACHIUM_FAILURE;
     }
 
@@ -99,39 +133,39 @@ machium_command_t m_breakpoint(Machium* machium) {
     state_count = ARM_DEBUG_STATE64_COUNT;
     kret = thread_get_state(thread_list[0], ARM_DEBUG_STATE64, (thread_state_t) &state, &state_count);
     if (kret != KERN_SUCCESS) {
-        printf(ERROR"Could not get thread_get_state with error: %s\n", mach_error_string(kret));
+        output_error(kret, "Could not get thread_get_state");
         return MACHIUM_FAILURE;
     }
 
     address = strtol(machium->args[2], NULL, 0);
 
-    if (br_count == 5) {
-        printf(ERROR"Max amount of hardware breakpoint registers used!\n");
+    if (machium->target->br_count == 5) {
+        output_error(KERN_SUCCESS, "Max amount of hardware breakpoint registers used!");
         return MACHIUM_FAILURE;
     }
 
     if (!strcmp(machium->args[1], "remove") || !strcmp(machium->args[1], "r")) {
-        if (br_count == 0) {
-            printf(ERROR"No breakpoints enabled!\n");
+        if (machium->target->br_count == 0) {
+            output_error(KERN_SUCCESS, "No breakpoints enabled!");
             return MACHIUM_FAILURE;
         }
-        br_count--;
-        state.__bvr[br_count] = 0; //remove address
-        state.__bcr[br_count] = BREAKPOINT_DISABLE; //disable breakpoint by setting state to 0
-        printf(GOOD"Removing breakpoint %d\n", br_count);
+        machium->target->br_count--;
+        state.__bvr[machium->target->br_count] = 0; //remove address
+        state.__bcr[machium->target->br_count] = BREAKPOINT_DISABLE; //disable breakpoint by setting state to 0
+        output_message(OUTPUT_LEVEL_GOOD, "Removing breakpoint %d", machium->target->br_count);
     }
 
     if (!strcmp(machium->args[1], "set") || !strcmp(machium->args[1], "s")) {
-        state.__bvr[br_count] = address; //set to the address where we want to set our breakpoint
-        state.__bcr[br_count] = BREAKPOINT_ENABLE; //enable breakpoint at a hardware level
-        printf(GOOD"Setting breakpoint %d at address 0x%llx\n", br_count, address);
-        br_count++;
+        state.__bvr[machium->target->br_count] = address; //set to the address where we want to set our breakpoint
+        state.__bcr[machium->target->br_count] = BREAKPOINT_ENABLE; //enable breakpoint at a hardware level
+        output_message(OUTPUT_LEVEL_GOOD, "Setting breakpoint %d at address 0x%llx%s", machium->target->br_count, address, image_annotate(machium, address, annotation, sizeof(annotation)));
+        machium->target->br_count++;
     }
 
     //thread_set_state is basically just thread_get_state but it sets the values we changed
     kret = thread_set_state(thread_list[0], ARM_DEBUG_STATE64, (thread_state_t)&state, state_count);
     if (kret != KERN_SUCCESS) {
-        printf(ERROR"Could not get thread_set_state with error: %s\n", mach_error_string(kret));
+        output_error(kret, "Could not get thread_set_state");
         return MACHIUM_FAILURE;
     }
 
@@ -159,28 +193,35 @@ machium_command_t m_watchpoint(Machium* machium) {
     mach_msg_type_number_t state_count;
 
     uint64_t address;
+    char annotation[IMAGE_DESCRIPTION_MAX];
 
     if (machium->args_count < 2) {
-        printf(ERROR"Not enough arguments for 'watchpoint', 2 minimum\n");
+        output_error(KERN_SUCCESS, "Not enough arguments for 'watchpoint', 2 minimum");
         return MACHIUM_FAILURE;
     }
     else if (machium->args_count > 3) {
-        printf(ERROR"Too many arguments for 'watchpoint', 3 maximum\n");
+        output_error(KERN_SUCCESS, "Too many arguments for 'watchpoint', 3 maximum");
+        return MACHIUM_FAILURE;
+    }
+
+    //coverage owns the breakpoint exception port while it runs, and 'coverage stop' would put this one's port back over ours
+    if (machium->target->coverage && machium->target->coverage->running) {
+        output_error(KERN_SUCCESS, "Coverage is running, 'coverage stop' first");
         return MACHIUM_FAILURE;
     }
 
     //handle mach exceptions
-    if (!started_exception_server) {
+    if (!machium->target->started_exception_server) {
         kret = start_exception_server(machium);
         if (kret != KERN_SUCCESS) {
-            printf(ERROR"Could not start breakpoint exception server!\n");
+            output_error(KERN_SUCCESS, "Could not start breakpoint exception server!");
         }
     }
 
     //task_threads gets an array of active threads for the task indicated by the first argument
-    kret = task_threads(machium->debug_task, &thread_list, &thread_count);
+    kret = task_threads(machium->target->debug_task, &thread_list, &thread_count);
     if (kret != KERN_SUCCESS) {
-        printf(ERROR"Could not get task_threads with error: %s\n", mach_error_string(kret));
+        output_error(kret, "Could not get task_threads");
         return MACHIUM_FAILURE;
     }
 
@@ -196,40 +237,40 @@ machium_command_t m_watchpoint(Machium* machium) {
     state_count = ARM_DEBUG_STATE64_COUNT;
     kret = thread_get_state(thread_list[0], ARM_DEBUG_STATE64, (thread_state_t) &state, &state_count);
     if (kret != KERN_SUCCESS) {
-        printf(ERROR"Could not get thread_get_state with error: %s\n", mach_error_string(kret));
+        output_error(kret, "Could not get thread_get_state");
         return MACHIUM_FAILURE;
     }
 
     address = strtol(machium->args[2], NULL, 0);
 
-    if (wa_count == 5) {
-        printf(ERROR"Max amount of hardware watchpoint registers used!\n");
+    if (machium->target->wa_count == 5) {
+        output_error(KERN_SUCCESS, "Max amount of hardware watchpoint registers used!");
         return MACHIUM_FAILURE;
     }
 
     if (!strcmp(machium->args[1], "remove") || !strcmp(machium->args[1], "r")) {
-        if (wa_count == 0) {
-            printf(ERROR"No watchpoints enabled!\n");
+        if (machium->target->wa_count == 0) {
+            output_error(KERN_SUCCESS, "No watchpoints enabled!");
             return MACHIUM_FAILURE;
         }
-        wa_count--;
-        state.__bvr[wa_count] = 0; //remove address
-        state.__bcr[wa_count] = BREAKPOINT_DISABLE; //disable breakpoint and continue execution
-        printf(GOOD"Removing watchpoint %d\n", wa_count);
+        machium->target->wa_count--;
+        state.__bvr[machium->target->wa_count] = 0; //remove address
+        state.__bcr[machium->target->wa_count] = BREAKPOINT_DISABLE; //disable breakpoint and continue execution
+        output_message(OUTPUT_LEVEL_GOOD, "Removing watchpoint %d", machium->target->wa_count);
 
     }
 
     if (!strcmp(machium->args[1], "set") || !strcmp(machium->args[1], "s")) {
-        state.__bvr[wa_count] = address; // address of the watchpoint
-        state.__bcr[wa_count] = BREAKPOINT_ENABLE; //literally the same as above. enables a hardware watchpoint
-        printf(GOOD"Setting watchpoint %d at address 0x%llx\n", wa_count, address);
-        wa_count++;
+        state.__bvr[machium->target->wa_count] = address; // address of the watchpoint
+        state.__bcr[machium->target->wa_count] = BREAKPOINT_ENABLE; //literally the same as above. enables a hardware watchpoint
+        output_message(OUTPUT_LEVEL_GOOD, "Setting watchpoint %d at address 0x%llx%s", machium->target->wa_count, address, image_annotate(machium, address, annotation, sizeof(annotation)));
+        machium->target->wa_count++;
     }
 
     //thread_set_state is basically just thread_get_state but it sets the values we changed
     kret = thread_set_state(thread_list[0], ARM_DEBUG_STATE64, (thread_state_t)&state, state_count);
     if (kret != KERN_SUCCESS) {
-        printf(ERROR"Could not get thread_set_state with error: %s\n", mach_error_string(kret));
+        output_error(kret, "Could not get thread_set_state");
         return MACHIUM_FAILURE;
     }
 
@@ -8,10 +8,46 @@
 #define BREAKPOINT_ENABLE 481
 #define BREAKPOINT_DISABLE 0
 
+#define EXCEPTION_RAISE_STATE 2406 //msgh_id of mach_exception_raise_state, replies are 100 more
+
+//mach_exception_raise_state as the kernel sends it (EXCEPTION_STATE | MACH_EXCEPTION_CODES)
+#pragma pack(push, 4)
+typedef struct ExceptionRequest {
+    mach_msg_header_t head;
+    NDR_record_t ndr;
+    exception_type_t exception;
+    mach_msg_type_number_t code_count;
+    int64_t code[2];
+    int flavor;
+    mach_msg_type_number_t state_count;
+    natural_t state[THREAD_STATE_MAX];
+    mach_msg_trailer_t trailer; //room for the trailer when the state is as big as it gets
+} ExceptionRequest;
+
+//the reply, new_state is what the thread continues with
+typedef struct ExceptionReply {
+    mach_msg_header_t head;
+    NDR_record_t ndr;
+    kern_return_t result;
+    int flavor;
+    mach_msg_type_number_t state_count;
+    natural_t state[THREAD_STATE_MAX];
+} ExceptionReply;
+#pragma pack(pop)
+
 //start the mach exception server which will handle hardware breakpoint exceptions
 //this just prevents crashes for now
 kern_return_t start_exception_server(Machium* machium);
 
+/*
+get the ARM_THREAD_STATE64 out of an exception message, NULL if it's some other message
+[reply] is filled in to fail the exception, exception_reply_state turns it into a success
+*/
+arm_thread_state64_t* exception_state(ExceptionRequest* request, ExceptionReply* reply);
+
+//let the thread of [request] go on with the state it stopped with
+void exception_reply_state(ExceptionRequest* request, ExceptionReply* reply);
+
 //handle breakpoints
 machium_command_t m_breakpoint(Machium* machium);
 
@@ -0,0 +1,373 @@
+#include "Core.h"
+#include "Job.h"
+#include "Output.h"
+#include <fcntl.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//LC_THREAD carrying one ARM_THREAD_STATE64, the layout lldb expects in a core
+typedef struct CoreThreadCommand {
+    uint32_t cmd;
+    uint32_t cmdsize;
+    uint32_t flavor;
+    uint32_t count;
+    arm_thread_state64_t state;
+} CoreThreadCommand;
+
+//true when all [size] bytes are 0. [size] is a multiple of 256
+static bool core_zero(const uint8_t* data, uint64_t size) {
+    for (uint64_t i = 0; i < size; i += 256) {
+#if defined(__ARM_NEON)
+        uint8x16_t any = vdupq_n_u8(0);
+
+        for (uint32_t j = 0; j < 256; j += 64)
+            any = vorrq_u8(any, vorrq_u8(vorrq_u8(vld1q_u8(data + i + j), vld1q_u8(data + i + j + 16)), vorrq_u8(vld1q_u8(data + i + j + 32), vld1q_u8(data + i + j + 48))));
+        if (vmaxvq_u8(any))
+            return false;
+#elif defined(__SSE2__)
+        __m128i any = _mm_setzero_si128();
+
+        for (uint32_t j = 0; j < 256; j += 16)
+            any = _mm_or_si128(any, _mm_loadu_si128((const __m128i*) (data + i + j)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) != 0xffff)
+            return false;
+#else
+        uint64_t any = 0;
+        uint64_t word;
+
+        for (uint32_t j = 0; j < 256; j += 8) {
+            memcpy(&word, data + i + j, sizeof(word));
+            any |= word;
+        }
+        if (any)
+            return false;
+#endif
+    }
+    return true;
+}
+
+/*
+write one piece of a region at its place in the file
+runs of zero pages are skipped, they read back as zeros from the holes they leave
+a region that turns out to be nothing but zeros gets no file space at all (filesize 0)
+*/
+static void core_write_buffer(CoreDump* dump, CoreBuffer* buffer) {
+    struct segment_command_64* segment = &dump->segments[buffer->region];
+    MemoryRegion* region = &dump->regions[buffer->region];
+    uint64_t start;
+    uint64_t end;
+
+    if (buffer->offset == 0)
+        segment->fileoff = dump->data_offset;
+
+    if (!buffer->readable) {
+        dump->unreadable += buffer->size;
+    }
+    else {
+        start = 0;
+        while (start < buffer->size) {
+            if (core_zero(buffer->data + start, vm_page_size)) {
+                start += vm_page_size;
+                continue;
+            }
+            end = start + vm_page_size;
+            while (end < buffer->size && !core_zero(buffer->data + end, vm_page_size))
+                end += vm_page_size;
+
+            if (!dump->failed && pwrite(dump->fd, buffer->data + start, end - start, (off_t) (segment->fileoff + buffer->offset + start)) != (ssize_t) (end - start))
+                dump->failed = true;
+            dump->stored += end - start;
+            segment->filesize = region->size;
+            start = end;
+        }
+    }
+
+    //last piece of the region, the next one starts after it unless it didn't need any space
+    if (buffer->offset + buffer->size == region->size) {
+        if (segment->filesize)
+            dump->data_offset += region->size;
+        else
+            segment->fileoff = 0;
+    }
+}
+
+//writer thread, writes the pieces in order until the reader is finished
+static void* core_writer(void* context) {
+    CoreDump* dump = (CoreDump*) context;
+    CoreBuffer* buffer;
+
+    while (1) {
+        pthread_mutex_lock(&dump->lock);
+        while (dump->head == dump->tail && !dump->finished)
+            pthread_cond_wait(&dump->filled, &dump->lock);
+        if (dump->head == dump->tail) {
+            pthread_mutex_unlock(&dump->lock);
+            break;
+        }
+        buffer = &dump->pieces[dump->head];
+        pthread_mutex_unlock(&dump->lock);
+
+        core_write_buffer(dump, buffer);
+
+        pthread_mutex_lock(&dump->lock);
+        if (buffer->slot >= 0)
+            dump->free_slots[dump->free_count++] = (uint32_t) buffer->slot;
+        dump->head++;
+        pthread_mutex_unlock(&dump->lock);
+        if (buffer->slot < 0 && buffer->readable)
+            vm_deallocate(mach_task_self(), (vm_address_t) buffer->data, buffer->size);
+    }
+    return NULL;
+}
+
+/*
+get one piece out of the suspended task
+a free ring buffer gets a copy, when the writer is behind the piece is mapped copy-on-write with vm_read instead
+that's just as much a picture of the paused task, it only costs memory for pages the task writes after it's resumed
+*/
+static void core_read_piece(CoreDump* dump, mach_port_t task, CoreBuffer* buffer) {
+    mach_msg_type_number_t count;
+    vm_size_t read_size;
+    vm_offset_t data;
+
+    pthread_mutex_lock(&dump->lock);
+    buffer->slot = dump->free_count ? (int32_t) dump->free_slots[--dump->free_count] : -1;
+    pthread_mutex_unlock(&dump->lock);
+
+    if (buffer->slot >= 0) {
+        buffer->data = dump->ring[buffer->slot];
+        read_size = buffer->size;
+        buffer->readable = vm_read_overwrite(task, (vm_address_t) (dump->regions[buffer->region].address + buffer->offset), buffer->size, (vm_address_t) buffer->data, &read_size) == KERN_SUCCESS;
+        return;
+    }
+
+    dump->spilled++;
+    buffer->readable = vm_read(task, (vm_address_t) (dump->regions[buffer->region].address + buffer->offset), buffer->size, &data, &count) == KERN_SUCCESS;
+    buffer->data = buffer->readable ? (uint8_t*) data : NULL;
+}
+
+//get the state of every thread of the (suspended) task
+static uint32_t core_threads(mach_port_t task, CoreThreadCommand** out) {
+    kern_return_t kret;
+    thread_act_port_array_t thread_list;
+    mach_msg_type_number_t thread_count;
+    mach_msg_type_number_t state_count;
+    CoreThreadCommand* threads;
+    uint32_t count;
+
+    *out = NULL;
+    kret = task_threads(task, &thread_list, &thread_count);
+    if (kret != KERN_SUCCESS)
+        return 0;
+
+    threads = (CoreThreadCommand*) calloc(thread_count ? thread_count : 1, sizeof(CoreThreadCommand));
+    count = 0;
+    for (mach_msg_type_number_t i = 0; i < thread_count; i++) {
+        state_count = ARM_THREAD_STATE64_COUNT;
+        kret = thread_get_state(thread_list[i], ARM_THREAD_STATE64, (thread_state_t) &threads[count].state, &state_count);
+        mach_port_deallocate(mach_task_self(), thread_list[i]);
+        if (kret != KERN_SUCCESS)
+            continue; //thread exited while we were looking
+
+        threads[count].cmd = LC_THREAD;
+        threads[count].cmdsize = sizeof(CoreThreadCommand);
+        threads[count].flavor = ARM_THREAD_STATE64;
+        threads[count].count = ARM_THREAD_STATE64_COUNT;
+        count++;
+    }
+    vm_deallocate(mach_task_self(), (vm_address_t) thread_list, thread_count * sizeof(thread_act_t));
+
+    *out = threads;
+    return count;
+}
+
+//write the mach header and load commands into the space reserved at the start of the file
+static bool core_write_header(CoreDump* dump, CoreThreadCommand* threads, uint32_t thread_count) {
+    struct mach_header_64* header;
+    uint8_t* commands;
+    size_t size;
+    bool written;
+
+    size = sizeof(struct mach_header_64) + dump->region_count * sizeof(struct segment_command_64) + thread_count * sizeof(CoreThreadCommand);
+    commands = (uint8_t*) calloc(1, size);
+
+    header = (struct mach_header_64*) commands;
+    header->magic = MH_MAGIC_64;
+    header->cputype = CPU_TYPE_ARM64;
+    header->cpusubtype = CPU_SUBTYPE_ARM64_ALL;
+    header->filetype = MH_CORE;
+    header->ncmds = dump->region_count + thread_count;
+    header->sizeofcmds = (uint32_t) (size - sizeof(struct mach_header_64));
+
+    memcpy(commands + sizeof(struct mach_header_64), dump->segments, dump->region_count * sizeof(struct segment_command_64));
+    memcpy(commands + sizeof(struct mach_header_64) + dump->region_count * sizeof(struct segment_command_64), threads, thread_count * sizeof(CoreThreadCommand));
+
+    written = pwrite(dump->fd, commands, size, 0) == (ssize_t) size;
+    free(commands);
+    return written;
+}
+
+/*
+write a Mach-O core file of the debug task: LC_SEGMENT_64 for every readable region and LC_THREAD for every thread
+the task is paused only while its memory is read, a writer thread puts pieces in the file as they come
+the reader never waits for the writer, so the task gets resumed as soon as the last piece is read
+the shared cache is left out unless 'full' is given, lldb can get it from the device instead
+
+machium->args[0] -> coredump
+machium->args[1] -> [file]
+machium->args[2] -> full (OPTIONAL)
+*/
+machium_command_t m_coredump(Machium* machium) {
+    CoreDump dump;
+    CoreThreadCommand* threads;
+    MemoryRegion* regions;
+    CoreBuffer* buffer;
+    mach_port_t task;
+    pthread_t writer;
+    uint32_t region_count;
+    uint32_t thread_count;
+    uint64_t header_size;
+    uint64_t total;
+    uint64_t piece;
+    double started;
+    double suspended;
+    bool full;
+
+    if (machium->args_count < 2) {
+        output_error(KERN_SUCCESS, "Not enough arguments for 'coredump', 2 minimum");
+        return MACHIUM_FAILURE;
+    }
+    else if (machium->args_count > 3) {
+        output_error(KERN_SUCCESS, "Too many arguments for 'coredump', 3 maximum");
+        return MACHIUM_FAILURE;
+    }
+    full = machium->args_count == 3 && !strcmp(machium->args[2], "full");
+    task = machium->target->debug_task;
+
+    memset(&dump, 0, sizeof(dump));
+    dump.fd = open(machium->args[1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dump.fd < 0) {
+        output_error(KERN_SUCCESS, "Could not open %s", machium->args[1]);
+        return MACHIUM_FAILURE;
+    }
+
+    started = job_time();
+    if (task_suspend(task) != KERN_SUCCESS) {
+        output_error(KERN_SUCCESS, "Unable to pause debug task!");
+        close(dump.fd);
+        return MACHIUM_FAILURE;
+    }
+
+    thread_count = core_threads(task, &threads);
+    region_count = region_list(task, 0, UINT64_MAX, VM_PROT_READ, &regions);
+
+    //everything but the shared cache lives at depth 0
+    dump.regions = regions;
+    dump.region_count = 0;
+    total = 0;
+    for (uint32_t i = 0; i < region_count; i++) {
+        if (regions[i].depth && !full)
+            continue;
+        dump.regions[dump.region_count++] = regions[i];
+        total += regions[i].size;
+    }
+
+    dump.segments = (struct segment_command_64*) calloc(dump.region_count ? dump.region_count : 1, sizeof(struct segment_command_64));
+    for (uint32_t i = 0; i < dump.region_count; i++) {
+        dump.segments[i].cmd = LC_SEGMENT_64;
+        dump.segments[i].cmdsize = sizeof(struct segment_command_64);
+        dump.segments[i].vmaddr = dump.regions[i].address;
+        dump.segments[i].vmsize = dump.regions[i].size;
+        dump.segments[i].maxprot = dump.regions[i].protection;
+        dump.segments[i].initprot = dump.regions[i].protection;
+    }
+
+    //the load commands go first but are written last, once the writer knows where every segment ended up
+    header_size = sizeof(struct mach_header_64) + dump.region_count * sizeof(struct segment_command_64) + thread_count * sizeof(CoreThreadCommand);
+    header_size = (header_size + vm_page_mask) & ~(uint64_t) vm_page_mask;
+    dump.data_offset = header_size;
+
+    //every piece is known up front, the writer takes them in this order
+    for (uint32_t i = 0; i < dump.region_count; i++)
+        dump.piece_count += (dump.regions[i].size + CORE_CHUNK_SIZE - 1) / CORE_CHUNK_SIZE;
+    dump.pieces = (CoreBuffer*) calloc(dump.piece_count ? dump.piece_count : 1, sizeof(CoreBuffer));
+
+    pthread_mutex_init(&dump.lock, NULL);
+    pthread_cond_init(&dump.filled, NULL);
+    for (uint32_t i = 0; i < CORE_BUFFERS; i++) {
+        dump.ring[i] = (uint8_t*) malloc(CORE_CHUNK_SIZE);
+        if (dump.ring[i])
+            dump.free_slots[dump.free_count++] = i;
+    }
+    pthread_create(&writer, NULL, core_writer, &dump);
+
+    job_add_total(total);
+    output_message(OUTPUT_LEVEL_GOOD, "Writing %u regions (%.1f MB) and %u threads to %s...", dump.region_count, (double) total / 1e6, thread_count, machium->args[1]);
+
+    for (uint32_t i = 0; i < dump.region_count && !job_cancelled(); i++) {
+        for (uint64_t offset = 0; offset < dump.regions[i].size && !job_cancelled(); offset += piece) {
+            piece = dump.regions[i].size - offset < CORE_CHUNK_SIZE ? dump.regions[i].size - offset : CORE_CHUNK_SIZE;
+
+            //only the reader writes tail, the writer doesn't look at a piece before tail passes it
+            buffer = &dump.pieces[dump.tail];
+            buffer->region = i;
+            buffer->offset = offset;
+            buffer->size = piece;
+            core_read_piece(&dump, task, buffer);
+
+            pthread_mutex_lock(&dump.lock);
+            dump.tail++;
+            pthread_cond_signal(&dump.filled);
+            pthread_mutex_unlock(&dump.lock);
+            job_add_progress(piece);
+        }
+    }
+
+    //everything is read, the task can go on while the writer catches up
+    task_resume(task);
+    suspended = job_time() - started;
+
+    pthread_mutex_lock(&dump.lock);
+    dump.finished = true;
+    pthread_cond_signal(&dump.filled);
+    pthread_mutex_unlock(&dump.lock);
+    pthread_join(writer, NULL);
+
+    if (!dump.failed && !job_cancelled()) {
+        dump.failed = !core_write_header(&dump, threads, thread_count);
+        //trailing zero pages are holes too, the file still has to reach the end of the last segment
+        if (!dump.failed && ftruncate(dump.fd, (off_t) dump.data_offset))
+            dump.failed = true;
+    }
+    close(dump.fd);
+
+    for (uint32_t i = 0; i < CORE_BUFFERS; i++)
+        free(dump.ring[i]);
+    pthread_mutex_destroy(&dump.lock);
+    pthread_cond_destroy(&dump.filled);
+    free(dump.pieces);
+    free(dump.segments);
+    free(regions);
+    free(threads);
+
+    if (job_cancelled()) {
+        output_message(OUTPUT_LEVEL_WARNING, "Core dump to %s was killed, the file is incomplete", machium->args[1]);
+        return MACHIUM_FAILURE;
+    }
+    if (dump.failed) {
+        output_error(KERN_SUCCESS, "Failed to write %s!", machium->args[1]);
+        return MACHIUM_FAILURE;
+    }
+    if (dump.unreadable)
+        output_message(OUTPUT_LEVEL_WARNING, "%llu bytes were unreadable and got left as zeros", dump.unreadable);
+
+    output_message(OUTPUT_LEVEL_GOOD, "Wrote %.1f MB of memory as %.1f MB of data in %.2fs, the task was paused for %.2fs",
+           (double) total / 1e6, (double) dump.stored / 1e6, job_time() - started, suspended);
+    if (dump.spilled)
+        output_message(OUTPUT_LEVEL_GOOD, "%llu of %llu pieces were mapped copy-on-write while the writer caught up", dump.spilled, dump.piece_count);
+    return MACHIUM_SUCCESS;
+}
@@ -0,0 +1,50 @@
+#ifndef CORE_H
+#define CORE_H
+
+#include "Machium.h"
+#include "Region.h"
+#include <mach-o/loader.h>
+#include <pthread.h>
+
+#define CORE_CHUNK_SIZE (4 * 1024 * 1024) //the reader hands memory to the writer in pieces this big
+#define CORE_BUFFERS 8 //pieces copied into buffers while the writer keeps up, the rest get mapped copy-on-write
+
+//one piece of memory on its way from the task to the file
+typedef struct CoreBuffer {
+    uint8_t* data;
+    uint32_t region; //index into CoreDump.regions
+    uint64_t offset; //offset inside the region
+    uint64_t size;
+    bool readable;
+    int32_t slot; //CoreDump.ring buffer [data] is in, -1 for a vm_read spill the writer deallocates
+} CoreBuffer;
+
+//state shared by the reader (the command's thread) and the writer thread
+typedef struct CoreDump {
+    int fd;
+    MemoryRegion* regions;
+    uint32_t region_count;
+    struct segment_command_64* segments; //one per region, filled in by the writer as it goes
+
+    CoreBuffer* pieces; //every piece of every region in file order, the reader never waits for the writer
+    uint64_t piece_count;
+    uint8_t* ring[CORE_BUFFERS];
+    uint32_t free_slots[CORE_BUFFERS]; //ring buffers the writer is done with
+    uint32_t free_count;
+    uint64_t head; //next piece the writer takes
+    uint64_t tail; //next piece the reader fills
+    uint64_t spilled; //pieces that didn't fit in the ring
+    bool finished; //reader is done, nothing more is coming
+    pthread_mutex_t lock;
+    pthread_cond_t filled;
+
+    uint64_t data_offset; //file offset of the next region
+    uint64_t stored; //bytes actually written, zero pages are left as holes
+    uint64_t unreadable;
+    bool failed;
+} CoreDump;
+
+//write a Mach-O core file of the debug task
+machium_command_t m_coredump(Machium* machium);
+
+#endif /* CORE_H */
@@ -0,0 +1,605 @@
+#include "Coverage.h"
+#include "Memory.h"
+#include "Image.h"
+#include "Region.h"
+#include "Job.h"
+#include "Hook.h"
+#include "Output.h"
+
+//one entry of a drcov BB table
+#pragma pack(push, 1)
+typedef struct CoverageBlock {
+    uint32_t start; //offset from the module base
+    uint16_t size;
+    uint16_t module;
+} CoverageBlock;
+#pragma pack(pop)
+
+static int compare_blocks(const void* a, const void* b) {
+    uint64_t first = *(const uint64_t*) a;
+    uint64_t second = *(const uint64_t*) b;
+
+    return first < second ? -1 : first > second;
+}
+
+static bool coverage_hit(Coverage* coverage, uint32_t block) {
+    return (coverage->hits[block / 64] >> (block % 64)) & 1;
+}
+
+//index of the block at [pc], -1 if it isn't one of ours
+static int64_t coverage_find(Coverage* coverage, uint64_t pc) {
+    uint32_t low;
+    uint32_t high;
+    uint32_t middle;
+
+    low = 0;
+    high = coverage->count;
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (coverage->blocks[middle] < pc)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if (low < coverage->count && coverage->blocks[low] == pc)
+        return low;
+    return -1;
+}
+
+bool coverage_owns(MachiumTarget* target, uint64_t address, uint64_t size) {
+    Coverage* coverage = target->coverage;
+    int64_t block;
+    bool owned;
+
+    if (coverage == NULL || !coverage->running)
+        return false;
+    owned = false;
+    pthread_mutex_lock(&coverage->lock);
+    for (uint64_t pc = address & ~3ULL; pc < address + size && !owned; pc += 4) {
+        block = coverage_find(coverage, pc);
+        owned = block >= 0 && (uint32_t) block < coverage->armed && !coverage_hit(coverage, (uint32_t) block);
+    }
+    pthread_mutex_unlock(&coverage->lock);
+    return owned;
+}
+
+/*
+put the original instruction of one block back, runs on the exception thread
+the page isn't executable while it's writable, so the task is suspended until it has its own protection back
+*/
+static void coverage_restore(Coverage* coverage, uint32_t block) {
+    MemoryRegion* regions;
+    vm_address_t page;
+    vm_prot_t protection;
+
+    page = (vm_address_t) (coverage->blocks[block] & ~(uint64_t) vm_page_mask);
+    if (region_list(coverage->task, page, page + vm_page_size, VM_PROT_NONE, &regions) == 0)
+        return;
+    protection = regions[0].protection;
+    free(regions);
+
+    if (task_suspend(coverage->task) != KERN_SUCCESS)
+        return;
+    if (vm_protect(coverage->task, page, vm_page_size, false, VM_PROT_READ | VM_PROT_WRITE | VM_PROT_COPY) == KERN_SUCCESS) {
+        vm_write(coverage->task, (vm_address_t) coverage->blocks[block], (vm_offset_t) &coverage->original[block], sizeof(uint32_t));
+        vm_protect(coverage->task, page, vm_page_size, false, protection);
+        memory_flush_code(coverage->task, coverage->blocks[block], sizeof(uint32_t));
+    }
+    task_resume(coverage->task);
+}
+
+/*
+answer one exception message
+a hit block gets its bit and its instruction back, and the thread goes on with the state it stopped with so it runs
+the real instruction. breakpoints that aren't ours are failed so the task sees them like it would without Machium
+*/
+static void coverage_handle(Coverage* coverage, ExceptionRequest* request, ExceptionReply* reply) {
+    arm_thread_state64_t* state;
+    int64_t block;
+
+    state = exception_state(request, reply);
+    if (state == NULL)
+        return;
+    block = coverage_find(coverage, state->__pc & MACHIUM_PC_MASK);
+    if (block < 0) {
+        __atomic_add_fetch(&coverage->foreign, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    //two threads can hit a block before it's restored, the second one just runs it again
+    pthread_mutex_lock(&coverage->lock);
+    if (!coverage_hit(coverage, (uint32_t) block)) {
+        coverage_restore(coverage, (uint32_t) block);
+        coverage->hits[block / 64] |= 1ULL << (block % 64);
+        coverage->hit_count++;
+    }
+    pthread_mutex_unlock(&coverage->lock);
+
+    exception_reply_state(request, reply);
+}
+
+//exception thread, handles hits until 'coverage stop' and nothing is left in the queue
+static void* coverage_server(void* context) {
+    Coverage* coverage = (Coverage*) context;
+    ExceptionRequest request;
+    ExceptionReply reply;
+    mach_msg_return_t kret;
+
+    while (1) {
+        kret = mach_msg(&request.head, MACH_RCV_MSG | MACH_RCV_TIMEOUT, 0, sizeof(request), coverage->port, COVERAGE_TIMEOUT, MACH_PORT_NULL);
+        if (kret == MACH_RCV_TIMED_OUT) {
+            if (coverage->stopping)
+                break;
+            continue;
+        }
+        if (kret != KERN_SUCCESS)
+            break;
+
+        coverage_handle(coverage, &request, &reply);
+        mach_msg(&reply.head, MACH_SEND_MSG, reply.head.msgh_size, 0, MACH_PORT_NULL, MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+    }
+    return NULL;
+}
+
+/*
+arm every block, or restore every block that wasn't hit
+blocks closer than COVERAGE_GAP are read, patched in Machium and written back with one memory_write
+the task has to be suspended
+*/
+static bool coverage_write(MachiumTarget* target, Coverage* coverage, bool arm) {
+    kern_return_t kret;
+    uint32_t* buffer;
+    vm_size_t read_size;
+    uint64_t start;
+    uint64_t size;
+    uint64_t mismatched;
+    uint32_t first;
+    uint32_t last;
+    uint32_t end;
+    bool success;
+
+    success = true;
+    pthread_mutex_lock(&coverage->lock);
+    end = arm ? coverage->count : coverage->armed;
+    for (first = arm ? coverage->armed : 0; first < end; first = last) {
+        last = first + 1;
+        if (!arm && coverage_hit(coverage, first))
+            continue;
+        while (last < end && coverage->blocks[last] - coverage->blocks[last - 1] < COVERAGE_GAP)
+            last++;
+
+        start = coverage->blocks[first];
+        size = coverage->blocks[last - 1] + sizeof(uint32_t) - start;
+        buffer = (uint32_t*) malloc(size);
+        read_size = (vm_size_t) size;
+        kret = vm_read_overwrite(coverage->task, (vm_address_t) start, (vm_size_t) size, (vm_address_t) buffer, &read_size);
+        if (kret == KERN_SUCCESS) {
+            for (uint32_t i = first; i < last; i++) {
+                if (arm) {
+                    coverage->original[i] = buffer[(coverage->blocks[i] - start) / 4];
+                    buffer[(coverage->blocks[i] - start) / 4] = COVERAGE_BRK;
+                }
+                else if (!coverage_hit(coverage, i)) {
+                    buffer[(coverage->blocks[i] - start) / 4] = coverage->original[i];
+                }
+            }
+            kret = memory_write(target, start, buffer, size, &mismatched);
+            if (kret == KERN_SUCCESS && mismatched)
+                kret = KERN_FAILURE;
+            memory_flush_code(coverage->task, start, size);
+        }
+        free(buffer);
+
+        if (kret == KERN_SUCCESS && arm)
+            coverage->armed = last;
+        if (kret != KERN_SUCCESS) {
+            output_error(kret, "Failed to %s the blocks at 0x%llx-0x%llx!", arm ? "arm" : "restore", start, start + size);
+            success = false;
+            if (arm)
+                break;
+        }
+    }
+    pthread_mutex_unlock(&coverage->lock);
+    return success;
+}
+
+//sort the blocks, drop duplicates and anything that isn't an aligned instruction in executable memory
+static uint32_t coverage_filter(mach_port_t task, uint64_t* blocks, uint32_t count) {
+    MemoryRegion* regions;
+    uint32_t region_count;
+    uint32_t region;
+    uint32_t kept;
+
+    if (count == 0)
+        return 0;
+    qsort(blocks, count, sizeof(uint64_t), compare_blocks);
+
+    region_count = region_list(task, blocks[0], blocks[count - 1] + sizeof(uint32_t), VM_PROT_READ | VM_PROT_EXECUTE, &regions);
+    kept = 0;
+    region = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if ((blocks[i] & 3) || (kept && blocks[i] == blocks[kept - 1]))
+            continue;
+        while (region < region_count && regions[region].address + regions[region].size < blocks[i] + sizeof(uint32_t))
+            region++;
+        if (region == region_count)
+            break;
+        if (blocks[i] >= regions[region].address)
+            blocks[kept++] = blocks[i];
+    }
+    free(regions);
+    return kept;
+}
+
+//hex addresses, one per line. lines starting with # are skipped
+static uint32_t coverage_read_file(const char* path, uint64_t** out) {
+    FILE* file;
+    char* line;
+    char* end;
+    size_t line_size;
+    uint64_t* blocks;
+    uint32_t count;
+    uint32_t capacity;
+    uint64_t address;
+
+    *out = NULL;
+    file = fopen(path, "r");
+    if (file == NULL)
+        return 0;
+
+    line = NULL;
+    line_size = 0;
+    count = 0;
+    capacity = 4096;
+    blocks = (uint64_t*) malloc(capacity * sizeof(uint64_t));
+    while (getline(&line, &line_size, file) > 0) {
+        if (line[0] == '#')
+            continue;
+        address = strtoull(line, &end, 16);
+        if (end == line)
+            continue;
+        if (count == capacity) {
+            capacity *= 2;
+            blocks = (uint64_t*) realloc(blocks, capacity * sizeof(uint64_t));
+        }
+        blocks[count++] = address;
+    }
+    free(line);
+    fclose(file);
+
+    *out = blocks;
+    return count;
+}
+
+/*
+stop a run: unhit blocks get their instructions back and the old exception ports return
+the exception thread keeps going until the queue is empty so no thread is left waiting on a reply
+*/
+static void coverage_stop(MachiumTarget* target, Coverage* coverage) {
+    bool suspended;
+
+    if (!coverage->running)
+        return;
+
+    suspended = task_suspend(coverage->task) == KERN_SUCCESS;
+    coverage_write(target, coverage, false);
+    for (mach_msg_type_number_t i = 0; i < coverage->old_count; i++) {
+        task_set_exception_ports(coverage->task, coverage->old_masks[i], coverage->old_ports[i], coverage->old_behaviors[i], coverage->old_flavors[i]);
+        if (MACH_PORT_VALID(coverage->old_ports[i]))
+            mach_port_deallocate(mach_task_self(), coverage->old_ports[i]);
+    }
+    coverage->old_count = 0;
+
+    coverage->stopping = true;
+    pthread_join(coverage->server, NULL);
+    mach_port_deallocate(mach_task_self(), coverage->port);
+    mach_port_mod_refs(mach_task_self(), coverage->port, MACH_PORT_RIGHT_RECEIVE, -1);
+    coverage->port = MACH_PORT_NULL;
+    coverage->running = false;
+    if (suspended)
+        task_resume(coverage->task);
+}
+
+void coverage_free(MachiumTarget* target) {
+    Coverage* coverage = target->coverage;
+
+    if (coverage == NULL)
+        return;
+    coverage_stop(target, coverage);
+    pthread_mutex_destroy(&coverage->lock);
+    free(coverage->blocks);
+    free(coverage->original);
+    free(coverage->hits);
+    free(coverage);
+    target->coverage = NULL;
+}
+
+/*
+start a coverage run
+
+machium->args[0] -> coverage
+machium->args[1] -> start
+machium->args[2] -> [file] / image
+machium->args[3] -> [image name] (image only)
+*/
+static machium_command_t m_coverage_start(Machium* machium) {
+    MachiumTarget* target;
+    Coverage* coverage;
+    kern_return_t kret;
+    uint64_t* blocks;
+    uint32_t count;
+    uint32_t found;
+    uint32_t kept;
+    double started;
+
+    target = machium->target;
+    if (target->coverage && target->coverage->running) {
+        output_error(KERN_SUCCESS, "Coverage is already running, 'coverage stop' first");
+        return MACHIUM_FAILURE;
+    }
+    //coverage takes the task's breakpoint exceptions, hardware breakpoint and watchpoint hits would be failed as foreign
+    if (target->br_count || target->wa_count) {
+        output_error(KERN_SUCCESS, "Remove the %u breakpoints and %u watchpoints first, coverage can't share the breakpoint exception port", target->br_count, target->wa_count);
+        return MACHIUM_FAILURE;
+    }
+    if (machium->args_count == 4 && !strcmp(machium->args[2], "image")) {
+        found = image_function_starts(machium, machium->args[3], &blocks);
+        if (found == 0) {
+            output_error(KERN_SUCCESS, "No function starts for image %s", machium->args[3]);
+            return MACHIUM_FAILURE;
+        }
+    }
+    else if (machium->args_count == 3) {
+        found = coverage_read_file(machium->args[2], &blocks);
+        if (found == 0) {
+            output_error(KERN_SUCCESS, "No block addresses in %s", machium->args[2]);
+            free(blocks);
+            return MACHIUM_FAILURE;
+        }
+    }
+    else {
+        output_error(KERN_SUCCESS, "Usage: coverage start [file] / coverage start image [name]");
+        return MACHIUM_FAILURE;
+    }
+
+    started = job_time();
+    count = coverage_filter(target->debug_task, blocks, found);
+
+    //a brk in a hook's patch would break the hook, and restoring it at 'coverage stop' would write over the patch
+    kept = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!hook_owns(target, blocks[i], sizeof(uint32_t)))
+            blocks[kept++] = blocks[i];
+    }
+    if (kept < count)
+        output_message(OUTPUT_LEVEL_WARNING, "Skipped %u blocks inside hooks", count - kept);
+    found -= count - kept;
+    count = kept;
+    if (count == 0) {
+        output_error(KERN_SUCCESS, "None of the %u blocks are in executable memory", found);
+        free(blocks);
+        return MACHIUM_FAILURE;
+    }
+    if (count < found)
+        output_message(OUTPUT_LEVEL_WARNING, "Skipped %u duplicate, unaligned or non executable blocks", found - count);
+
+    coverage_free(target);
+    coverage = (Coverage*) calloc(1, sizeof(Coverage));
+    coverage->task = target->debug_task;
+    coverage->blocks = blocks;
+    coverage->count = count;
+    coverage->original = (uint32_t*) malloc(count * sizeof(uint32_t));
+    coverage->hits = (uint64_t*) calloc((count + 63) / 64, sizeof(uint64_t));
+    pthread_mutex_init(&coverage->lock, NULL);
+    target->coverage = coverage;
+
+    //the port has to be in place before the first breakpoint is
+    kret = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &coverage->port);
+    if (kret == KERN_SUCCESS)
+        kret = mach_port_insert_right(mach_task_self(), coverage->port, coverage->port, MACH_MSG_TYPE_MAKE_SEND);
+    if (kret == KERN_SUCCESS) {
+        coverage->old_count = EXC_TYPES_COUNT;
+        kret = task_swap_exception_ports(coverage->task, EXC_MASK_BREAKPOINT, coverage->port, EXCEPTION_STATE | MACH_EXCEPTION_CODES, ARM_THREAD_STATE64,
+                                         coverage->old_masks, &coverage->old_count, coverage->old_ports, coverage->old_behaviors, coverage->old_flavors);
+    }
+    if (kret != KERN_SUCCESS) {
+        output_error(kret, "Failed to set up the exception port!");
+        coverage->old_count = 0;
+        if (MACH_PORT_VALID(coverage->port))
+            mach_port_mod_refs(mach_task_self(), coverage->port, MACH_PORT_RIGHT_RECEIVE, -1);
+        coverage_free(target);
+        return MACHIUM_FAILURE;
+    }
+    pthread_create(&coverage->server, NULL, coverage_server, coverage);
+    coverage->running = true;
+
+    //every breakpoint goes in while no thread runs
+    kret = task_suspend(coverage->task);
+    if (kret != KERN_SUCCESS) {
+        output_error(kret, "Failed to suspend the task!");
+        coverage_free(target);
+        return MACHIUM_FAILURE;
+    }
+    if (!coverage_write(target, coverage, true)) {
+        task_resume(coverage->task);
+        coverage_free(target);
+        return MACHIUM_FAILURE;
+    }
+    task_resume(coverage->task);
+
+    coverage->started = job_time();
+    output_message(OUTPUT_LEVEL_GOOD, "Armed %u blocks in %.2fs", count, coverage->started - started);
+    return MACHIUM_SUCCESS;
+}
+
+/*
+print how many blocks were hit
+
+machium->args[0] -> coverage
+machium->args[1] -> status (OPTIONAL)
+*/
+static machium_command_t m_coverage_status(Machium* machium) {
+    Coverage* coverage = machium->target->coverage;
+
+    if (coverage == NULL) {
+        output_message(OUTPUT_LEVEL_WARNING, "No coverage, 'coverage start' first");
+        return MACHIUM_SUCCESS;
+    }
+    output_message(OUTPUT_LEVEL_GOOD, "%u of %u blocks hit (" YELLOW "%.1f%%" WHITE ")%s", coverage->hit_count, coverage->count, 100.0 * coverage->hit_count / coverage->count, coverage->running ? "" : ", stopped");
+    if (coverage->running)
+        output_message(OUTPUT_LEVEL_GOOD, "Running for %.0fs", job_time() - coverage->started);
+    if (coverage->foreign)
+        output_message(OUTPUT_LEVEL_WARNING, "%llu breakpoints that weren't coverage blocks were passed on to the task", coverage->foreign);
+    return MACHIUM_SUCCESS;
+}
+
+/*
+stop the run, the hits stay around for 'coverage save'
+
+machium->args[0] -> coverage
+machium->args[1] -> stop
+*/
+static machium_command_t m_coverage_stop(Machium* machium) {
+    Coverage* coverage = machium->target->coverage;
+
+    if (coverage == NULL || !coverage->running) {
+        output_error(KERN_SUCCESS, "Coverage isn't running");
+        return MACHIUM_FAILURE;
+    }
+    coverage_stop(machium->target, coverage);
+    output_message(OUTPUT_LEVEL_GOOD, "Stopped, %u of %u blocks hit", coverage->hit_count, coverage->count);
+    return MACHIUM_SUCCESS;
+}
+
+/*
+write the hit blocks as a drcov file, every image with a hit block becomes a module
+only the first instruction of a block is known to have run, so every block is 4 bytes long
+*/
+static bool coverage_save_drcov(Machium* machium, Coverage* coverage, FILE* file) {
+    ImageIndex* index;
+    ImageEntry* entry;
+    CoverageBlock* table;
+    int32_t* modules;
+    ImageEntry** module_images;
+    const MachOSegment* text;
+    uint64_t* hits;
+    uint32_t hit_count;
+    uint32_t module_count;
+    uint32_t count;
+    uint32_t image;
+
+    index = image_index(machium);
+    if (index == NULL)
+        return false;
+
+    //the exception thread keeps adding hits while a run goes on, the file gets the ones there are right now
+    hits = (uint64_t*) malloc((coverage->count + 63) / 64 * sizeof(uint64_t));
+    pthread_mutex_lock(&coverage->lock);
+    memcpy(hits, coverage->hits, (coverage->count + 63) / 64 * sizeof(uint64_t));
+    hit_count = coverage->hit_count;
+    pthread_mutex_unlock(&coverage->lock);
+
+    modules = (int32_t*) malloc(index->count * sizeof(int32_t));
+    memset(modules, 0xff, index->count * sizeof(int32_t));
+    module_images = (ImageEntry**) malloc(index->count * sizeof(ImageEntry*));
+    table = (CoverageBlock*) malloc(hit_count * sizeof(CoverageBlock) + sizeof(CoverageBlock));
+    module_count = 0;
+    count = 0;
+    for (uint32_t i = 0; i < coverage->count && count < hit_count; i++) {
+        if (!((hits[i / 64] >> (i % 64)) & 1))
+            continue;
+        entry = image_find(machium, coverage->blocks[i]);
+        if (entry == NULL)
+            continue;
+        image = (uint32_t) (entry - index->images);
+        if (modules[image] < 0) {
+            modules[image] = (int32_t) module_count;
+            module_images[module_count++] = entry;
+        }
+        table[count].start = (uint32_t) (coverage->blocks[i] - entry->base);
+        table[count].size = sizeof(uint32_t);
+        table[count].module = (uint16_t) modules[image];
+        count++;
+    }
+
+    fprintf(file, "DRCOV VERSION: 2\nDRCOV FLAVOR: machium\n");
+    fprintf(file, "Module Table: version 2, count %u\n", module_count);
+    fprintf(file, "Columns: id, base, end, entry, checksum, timestamp, path\n");
+    for (uint32_t i = 0; i < module_count; i++) {
+        //blocks are code, a module ends with its __TEXT. the span to its last segment runs over other images in the shared cache
+        text = macho_segment_at(&module_images[i]->macho, 0);
+        fprintf(file, "%3u, 0x%016llx, 0x%016llx, 0x0000000000000000, 0x00000000, 0x00000000, %s\n", i, module_images[i]->base, module_images[i]->base + (text ? text->vmsize : module_images[i]->macho.size), module_images[i]->path);
+    }
+    fprintf(file, "BB Table: %u bbs\n", count);
+    fwrite(table, sizeof(CoverageBlock), count, file);
+
+    if (count < hit_count)
+        output_message(OUTPUT_LEVEL_WARNING, "%u hit blocks aren't in a loaded image and were left out", hit_count - count);
+    free(hits);
+    free(modules);
+    free(module_images);
+    free(table);
+    return true;
+}
+
+/*
+save the hits
+
+machium->args[0] -> coverage
+machium->args[1] -> save
+machium->args[2] -> [file]
+machium->args[3] -> raw (OPTIONAL), the bitmap itself: bit i (lowest first) is the i-th lowest block address
+*/
+static machium_command_t m_coverage_save(Machium* machium) {
+    Coverage* coverage = machium->target->coverage;
+    FILE* file;
+    bool raw;
+    bool saved;
+
+    if (machium->args_count < 3 || machium->args_count > 4) {
+        output_error(KERN_SUCCESS, "Usage: coverage save [file] [raw]");
+        return MACHIUM_FAILURE;
+    }
+    if (coverage == NULL) {
+        output_error(KERN_SUCCESS, "No coverage, 'coverage start' first");
+        return MACHIUM_FAILURE;
+    }
+    raw = machium->args_count == 4 && !strcmp(machium->args[3], "raw");
+
+    file = fopen(machium->args[2], "wb");
+    if (file == NULL) {
+        output_error(KERN_SUCCESS, "Couldn't open %s", machium->args[2]);
+        return MACHIUM_FAILURE;
+    }
+    if (raw) {
+        pthread_mutex_lock(&coverage->lock);
+        saved = fwrite(coverage->hits, 1, (coverage->count + 7) / 8, file) == (coverage->count + 7) / 8;
+        pthread_mutex_unlock(&coverage->lock);
+    }
+    else
+        saved = coverage_save_drcov(machium, coverage, file);
+    saved = !fclose(file) && saved;
+
+    if (!saved) {
+        output_error(KERN_SUCCESS, "Failed to write %s", machium->args[2]);
+        return MACHIUM_FAILURE;
+    }
+    output_message(OUTPUT_LEVEL_GOOD, "Saved %u of %u blocks to %s", coverage->hit_count, coverage->count, machium->args[2]);
+    return MACHIUM_SUCCESS;
+}
+
+/*
+handle coverage commands
+
+machium->args[0] -> coverage
+machium->args[1] -> [command]
+*/
+machium_command_t m_coverage(Machium* machium) {
+    if (machium->args_count < 2 || !strcmp(machium->args[1], "status")) return m_coverage_status(machium);
+    else if (!strcmp(machium->args[1], "start")) return m_coverage_start(machium);
+    else if (!strcmp(machium->args[1], "stop")) return m_coverage_stop(machium);
+    else if (!strcmp(machium->args[1], "save")) return m_coverage_save(machium);
+
+    output_error(KERN_SUCCESS, "Invalid argument for 'coverage', %s", machium->args[1]);
+    return MACHIUM_FAILURE;
+}
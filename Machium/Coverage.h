@@ -0,0 +1,47 @@
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include "Machium.h"
+#include "Breakpoint.h"
+#include <pthread.h>
+
+#define COVERAGE_BRK 0xd4200000 //brk #0, what every block gets until it's hit
+#define COVERAGE_GAP 4096 //blocks closer than this are read and written back as one range when arming
+#define COVERAGE_TIMEOUT 100 //ms the exception thread waits for a message before checking if it should stop
+
+//every block of one coverage run
+typedef struct Coverage {
+    mach_port_t task;
+    uint64_t* blocks; //sorted so the exception thread finds a pc with a binary search
+    uint32_t* original; //the instruction the breakpoint of each block replaced
+    uint64_t* hits; //bit i is set once block i ran
+    uint32_t count;
+    uint32_t armed; //blocks before this one have a breakpoint (or had one until they were hit)
+    volatile uint32_t hit_count;
+    volatile uint64_t foreign; //breakpoints that weren't ours, passed on as failures
+
+    mach_port_t port; //exception port of the run
+    pthread_t server;
+    volatile bool stopping;
+    bool running;
+    pthread_mutex_t lock; //one patch of the task at a time
+    double started;
+
+    //exception ports the task had before, put back by 'coverage stop'
+    exception_mask_t old_masks[EXC_TYPES_COUNT];
+    mach_port_t old_ports[EXC_TYPES_COUNT];
+    exception_behavior_t old_behaviors[EXC_TYPES_COUNT];
+    thread_state_flavor_t old_flavors[EXC_TYPES_COUNT];
+    mach_msg_type_number_t old_count;
+} Coverage;
+
+//stop the run of [target] if there is one and free it
+void coverage_free(MachiumTarget* target);
+
+//true when a running coverage of [target] still has a breakpoint in [address, address + size)
+bool coverage_owns(MachiumTarget* target, uint64_t address, uint64_t size);
+
+//handle coverage commands
+machium_command_t m_coverage(Machium* machium);
+
+#endif /* COVERAGE_H */
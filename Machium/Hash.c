@@ -0,0 +1,222 @@
+#include "Hash.h"
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#define PRIME1 0x9e3779b185ebca87ULL
+#define PRIME2 0xc2b2ae3d27d4eb4fULL
+#define PRIME3 0x165667b19e3779f9ULL
+#define PRIME4 0x85ebca77c2b2ae63ULL
+#define PRIME5 0x27d4eb2f165667c5ULL
+
+static inline uint64_t rotate(uint64_t value, uint32_t bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+//memcpy so unaligned input is fine, compilers turn it into a single load
+static inline uint64_t read64(const uint8_t* data) {
+    uint64_t value;
+
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static inline uint32_t read32(const uint8_t* data) {
+    uint32_t value;
+
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static inline uint64_t hash_round(uint64_t accumulator, uint64_t input) {
+    accumulator += input * PRIME2;
+    accumulator = rotate(accumulator, 31);
+    return accumulator * PRIME1;
+}
+
+static inline uint64_t hash_merge(uint64_t hash, uint64_t accumulator) {
+    hash ^= hash_round(0, accumulator);
+    return hash * PRIME1 + PRIME4;
+}
+
+uint64_t hash64(const void* data, size_t size, uint64_t seed) {
+    const uint8_t* bytes = (const uint8_t*) data;
+    const uint8_t* end = bytes + size;
+    uint64_t lanes[4];
+    uint64_t hash;
+
+    if (size >= 32) {
+        //four independent lanes keep the multipliers busy
+        lanes[0] = seed + PRIME1 + PRIME2;
+        lanes[1] = seed + PRIME2;
+        lanes[2] = seed;
+        lanes[3] = seed - PRIME1;
+        do {
+            lanes[0] = hash_round(lanes[0], read64(bytes));
+            lanes[1] = hash_round(lanes[1], read64(bytes + 8));
+            lanes[2] = hash_round(lanes[2], read64(bytes + 16));
+            lanes[3] = hash_round(lanes[3], read64(bytes + 24));
+            bytes += 32;
+        } while (bytes + 32 <= end);
+
+        hash = rotate(lanes[0], 1) + rotate(lanes[1], 7) + rotate(lanes[2], 12) + rotate(lanes[3], 18);
+        for (int i = 0; i < 4; i++)
+            hash = hash_merge(hash, lanes[i]);
+    }
+    else {
+        hash = seed + PRIME5;
+    }
+    hash += (uint64_t) size;
+
+    for (; bytes + 8 <= end; bytes += 8) {
+        hash ^= hash_round(0, read64(bytes));
+        hash = rotate(hash, 27) * PRIME1 + PRIME4;
+    }
+    if (bytes + 4 <= end) {
+        hash ^= (uint64_t) read32(bytes) * PRIME1;
+        hash = rotate(hash, 23) * PRIME2 + PRIME3;
+        bytes += 4;
+    }
+    for (; bytes < end; bytes++) {
+        hash ^= (uint64_t) *bytes * PRIME5;
+        hash = rotate(hash, 11) * PRIME1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/*
+hash64_wide runs 8 lanes over 64 byte stripes, every lane multiplies the low and high half of its input with the key
+mixed in and adds the neighbouring lane's input. that's 4 vector multiplies a stripe with NEON
+the keys of a stripe start one word further into wide_keys than the ones of the stripe before it, so two stripes of a
+block trade places only with a different hash, and the lanes get scrambled every HASH_WIDE_BLOCK bytes so blocks can't either
+*/
+#define HASH_WIDE_STRIPE 64
+#define HASH_WIDE_BLOCK 1024
+#define HASH_WIDE_PRIME 0x9e3779b1U
+
+//8 keys for every stripe of a block, each stripe starting one further
+static const uint64_t wide_keys[8 + HASH_WIDE_BLOCK / HASH_WIDE_STRIPE - 1] = {
+    0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+    0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL, 0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL,
+    0xcb00c391bb52283cULL, 0xa32e531b8b65d088ULL, 0x4ef90da297486471ULL, 0xd8acdea946ef1938ULL,
+    0x3f349ce33f76faa8ULL, 0x1d4f0bc7c7bbdcf9ULL, 0x3159b4cd4be0518aULL, 0x647378d9c97e9fc8ULL,
+    0xc3ebd33483acc5eaULL, 0xeb6313faffa081c5ULL, 0x49daf0b751dd0d17ULL, 0x9e68d429265516d3ULL,
+    0xfca1477d58be162bULL, 0xce31d07ad1b8f88fULL, 0x280416958f3acb45ULL,
+};
+
+static const uint64_t wide_scramble_keys[8] = {
+    0xcb00c391bb52283cULL, 0xa32e531b8b65d088ULL, 0x4ef90da297486471ULL, 0xd8acdea946ef1938ULL,
+    0x3f349ce33f76faa8ULL, 0x1d4f0bc7c7bbdcf9ULL, 0x3159b4cd4be0518aULL, 0x647378d9c97e9fc8ULL,
+};
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+//[stripes] stripes of [data] into the lanes, then a scramble when [scramble]
+static void wide_block(uint64_t lanes[8], const uint8_t* data, size_t stripes, int scramble) {
+    uint64x2_t accumulators[4];
+    uint64x2_t input;
+    uint64x2_t keyed;
+    uint32x2_t prime;
+
+    for (int i = 0; i < 4; i++)
+        accumulators[i] = vld1q_u64(lanes + i * 2);
+
+    for (size_t stripe = 0; stripe < stripes; stripe++, data += HASH_WIDE_STRIPE) {
+        for (int i = 0; i < 4; i++) {
+            input = vreinterpretq_u64_u8(vld1q_u8(data + i * 16));
+            keyed = veorq_u64(input, vld1q_u64(wide_keys + stripe + i * 2));
+            accumulators[i] = vaddq_u64(accumulators[i], vextq_u64(input, input, 1));
+            accumulators[i] = vaddq_u64(accumulators[i], vmull_u32(vmovn_u64(keyed), vshrn_n_u64(keyed, 32)));
+        }
+    }
+
+    if (scramble) {
+        //64 bit multiply out of two 32 bit ones, NEON has no 64x64
+        prime = vdup_n_u32(HASH_WIDE_PRIME);
+        for (int i = 0; i < 4; i++) {
+            keyed = veorq_u64(accumulators[i], vshrq_n_u64(accumulators[i], 47));
+            keyed = veorq_u64(keyed, vld1q_u64(wide_scramble_keys + i * 2));
+            accumulators[i] = vaddq_u64(vmull_u32(vmovn_u64(keyed), prime), vshlq_n_u64(vmull_u32(vshrn_n_u64(keyed, 32), prime), 32));
+        }
+    }
+
+    for (int i = 0; i < 4; i++)
+        vst1q_u64(lanes + i * 2, accumulators[i]);
+}
+
+#else
+
+//same as the NEON version, one lane at a time
+static void wide_block(uint64_t lanes[8], const uint8_t* data, size_t stripes, int scramble) {
+    uint64_t input[8];
+    uint64_t keyed;
+
+    for (size_t stripe = 0; stripe < stripes; stripe++, data += HASH_WIDE_STRIPE) {
+        memcpy(input, data, sizeof(input));
+        for (int i = 0; i < 8; i++) {
+            keyed = input[i] ^ wide_keys[stripe + i];
+            lanes[i] += input[i ^ 1] + (keyed & 0xffffffff) * (keyed >> 32);
+        }
+    }
+
+    if (scramble) {
+        for (int i = 0; i < 8; i++) {
+            keyed = lanes[i] ^ (lanes[i] >> 47) ^ wide_scramble_keys[i];
+            lanes[i] = keyed * HASH_WIDE_PRIME;
+        }
+    }
+}
+
+#endif
+
+static inline uint64_t wide_fold(uint64_t a, uint64_t b) {
+    __uint128_t product = (__uint128_t) a * b;
+
+    return (uint64_t) product ^ (uint64_t) (product >> 64);
+}
+
+uint64_t hash64_wide(const void* data, size_t size, uint64_t seed) {
+    const uint8_t* bytes = (const uint8_t*) data;
+    uint64_t lanes[8];
+    uint64_t hash;
+    size_t stripes;
+
+    if (size < HASH_WIDE_BLOCK)
+        return hash64(data, size, seed);
+
+    lanes[0] = seed + PRIME1;
+    lanes[1] = seed + PRIME2;
+    lanes[2] = seed + PRIME3;
+    lanes[3] = seed + PRIME4;
+    lanes[4] = seed + PRIME5;
+    lanes[5] = seed - PRIME1;
+    lanes[6] = seed - PRIME2;
+    lanes[7] = seed - PRIME3;
+
+    stripes = size / HASH_WIDE_STRIPE;
+    while (stripes >= HASH_WIDE_BLOCK / HASH_WIDE_STRIPE) {
+        wide_block(lanes, bytes, HASH_WIDE_BLOCK / HASH_WIDE_STRIPE, 1);
+        bytes += HASH_WIDE_BLOCK;
+        stripes -= HASH_WIDE_BLOCK / HASH_WIDE_STRIPE;
+    }
+    wide_block(lanes, bytes, stripes, 0);
+    bytes += stripes * HASH_WIDE_STRIPE;
+
+    hash = (uint64_t) size * PRIME1;
+    for (int i = 0; i < 8; i += 2)
+        hash += wide_fold(lanes[i] ^ wide_keys[i], lanes[i + 1] ^ wide_keys[i + 1]);
+    hash ^= hash >> 37;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+
+    //the last partial stripe
+    return hash64(bytes, (size_t) ((const uint8_t*) data + size - bytes), hash);
+}
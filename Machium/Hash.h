@@ -0,0 +1,14 @@
+#ifndef HASH_H
+#define HASH_H
+
+//like MachO.h this only needs libc, so it can be checked against reference values on any machine
+#include <stdint.h>
+#include <stddef.h>
+
+//64-bit hash of [size] bytes (XXH64), fast enough to hash every page of a task
+uint64_t hash64(const void* data, size_t size, uint64_t seed);
+
+//64-bit hash of [size] bytes for big inputs, vectorized with NEON. not the same values as hash64, inputs under 1KB just go to hash64
+uint64_t hash64_wide(const void* data, size_t size, uint64_t seed);
+
+#endif /* HASH_H */
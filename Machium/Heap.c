@@ -0,0 +1,542 @@
+#include "Heap.h"
+#include "Image.h"
+#include "Job.h"
+#include "Output.h"
+#include <malloc/malloc.h>
+
+//zone structs hold signed pointers on arm64e, compare them without the signature
+#if defined(__has_feature)
+#if __has_feature(ptrauth_calls)
+#include <ptrauth.h>
+#define HEAP_STRIP(pointer) ((uint64_t) ptrauth_strip((void*) (pointer), ptrauth_key_asda))
+#endif
+#endif
+#ifndef HEAP_STRIP
+#define HEAP_STRIP(pointer) ((uint64_t) (pointer))
+#endif
+
+//memory_reader_t has no context argument, so the walk running on this thread goes here
+static __thread HeapWalk* current_walk = NULL;
+
+static bool heap_read_value(mach_port_t task, uint64_t address, void* out, size_t size) {
+    kern_return_t kret;
+    vm_size_t read_size;
+
+    read_size = size;
+    kret = vm_read_overwrite(task, (vm_address_t) address, size, (vm_address_t) out, &read_size);
+    return kret == KERN_SUCCESS && read_size == size;
+}
+
+//keep [read] until the enumerator returns, it's about to get a pointer into it
+static void heap_pin(HeapWalk* walk, HeapRead* read) {
+    if (read->pinned)
+        return;
+    read->pinned = true;
+    walk->cached_bytes -= read->size;
+}
+
+//find a read that already covers [address, address + size), [pin] it when it goes to the enumerator
+static uint8_t* heap_find(HeapWalk* walk, uint64_t address, uint64_t size, bool pin) {
+    HeapRead* read;
+
+    if (walk->last_hit < walk->read_count) {
+        read = &walk->reads[walk->last_hit];
+        if (read->data && address >= read->address && address + size <= read->address + read->size) {
+            if (pin)
+                heap_pin(walk, read);
+            return read->data + (address - read->address);
+        }
+    }
+
+    for (uint32_t i = walk->read_count; i-- > 0;) {
+        read = &walk->reads[i];
+        if (read->data && address >= read->address && address + size <= read->address + read->size) {
+            walk->last_hit = i;
+            if (pin)
+                heap_pin(walk, read);
+            return read->data + (address - read->address);
+        }
+    }
+    return NULL;
+}
+
+//drop evicted reads from the list so lookups don't keep walking over them
+static void heap_compact(HeapWalk* walk) {
+    uint32_t kept;
+
+    kept = 0;
+    for (uint32_t i = 0; i < walk->read_count; i++) {
+        if (walk->reads[i].data)
+            walk->reads[kept++] = walk->reads[i];
+    }
+    walk->read_count = kept;
+    walk->evict_next = 0;
+    walk->last_hit = 0;
+}
+
+/*
+copy [size] bytes at [address] out of the task in one vm_read_overwrite
+nothing says how long an enumerator keeps using what the reader gave it (the zone struct, the large entry table
+and regions all get used long after they were read), so [pinned] reads stay until it returns. only the pages
+heap_peek reads for itself are thrown away, oldest first past HEAP_CACHE_SIZE
+*/
+static uint8_t* heap_cache_read(HeapWalk* walk, uint64_t address, uint64_t size, bool pinned) {
+    HeapRead* reads;
+    HeapRead* read;
+    uint8_t* data;
+    uint32_t evicted;
+
+    if (walk->read_count == walk->read_capacity) {
+        reads = (HeapRead*) realloc(walk->reads, (walk->read_capacity ? walk->read_capacity * 2 : 256) * sizeof(HeapRead));
+        if (reads == NULL)
+            return NULL;
+        walk->reads = reads;
+        walk->read_capacity = walk->read_capacity ? walk->read_capacity * 2 : 256;
+    }
+
+    data = (uint8_t*) malloc(size);
+    if (data == NULL)
+        return NULL;
+    if (!heap_read_value(walk->task, address, data, size)) {
+        free(data);
+        return NULL;
+    }
+    walk->read_bytes += size;
+    job_add_progress(size);
+
+    read = &walk->reads[walk->read_count++];
+    read->address = address;
+    read->size = size;
+    read->data = data;
+    read->pinned = pinned;
+    if (pinned)
+        return data;
+
+    //never evict the read we're about to hand out
+    walk->cached_bytes += size;
+    evicted = 0;
+    while (walk->cached_bytes > HEAP_CACHE_SIZE && walk->evict_next < walk->read_count - 1) {
+        read = &walk->reads[walk->evict_next++];
+        if (read->pinned || read->data == NULL)
+            continue;
+        free(read->data);
+        read->data = NULL;
+        walk->cached_bytes -= read->size;
+        evicted++;
+    }
+    if (evicted && walk->evict_next > walk->read_count / 2)
+        heap_compact(walk);
+    return data;
+}
+
+//forget every read, done after each zone
+static void heap_cache_clear(HeapWalk* walk) {
+    for (uint32_t i = 0; i < walk->read_count; i++)
+        free(walk->reads[i].data);
+    walk->read_count = 0;
+    walk->evict_next = 0;
+    walk->last_hit = 0;
+    walk->cached_bytes = 0;
+}
+
+//memory_reader_t handed to the zone enumerators
+static kern_return_t heap_reader(task_t task, vm_address_t address, vm_size_t size, void** local) {
+    HeapWalk* walk = current_walk;
+    uint8_t* data;
+
+    //failing a read makes the enumerator give up on the zone, which is exactly what 'kill' wants
+    if (job_cancelled())
+        return KERN_ABORTED;
+
+    data = heap_find(walk, address, size, true);
+    if (data == NULL)
+        data = heap_cache_read(walk, address, size, true);
+    if (data == NULL)
+        return KERN_FAILURE;
+
+    *local = data;
+    return KERN_SUCCESS;
+}
+
+//get the first word of an allocation, usually out of the region the enumerator just read
+static bool heap_peek(HeapWalk* walk, uint64_t address, uint64_t* out) {
+    uint8_t* data;
+
+    data = heap_find(walk, address, sizeof(uint64_t), false);
+    if (data == NULL) {
+        //large allocations aren't inside any region, read the page so neighbours come for free
+        heap_cache_read(walk, address & ~(uint64_t) vm_page_mask, vm_page_size, false);
+        data = heap_find(walk, address, sizeof(uint64_t), false);
+    }
+    if (data == NULL)
+        return false;
+
+    memcpy(out, data, sizeof(uint64_t));
+    return true;
+}
+
+static int compare_classes(const void* a, const void* b) {
+    uint64_t left = *(const uint64_t*) a;
+    uint64_t right = *(const uint64_t*) b;
+
+    return left < right ? -1 : left > right;
+}
+
+//get the class sections of [entry], read the first time they're needed
+static HeapClasses* heap_load_classes(HeapWalk* walk, ImageEntry* entry) {
+    HeapClasses* classes;
+    uint64_t address;
+    uint64_t size;
+
+    classes = &walk->image_classes[entry - walk->images->images];
+    if (classes->loaded)
+        return classes;
+    classes->loaded = true;
+
+    if (!image_find_section(walk->machium, entry, "__objc_data", &classes->objc_data, &classes->objc_data_size))
+        classes->objc_data_size = 0;
+
+    //swift classes and classes of the shared cache can sit outside __objc_data, but every class is in the list
+    if (!image_find_section(walk->machium, entry, "__objc_classlist", &address, &size) || size < sizeof(uint64_t))
+        return classes;
+    classes->classes = (uint64_t*) malloc(size);
+    if (classes->classes == NULL || !heap_read_value(walk->task, address, classes->classes, size)) {
+        free(classes->classes);
+        classes->classes = NULL;
+        return classes;
+    }
+    classes->count = (uint32_t) (size / sizeof(uint64_t));
+    for (uint32_t i = 0; i < classes->count; i++)
+        classes->classes[i] &= HEAP_ISA_MASK;
+    qsort(classes->classes, classes->count, sizeof(uint64_t), compare_classes);
+    return classes;
+}
+
+/*
+objc classes are in __objc_data or listed in __objc_classlist of an image
+anything else in the data segments (vtables, globals) is a pointer but not an object
+*/
+static bool heap_is_class(HeapWalk* walk, uint64_t isa) {
+    HeapClasses* classes;
+    ImageEntry* entry;
+    MachOSegment* segment;
+    uint64_t unslid;
+    bool in_data;
+
+    if (isa < walk->images_start || walk->image_classes == NULL)
+        return false;
+    entry = image_find(walk->machium, isa);
+    if (entry == NULL)
+        return false;
+
+    //cheap check first, classes are never in __TEXT or __LINKEDIT
+    in_data = false;
+    unslid = isa - entry->base + entry->macho.text_vmaddr;
+    for (uint32_t i = 0; i < entry->macho.segment_count && !in_data; i++) {
+        segment = &entry->macho.segments[i];
+        if (unslid < segment->vmaddr || unslid - segment->vmaddr >= segment->vmsize)
+            continue;
+        in_data = !strncmp(segment->name, "__DATA", 6) || !strncmp(segment->name, "__AUTH", 6) || !strncmp(segment->name, "__OBJC", 6);
+    }
+    if (!in_data)
+        return false;
+
+    classes = heap_load_classes(walk, entry);
+    if (isa - classes->objc_data < classes->objc_data_size)
+        return true;
+    return classes->classes && bsearch(&isa, classes->classes, classes->count, sizeof(uint64_t), compare_classes) != NULL;
+}
+
+static void heap_count_isa(HeapWalk* walk, uint64_t isa, uint64_t size) {
+    HeapIsa* slot;
+    uint32_t index;
+
+    if (isa == 0)
+        return;
+
+    index = (uint32_t) (((isa >> 3) * 0x9e3779b97f4a7c15ULL) >> 52) & (HEAP_ISA_SLOTS - 1);
+    for (uint32_t probe = 0; probe < HEAP_ISA_SLOTS; probe++) {
+        slot = &walk->isas[(index + probe) & (HEAP_ISA_SLOTS - 1)];
+        if (slot->isa == isa) {
+            if (slot->is_class) {
+                slot->count++;
+                slot->bytes += size;
+                walk->objects++;
+            }
+            return;
+        }
+        if (slot->isa == 0)
+            break;
+    }
+
+    //new pointer. keep the table at most 3/4 full so probes stay short
+    if (slot->isa == 0 && walk->isa_count < HEAP_ISA_SLOTS / 4 * 3) {
+        slot->isa = isa;
+        slot->is_class = heap_is_class(walk, isa);
+        walk->isa_count++;
+        if (slot->is_class) {
+            slot->count = 1;
+            slot->bytes = size;
+            walk->objects++;
+        }
+    }
+    else if (heap_is_class(walk, isa)) {
+        walk->objects++;
+        walk->other_objects++;
+    }
+}
+
+static uint32_t heap_size_class(uint64_t size) {
+    uint32_t class;
+
+    if (size <= 16)
+        return 0;
+    class = 64 - __builtin_clzll(size - 1) - 4;
+    return class < HEAP_SIZE_CLASSES ? class : HEAP_SIZE_CLASSES - 1;
+}
+
+//vm_range_recorder_t handed to the zone enumerators, gets a batch of allocations at a time
+static void heap_recorder(task_t task, void* context, unsigned type, vm_range_t* ranges, unsigned count) {
+    HeapWalk* walk = (HeapWalk*) context;
+    uint64_t word;
+    uint32_t class;
+
+    for (unsigned i = 0; i < count; i++) {
+        class = heap_size_class(ranges[i].size);
+        walk->class_count[class]++;
+        walk->class_bytes[class] += ranges[i].size;
+        walk->allocations++;
+        walk->bytes += ranges[i].size;
+
+        //an object is at least an isa and a refcount / ivar
+        if (ranges[i].size >= 16 && heap_peek(walk, ranges[i].address, &word))
+            heap_count_isa(walk, word & HEAP_ISA_MASK, ranges[i].size);
+    }
+}
+
+/*
+get the zone list of the task
+malloc_zones / malloc_num_zones in libsystem_malloc is the registry malloc itself uses,
+malloc_get_all_zones is the fallback when the image has no symbols for them
+*/
+static uint32_t heap_find_zones(HeapWalk* walk, uint64_t** out) {
+    vm_address_t* addresses;
+    uint64_t zones_address;
+    uint64_t count_address;
+    uint64_t zones;
+    uint32_t count;
+    unsigned all_count;
+
+    *out = NULL;
+    zones_address = image_find_symbol(walk->machium, "libsystem_malloc.dylib", "malloc_zones");
+    count_address = image_find_symbol(walk->machium, "libsystem_malloc.dylib", "malloc_num_zones");
+    if (zones_address && count_address &&
+        heap_read_value(walk->task, zones_address, &zones, sizeof(zones)) &&
+        heap_read_value(walk->task, count_address, &count, sizeof(count)) &&
+        count && count < 1024) {
+        *out = (uint64_t*) malloc(count * sizeof(uint64_t));
+        if (heap_read_value(walk->task, zones, *out, count * sizeof(uint64_t)))
+            return count;
+        free(*out);
+        *out = NULL;
+    }
+
+    if (malloc_get_all_zones(walk->task, heap_reader, &addresses, &all_count) != KERN_SUCCESS || all_count == 0)
+        return 0;
+    *out = (uint64_t*) malloc(all_count * sizeof(uint64_t));
+    for (unsigned i = 0; i < all_count; i++)
+        (*out)[i] = addresses[i];
+    heap_cache_clear(walk); //addresses pointed into the reads
+    return all_count;
+}
+
+/*
+the enumerators are code in libsystem_malloc, which sits at the same address in every process thanks to the shared cache
+so a zone of the task can be walked with the introspection table of the same kind of zone in Machium
+*/
+static malloc_introspection_t* heap_local_introspect(uint64_t remote) {
+    vm_address_t* addresses;
+    malloc_zone_t* zone;
+    unsigned count;
+
+    if (malloc_get_all_zones(mach_task_self(), NULL, &addresses, &count) != KERN_SUCCESS)
+        return NULL;
+    for (unsigned i = 0; i < count; i++) {
+        zone = (malloc_zone_t*) addresses[i];
+        if (zone->introspect && HEAP_STRIP(zone->introspect) == HEAP_STRIP(remote))
+            return zone->introspect;
+    }
+    return NULL;
+}
+
+static void heap_zone_name(HeapWalk* walk, uint64_t address, char* out, size_t size) {
+    size_t length;
+
+    //don't read past the page the name starts in, zone names are short
+    length = vm_page_size - (address & vm_page_mask);
+    if (length > size - 1)
+        length = size - 1;
+    if (address == 0 || !heap_read_value(walk->task, address, out, length))
+        length = 0;
+    out[length] = '\0';
+    if (out[0] == '\0')
+        snprintf(out, size, "(unnamed)");
+}
+
+static int compare_isas(const void* a, const void* b) {
+    const HeapIsa* left = *(const HeapIsa**) a;
+    const HeapIsa* right = *(const HeapIsa**) b;
+
+    if (left->count != right->count)
+        return left->count < right->count ? 1 : -1;
+    return 0;
+}
+
+static void heap_print(HeapWalk* walk, uint32_t top) {
+    char description[IMAGE_DESCRIPTION_MAX];
+    char bar[32];
+    HeapIsa** sorted;
+    const char* name;
+    uint64_t most;
+    uint32_t count;
+    uint32_t length;
+
+    most = 0;
+    for (uint32_t i = 0; i < HEAP_SIZE_CLASSES; i++) {
+        if (walk->class_count[i] > most)
+            most = walk->class_count[i];
+    }
+
+    output_textf(YELLOW"%-12s %12s %16s\n"WHITE, "size", "count", "bytes");
+    for (uint32_t i = 0; i < HEAP_SIZE_CLASSES; i++) {
+        if (walk->class_count[i] == 0)
+            continue;
+        length = (uint32_t) (walk->class_count[i] * 30 / most);
+        memset(bar, '#', length);
+        bar[length] = '\0';
+        output_textf("<= %-9llu %12llu %16llu %s\n", 16ULL << i, walk->class_count[i], walk->class_bytes[i], bar);
+    }
+
+    sorted = (HeapIsa**) malloc(HEAP_ISA_SLOTS * sizeof(HeapIsa*));
+    count = 0;
+    for (uint32_t i = 0; i < HEAP_ISA_SLOTS; i++) {
+        if (walk->isas[i].is_class)
+            sorted[count++] = &walk->isas[i];
+    }
+    qsort(sorted, count, sizeof(HeapIsa*), compare_isas);
+
+    output_message(OUTPUT_LEVEL_GOOD, "%llu allocations look like objects (%u classes)", walk->objects, count);
+    if (count)
+        output_textf(YELLOW"%12s %16s  %s\n"WHITE, "count", "bytes", "class");
+    for (uint32_t i = 0; i < count && i < top; i++) {
+        //symbol names resolve lazily, so this only costs something for the classes that get printed
+        if (image_describe(walk->machium, sorted[i]->isa, description, sizeof(description))) {
+            name = strstr(description, "OBJC_CLASS_$_");
+            name = name ? name + strlen("OBJC_CLASS_$_") : description;
+        }
+        else {
+            snprintf(description, sizeof(description), "0x%llx", sorted[i]->isa);
+            name = description;
+        }
+        output_textf("%12llu %16llu  %s\n", sorted[i]->count, sorted[i]->bytes, name);
+    }
+    if (walk->other_objects)
+        output_textf("%12llu %16s  (other)\n", walk->other_objects, "-");
+    free(sorted);
+}
+
+/*
+walk every malloc zone of the debug task and print a census by size class and by objc class
+the task is paused while walking so the heap doesn't change under the enumerators
+
+machium->args[0] -> heap
+machium->args[1] -> [classes] (OPTIONAL, how many classes to print, 20 by default)
+*/
+machium_command_t m_heap(Machium* machium) {
+    HeapWalk* walk;
+    ImageIndex* index;
+    malloc_introspection_t* introspect;
+    malloc_zone_t zone;
+    char name[64];
+    uint64_t* zones;
+    uint32_t zone_count;
+    uint32_t top;
+    uint64_t allocations;
+    uint64_t bytes;
+    kern_return_t kret;
+    double started;
+
+    if (machium->args_count > 2) {
+        output_error(KERN_SUCCESS, "Too many arguments for 'heap', 2 maximum");
+        return MACHIUM_FAILURE;
+    }
+    top = machium->args_count == 2 ? (uint32_t) strtoul(machium->args[1], NULL, 0) : 20;
+
+    walk = (HeapWalk*) calloc(1, sizeof(HeapWalk));
+    if (walk == NULL) {
+        output_error(KERN_SUCCESS, "Out of memory for the heap walk");
+        return MACHIUM_FAILURE;
+    }
+    walk->machium = machium;
+    walk->task = machium->target->debug_task;
+    index = image_index(machium);
+    if (index && index->count) {
+        walk->images_start = index->images[0].base;
+        walk->images = index;
+        walk->image_classes = (HeapClasses*) calloc(index->count, sizeof(HeapClasses)); //no objects get counted without it
+    }
+    current_walk = walk;
+    started = job_time();
+
+    if (task_suspend(walk->task) != KERN_SUCCESS) {
+        output_error(KERN_SUCCESS, "Unable to pause debug task!");
+        free(walk->image_classes);
+        free(walk);
+        return MACHIUM_FAILURE;
+    }
+
+    zone_count = heap_find_zones(walk, &zones);
+    if (zone_count == 0)
+        output_error(KERN_SUCCESS, "Couldn't find the malloc zones of the debug task");
+
+    for (uint32_t i = 0; i < zone_count && !job_cancelled(); i++) {
+        if (!heap_read_value(walk->task, zones[i], &zone, sizeof(zone))) {
+            output_message(OUTPUT_LEVEL_WARNING, "Couldn't read zone at 0x%llx", zones[i]);
+            continue;
+        }
+        heap_zone_name(walk, (uint64_t) zone.zone_name, name, sizeof(name));
+
+        introspect = heap_local_introspect((uint64_t) zone.introspect);
+        if (introspect == NULL || introspect->enumerator == NULL) {
+            output_message(OUTPUT_LEVEL_WARNING, "Skipping zone %s at 0x%llx, Machium has no zone of the same kind to walk it with", name, zones[i]);
+            continue;
+        }
+
+        allocations = walk->allocations;
+        bytes = walk->bytes;
+        kret = introspect->enumerator(walk->task, walk, MALLOC_PTR_IN_USE_RANGE_TYPE, (vm_address_t) zones[i], heap_reader, heap_recorder);
+        heap_cache_clear(walk);
+
+        if (kret != KERN_SUCCESS && !job_cancelled())
+            output_message(OUTPUT_LEVEL_WARNING, "Zone %s at 0x%llx was only partially walked", name, zones[i]);
+        output_message(OUTPUT_LEVEL_GOOD, "Zone %s: %llu allocations, %llu bytes", name, walk->allocations - allocations, walk->bytes - bytes);
+    }
+
+    task_resume(walk->task);
+    current_walk = NULL;
+
+    if (job_cancelled())
+        output_message(OUTPUT_LEVEL_WARNING, "Heap walk cancelled, the census is incomplete");
+    output_message(OUTPUT_LEVEL_GOOD, "%llu allocations, %llu bytes in %u zones (read %.1f MB in %.2fs)", walk->allocations, walk->bytes, zone_count,
+           (double) walk->read_bytes / (1024.0 * 1024.0), job_time() - started);
+    if (walk->allocations)
+        heap_print(walk, top);
+
+    free(zones);
+    free(walk->reads);
+    for (uint32_t i = 0; walk->image_classes && i < index->count; i++)
+        free(walk->image_classes[i].classes);
+    free(walk->image_classes);
+    free(walk);
+    return zone_count ? MACHIUM_SUCCESS : MACHIUM_FAILURE;
+}
@@ -0,0 +1,75 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include "Machium.h"
+
+//size classes are powers of two from <= 16 bytes up
+#define HEAP_SIZE_CLASSES 48
+
+//how many different isa pointers the census keeps apart, the rest get counted as "other"
+#define HEAP_ISA_SLOTS 4096
+
+//class pointer bits of a (possibly non-pointer) isa on arm64
+#define HEAP_ISA_MASK 0x0000000ffffffff8ULL
+
+//pages read to peek at large allocations get thrown away oldest first once they add up to more than this
+#define HEAP_CACHE_SIZE (64 * 1024 * 1024)
+
+//one vm_read_overwrite, for a zone enumerator or to peek at an allocation
+typedef struct HeapRead {
+    uint64_t address;
+    uint64_t size;
+    uint8_t* data; //NULL once evicted
+    bool pinned; //handed to the enumerator, which may hold on to it until it returns
+} HeapRead;
+
+//where the classes of one image are
+typedef struct HeapClasses {
+    uint64_t objc_data; //slid __objc_data
+    uint64_t objc_data_size;
+    uint64_t* classes; //__objc_classlist without pointer authentication bits, sorted
+    uint32_t count;
+    bool loaded;
+} HeapClasses;
+
+typedef struct HeapIsa {
+    uint64_t isa; //0 for an empty slot
+    bool is_class; //pointers that turned out not to be classes stay in the table so they're only checked once
+    uint64_t count;
+    uint64_t bytes;
+} HeapIsa;
+
+//state of one 'heap' run
+typedef struct HeapWalk {
+    Machium* machium;
+    mach_port_t task;
+
+    //everything the enumerator of the current zone got from heap_reader
+    HeapRead* reads;
+    uint32_t read_count;
+    uint32_t read_capacity;
+    uint32_t evict_next; //oldest read that might still be evicted
+    uint32_t last_hit; //reads are looked up newest first, but the last one that matched usually matches again
+    uint64_t cached_bytes; //bytes held by unpinned reads
+    uint64_t read_bytes; //total read from the task, for throughput
+
+    uint64_t images_start; //lowest image base, anything below can't be a class
+
+    struct ImageIndex* images;
+    HeapClasses* image_classes; //one per image, loaded the first time an isa lands in it
+
+    uint64_t allocations;
+    uint64_t bytes;
+    uint64_t class_count[HEAP_SIZE_CLASSES];
+    uint64_t class_bytes[HEAP_SIZE_CLASSES];
+
+    HeapIsa isas[HEAP_ISA_SLOTS]; //open addressing on the isa
+    uint32_t isa_count;
+    uint64_t objects; //allocations that looked like an object
+    uint64_t other_objects; //objects that didn't fit in isas
+} HeapWalk;
+
+//walk the malloc zones of the debug task and print an allocation census
+machium_command_t m_heap(Machium* machium);
+
+#endif /* HEAP_H */
@@ -0,0 +1,572 @@
+#include "Hook.h"
+#include "Memory.h"
+#include "Image.h"
+#include "View.h"
+#include "Coverage.h"
+#include "Output.h"
+
+//a trampoline being put together, literals go in a pool after the code
+typedef struct HookCode {
+    uint64_t base; //address of the trampoline in the task
+    uint32_t code[HOOK_CODE_MAX];
+    uint32_t count;
+    uint64_t literals[HOOK_CODE_MAX / 2];
+    uint32_t literal_count;
+    uint32_t fixups[HOOK_CODE_MAX / 2]; //instruction that loads literal i
+    bool overflow;
+} HookCode;
+
+static int64_t hook_sign_extend(uint64_t value, uint32_t bits) {
+    return (int64_t) (value << (64 - bits)) >> (64 - bits);
+}
+
+static void hook_emit(HookCode* code, uint32_t instruction) {
+    if (code->count == HOOK_CODE_MAX) {
+        code->overflow = true;
+        return;
+    }
+    code->code[code->count++] = instruction;
+}
+
+//ldr x[rt], =[value], the offset to the pool gets filled in by hook_finish
+static void hook_emit_literal(HookCode* code, uint32_t rt, uint64_t value) {
+    if (code->literal_count == HOOK_CODE_MAX / 2) {
+        code->overflow = true;
+        return;
+    }
+    code->fixups[code->literal_count] = code->count;
+    code->literals[code->literal_count++] = value;
+    hook_emit(code, 0x58000000 | rt);
+}
+
+//ldr x17, =[target] / br x17, reaches anywhere
+static void hook_emit_jump(HookCode* code, uint64_t target) {
+    hook_emit_literal(code, 17, target);
+    hook_emit(code, 0xd61f0220);
+}
+
+/*
+copy one of the instructions the patch replaced into the trampoline
+anything that depends on where it runs is rewritten to use the absolute address it meant
+false for the ones that can't move: bl / blr would return into the trampoline, and an unconditional branch before the
+last instruction means the bytes after it might not belong to this function
+*/
+static bool hook_relocate(HookCode* code, uint64_t pc, uint32_t instruction, bool last) {
+    uint64_t target;
+    uint32_t load;
+
+    //adr / adrp
+    if ((instruction & 0x1f000000) == 0x10000000) {
+        target = (uint64_t) hook_sign_extend(((instruction >> 29) & 3) | (((instruction >> 5) & 0x7ffff) << 2), 21);
+        if (instruction & 0x80000000)
+            target = (pc & ~0xfffULL) + (target << 12);
+        else
+            target += pc;
+        hook_emit_literal(code, instruction & 31, target);
+        return true;
+    }
+
+    //b / bl
+    if ((instruction & 0x7c000000) == 0x14000000) {
+        if ((instruction & 0x80000000) || !last)
+            return false;
+        hook_emit_jump(code, pc + (uint64_t) (hook_sign_extend(instruction & 0x3ffffff, 26) * 4));
+        return true;
+    }
+
+    //conditional branches: the opposite condition skips over a jump to where it went
+    if ((instruction & 0xff000010) == 0x54000000) {
+        target = pc + (uint64_t) (hook_sign_extend((instruction >> 5) & 0x7ffff, 19) * 4);
+        if ((instruction & 0xf) >= 0xe) {
+            //b.al / b.nv always branch
+            if (!last)
+                return false;
+        }
+        else {
+            hook_emit(code, 0x54000060 | ((instruction & 0xf) ^ 1)); //b.!cond #12
+        }
+        hook_emit_jump(code, target);
+        return true;
+    }
+    if ((instruction & 0x7e000000) == 0x34000000) {
+        //cbz <-> cbnz, #12
+        target = pc + (uint64_t) (hook_sign_extend((instruction >> 5) & 0x7ffff, 19) * 4);
+        hook_emit(code, ((instruction & 0xff00001f) ^ 0x01000000) | (3 << 5));
+        hook_emit_jump(code, target);
+        return true;
+    }
+    if ((instruction & 0x7e000000) == 0x36000000) {
+        //tbz <-> tbnz, #12
+        target = pc + (uint64_t) (hook_sign_extend((instruction >> 5) & 0x3fff, 14) * 4);
+        hook_emit(code, ((instruction & 0xfff8001f) ^ 0x01000000) | (3 << 5));
+        hook_emit_jump(code, target);
+        return true;
+    }
+
+    //ldr (literal): load the address into x17 and do the same load from there
+    if ((instruction & 0x3b000000) == 0x18000000) {
+        target = pc + (uint64_t) (hook_sign_extend((instruction >> 5) & 0x7ffff, 19) * 4);
+        switch ((instruction >> 30) | ((instruction >> 24) & 4)) { //opc, V
+            case 0: load = 0xb9400220; break; //ldr w, [x17]
+            case 1: load = 0xf9400220; break; //ldr x, [x17]
+            case 2: load = 0xb9800220; break; //ldrsw x, [x17]
+            case 3: return true; //prfm, only a hint
+            case 4: load = 0xbd400220; break; //ldr s, [x17]
+            case 5: load = 0xfd400220; break; //ldr d, [x17]
+            case 6: load = 0x3dc00220; break; //ldr q, [x17]
+            default: return false;
+        }
+        hook_emit_literal(code, 17, target);
+        hook_emit(code, load | (instruction & 31));
+        return true;
+    }
+
+    //br / blr / ret and their pointer authentication versions
+    if ((instruction & 0xfe000000) == 0xd6000000) {
+        if (((instruction >> 21) & 7) == 1 || !last)
+            return false;
+    }
+
+    hook_emit(code, instruction);
+    return true;
+}
+
+//put the literal pool after the code and point every literal load at its slot
+static void hook_finish(HookCode* code) {
+    uint32_t pool;
+
+    if (code->count & 1)
+        hook_emit(code, 0xd503201f); //nop, literals are 8 byte aligned
+    pool = code->count;
+    for (uint32_t i = 0; i < code->literal_count; i++) {
+        hook_emit(code, (uint32_t) code->literals[i]);
+        hook_emit(code, (uint32_t) (code->literals[i] >> 32));
+        code->code[code->fixups[i]] |= ((pool + i * 2 - code->fixups[i]) & 0x7ffff) << 5;
+    }
+}
+
+/*
+build the trampoline of [hook]. it runs instead of the first 4 instructions of the function:
+
+stp x0, x1, [sp, #-16]!         x16 / x17 are free to use at a call, x0 and x1 get saved
+adr x16, data
+1: ldxr x0, [x16]               count the call, other threads can be in here too
+add x0, x0, #1
+stxr w1, x0, [x16]
+cbnz w1, 1b
+(args hooks write x0-x7, lr, sp and the thread into ring[(count - 1) % HOOK_RING_ENTRIES], count last with stlr)
+ldp x0, x1, [sp], #16
+(the 4 instructions the patch replaced)
+ldr x16, =function + 16
+br x16
+*/
+static bool hook_build(Hook* hook, const uint8_t* original, HookCode* code) {
+    uint64_t data;
+    int64_t offset;
+    uint32_t instruction;
+
+    memset(code, 0, sizeof(HookCode));
+    code->base = hook->cave;
+    data = hook->cave + vm_page_size;
+
+    hook_emit(code, 0xa9bf07e0); //stp x0, x1, [sp, #-16]!
+    offset = (int64_t) (data - (code->base + code->count * 4));
+    hook_emit(code, 0x10000010 | (uint32_t) ((offset & 3) << 29) | (uint32_t) (((offset >> 2) & 0x7ffff) << 5)); //adr x16, data
+    hook_emit(code, 0xc85f7e00); //ldxr x0, [x16]
+    hook_emit(code, 0x91000400); //add x0, x0, #1
+    hook_emit(code, 0xc8017e00); //stxr w1, x0, [x16]
+    hook_emit(code, 0x35ffffa1); //cbnz w1, #-12
+
+    if (hook->record) {
+        hook_emit(code, 0xd1000401); //sub x1, x0, #1
+        hook_emit(code, 0x92400021 | ((uint32_t) (__builtin_ctz(HOOK_RING_ENTRIES) - 1) << 10)); //and x1, x1, #(HOOK_RING_ENTRIES - 1)
+        hook_emit(code, 0x91010210); //add x16, x16, #64 (ring)
+        hook_emit(code, 0x8b011e10); //add x16, x16, x1, lsl #7 (record)
+        hook_emit(code, 0xa94047e1); //ldp x1, x17, [sp] (x0 and x1 of the caller)
+        hook_emit(code, 0xa900c601); //stp x1, x17, [x16, #8]
+        hook_emit(code, 0xa9018e02); //stp x2, x3, [x16, #24]
+        hook_emit(code, 0xa9029604); //stp x4, x5, [x16, #40]
+        hook_emit(code, 0xa9039e06); //stp x6, x7, [x16, #56]
+        hook_emit(code, 0x910043e1); //add x1, sp, #16 (sp of the caller)
+        hook_emit(code, 0xa904861e); //stp x30, x1, [x16, #72]
+        hook_emit(code, 0xd53bd061); //mrs x1, tpidrro_el0
+        hook_emit(code, 0xf9002e01); //str x1, [x16, #88]
+        hook_emit(code, 0xc89ffe00); //stlr x0, [x16]
+    }
+    hook_emit(code, 0xa8c107e0); //ldp x0, x1, [sp], #16
+
+    for (uint32_t i = 0; i < HOOK_PATCH_SIZE / 4; i++) {
+        memcpy(&instruction, original + i * 4, 4);
+        if (!hook_relocate(code, hook->address + i * 4, instruction, i == HOOK_PATCH_SIZE / 4 - 1))
+            return false;
+    }
+
+    hook_emit_literal(code, 16, hook->address + HOOK_PATCH_SIZE);
+    hook_emit(code, 0xd61f0200); //br x16
+    hook_finish(code);
+    return !code->overflow;
+}
+
+/*
+with the task suspended, check no thread is stopped where patching [hook] would break it:
+inside the patched instructions (past the first one) or inside the trampoline
+*/
+static bool hook_threads_clear(mach_port_t task, Hook* hook) {
+    kern_return_t kret;
+    thread_act_port_array_t thread_list;
+    mach_msg_type_number_t thread_count;
+    arm_thread_state64_t state;
+    mach_msg_type_number_t state_count;
+    uint64_t pc;
+    bool clear;
+
+    kret = task_threads(task, &thread_list, &thread_count);
+    if (kret != KERN_SUCCESS)
+        return false;
+
+    clear = true;
+    for (mach_msg_type_number_t i = 0; i < thread_count; i++) {
+        state_count = ARM_THREAD_STATE64_COUNT;
+        kret = thread_get_state(thread_list[i], ARM_THREAD_STATE64, (thread_state_t) &state, &state_count);
+        mach_port_deallocate(mach_task_self(), thread_list[i]);
+        if (kret != KERN_SUCCESS)
+            continue; //thread exited while we were looking
+
+        pc = state.__pc & MACHIUM_PC_MASK;
+        if ((pc > hook->address && pc < hook->address + HOOK_PATCH_SIZE) || (pc >= hook->cave && pc < hook->cave + vm_page_size))
+            clear = false;
+    }
+    vm_deallocate(mach_task_self(), (vm_address_t) thread_list, thread_count * sizeof(thread_act_t));
+    return clear;
+}
+
+static HookSet* hook_set(MachiumTarget* target) {
+    if (target->hooks == NULL) {
+        target->hooks = (HookSet*) calloc(1, sizeof(HookSet));
+        target->hooks->next_id = 1;
+    }
+    return target->hooks;
+}
+
+uint32_t hook_count(MachiumTarget* target) {
+    return target->hooks ? target->hooks->count : 0;
+}
+
+bool hook_owns(MachiumTarget* target, uint64_t address, uint64_t size) {
+    for (uint32_t i = 0; i < hook_count(target); i++) {
+        if (address < target->hooks->hooks[i].address + HOOK_PATCH_SIZE && address + size > target->hooks->hooks[i].address)
+            return true;
+    }
+    return false;
+}
+
+static Hook* hook_find(HookSet* set, uint32_t id) {
+    for (uint32_t i = 0; i < set->count; i++) {
+        if (set->hooks[i].id == id)
+            return &set->hooks[i];
+    }
+    return NULL;
+}
+
+//put the original instructions back and free the trampoline, the task has to be suspended
+static bool hook_remove(Machium* machium, Hook* hook) {
+    mach_port_t task;
+    uint64_t mismatched;
+
+    task = machium->target->debug_task;
+    if (!hook_threads_clear(task, hook)) {
+        output_message(OUTPUT_LEVEL_WARNING, "A thread is inside hook %u, continue the task for a bit and try again", hook->id);
+        return false;
+    }
+    if (memory_write(machium->target, hook->address, hook->original, HOOK_PATCH_SIZE, &mismatched) != KERN_SUCCESS || mismatched) {
+        output_error(KERN_SUCCESS, "Couldn't restore the instructions under hook %u", hook->id);
+        return false;
+    }
+    memory_flush_code(task, hook->address, HOOK_PATCH_SIZE);
+    vm_deallocate(task, (vm_address_t) hook->cave, (vm_size_t) hook->cave_size);
+    return true;
+}
+
+/*
+hook a function
+
+machium->args[0] -> hook
+machium->args[1] -> [address]
+machium->args[2] -> args (OPTIONAL)
+*/
+static machium_command_t m_hook_add(Machium* machium) {
+    char annotation[IMAGE_DESCRIPTION_MAX];
+    kern_return_t kret;
+    HookSet* set;
+    Hook hook;
+    HookCode* code;
+    mach_port_t task;
+    vm_address_t cave;
+    vm_size_t read_size;
+    uint8_t patch[HOOK_PATCH_SIZE];
+    uint64_t mismatched;
+    bool patched;
+
+    if (machium->args_count > 3) {
+        output_error(KERN_SUCCESS, "Too many arguments for 'hook', 3 maximum");
+        return MACHIUM_FAILURE;
+    }
+
+    task = machium->target->debug_task;
+    set = hook_set(machium->target);
+    if (set->count == HOOK_MAX) {
+        output_error(KERN_SUCCESS, "Max amount of hooks placed! (%d)", HOOK_MAX);
+        return MACHIUM_FAILURE;
+    }
+
+    memset(&hook, 0, sizeof(hook));
+    hook.address = (uint64_t) strtoull(machium->args[1], NULL, 0);
+    if (machium->args_count == 3) {
+        if (strcmp(machium->args[2], "args")) {
+            output_error(KERN_SUCCESS, "Invalid argument for 'hook', %s", machium->args[2]);
+            return MACHIUM_FAILURE;
+        }
+        hook.record = true;
+    }
+    if (hook.address & 3) {
+        output_error(KERN_SUCCESS, "0x%llx isn't an instruction address", hook.address);
+        return MACHIUM_FAILURE;
+    }
+    for (uint32_t i = 0; i < set->count; i++) {
+        if (hook.address + HOOK_PATCH_SIZE > set->hooks[i].address && hook.address < set->hooks[i].address + HOOK_PATCH_SIZE) {
+            output_error(KERN_SUCCESS, "0x%llx is already hooked by hook %u", hook.address, set->hooks[i].id);
+            return MACHIUM_FAILURE;
+        }
+    }
+    //the patch would save coverage's brk as the original, and 'coverage stop' would write over the patch
+    if (coverage_owns(machium->target, hook.address, HOOK_PATCH_SIZE)) {
+        output_error(KERN_SUCCESS, "0x%llx has coverage blocks that weren't hit yet, 'coverage stop' first", hook.address);
+        return MACHIUM_FAILURE;
+    }
+
+    read_size = HOOK_PATCH_SIZE;
+    kret = vm_read_overwrite(task, (vm_address_t) hook.address, HOOK_PATCH_SIZE, (vm_address_t) hook.original, &read_size);
+    if (kret != KERN_SUCCESS) {
+        output_error(kret, "Failed to read the instructions at 0x%llx!", hook.address);
+        return MACHIUM_FAILURE;
+    }
+
+    //one page of code, then the counter and the ring
+    hook.cave_size = vm_page_size + ((sizeof(HookData) + vm_page_mask) & ~(uint64_t) vm_page_mask);
+    cave = 0;
+    kret = vm_allocate(task, &cave, (vm_size_t) hook.cave_size, VM_FLAGS_ANYWHERE);
+    if (kret != KERN_SUCCESS) {
+        output_error(kret, "Failed to allocate the trampoline!");
+        return MACHIUM_FAILURE;
+    }
+    hook.cave = cave;
+
+    code = (HookCode*) malloc(sizeof(HookCode));
+    if (!hook_build(&hook, hook.original, code)) {
+        output_error(KERN_SUCCESS, "The first %d bytes at 0x%llx can't be moved into a trampoline (a call, or the function is too short)", HOOK_PATCH_SIZE, hook.address);
+        free(code);
+        vm_deallocate(task, cave, (vm_size_t) hook.cave_size);
+        return MACHIUM_FAILURE;
+    }
+    kret = vm_write(task, cave, (vm_offset_t) code->code, code->count * 4);
+    free(code);
+    if (kret == KERN_SUCCESS)
+        kret = vm_protect(task, cave, vm_page_size, false, VM_PROT_READ | VM_PROT_EXECUTE);
+    if (kret != KERN_SUCCESS) {
+        output_error(kret, "Failed to write the trampoline!");
+        vm_deallocate(task, cave, (vm_size_t) hook.cave_size);
+        return MACHIUM_FAILURE;
+    }
+    memory_flush_code(task, cave, vm_page_size);
+
+    //ldr x16, #8 / br x16 / .quad cave
+    memcpy(patch, "\x50\x00\x00\x58\x00\x02\x1f\xd6", 8);
+    memcpy(patch + 8, &hook.cave, 8);
+
+    //with every thread stopped the patch goes in all at once
+    kret = task_suspend(task);
+    if (kret != KERN_SUCCESS) {
+        output_error(kret, "Failed to suspend the task!");
+        vm_deallocate(task, cave, (vm_size_t) hook.cave_size);
+        return MACHIUM_FAILURE;
+    }
+    patched = false;
+    if (!hook_threads_clear(task, &hook))
+        output_message(OUTPUT_LEVEL_WARNING, "A thread is stopped inside the first %d bytes at 0x%llx, continue the task for a bit and try again", HOOK_PATCH_SIZE, hook.address);
+    else if (memory_write(machium->target, hook.address, patch, HOOK_PATCH_SIZE, &mismatched) != KERN_SUCCESS || mismatched)
+        output_error(KERN_SUCCESS, "Failed to patch 0x%llx", hook.address);
+    else
+        patched = true;
+    if (patched)
+        memory_flush_code(task, hook.address, HOOK_PATCH_SIZE);
+    task_resume(task);
+
+    if (!patched) {
+        vm_deallocate(task, cave, (vm_size_t) hook.cave_size);
+        return MACHIUM_FAILURE;
+    }
+
+    hook.id = set->next_id++;
+    set->hooks[set->count++] = hook;
+    output_message(OUTPUT_LEVEL_GOOD, "Hook %u placed at 0x%llx%s, trampoline at 0x%llx", hook.id, hook.address, image_annotate(machium, hook.address, annotation, sizeof(annotation)), hook.cave);
+    return MACHIUM_SUCCESS;
+}
+
+/*
+list hooks with how often they were hit
+
+machium->args[0] -> hook
+machium->args[1] -> list
+*/
+static machium_command_t m_hook_list(Machium* machium) {
+    char annotation[IMAGE_DESCRIPTION_MAX];
+    HookSet* set;
+    Hook* hook;
+    vm_size_t read_size;
+    uint64_t count;
+
+    set = hook_set(machium->target);
+    if (set->count == 0) {
+        output_message(OUTPUT_LEVEL_WARNING, "No hooks placed");
+        return MACHIUM_SUCCESS;
+    }
+
+    for (uint32_t i = 0; i < set->count; i++) {
+        hook = &set->hooks[i];
+        read_size = sizeof(count);
+        if (vm_read_overwrite(machium->target->debug_task, (vm_address_t) (hook->cave + vm_page_size), sizeof(count), (vm_address_t) &count, &read_size) != KERN_SUCCESS)
+            count = 0;
+        output_textf(YELLOW"%u "WHITE"0x%llx%s %s- %llu calls\n", hook->id, hook->address, image_annotate(machium, hook->address, annotation, sizeof(annotation)), hook->record ? "(args) " : "", count);
+    }
+    return MACHIUM_SUCCESS;
+}
+
+/*
+print the newest calls an 'args' hook recorded, oldest first
+
+machium->args[0] -> hook
+machium->args[1] -> log
+machium->args[2] -> [id]
+machium->args[3] -> [count] (OPTIONAL)
+*/
+static machium_command_t m_hook_log(Machium* machium) {
+    char annotation[IMAGE_DESCRIPTION_MAX];
+    MemoryView view;
+    HookData* data;
+    HookRecord* record;
+    Hook* hook;
+    uint64_t count;
+    uint64_t first;
+    uint64_t skipped;
+
+    if (machium->args_count < 3) {
+        output_error(KERN_SUCCESS, "Not enough arguments for 'hook log', 3 minimum");
+        return MACHIUM_FAILURE;
+    }
+    hook = hook_find(hook_set(machium->target), (uint32_t) strtoul(machium->args[2], NULL, 0));
+    if (hook == NULL) {
+        output_error(KERN_SUCCESS, "No hook %s", machium->args[2]);
+        return MACHIUM_FAILURE;
+    }
+    if (!hook->record) {
+        output_error(KERN_SUCCESS, "Hook %u only counts calls, place it with 'hook [0xaddress] args' to record them", hook->id);
+        return MACHIUM_FAILURE;
+    }
+
+    count = machium->args_count > 3 ? strtoull(machium->args[3], NULL, 0) : HOOK_LOG_COUNT;
+    if (count > HOOK_RING_ENTRIES)
+        count = HOOK_RING_ENTRIES;
+
+    //the ring is read in one go so it's all from about the same moment
+    if (!view_acquire(view_cache(machium->target), hook->cave + vm_page_size, sizeof(HookData), &view)) {
+        output_error(KERN_SUCCESS, "Failed to read the records of hook %u", hook->id);
+        return MACHIUM_FAILURE;
+    }
+    data = (HookData*) view.data;
+
+    first = data->count > count ? data->count - count + 1 : 1;
+    output_message(OUTPUT_LEVEL_GOOD, "Hook %u has %llu calls, printing from call %llu", hook->id, data->count, first);
+    skipped = 0;
+    for (uint64_t call = first; call <= data->count; call++) {
+        record = &data->ring[(call - 1) & (HOOK_RING_ENTRIES - 1)];
+        if (record->count != call) {
+            skipped++; //being written right now, or already overwritten by a newer call
+            continue;
+        }
+        output_textf(BLUE"#%llu "WHITE"thread 0x%llx sp 0x%llx lr 0x%llx%s\n", call, record->thread, record->sp, record->lr & MACHIUM_PC_MASK, image_annotate(machium, record->lr & MACHIUM_PC_MASK, annotation, sizeof(annotation)));
+        output_textf("    x0 0x%llx x1 0x%llx x2 0x%llx x3 0x%llx\n", record->x[0], record->x[1], record->x[2], record->x[3]);
+        output_textf("    x4 0x%llx x5 0x%llx x6 0x%llx x7 0x%llx\n", record->x[4], record->x[5], record->x[6], record->x[7]);
+    }
+    view_release(&view);
+
+    if (skipped)
+        output_message(OUTPUT_LEVEL_WARNING, "%llu calls were overwritten while reading", skipped);
+    return MACHIUM_SUCCESS;
+}
+
+/*
+remove one or every hook, all in one suspension of the task
+
+machium->args[0] -> hook
+machium->args[1] -> remove / clear
+machium->args[2] -> [id] (remove only)
+*/
+static machium_command_t m_hook_remove(Machium* machium, bool all) {
+    HookSet* set;
+    Hook* hook;
+    kern_return_t kret;
+    uint32_t removed;
+
+    set = hook_set(machium->target);
+    hook = NULL;
+    if (!all) {
+        if (machium->args_count < 3) {
+            output_error(KERN_SUCCESS, "Not enough arguments for 'hook remove', 3 required");
+            return MACHIUM_FAILURE;
+        }
+        hook = hook_find(set, (uint32_t) strtoul(machium->args[2], NULL, 0));
+        if (hook == NULL) {
+            output_error(KERN_SUCCESS, "No hook %s", machium->args[2]);
+            return MACHIUM_FAILURE;
+        }
+    }
+
+    kret = task_suspend(machium->target->debug_task);
+    if (kret != KERN_SUCCESS) {
+        output_error(kret, "Failed to suspend the task!");
+        return MACHIUM_FAILURE;
+    }
+    removed = 0;
+    for (uint32_t i = 0; i < set->count;) {
+        if ((all || &set->hooks[i] == hook) && hook_remove(machium, &set->hooks[i])) {
+            output_message(OUTPUT_LEVEL_GOOD, "Removed hook %u", set->hooks[i].id);
+            memmove(&set->hooks[i], &set->hooks[i + 1], (set->count - i - 1) * sizeof(Hook));
+            set->count--;
+            removed++;
+            if (!all)
+                break;
+            continue;
+        }
+        i++;
+    }
+    task_resume(machium->target->debug_task);
+
+    return removed ? MACHIUM_SUCCESS : MACHIUM_FAILURE;
+}
+
+/*
+handle hook commands
+
+machium->args[0] -> hook
+machium->args[1] -> [command] / [address]
+*/
+machium_command_t m_hook(Machium* machium) {
+    if (machium->args_count < 2 || !strcmp(machium->args[1], "list") || !strcmp(machium->args[1], "l")) return m_hook_list(machium);
+    else if (!strcmp(machium->args[1], "log")) return m_hook_log(machium);
+    else if (!strcmp(machium->args[1], "remove") || !strcmp(machium->args[1], "rm")) return m_hook_remove(machium, false);
+    else if (!strcmp(machium->args[1], "clear")) return m_hook_remove(machium, true);
+    else if (!strncmp(machium->args[1], "0x", 2)) return m_hook_add(machium);
+
+    output_error(KERN_SUCCESS, "Invalid argument for 'hook', %s", machium->args[1]);
+    return MACHIUM_FAILURE;
+}
@@ -0,0 +1,59 @@
+#ifndef HOOK_H
+#define HOOK_H
+
+#include "Machium.h"
+#include <stddef.h>
+
+#define HOOK_MAX 64 //hooks per target
+#define HOOK_PATCH_SIZE 16 //ldr x16, #8 / br x16 / .quad [trampoline] over the first 4 instructions of the function
+#define HOOK_RING_ENTRIES 1024 //calls an 'args' hook remembers, has to be a power of 2
+#define HOOK_CODE_MAX 128 //instructions (and literals) in one trampoline
+#define HOOK_LOG_COUNT 20 //records 'hook log' prints unless told otherwise
+
+//what an 'args' hook writes for one call. 128 bytes so the trampoline can find a record with a shift
+typedef struct HookRecord {
+    uint64_t count; //which call this was, written last so a record with a count is complete
+    uint64_t x[8];
+    uint64_t lr;
+    uint64_t sp;
+    uint64_t thread; //TPIDRRO_EL0, tells threads apart
+    uint64_t reserved[4];
+} HookRecord;
+
+//the page(s) right after a trampoline, the trampoline writes them and Machium reads them
+typedef struct HookData {
+    uint64_t count; //calls so far
+    uint64_t reserved[7];
+    HookRecord ring[HOOK_RING_ENTRIES]; //record of call n is at (n - 1) % HOOK_RING_ENTRIES
+} HookData;
+
+_Static_assert(sizeof(HookRecord) == 128, "the trampoline shifts by 7 to index the ring");
+_Static_assert(offsetof(HookData, ring) == 64, "the trampoline adds 64 to get to the ring");
+_Static_assert((HOOK_RING_ENTRIES & (HOOK_RING_ENTRIES - 1)) == 0, "the trampoline masks the ring index");
+
+typedef struct Hook {
+    uint32_t id;
+    uint64_t address; //hooked function
+    uint64_t cave; //trampoline page in the task, HookData follows it
+    uint64_t cave_size;
+    bool record; //'args' hook, records registers as well as counting
+    uint8_t original[HOOK_PATCH_SIZE]; //what the patch replaced
+} Hook;
+
+//every hook of a target
+typedef struct HookSet {
+    Hook hooks[HOOK_MAX];
+    uint32_t count;
+    uint32_t next_id;
+} HookSet;
+
+//hooks placed in the task of [target]
+uint32_t hook_count(MachiumTarget* target);
+
+//true when [address, address + size) overlaps an instruction a hook of [target] patched
+bool hook_owns(MachiumTarget* target, uint64_t address, uint64_t size);
+
+//handle hook commands
+machium_command_t m_hook(Machium* machium);
+
+#endif /* HOOK_H */
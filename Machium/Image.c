@@ -0,0 +1,717 @@
+#include "Image.h"
+#include "SymbolCache.h"
+#include "SharedCache.h"
+#include "Job.h"
+#include "Output.h"
+#include <mach-o/dyld_images.h>
+#include <limits.h>
+
+//macho_read_t for images loaded in a task. context is a pointer to the task port
+static bool image_read(void* context, uint64_t address, void* out, size_t size) {
+    kern_return_t kret;
+    vm_size_t read_size;
+
+    read_size = size;
+    kret = vm_read_overwrite(*(mach_port_t*) context, (vm_address_t) address, size, (vm_address_t) out, &read_size);
+    return kret == KERN_SUCCESS && read_size == size;
+}
+
+//read a string out of the task without reading past the page it ends in
+static bool image_read_string(mach_port_t task, uint64_t address, char* out, size_t size) {
+    size_t offset;
+    size_t chunk;
+
+    offset = 0;
+    while (offset < size - 1) {
+        chunk = vm_page_size - ((address + offset) & vm_page_mask);
+        if (chunk > size - 1 - offset)
+            chunk = size - 1 - offset;
+        if (!image_read(&task, address + offset, out + offset, chunk))
+            return false;
+        if (memchr(out + offset, '\0', chunk))
+            return true;
+        offset += chunk;
+    }
+    out[size - 1] = '\0';
+    return true;
+}
+
+static int compare_images(const void* a, const void* b) {
+    const ImageEntry* left = (const ImageEntry*) a;
+    const ImageEntry* right = (const ImageEntry*) b;
+
+    if (left->base == right->base)
+        return 0;
+    return left->base < right->base ? -1 : 1;
+}
+
+static void image_set_path(ImageEntry* entry, const char* path) {
+    const char* slash;
+
+    entry->path = strdup(path);
+    slash = strrchr(entry->path, '/');
+    entry->name = slash ? slash + 1 : entry->path;
+}
+
+/*
+dyld keeps a list of every loaded image in dyld_all_image_infos
+TASK_DYLD_INFO tells us where that struct lives in the task
+*/
+static void* image_warm(void* context);
+
+ImageIndex* image_index_load(mach_port_t task) {
+    kern_return_t kret;
+    struct task_dyld_info dyld_info;
+    mach_msg_type_number_t count;
+    struct dyld_all_image_infos infos;
+    struct dyld_image_info* info_array;
+    ImageIndex* index;
+    char path[PATH_MAX];
+    size_t infos_size;
+
+    count = TASK_DYLD_INFO_COUNT;
+    kret = task_info(task, TASK_DYLD_INFO, (task_info_t) &dyld_info, &count);
+    if (kret != KERN_SUCCESS) {
+        output_error(kret, "Could not get TASK_DYLD_INFO");
+        return NULL;
+    }
+
+    infos_size = dyld_info.all_image_info_size < sizeof(infos) ? dyld_info.all_image_info_size : sizeof(infos);
+
+    //dyld sets infoArray to NULL while it's changing the list, give it a moment if we catch it mid-update
+    for (int attempt = 0; attempt < 10; attempt++) {
+        memset(&infos, 0, sizeof(infos));
+        if (!image_read(&task, dyld_info.all_image_info_addr, &infos, infos_size)) {
+            output_error(KERN_SUCCESS, "Could not read dyld_all_image_infos!");
+            return NULL;
+        }
+        if (infos.infoArray != NULL)
+            break;
+        usleep(1000);
+    }
+    if (infos.infoArray == NULL) {
+        output_error(KERN_SUCCESS, "dyld image list is busy, try again!");
+        return NULL;
+    }
+
+    info_array = (struct dyld_image_info*) malloc(infos.infoArrayCount * sizeof(struct dyld_image_info));
+    if (info_array == NULL) {
+        output_error(KERN_SUCCESS, "Out of memory for %u images!", infos.infoArrayCount);
+        return NULL;
+    }
+    if (!image_read(&task, (uint64_t) infos.infoArray, info_array, infos.infoArrayCount * sizeof(struct dyld_image_info))) {
+        output_error(KERN_SUCCESS, "Could not read dyld image list!");
+        free(info_array);
+        return NULL;
+    }
+
+    index = (ImageIndex*) calloc(1, sizeof(ImageIndex));
+    index->images = (ImageEntry*) calloc(infos.infoArrayCount + 1, sizeof(ImageEntry));
+
+    for (uint32_t i = 0; i < infos.infoArrayCount; i++) {
+        ImageEntry* entry = &index->images[index->count++];
+        entry->base = (uint64_t) info_array[i].imageLoadAddress;
+        if (!image_read_string(task, (uint64_t) info_array[i].imageFilePath, path, sizeof(path)))
+            snprintf(path, sizeof(path), "image_0x%llx", entry->base);
+        image_set_path(entry, path);
+    }
+    free(info_array);
+
+    //dyld isn't in its own list
+    if (infos.dyldImageLoadAddress) {
+        ImageEntry* entry = &index->images[index->count++];
+        entry->base = (uint64_t) infos.dyldImageLoadAddress;
+        image_set_path(entry, "/usr/lib/dyld");
+    }
+
+    qsort(index->images, index->count, sizeof(ImageEntry), compare_images);
+
+    //the slide and uuid pick and place the cache file whose symbols the images in the shared cache get
+    index->shared_cache_slide = (uint64_t) infos.sharedCacheSlide;
+    memcpy(index->shared_cache_uuid, infos.sharedCacheUUID, 16);
+
+    index->task = task;
+    pthread_mutex_init(&index->lock, NULL);
+    pthread_mutex_init(&index->shared_cache_lock, NULL);
+    index->warming = !pthread_create(&index->warm_thread, NULL, image_warm, index);
+    return index;
+}
+
+void image_index_free(ImageIndex* index) {
+    if (index == NULL)
+        return;
+    if (index->warming) {
+        index->stop = true;
+        pthread_join(index->warm_thread, NULL);
+    }
+    pthread_mutex_destroy(&index->lock);
+    pthread_mutex_destroy(&index->shared_cache_lock);
+    if (index->shared_cache) {
+        shared_cache_close(index->shared_cache);
+        free(index->shared_cache);
+    }
+    free(index->shared_cache_path);
+    for (uint32_t i = 0; i < index->count; i++) {
+        free(index->images[i].path);
+        macho_free(&index->images[i].macho);
+    }
+    free(index->images);
+    free(index->ranges);
+    free(index);
+}
+
+ImageIndex* image_index(Machium* machium) {
+    static pthread_mutex_t load_lock = PTHREAD_MUTEX_INITIALIZER;
+
+    //background jobs symbolicate too, only one of them should load the list
+    pthread_mutex_lock(&load_lock);
+    if (machium->target->images == NULL)
+        machium->target->images = image_index_load(machium->target->debug_task);
+    pthread_mutex_unlock(&load_lock);
+    return machium->target->images;
+}
+
+//where the cache file is on every OS version, newest first
+static const char* shared_cache_paths[] = {
+    "/System/Volumes/Preboot/Cryptexes/OS/System/Library/dyld/dyld_shared_cache_arm64e", //macOS 13 and later
+    "/System/Library/dyld/dyld_shared_cache_arm64e", //macOS 11 and 12
+    "/private/preboot/Cryptexes/OS/System/Library/Caches/com.apple.dyld/dyld_shared_cache_arm64e", //iOS 16 and later
+    "/System/Library/Caches/com.apple.dyld/dyld_shared_cache_arm64e",
+    "/System/Library/Caches/com.apple.dyld/dyld_shared_cache_arm64",
+};
+
+//open and index the cache at [path] if it's the task's. the caller holds shared_cache_lock
+static bool image_open_shared_cache(ImageIndex* index, const char* path) {
+    SharedCache* cache;
+    double started;
+
+    started = job_time();
+    cache = (SharedCache*) malloc(sizeof(SharedCache));
+    if (cache == NULL || !shared_cache_open(cache, path, index->shared_cache_uuid)) {
+        free(cache);
+        return false;
+    }
+    index->shared_cache = cache;
+    index->shared_cache_path = strdup(path);
+    index->shared_cache_time = job_time() - started;
+    return true;
+}
+
+/*
+per image, the shared cache's symbols would have to be read out of the task's __LINKEDIT, which only has the exported ones
+the cache file on disk has the locals too and gets indexed in one go, the lookups are a binary search over every image at once
+*/
+SharedCache* image_shared_cache(ImageIndex* index) {
+    const char* path;
+
+    pthread_mutex_lock(&index->shared_cache_lock);
+    if (!index->shared_cache_tried) {
+        index->shared_cache_tried = true;
+        path = getenv(SHARED_CACHE_PATH_ENV);
+        if (path && path[0])
+            image_open_shared_cache(index, path);
+        for (size_t i = 0; i < sizeof(shared_cache_paths) / sizeof(shared_cache_paths[0]) && index->shared_cache == NULL; i++)
+            image_open_shared_cache(index, shared_cache_paths[i]);
+    }
+    pthread_mutex_unlock(&index->shared_cache_lock);
+    return index->shared_cache;
+}
+
+/*
+parse the symbols of an image into [out]
+the file on disk is much faster to parse than the task's memory, but only if it's the same binary that's loaded
+images in the dyld shared cache don't exist on disk so they always come from memory
+*/
+static void image_parse_symbols(ImageIndex* index, ImageEntry* entry, MachOImage* out) {
+    MachOImage file_image;
+
+    if (!(out->flags & MH_DYLIB_IN_CACHE) && macho_parse_file(&file_image, entry->path)) {
+        if (file_image.has_uuid && out->has_uuid && !memcmp(file_image.uuid, out->uuid, 16)) {
+            out->symbols = file_image.symbols;
+            out->symbol_count = file_image.symbol_count;
+            out->strings = file_image.strings;
+            out->strings_size = file_image.strings_size;
+            file_image.symbols = NULL;
+            file_image.strings = NULL;
+            macho_free(&file_image);
+            return;
+        }
+        macho_free(&file_image);
+    }
+
+    macho_parse_symbols(out, image_read, &index->task, entry->base, true);
+}
+
+//make sure an image's load commands are parsed
+static bool image_parse_header(ImageIndex* index, ImageEntry* entry) {
+    bool parsed;
+
+    pthread_mutex_lock(&index->lock);
+    if (!entry->parsed_header && !entry->failed) {
+        entry->failed = !macho_parse_header(&entry->macho, image_read, &index->task, entry->base);
+        entry->parsed_header = !entry->failed;
+    }
+    parsed = entry->parsed_header;
+    pthread_mutex_unlock(&index->lock);
+    return parsed;
+}
+
+/*
+make sure an image's symbols are loaded
+the symbol cache is tried first, a miss means parsing the image and writing a fresh cache file for next time
+the work happens outside of the lock so a lookup never waits on the background thread parsing some other image
+*/
+static void image_load_symbols(ImageIndex* index, ImageEntry* entry) {
+    MachOImage loaded;
+
+    pthread_mutex_lock(&index->lock);
+    if (entry->parsed_symbols) {
+        pthread_mutex_unlock(&index->lock);
+        return;
+    }
+    loaded = entry->macho; //segments are shared, they never change once the header is parsed
+    pthread_mutex_unlock(&index->lock);
+
+    if (!symbol_cache_load(&loaded)) {
+        image_parse_symbols(index, entry, &loaded);
+        symbol_cache_store(&loaded);
+    }
+
+    pthread_mutex_lock(&index->lock);
+    if (!entry->parsed_symbols) {
+        entry->macho.symbols = loaded.symbols;
+        entry->macho.symbol_count = loaded.symbol_count;
+        entry->macho.strings = loaded.strings;
+        entry->macho.strings_size = loaded.strings_size;
+        entry->macho.mapping = loaded.mapping;
+        entry->macho.mapping_size = loaded.mapping_size;
+        entry->parsed_symbols = true;
+    }
+    else {
+        //someone else got there first
+        loaded.segments = NULL;
+        macho_free(&loaded);
+    }
+    pthread_mutex_unlock(&index->lock);
+}
+
+//background thread started by image_index_load
+static void* image_warm(void* context) {
+    ImageIndex* index = (ImageIndex*) context;
+    SharedCache* cache;
+
+    //most addresses land in the shared cache, its index goes first
+    cache = image_shared_cache(index);
+    for (uint32_t i = 0; i < index->count && !index->stop; i++) {
+        if (!image_parse_header(index, &index->images[i]))
+            continue;
+        if (cache == NULL || !(index->images[i].macho.flags & MH_DYLIB_IN_CACHE))
+            image_load_symbols(index, &index->images[i]);
+    }
+    return NULL;
+}
+
+static int compare_ranges(const void* a, const void* b) {
+    uint64_t left = ((const ImageRange*) a)->start;
+    uint64_t right = ((const ImageRange*) b)->start;
+
+    return left < right ? -1 : left > right;
+}
+
+//the segment table of every image, built once. the headers get parsed outside of the lock like everywhere else
+static void image_build_ranges(ImageIndex* index) {
+    ImageRange* ranges;
+    ImageEntry* entry;
+    MachOSegment* segment;
+    uint32_t capacity;
+    uint32_t count;
+
+    pthread_mutex_lock(&index->lock);
+    if (index->ranges_built) {
+        pthread_mutex_unlock(&index->lock);
+        return;
+    }
+    pthread_mutex_unlock(&index->lock);
+
+    capacity = 0;
+    for (uint32_t i = 0; i < index->count; i++) {
+        if (image_parse_header(index, &index->images[i]))
+            capacity += index->images[i].macho.segment_count;
+    }
+    ranges = (ImageRange*) malloc((capacity ? capacity : 1) * sizeof(ImageRange));
+    if (ranges == NULL)
+        return;
+
+    count = 0;
+    for (uint32_t i = 0; i < index->count; i++) {
+        entry = &index->images[i];
+        if (!entry->parsed_header)
+            continue;
+        for (uint32_t j = 0; j < entry->macho.segment_count && count < capacity; j++) {
+            segment = &entry->macho.segments[j];
+            if (segment->vmsize == 0 || !strcmp(segment->name, "__PAGEZERO") || !strcmp(segment->name, "__LINKEDIT"))
+                continue;
+            ranges[count].start = entry->base + (segment->vmaddr - entry->macho.text_vmaddr);
+            ranges[count].end = ranges[count].start + segment->vmsize;
+            ranges[count].entry = entry;
+            count++;
+        }
+    }
+    qsort(ranges, count, sizeof(ImageRange), compare_ranges);
+
+    pthread_mutex_lock(&index->lock);
+    if (!index->ranges_built) {
+        index->ranges = ranges;
+        index->range_count = count;
+        index->ranges_built = true;
+        ranges = NULL;
+    }
+    pthread_mutex_unlock(&index->lock);
+    free(ranges);
+}
+
+//binary search of the segment table
+static ImageEntry* image_find_range(ImageIndex* index, uint64_t address) {
+    uint32_t low;
+    uint32_t high;
+    uint32_t middle;
+
+    image_build_ranges(index);
+    if (index->range_count == 0 || address < index->ranges[0].start)
+        return NULL;
+
+    low = 0;
+    high = index->range_count;
+    while (high - low > 1) {
+        middle = low + (high - low) / 2;
+        if (index->ranges[middle].start <= address)
+            low = middle;
+        else
+            high = middle;
+    }
+    return address < index->ranges[low].end ? index->ranges[low].entry : NULL;
+}
+
+/*
+the image with the closest base below [address] is almost always the one, as long as a segment of it has [address]
+the segments of images in the shared cache are spread out between other images, those go through the segment table
+*/
+ImageEntry* image_find(Machium* machium, uint64_t address) {
+    ImageIndex* index;
+    ImageEntry* entry;
+    uint32_t low;
+    uint32_t high;
+    uint32_t middle;
+
+    index = image_index(machium);
+    if (index == NULL || index->count == 0)
+        return NULL;
+
+    //last image with a base at or below address
+    if (address >= index->images[0].base) {
+        low = 0;
+        high = index->count;
+        while (high - low > 1) {
+            middle = low + (high - low) / 2;
+            if (index->images[middle].base <= address)
+                low = middle;
+            else
+                high = middle;
+        }
+
+        entry = &index->images[low];
+        if (image_parse_header(index, entry) && address - entry->base < entry->macho.size && macho_segment_at(&entry->macho, address - entry->base))
+            return entry;
+    }
+    return image_find_range(index, address);
+}
+
+//"image`symbol+0xoffset", [symbol_offset] and [offset] are from the image's base
+static void image_format(char* out, size_t size, const char* image, const char* name, uint64_t symbol_offset, uint64_t offset) {
+    if (name && offset == symbol_offset)
+        snprintf(out, size, "%s`%s", image, name);
+    else if (name)
+        snprintf(out, size, "%s`%s+0x%llx", image, name, offset - symbol_offset);
+    else if (offset == symbol_offset)
+        snprintf(out, size, "%s`sub_%llx", image, symbol_offset); //function starts only tell us where a function is, not what it's called
+    else
+        snprintf(out, size, "%s`sub_%llx+0x%llx", image, symbol_offset, offset - symbol_offset);
+}
+
+//describe an address of an image in the shared cache with the cache's index, false if there's no cache file
+static bool image_describe_shared(ImageIndex* index, ImageEntry* entry, uint64_t address, char* out, size_t size) {
+    SharedCache* cache;
+    const SharedCacheSymbol* symbol;
+    uint64_t image_address;
+
+    cache = image_shared_cache(index);
+    if (cache == NULL)
+        return false;
+
+    //the closest symbol below can be the last one of the image before, that's no symbol of ours
+    symbol = shared_cache_lookup(cache, address - index->shared_cache_slide);
+    image_address = symbol ? cache->images[symbol->image].address + index->shared_cache_slide : 0;
+    if (symbol == NULL || image_address != entry->base) {
+        snprintf(out, size, "%s+0x%llx", entry->name, address - entry->base);
+        return true;
+    }
+    image_format(out, size, entry->name, shared_cache_symbol_name(cache, symbol), symbol->address + index->shared_cache_slide - entry->base, address - entry->base);
+    return true;
+}
+
+bool image_describe(Machium* machium, uint64_t address, char* out, size_t size) {
+    ImageEntry* entry;
+    const MachOSymbol* symbol;
+    uint64_t offset;
+
+    entry = image_find(machium, address);
+    if (entry == NULL)
+        return false;
+
+    if (entry->macho.flags & MH_DYLIB_IN_CACHE && image_describe_shared(machium->target->images, entry, address, out, size))
+        return true;
+
+    image_load_symbols(machium->target->images, entry);
+
+    offset = address - entry->base;
+    symbol = macho_lookup(&entry->macho, offset);
+    if (symbol == NULL) {
+        snprintf(out, size, "%s+0x%llx", entry->name, offset);
+        return true;
+    }
+    image_format(out, size, entry->name, macho_symbol_name(&entry->macho, symbol), symbol->offset, offset);
+    return true;
+}
+
+const char* image_annotate(Machium* machium, uint64_t address, char* out, size_t size) {
+    char description[IMAGE_DESCRIPTION_MAX];
+
+    out[0] = '\0';
+    if (image_describe(machium, address, description, sizeof(description)))
+        snprintf(out, size, " (%s)", description);
+    return out;
+}
+
+uint64_t image_find_symbol(Machium* machium, const char* image_name, const char* symbol) {
+    ImageIndex* index;
+    ImageEntry* entry;
+    SharedCache* cache;
+    uint64_t offset;
+    int64_t image;
+
+    index = image_index(machium);
+    if (index == NULL)
+        return 0;
+    cache = image_shared_cache(index);
+
+    for (uint32_t i = 0; i < index->count; i++) {
+        entry = &index->images[i];
+        if (image_name && strcmp(entry->name, image_name))
+            continue;
+        if (!image_parse_header(index, entry))
+            continue;
+        if (cache && entry->macho.flags & MH_DYLIB_IN_CACHE) {
+            if (image_name == NULL)
+                continue;
+            //-1 would search every image of the cache, an image the cache doesn't know has nothing in it
+            image = shared_cache_find_image(cache, entry->base - index->shared_cache_slide);
+            if (image < 0)
+                continue;
+            offset = shared_cache_find_symbol(cache, image, symbol);
+            if (offset != UINT64_MAX)
+                return offset + index->shared_cache_slide;
+            continue;
+        }
+        image_load_symbols(index, entry);
+        offset = macho_find_symbol(&entry->macho, symbol);
+        if (offset != UINT64_MAX)
+            return entry->base + offset;
+    }
+
+    //every image in the cache in one pass over its index, not one pass per image
+    if (cache && image_name == NULL) {
+        offset = shared_cache_find_symbol(cache, -1, symbol);
+        if (offset != UINT64_MAX)
+            return offset + index->shared_cache_slide;
+    }
+    return 0;
+}
+
+uint32_t image_function_starts(Machium* machium, const char* image_name, uint64_t** out) {
+    ImageIndex* index;
+    ImageEntry* entry;
+    uint32_t* offsets;
+    uint64_t* functions;
+    uint32_t count;
+
+    *out = NULL;
+    index = image_index(machium);
+    if (index == NULL)
+        return 0;
+
+    for (uint32_t i = 0; i < index->count; i++) {
+        entry = &index->images[i];
+        if (strcmp(entry->name, image_name) || !image_parse_header(index, entry))
+            continue;
+
+        //straight from the task, function starts are tiny next to the rest of __LINKEDIT
+        count = macho_function_starts(&entry->macho, image_read, &index->task, entry->base, true, &offsets);
+        if (count == 0)
+            return 0;
+        functions = (uint64_t*) malloc((size_t) count * sizeof(uint64_t));
+        for (uint32_t j = 0; j < count; j++)
+            functions[j] = entry->base + offsets[j];
+        free(offsets);
+        *out = functions;
+        return count;
+    }
+    return 0;
+}
+
+bool image_find_section(Machium* machium, ImageEntry* entry, const char* name, uint64_t* address, uint64_t* size) {
+    ImageIndex* index;
+    uint64_t vmaddr;
+
+    index = image_index(machium);
+    if (index == NULL || !image_parse_header(index, entry))
+        return false;
+    if (!macho_find_section(image_read, &index->task, entry->base, name, &vmaddr, size))
+        return false;
+    *address = vmaddr - entry->macho.text_vmaddr + entry->base;
+    return true;
+}
+
+/*
+list loaded images
+
+machium->args[0] -> image
+machium->args[1] -> list
+*/
+machium_command_t m_image_list(Machium* machium) {
+    ImageIndex* index;
+
+    index = image_index(machium);
+    if (index == NULL) {
+        output_error(KERN_SUCCESS, "Could not load image list!");
+        return MACHIUM_FAILURE;
+    }
+
+    output_message(OUTPUT_LEVEL_GOOD, "%u images loaded:", index->count);
+    for (uint32_t i = 0; i < index->count; i++) {
+        output_textf(YELLOW "[%3u] " BLUE "0x%llx " WHITE "%s\n", i, index->images[i].base, index->images[i].path);
+    }
+    return MACHIUM_SUCCESS;
+}
+
+/*
+symbolicate an address or find a symbol
+
+machium->args[0] -> image
+machium->args[1] -> lookup
+machium->args[2] -> [0xaddress / symbol]
+*/
+machium_command_t m_image_lookup(Machium* machium) {
+    char description[IMAGE_DESCRIPTION_MAX];
+    uint64_t address;
+
+    if (machium->args_count != 3) {
+        output_error(KERN_SUCCESS, "'image lookup' takes 3 arguments");
+        return MACHIUM_FAILURE;
+    }
+
+    if (!strncmp(machium->args[2], "0x", 2)) {
+        address = (uint64_t) strtoull(machium->args[2], NULL, 0);
+        if (!image_describe(machium, address, description, sizeof(description))) {
+            output_error(KERN_SUCCESS, "0x%llx isn't inside of any loaded image", address);
+            return MACHIUM_FAILURE;
+        }
+        output_message(OUTPUT_LEVEL_GOOD, "0x%llx = %s", address, description);
+        return MACHIUM_SUCCESS;
+    }
+
+    address = image_find_symbol(machium, NULL, machium->args[2]);
+    if (address == 0) {
+        output_error(KERN_SUCCESS, "Could not find symbol '%s'", machium->args[2]);
+        return MACHIUM_FAILURE;
+    }
+    image_describe(machium, address, description, sizeof(description));
+    output_message(OUTPUT_LEVEL_GOOD, "%s = 0x%llx", description, address);
+    return MACHIUM_SUCCESS;
+}
+
+/*
+print the shared cache file the symbols of images in the cache come from
+
+machium->args[0] -> image
+machium->args[1] -> shared
+machium->args[2] -> [path] (OPTIONAL), a cache file to use when none was found, it has to be the task's
+*/
+machium_command_t m_image_shared(Machium* machium) {
+    ImageIndex* index;
+    SharedCache* cache;
+
+    index = image_index(machium);
+    if (index == NULL) {
+        output_error(KERN_SUCCESS, "Could not load image list!");
+        return MACHIUM_FAILURE;
+    }
+    cache = image_shared_cache(index);
+
+    if (machium->args_count == 3) {
+        if (cache) {
+            output_error(KERN_SUCCESS, "Already using %s", index->shared_cache_path);
+            return MACHIUM_FAILURE;
+        }
+        pthread_mutex_lock(&index->shared_cache_lock);
+        if (index->shared_cache == NULL && !image_open_shared_cache(index, machium->args[2])) {
+            pthread_mutex_unlock(&index->shared_cache_lock);
+            output_error(KERN_SUCCESS, "%s isn't a shared cache or not the one of the task", machium->args[2]);
+            return MACHIUM_FAILURE;
+        }
+        pthread_mutex_unlock(&index->shared_cache_lock);
+        cache = index->shared_cache;
+    }
+
+    if (cache == NULL) {
+        output_message(OUTPUT_LEVEL_WARNING, "No shared cache file matches the task's, symbols of images in it come from memory (exports only)");
+        output_message(OUTPUT_LEVEL_WARNING, "Point %s or 'image shared [path]' at the cache file", SHARED_CACHE_PATH_ENV);
+        return MACHIUM_SUCCESS;
+    }
+    output_textf(GOOD"%s" WHITE ", slide " YELLOW "0x%llx\n" WHITE, index->shared_cache_path, index->shared_cache_slide);
+    output_message(OUTPUT_LEVEL_GOOD, "%u images, %u symbols (%u local) from %u files, indexed in %.2fs", cache->image_count, cache->symbol_count, cache->local_count, cache->file_count, index->shared_cache_time);
+    if (cache->missing_files)
+        output_message(OUTPUT_LEVEL_WARNING, "%u subcache files are missing, images with symbols in them are only partly covered", cache->missing_files);
+    return MACHIUM_SUCCESS;
+}
+
+/*
+handle image commands
+
+machium->args[0] -> image
+machium->args[1] -> [command]
+*/
+machium_command_t m_image(Machium* machium) {
+    if (!strcmp(machium->args[1], "list")) m_image_list(machium);
+    else if (!strcmp(machium->args[1], "l")) m_image_list(machium);
+
+    else if (!strcmp(machium->args[1], "lookup")) m_image_lookup(machium);
+    else if (!strcmp(machium->args[1], "lo")) m_image_lookup(machium);
+
+    else if (!strcmp(machium->args[1], "shared")) return m_image_shared(machium);
+
+    //dlopen'd images only show up after a reload
+    else if (!strcmp(machium->args[1], "reload")) {
+        if (!job_idle("image reload"))
+            return MACHIUM_FAILURE;
+        image_index_free(machium->target->images);
+        machium->target->images = NULL;
+        if (image_index(machium) == NULL)
+            return MACHIUM_FAILURE;
+        output_message(OUTPUT_LEVEL_GOOD, "Reloaded %u images", machium->target->images->count);
+    }
+    else {
+        output_error(KERN_SUCCESS, "Invalid argument for 'image', %s", machium->args[1]);
+        return MACHIUM_FAILURE;
+    }
+    return MACHIUM_SUCCESS;
+}
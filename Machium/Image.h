@@ -0,0 +1,89 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "Machium.h"
+#include "MachO.h"
+#include <pthread.h>
+
+//longest "image`symbol+0xoffset" we'll print
+#define IMAGE_DESCRIPTION_MAX 256
+
+typedef struct ImageEntry {
+    uint64_t base; //slid address of the mach header
+    char* path;
+    const char* name; //last component of path
+    MachOImage macho;
+    bool parsed_header; //load commands are parsed lazily the first time an address lands near the image
+    bool parsed_symbols; //same for the symbol table
+    bool failed;
+} ImageEntry;
+
+//one mapped segment of an image, slid
+typedef struct ImageRange {
+    uint64_t start;
+    uint64_t end;
+    ImageEntry* entry;
+} ImageRange;
+
+typedef struct ImageIndex {
+    ImageEntry* images; //sorted by base so lookups are a binary search
+    uint32_t count;
+    mach_port_t task;
+
+    //a background thread loads (or builds) the symbol cache of every image while the CLI is already usable
+    pthread_mutex_t lock; //guards parsed_header / parsed_symbols and installing symbols into an entry
+    pthread_t warm_thread;
+    bool warming;
+    volatile bool stop;
+
+    //every segment of every image sorted by start, for addresses the image right below doesn't have (shared cache __DATA)
+    //built the first time image_find needs it, which parses every header
+    ImageRange* ranges;
+    uint32_t range_count;
+    bool ranges_built;
+
+    //symbols of images in the dyld shared cache come from one index over the cache file, see SharedCache.h
+    struct SharedCache* shared_cache; //NULL when no cache file on disk is the task's
+    char* shared_cache_path;
+    uint64_t shared_cache_slide;
+    uint8_t shared_cache_uuid[16];
+    double shared_cache_time; //seconds it took to index
+    pthread_mutex_t shared_cache_lock; //held while the cache is being looked for, the first lookup waits on it
+    bool shared_cache_tried;
+} ImageIndex;
+
+//get the loaded image list of a task through TASK_DYLD_INFO and start warming up its symbols
+ImageIndex* image_index_load(mach_port_t task);
+void image_index_free(ImageIndex* index);
+
+//get the image index of the debug task, loading it the first time it's needed
+ImageIndex* image_index(Machium* machium);
+
+//get the shared cache index of the task, looking for and indexing the cache file the first time. NULL if none matches
+struct SharedCache* image_shared_cache(ImageIndex* index);
+
+//find the image with a segment containing [address]
+ImageEntry* image_find(Machium* machium, uint64_t address);
+
+//write "image`symbol+0xoffset" for [address] into [out]
+bool image_describe(Machium* machium, uint64_t address, char* out, size_t size);
+
+//same as image_describe but writes " (image`symbol+0xoffset)" or an empty string so it can go straight into a printf
+const char* image_annotate(Machium* machium, uint64_t address, char* out, size_t size);
+
+//find the slid address of [symbol] in the image named [image_name], 0 if not found
+uint64_t image_find_symbol(Machium* machium, const char* image_name, const char* symbol);
+
+//get the slid address of every function start of the image named [image_name], in order. returns the count, [out] has to be freed
+uint32_t image_function_starts(Machium* machium, const char* image_name, uint64_t** out);
+
+//find section [name] of [entry], [address] is slid
+bool image_find_section(Machium* machium, ImageEntry* entry, const char* name, uint64_t* address, uint64_t* size);
+
+//handle image commands
+machium_command_t m_image(Machium* machium);
+machium_command_t m_image_list(Machium* machium); //list loaded images
+machium_command_t m_image_lookup(Machium* machium); //symbolicate an address or find a symbol
+machium_command_t m_image_shared(Machium* machium); //print or pick the shared cache file
+
+#endif /* IMAGE_H */
@@ -0,0 +1,427 @@
+#include "Integrity.h"
+#include "Region.h"
+#include "Image.h"
+#include "Hash.h"
+#include "Job.h"
+#include "Output.h"
+#include <pthread/qos.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+static void integrity_record(Integrity* integrity, const IntegrityChange* change) {
+    pthread_mutex_lock(&integrity->lock);
+    integrity->changes[integrity->change_count % INTEGRITY_CHANGES] = *change;
+    integrity->change_count++;
+    pthread_mutex_unlock(&integrity->lock);
+}
+
+//record the changed bytes [start, end) of a block, [original] and [current] are the block's bytes
+static void integrity_record_range(Integrity* integrity, uint64_t address, const uint8_t* original, const uint8_t* current, uint64_t start, uint64_t end) {
+    IntegrityChange change = { 0 };
+    uint64_t kept;
+
+    kept = end - start < INTEGRITY_BYTES ? end - start : INTEGRITY_BYTES;
+    change.kind = INTEGRITY_MODIFIED;
+    change.address = address + start;
+    change.size = end - start;
+    change.pass = integrity->passes;
+    memcpy(change.original, original + start, kept);
+    memcpy(change.current, current + start, kept);
+    integrity_record(integrity, &change);
+}
+
+/*
+a block's hash changed, find what's different from what the last pass saw so a change is only reported once
+pages are memcmp'd first so only the changed ones get looked at byte by byte
+*/
+static void integrity_diff(Integrity* integrity, uint64_t address, const uint8_t* original, const uint8_t* current, uint64_t size) {
+    uint64_t page_end;
+    uint64_t start;
+    uint64_t end;
+    uint32_t recorded;
+    bool open;
+
+    recorded = 0;
+    open = false;
+    start = end = 0;
+    for (uint64_t page = 0; page < size; page += vm_page_size) {
+        page_end = page + vm_page_size < size ? page + vm_page_size : size;
+        if (!memcmp(original + page, current + page, page_end - page))
+            continue;
+        for (uint64_t i = page; i < page_end; i++) {
+            if (original[i] == current[i])
+                continue;
+            if (open && i - end < INTEGRITY_GAP) {
+                end = i + 1;
+                continue;
+            }
+            if (open) {
+                if (recorded++ < INTEGRITY_BLOCK_CHANGES)
+                    integrity_record_range(integrity, address, original, current, start, end);
+            }
+            open = true;
+            start = i;
+            end = i + 1;
+        }
+    }
+    if (open && recorded++ < INTEGRITY_BLOCK_CHANGES)
+        integrity_record_range(integrity, address, original, current, start, end);
+    if (recorded > INTEGRITY_BLOCK_CHANGES)
+        __atomic_add_fetch(&integrity->dropped, recorded - INTEGRITY_BLOCK_CHANGES, __ATOMIC_RELAXED);
+}
+
+/*
+block [block] of [region] hashes differently than last time, report it and remember how it looks now
+only changed blocks get a copy, everything else is compared to the baseline
+*/
+static void integrity_changed(Integrity* integrity, IntegrityRegion* region, uint32_t block, const uint8_t* current, uint64_t size) {
+    IntegrityChange change = { 0 };
+    const uint8_t* baseline;
+    uint64_t offset;
+
+    offset = (uint64_t) block * INTEGRITY_BLOCK;
+    baseline = (const uint8_t*) region->baseline + offset;
+
+    //something undid a patch
+    if (region->seen[block] && !memcmp(baseline, current, size)) {
+        change.kind = INTEGRITY_RESTORED;
+        change.address = region->address + offset;
+        change.size = size;
+        change.pass = integrity->passes;
+        integrity_record(integrity, &change);
+        free(region->seen[block]);
+        region->seen[block] = NULL;
+        return;
+    }
+
+    integrity_diff(integrity, region->address + offset, region->seen[block] ? region->seen[block] : baseline, current, size);
+    if (region->seen[block] == NULL)
+        region->seen[block] = (uint8_t*) malloc(INTEGRITY_BLOCK);
+    if (region->seen[block]) //without a copy the next change is diffed against the baseline again
+        memcpy(region->seen[block], current, size);
+}
+
+/*
+hash every block again and diff the ones that changed
+vm_read always gives the task's current pages (views can miss a page the task copied on write) and only
+makes a copy-on-write mapping, so a pass costs little more than the hashing itself
+*/
+static void integrity_pass(Integrity* integrity) {
+    IntegrityRegion* region;
+    IntegrityChange change;
+    kern_return_t kret;
+    vm_offset_t data;
+    mach_msg_type_number_t count;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t hash;
+    double started;
+
+    started = job_time();
+    for (uint32_t i = 0; i < integrity->region_count && !__atomic_load_n(&integrity->stopping, __ATOMIC_ACQUIRE); i++) {
+        region = &integrity->regions[i];
+        if (region->unmapped)
+            continue;
+        for (uint32_t block = 0; block < region->block_count; block++) {
+            offset = (uint64_t) block * INTEGRITY_BLOCK;
+            size = region->size - offset < INTEGRITY_BLOCK ? region->size - offset : INTEGRITY_BLOCK;
+            kret = vm_read(integrity->task, region->address + offset, size, &data, &count);
+            if (kret != KERN_SUCCESS) {
+                memset(&change, 0, sizeof(change));
+                change.kind = INTEGRITY_UNMAPPED;
+                change.address = region->address;
+                change.size = region->size;
+                change.pass = integrity->passes;
+                integrity_record(integrity, &change);
+                region->unmapped = true;
+                break;
+            }
+            hash = hash64_wide((const void*) data, size, 0);
+            if (hash != region->hashes[block]) {
+                integrity_changed(integrity, region, block, (const uint8_t*) data, size);
+                region->hashes[block] = hash;
+            }
+            vm_deallocate(mach_task_self(), data, count);
+        }
+    }
+    integrity->pass_time = job_time() - started;
+    integrity->passes++;
+}
+
+//sleep for the interval, pass, repeat. utility QoS keeps the passes off the cores the CLI and the task want
+static void* integrity_thread(void* argument) {
+    Integrity* integrity = (Integrity*) argument;
+    struct timespec deadline;
+
+    pthread_set_qos_class_self_np(QOS_CLASS_UTILITY, 0);
+    pthread_mutex_lock(&integrity->lock);
+    while (!integrity->stopping) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += integrity->interval / 1000;
+        deadline.tv_nsec += (long) (integrity->interval % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while (!integrity->stopping && pthread_cond_timedwait(&integrity->wake, &integrity->lock, &deadline) != ETIMEDOUT);
+        if (integrity->stopping)
+            break;
+
+        pthread_mutex_unlock(&integrity->lock);
+        integrity_pass(integrity);
+        pthread_mutex_lock(&integrity->lock);
+    }
+    pthread_mutex_unlock(&integrity->lock);
+    return NULL;
+}
+
+static void integrity_stop(Integrity* integrity) {
+    if (!integrity->running)
+        return;
+    pthread_mutex_lock(&integrity->lock);
+    __atomic_store_n(&integrity->stopping, true, __ATOMIC_RELEASE);
+    pthread_cond_signal(&integrity->wake);
+    pthread_mutex_unlock(&integrity->lock);
+    pthread_join(integrity->thread, NULL);
+    integrity->running = false;
+}
+
+void integrity_free(MachiumTarget* target) {
+    Integrity* integrity = target->integrity;
+
+    if (integrity == NULL)
+        return;
+    integrity_stop(integrity);
+    for (uint32_t i = 0; i < integrity->region_count; i++) {
+        if (integrity->regions[i].baseline)
+            vm_deallocate(mach_task_self(), integrity->regions[i].baseline, integrity->regions[i].size);
+        for (uint32_t block = 0; integrity->regions[i].seen && block < integrity->regions[i].block_count; block++)
+            free(integrity->regions[i].seen[block]);
+        free(integrity->regions[i].seen);
+        free(integrity->regions[i].hashes);
+    }
+    free(integrity->regions);
+    pthread_mutex_destroy(&integrity->lock);
+    pthread_cond_destroy(&integrity->wake);
+    free(integrity);
+    target->integrity = NULL;
+}
+
+static void integrity_print_bytes(const uint8_t* bytes, uint64_t size) {
+    for (uint64_t i = 0; i < size && i < INTEGRITY_BYTES; i++)
+        output_textf("%02x", bytes[i]);
+    if (size > INTEGRITY_BYTES)
+        output_textf("..");
+}
+
+static void integrity_print(Machium* machium, MachiumTarget* target, const IntegrityChange* change) {
+    char annotation[MACHIUM_INPUT_LENGTH];
+    char who[MACHIUM_ARG_LENGTH + 4];
+
+    //symbols come from the selected target's images, changes of other targets just get its name
+    annotation[0] = '\0';
+    if (target == machium->target)
+        image_annotate(machium, change->address, annotation, sizeof(annotation));
+    who[0] = '\0';
+    if (machium->session->target_count > 1)
+        snprintf(who, sizeof(who), "[%s] ", target->name);
+
+    if (change->kind == INTEGRITY_UNMAPPED) {
+        output_message(OUTPUT_LEVEL_WARNING, "%sRegion 0x%llx-0x%llx can't be read anymore, no longer watched", who, change->address, change->address + change->size);
+        return;
+    }
+    if (change->kind == INTEGRITY_RESTORED) {
+        output_message(OUTPUT_LEVEL_GOOD, "%sRestored 0x%llx-0x%llx%s to the baseline (pass %llu)", who, change->address, change->address + change->size, annotation, change->pass);
+        return;
+    }
+    output_textf(ERROR"%sModified " YELLOW "0x%llx" WHITE "%s, %llu bytes (pass %llu): ", who, change->address, annotation, change->size, change->pass);
+    integrity_print_bytes(change->original, change->size);
+    output_textf(" -> " RED);
+    integrity_print_bytes(change->current, change->size);
+    output_textf(WHITE "\n");
+}
+
+//print changes [from, to) of [integrity] that are still in the ring
+static uint64_t integrity_print_changes(Machium* machium, MachiumTarget* target, Integrity* integrity, uint64_t from) {
+    uint64_t to;
+
+    pthread_mutex_lock(&integrity->lock);
+    to = integrity->change_count;
+    if (to - from > INTEGRITY_CHANGES) {
+        output_message(OUTPUT_LEVEL_WARNING, "%llu older changes were dropped", to - from - INTEGRITY_CHANGES);
+        from = to - INTEGRITY_CHANGES;
+    }
+    for (uint64_t i = from; i < to; i++)
+        integrity_print(machium, target, &integrity->changes[i % INTEGRITY_CHANGES]);
+    pthread_mutex_unlock(&integrity->lock);
+    return to;
+}
+
+void integrity_report(Machium* machium) {
+    Integrity* integrity;
+
+    for (uint8_t i = 0; i < machium->session->target_count; i++) {
+        integrity = machium->session->targets[i].integrity;
+        if (integrity == NULL || __atomic_load_n(&integrity->change_count, __ATOMIC_ACQUIRE) == integrity->reported)
+            continue;
+        integrity->reported = integrity_print_changes(machium, &machium->session->targets[i], integrity, integrity->reported);
+    }
+}
+
+/*
+take the baseline of every executable region and start passing over them in the background
+
+machium->args[0] -> integrity
+machium->args[1] -> start
+machium->args[2] -> [interval] in ms (OPTIONAL)
+machium->args[3] -> shared (OPTIONAL), watch the shared cache as well
+*/
+static machium_command_t m_integrity_start(Machium* machium) {
+    MachiumTarget* target;
+    Integrity* integrity;
+    IntegrityRegion* region;
+    MemoryRegion* regions;
+    kern_return_t kret;
+    mach_msg_type_number_t count;
+    uint32_t region_count;
+    uint32_t skipped;
+    uint32_t interval;
+    uint64_t offset;
+    bool shared;
+    double started;
+
+    target = machium->target;
+    interval = INTEGRITY_INTERVAL;
+    shared = false;
+    for (uint8_t i = 2; i < machium->args_count; i++) {
+        if (!strcmp(machium->args[i], "shared"))
+            shared = true;
+        else
+            interval = (uint32_t) strtoul(machium->args[i], NULL, 0);
+    }
+    if (interval == 0) {
+        output_error(KERN_SUCCESS, "Usage: integrity start [interval ms] [shared]");
+        return MACHIUM_FAILURE;
+    }
+
+    started = job_time();
+    region_count = region_list(target->debug_task, 0, UINT64_MAX, VM_PROT_READ | VM_PROT_EXECUTE, &regions);
+    integrity_free(target);
+    integrity = (Integrity*) calloc(1, sizeof(Integrity));
+    integrity->task = target->debug_task;
+    integrity->interval = interval;
+    integrity->regions = (IntegrityRegion*) calloc(region_count ? region_count : 1, sizeof(IntegrityRegion));
+    pthread_mutex_init(&integrity->lock, NULL);
+    pthread_cond_init(&integrity->wake, NULL);
+    target->integrity = integrity;
+
+    skipped = 0;
+    for (uint32_t i = 0; i < region_count; i++) {
+        if (regions[i].depth && !shared)
+            continue;
+        region = &integrity->regions[integrity->region_count];
+        kret = vm_read(integrity->task, regions[i].address, regions[i].size, &region->baseline, &count);
+        if (kret != KERN_SUCCESS) {
+            skipped++;
+            continue;
+        }
+        region->address = regions[i].address;
+        region->size = regions[i].size;
+        region->block_count = (uint32_t) ((region->size + INTEGRITY_BLOCK - 1) / INTEGRITY_BLOCK);
+        region->hashes = (uint64_t*) malloc(region->block_count * sizeof(uint64_t));
+        region->seen = (uint8_t**) calloc(region->block_count, sizeof(uint8_t*));
+        if (region->hashes == NULL || region->seen == NULL) {
+            vm_deallocate(mach_task_self(), region->baseline, count);
+            free(region->hashes);
+            free(region->seen);
+            memset(region, 0, sizeof(IntegrityRegion));
+            skipped++;
+            continue;
+        }
+        for (uint32_t block = 0; block < region->block_count; block++) {
+            offset = (uint64_t) block * INTEGRITY_BLOCK;
+            region->hashes[block] = hash64_wide((const uint8_t*) region->baseline + offset, region->size - offset < INTEGRITY_BLOCK ? region->size - offset : INTEGRITY_BLOCK, 0);
+        }
+        integrity->bytes += region->size;
+        integrity->region_count++;
+    }
+    free(regions);
+
+    if (integrity->region_count == 0) {
+        output_error(KERN_SUCCESS, "No readable executable regions%s", shared ? "" : " outside the shared cache, try 'integrity start [interval] shared'");
+        integrity_free(target);
+        return MACHIUM_FAILURE;
+    }
+    if (skipped)
+        output_message(OUTPUT_LEVEL_WARNING, "Skipped %u regions that couldn't be read", skipped);
+
+    pthread_create(&integrity->thread, NULL, integrity_thread, integrity);
+    integrity->running = true;
+    output_message(OUTPUT_LEVEL_GOOD, "Baseline of %u regions (%.1f MB) in %.2fs, checking every %ums", integrity->region_count, integrity->bytes / (1024.0 * 1024.0), job_time() - started, interval);
+    return MACHIUM_SUCCESS;
+}
+
+/*
+print how the monitor is doing and every change still kept
+
+machium->args[0] -> integrity
+machium->args[1] -> status (OPTIONAL)
+*/
+static machium_command_t m_integrity_status(Machium* machium) {
+    Integrity* integrity = machium->target->integrity;
+    uint64_t passes;
+    uint64_t changes;
+
+    if (integrity == NULL) {
+        output_message(OUTPUT_LEVEL_WARNING, "No integrity monitor, 'integrity start' first");
+        return MACHIUM_SUCCESS;
+    }
+    passes = integrity->passes;
+    changes = __atomic_load_n(&integrity->change_count, __ATOMIC_ACQUIRE);
+    output_message(OUTPUT_LEVEL_GOOD, "Watching %u regions (%.1f MB) every %ums%s", integrity->region_count, integrity->bytes / (1024.0 * 1024.0), integrity->interval, integrity->running ? "" : ", stopped");
+    if (passes)
+        output_message(OUTPUT_LEVEL_GOOD, "%llu passes, the last took %.1fms (" YELLOW "%.1f%%" WHITE " of a core)", passes, integrity->pass_time * 1000.0, 100.0 * integrity->pass_time * 1000.0 / (integrity->interval + integrity->pass_time * 1000.0));
+    if (changes == 0) {
+        output_message(OUTPUT_LEVEL_GOOD, "No changes");
+        return MACHIUM_SUCCESS;
+    }
+    output_message(OUTPUT_LEVEL_GOOD, "%llu changes:", changes);
+    integrity->reported = integrity_print_changes(machium, machium->target, integrity, 0); //no need to print them again at the prompt
+    if (integrity->dropped)
+        output_message(OUTPUT_LEVEL_WARNING, "%llu more changed ranges in blocks with over %u changes weren't recorded", integrity->dropped, INTEGRITY_BLOCK_CHANGES);
+    return MACHIUM_SUCCESS;
+}
+
+/*
+stop the background passes, the changes stay around for 'integrity status'
+
+machium->args[0] -> integrity
+machium->args[1] -> stop
+*/
+static machium_command_t m_integrity_stop(Machium* machium) {
+    Integrity* integrity = machium->target->integrity;
+
+    if (integrity == NULL || !integrity->running) {
+        output_error(KERN_SUCCESS, "The integrity monitor isn't running");
+        return MACHIUM_FAILURE;
+    }
+    integrity_stop(integrity);
+    output_message(OUTPUT_LEVEL_GOOD, "Stopped after %llu passes, %llu changes", integrity->passes, integrity->change_count);
+    return MACHIUM_SUCCESS;
+}
+
+/*
+handle integrity commands
+
+machium->args[0] -> integrity
+machium->args[1] -> [command]
+*/
+machium_command_t m_integrity(Machium* machium) {
+    if (machium->args_count < 2 || !strcmp(machium->args[1], "status")) return m_integrity_status(machium);
+    else if (!strcmp(machium->args[1], "start")) return m_integrity_start(machium);
+    else if (!strcmp(machium->args[1], "stop")) return m_integrity_stop(machium);
+
+    output_error(KERN_SUCCESS, "Invalid argument for 'integrity', %s", machium->args[1]);
+    return MACHIUM_FAILURE;
+}
@@ -0,0 +1,70 @@
+#ifndef INTEGRITY_H
+#define INTEGRITY_H
+
+#include "Machium.h"
+#include <pthread.h>
+
+#define INTEGRITY_BLOCK (1024 * 1024) //regions are read and hashed in blocks this big, a block whose hash changed gets compared byte by byte
+#define INTEGRITY_INTERVAL 1000 //ms between passes unless 'integrity start' gets one
+#define INTEGRITY_CHANGES 256 //changes kept for 'integrity status', older ones are dropped
+#define INTEGRITY_BLOCK_CHANGES 32 //changes recorded per changed block, the rest are only counted
+#define INTEGRITY_GAP 8 //changed bytes closer than this are one change
+#define INTEGRITY_BYTES 16 //bytes of a change that are kept to print
+
+//kinds of change
+#define INTEGRITY_MODIFIED 0 //bytes differ from what the last pass saw
+#define INTEGRITY_RESTORED 1 //a block went back to the baseline after being modified
+#define INTEGRITY_UNMAPPED 2 //a region can't be read anymore, it's skipped from then on
+
+//an executable region being watched
+typedef struct IntegrityRegion {
+    uint64_t address;
+    uint64_t size;
+    vm_offset_t baseline; //vm_read copy of the region from 'integrity start'. it's copy-on-write, so it costs no memory until the task writes to its pages
+    uint64_t* hashes; //of every block, as of the last pass
+    uint8_t** seen; //copy of every block as the last pass saw it, NULL while it's the same as the baseline
+    uint32_t block_count;
+    bool unmapped;
+} IntegrityRegion;
+
+typedef struct IntegrityChange {
+    uint8_t kind;
+    uint64_t address;
+    uint64_t size;
+    uint64_t pass; //pass that found it
+    uint8_t original[INTEGRITY_BYTES]; //as the pass before saw them
+    uint8_t current[INTEGRITY_BYTES];
+} IntegrityChange;
+
+//the monitor of a target
+typedef struct Integrity {
+    mach_port_t task;
+    IntegrityRegion* regions;
+    uint32_t region_count;
+    uint64_t bytes; //watched
+    uint32_t interval; //ms
+
+    pthread_t thread;
+    pthread_mutex_t lock; //guards the changes and wakes the thread up to stop
+    pthread_cond_t wake;
+    bool stopping; //atomic, the pass checks it without the lock
+    bool running;
+
+    IntegrityChange changes[INTEGRITY_CHANGES]; //ring, change i is at i % INTEGRITY_CHANGES
+    uint64_t change_count;
+    uint64_t reported; //changes printed before the prompt so far
+    uint64_t dropped; //changes past INTEGRITY_BLOCK_CHANGES of a block
+    volatile uint64_t passes;
+    volatile double pass_time; //seconds the last pass took
+} Integrity;
+
+//stop the monitor of [target] if there is one and free it
+void integrity_free(MachiumTarget* target);
+
+//print changes found since the last prompt, for every target
+void integrity_report(Machium* machium);
+
+//handle integrity commands
+machium_command_t m_integrity(Machium* machium);
+
+#endif /* INTEGRITY_H */
@@ -0,0 +1,336 @@
+#include "Job.h"
+#include "Output.h"
+#include <time.h>
+
+static Job* jobs = NULL; //every job that hasn't been reported as finished yet
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t next_job_id = 1;
+
+//the job whose work is running on this thread
+static __thread Job* current_job = NULL;
+
+//one piece of a job_for_each_chunk
+typedef struct JobChunk {
+    Job* job;
+    job_chunk_t function;
+    void* context;
+    uint64_t address;
+    uint64_t size;
+    bool* failed;
+} JobChunk;
+
+double job_time(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+Job* job_current(void) {
+    return current_job;
+}
+
+bool job_cancelled(void) {
+    return current_job && current_job->cancelled;
+}
+
+void job_add_total(uint64_t total) {
+    if (current_job)
+        __atomic_fetch_add(&current_job->total, total, __ATOMIC_RELAXED);
+}
+
+void job_add_progress(uint64_t progress) {
+    if (current_job)
+        __atomic_fetch_add(&current_job->progress, progress, __ATOMIC_RELAXED);
+}
+
+static void job_run(void* argument) {
+    Job* job = (Job*) argument;
+    Job* previous;
+
+    //a worker waiting on a pool group may run pieces of other jobs, so put back whatever was current before
+    previous = current_job;
+    current_job = job;
+    job->result = job->function(&job->machium);
+    current_job = previous;
+    output_job_flush(job); //records of the job go out in one piece when it's done
+
+    __atomic_store_n(&job->state, JOB_DONE, __ATOMIC_RELEASE);
+}
+
+Job* job_start(Machium* machium, job_command_t function, const char* command) {
+    Job* job;
+    Job** last;
+    size_t length;
+
+    job = (Job*) calloc(1, sizeof(Job));
+    if (job == NULL) {
+        output_error(KERN_SUCCESS, "Out of memory for a background job");
+        return NULL;
+    }
+    job->machium = *machium; //session and target still point at the CLI's, which is what we want
+    job->function = function;
+    job->state = JOB_RUNNING;
+    job->started = job_time();
+    pthread_mutex_init(&job->output_lock, NULL);
+
+    snprintf(job->command, sizeof(job->command), "%s", command);
+    length = strlen(job->command);
+    if (length && job->command[length - 1] == '\n')
+        job->command[length - 1] = '\0';
+
+    pthread_mutex_lock(&jobs_lock);
+    job->id = next_job_id++;
+    for (last = &jobs; *last; last = &(*last)->next);
+    *last = job;
+    pthread_mutex_unlock(&jobs_lock);
+
+    output_message(OUTPUT_LEVEL_GOOD, "[%u] started", job->id);
+    pool_submit(machium_pool(), &job->group, job_run, job);
+    return job;
+}
+
+static void job_run_chunk(void* argument) {
+    JobChunk* chunk = (JobChunk*) argument;
+    Job* previous;
+
+    previous = current_job;
+    current_job = chunk->job;
+    if (job_cancelled() || !chunk->function(chunk->context, chunk->address, chunk->size))
+        __atomic_store_n(chunk->failed, true, __ATOMIC_RELAXED);
+    job_add_progress(chunk->size);
+    current_job = previous;
+}
+
+bool job_for_each_range(const JobRange* ranges, uint32_t range_count, uint64_t chunk, job_chunk_t function, void* context) {
+    JobChunk* chunks;
+    PoolGroup group;
+    uint64_t count;
+    uint64_t total;
+    uint64_t offset;
+    uint64_t piece;
+    uint64_t index;
+    bool failed;
+
+    //the first piece of a range runs up to the next chunk boundary, the rest are aligned
+    count = 0;
+    total = 0;
+    for (uint32_t i = 0; i < range_count; i++) {
+        if (ranges[i].size)
+            count += (ranges[i].address % chunk + ranges[i].size + chunk - 1) / chunk;
+        total += ranges[i].size;
+    }
+    if (count == 0)
+        return true;
+
+    chunks = (JobChunk*) malloc(count * sizeof(JobChunk));
+    if (chunks == NULL)
+        return false;
+    failed = false;
+    memset(&group, 0, sizeof(group));
+
+    job_add_total(total);
+
+    index = 0;
+    for (uint32_t i = 0; i < range_count; i++) {
+        offset = 0;
+        while (offset < ranges[i].size) {
+            piece = chunk - (ranges[i].address + offset) % chunk;
+            if (piece > ranges[i].size - offset)
+                piece = ranges[i].size - offset;
+
+            chunks[index].job = current_job;
+            chunks[index].function = function;
+            chunks[index].context = context;
+            chunks[index].address = ranges[i].address + offset;
+            chunks[index].size = piece;
+            chunks[index].failed = &failed;
+            pool_submit(machium_pool(), &group, job_run_chunk, &chunks[index]);
+            offset += piece;
+            index++;
+        }
+    }
+    pool_wait(machium_pool(), &group);
+
+    free(chunks);
+    return !failed && !job_cancelled();
+}
+
+bool job_for_each_chunk(uint64_t address, uint64_t size, uint64_t chunk, job_chunk_t function, void* context) {
+    JobRange range;
+
+    range.address = address;
+    range.size = size;
+    return job_for_each_range(&range, 1, chunk, function, context);
+}
+
+void job_report(void) {
+    Job* finished;
+    Job** last;
+    Job** link;
+    Job* job;
+
+    //take the finished jobs off the list, waiting on their groups with the lock held would stall 'jobs' and 'kill'
+    finished = NULL;
+    last = &finished;
+    pthread_mutex_lock(&jobs_lock);
+    link = &jobs;
+    while (*link) {
+        job = *link;
+        if (__atomic_load_n(&job->state, __ATOMIC_ACQUIRE) != JOB_DONE) {
+            link = &job->next;
+            continue;
+        }
+        *link = job->next;
+        job->next = NULL;
+        *last = job;
+        last = &job->next;
+    }
+    pthread_mutex_unlock(&jobs_lock);
+
+    while (finished) {
+        job = finished;
+        finished = job->next;
+
+        //the worker might still be between finishing the command and letting go of the group
+        pool_wait(machium_pool(), &job->group);
+
+        if (job->cancelled)
+            output_message(OUTPUT_LEVEL_WARNING, "[%u] Killed  %s", job->id, job->command);
+        else if (job->result == MACHIUM_SUCCESS)
+            output_message(OUTPUT_LEVEL_GOOD, "[%u] Done    %s (%.2fs)", job->id, job->command, job_time() - job->started);
+        else
+            output_error(KERN_SUCCESS, "[%u] Failed  %s", job->id, job->command);
+
+        pthread_mutex_destroy(&job->output_lock);
+        free(job);
+    }
+}
+
+bool job_idle(const char* command) {
+    uint32_t running;
+    Job* job;
+
+    running = 0;
+    pthread_mutex_lock(&jobs_lock);
+    for (job = jobs; job; job = job->next) {
+        if (__atomic_load_n(&job->state, __ATOMIC_ACQUIRE) != JOB_DONE)
+            running++;
+    }
+    pthread_mutex_unlock(&jobs_lock);
+
+    if (running == 0)
+        return true;
+    output_error(KERN_SUCCESS, "'%s' would pull state out from under %u background job%s, 'wait' for them or 'kill' them first", command, running, running == 1 ? "" : "s");
+    return false;
+}
+
+static Job* job_find(uint32_t id) {
+    Job* job;
+
+    for (job = jobs; job; job = job->next) {
+        if (job->id == id)
+            return job;
+    }
+    return NULL;
+}
+
+/*
+list background jobs
+
+machium->args[0] -> jobs
+*/
+machium_command_t m_jobs(Machium* machium) {
+    Job* job;
+    uint64_t progress;
+    uint64_t total;
+
+    pthread_mutex_lock(&jobs_lock);
+    if (jobs == NULL)
+        output_message(OUTPUT_LEVEL_GOOD, "No background jobs");
+
+    for (job = jobs; job; job = job->next) {
+        progress = __atomic_load_n(&job->progress, __ATOMIC_RELAXED);
+        total = __atomic_load_n(&job->total, __ATOMIC_RELAXED);
+
+        output_textf(YELLOW"[%u] "WHITE"%-9s", job->id, job->state == JOB_DONE ? "done" : job->cancelled ? "killing" : "running");
+        if (total)
+            output_textf("%5.1f%% ", 100.0 * (double) progress / (double) total);
+        else
+            output_textf("     - ");
+        output_textf("%7.2fs  %s\n", job_time() - job->started, job->command);
+    }
+    pthread_mutex_unlock(&jobs_lock);
+    return MACHIUM_SUCCESS;
+}
+
+/*
+cancel a background job. it stops at the next chunk it starts
+
+machium->args[0] -> kill
+machium->args[1] -> [job id]
+*/
+machium_command_t m_kill(Machium* machium) {
+    Job* job;
+    uint32_t id;
+
+    if (machium->args_count != 2) {
+        output_error(KERN_SUCCESS, "'kill' takes 2 arguments");
+        return MACHIUM_FAILURE;
+    }
+
+    id = (uint32_t) strtoul(machium->args[1], NULL, 0);
+
+    pthread_mutex_lock(&jobs_lock);
+    job = job_find(id);
+    if (job == NULL || job->state == JOB_DONE) {
+        pthread_mutex_unlock(&jobs_lock);
+        output_error(KERN_SUCCESS, "No running job %u", id);
+        return MACHIUM_FAILURE;
+    }
+    job->cancelled = true;
+    pthread_mutex_unlock(&jobs_lock);
+
+    output_message(OUTPUT_LEVEL_GOOD, "Killing job %u...", id);
+    return MACHIUM_SUCCESS;
+}
+
+/*
+wait for background jobs
+
+machium->args[0] -> wait
+machium->args[1] -> [job id] (OPTIONAL, all jobs if missing)
+*/
+machium_command_t m_wait(Machium* machium) {
+    Job* waiting[64];
+    Job* job;
+    uint32_t count;
+    uint32_t id;
+
+    if (machium->args_count > 2) {
+        output_error(KERN_SUCCESS, "Too many arguments for 'wait', 2 maximum");
+        return MACHIUM_FAILURE;
+    }
+
+    id = machium->args_count == 2 ? (uint32_t) strtoul(machium->args[1], NULL, 0) : 0;
+
+    //jobs only get freed by job_report on this thread, so the pointers stay good after unlocking
+    count = 0;
+    pthread_mutex_lock(&jobs_lock);
+    for (job = jobs; job && count < 64; job = job->next) {
+        if (id == 0 || job->id == id)
+            waiting[count++] = job;
+    }
+    pthread_mutex_unlock(&jobs_lock);
+
+    if (id && count == 0) {
+        output_error(KERN_SUCCESS, "No job %u", id);
+        return MACHIUM_FAILURE;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+        pool_wait(machium_pool(), &waiting[i]->group);
+
+    job_report();
+    return MACHIUM_SUCCESS;
+}
@@ -0,0 +1,87 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include "Machium.h"
+#include "ThreadPool.h"
+#include "Output.h"
+
+#define JOB_RUNNING 0
+#define JOB_DONE 1
+
+typedef machium_command_t (*job_command_t)(Machium* machium);
+
+//a command running in the background, started by ending it with '&'
+typedef struct Job {
+    uint32_t id;
+    char command[MACHIUM_INPUT_LENGTH]; //what was typed, for 'jobs'
+    Machium machium; //the args and selected target as typed, the session behind it is the CLI's
+    job_command_t function;
+    machium_command_t result;
+
+    PoolGroup group;
+    volatile bool cancelled; //set by 'kill', long operations check it through job_cancelled()
+    volatile uint8_t state;
+    OutputWriter output; //records of the job, they go to the terminal in one piece when it's done and never into the CLI's writer
+    OutputWriter printed; //text of the job that isn't a whole line yet, see output_text
+    pthread_mutex_t output_lock; //pieces of the job on other workers output too
+    uint64_t progress; //bytes (or whatever unit the command uses) done so far
+    uint64_t total;
+    double started;
+
+    struct Job* next;
+} Job;
+
+//called by chunked operations for every piece, returns false on failure
+typedef bool (*job_chunk_t)(void* context, uint64_t address, uint64_t size);
+
+//run [function] in the background on the thread pool
+Job* job_start(Machium* machium, job_command_t function, const char* command);
+
+//the job running on this thread, NULL for commands running in the foreground
+Job* job_current(void);
+
+//true when the job running on this thread got killed. always false in the foreground
+bool job_cancelled(void);
+
+//add to the amount of work the job running on this thread has to do / has done
+void job_add_total(uint64_t total);
+void job_add_progress(uint64_t progress);
+
+/*
+split [size] bytes at [address] into [chunk] sized pieces and run [function] on all of them at once on the thread pool
+pieces after the first are aligned to [chunk] so they line up with pages and regions
+works in the foreground too, it just blocks the CLI until it's done
+*/
+bool job_for_each_chunk(uint64_t address, uint64_t size, uint64_t chunk, job_chunk_t function, void* context);
+
+//a piece of address space for job_for_each_range
+typedef struct JobRange {
+    uint64_t address;
+    uint64_t size;
+} JobRange;
+
+//job_for_each_chunk over several ranges at once. every piece of every range goes on the pool together so lots of small regions still keep every core busy
+bool job_for_each_range(const JobRange* ranges, uint32_t range_count, uint64_t chunk, job_chunk_t function, void* context);
+
+//print and forget jobs that finished since the last prompt
+void job_report(void);
+
+/*
+jobs share the target state (images, views, snapshots, layouts) with the CLI instead of copying it
+commands that free or move that state call this first, false after printing why [command] has to wait
+*/
+bool job_idle(const char* command);
+
+//seconds on a monotonic clock, for progress and throughput
+double job_time(void);
+
+//list background jobs
+machium_command_t m_jobs(Machium* machium);
+
+//cancel a background job
+machium_command_t m_kill(Machium* machium);
+
+//wait for background jobs to finish
+machium_command_t m_wait(Machium* machium);
+
+#endif /* JOB_H */
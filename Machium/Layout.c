@@ -0,0 +1,494 @@
+#include "Layout.h"
+#include "SymbolCache.h"
+#include "Output.h"
+#include "Job.h"
+
+#include <stdarg.h>
+
+//output of one 'read array', handed to the output layer in big blocks instead of one printf per cell
+typedef struct LayoutOutput {
+    char* data;
+    size_t used;
+} LayoutOutput;
+
+static void layout_flush(LayoutOutput* output) {
+    output_text(output->data, output->used);
+    output->used = 0;
+}
+
+static void layout_append(LayoutOutput* output, const char* format, ...) {
+    va_list args;
+    size_t capacity;
+    int written;
+
+    if (output->used > LAYOUT_FLUSH)
+        layout_flush(output);
+    capacity = LAYOUT_FLUSH + LAYOUT_CELL_MAX - output->used;
+    va_start(args, format);
+    written = vsnprintf(output->data + output->used, capacity, format, args);
+    va_end(args);
+    if (written > 0)
+        output->used += (size_t) written < capacity ? (size_t) written : capacity - 1;
+}
+
+//parse [text] (u32, char[16], ...) into the type and size of [field]
+static bool layout_parse_type(const char* text, LayoutField* field) {
+    static const struct { const char* prefix; uint8_t type; } numbers[] = {
+        { "u", LAYOUT_UNSIGNED }, { "i", LAYOUT_SIGNED }, { "x", LAYOUT_HEX }, { "f", LAYOUT_FLOAT },
+    };
+    const char* bracket;
+    char* end;
+    uint64_t bits;
+
+    if (!strcmp(text, "ptr")) {
+        field->type = LAYOUT_POINTER;
+        field->size = 8;
+        return true;
+    }
+    if (!strcmp(text, "bool")) {
+        field->type = LAYOUT_BOOL;
+        field->size = 1;
+        return true;
+    }
+
+    bracket = strchr(text, '[');
+    if (bracket) {
+        if (!strncmp(text, "char[", 5) && bracket == text + 4)
+            field->type = LAYOUT_CHAR;
+        else if (!strncmp(text, "bytes[", 6) && bracket == text + 5)
+            field->type = LAYOUT_BYTES;
+        else
+            return false;
+        field->size = (uint32_t) strtoul(bracket + 1, &end, 0);
+        return *end == ']' && end[1] == '\0' && field->size && field->size <= LAYOUT_ARRAY_MAX;
+    }
+
+    for (uint32_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); i++) {
+        if (text[0] != numbers[i].prefix[0])
+            continue;
+        bits = strtoull(text + 1, &end, 10);
+        if (*end != '\0' || (bits != 8 && bits != 16 && bits != 32 && bits != 64))
+            return false;
+        if (numbers[i].type == LAYOUT_FLOAT && bits != 32 && bits != 64)
+            return false;
+        field->type = numbers[i].type;
+        field->size = (uint32_t) (bits / 8);
+        return true;
+    }
+    return false;
+}
+
+static bool layout_add_field(Layout* layout, const char* name, const char* offset, const char* type) {
+    LayoutField* field;
+    char* end;
+
+    if (layout->field_count == LAYOUT_FIELDS_MAX || strlen(name) >= sizeof(field->name))
+        return false;
+    field = &layout->fields[layout->field_count];
+    memset(field, 0, sizeof(LayoutField));
+    strcpy(field->name, name);
+    field->offset = (uint32_t) strtoul(offset, &end, 0);
+    if (*end != '\0' || !layout_parse_type(type, field))
+        return false;
+    layout->field_count++;
+    return true;
+}
+
+//default stride when the layout doesn't give one
+static void layout_finish(Layout* layout) {
+    uint32_t alignment;
+
+    alignment = 1;
+    layout->end = 0;
+    for (uint32_t i = 0; i < layout->field_count; i++) {
+        if (layout->fields[i].offset + layout->fields[i].size > layout->end)
+            layout->end = layout->fields[i].offset + layout->fields[i].size;
+        if (layout->fields[i].type != LAYOUT_CHAR && layout->fields[i].type != LAYOUT_BYTES && layout->fields[i].size > alignment)
+            alignment = layout->fields[i].size;
+    }
+    if (layout->size == 0)
+        layout->size = (layout->end + alignment - 1) / alignment * alignment;
+}
+
+//add [layout], replacing the one with the same name. false when out of memory
+static bool layout_add(LayoutSet* set, const Layout* layout) {
+    Layout** layouts;
+    Layout* copy;
+
+    for (uint32_t i = 0; i < set->count; i++) {
+        if (!strcmp(set->layouts[i]->name, layout->name)) {
+            *set->layouts[i] = *layout;
+            return true;
+        }
+    }
+    copy = (Layout*) malloc(sizeof(Layout));
+    layouts = copy ? (Layout**) realloc(set->layouts, (set->count + 1) * sizeof(Layout*)) : NULL;
+    if (layouts == NULL) {
+        free(copy);
+        return false;
+    }
+    *copy = *layout;
+    set->layouts = layouts;
+    set->layouts[set->count++] = copy;
+    return true;
+}
+
+static void layout_set_free(LayoutSet* set) {
+    for (uint32_t i = 0; i < set->count; i++)
+        free(set->layouts[i]);
+    free(set->layouts);
+    memset(set, 0, sizeof(LayoutSet));
+}
+
+//load every layout in [path], returns how many or -1 after printing what's wrong with the file
+//the file is parsed into a set of its own first so [set] only changes when all of it parsed
+static int layout_load_file(LayoutSet* set, const char* path) {
+    char line[512];
+    char words[4][MACHIUM_ARG_LENGTH];
+    LayoutSet parsed = { 0 };
+    Layout* layout;
+    FILE* file;
+    uint32_t line_number;
+    int word_count;
+    int loaded;
+    bool failed;
+
+    file = fopen(path, "r");
+    if (file == NULL) {
+        output_error(KERN_SUCCESS, "Failed to open %s", path);
+        return -1;
+    }
+
+    layout = (Layout*) calloc(1, sizeof(Layout));
+    failed = layout == NULL;
+    line_number = 0;
+    while (!failed && fgets(line, sizeof(line), file)) {
+        line_number++;
+        if (strchr(line, '#'))
+            *strchr(line, '#') = '\0';
+        word_count = sscanf(line, "%63s %63s %63s %63s", words[0], words[1], words[2], words[3]);
+        if (word_count <= 0)
+            continue;
+
+        if (!strcmp(words[0], "layout") && (word_count == 2 || word_count == 3)) {
+            if (layout->name[0]) {
+                layout_finish(layout);
+                failed = !layout_add(&parsed, layout);
+            }
+            memset(layout, 0, sizeof(Layout));
+            strcpy(layout->name, words[1]);
+            if (word_count == 3)
+                layout->size = (uint32_t) strtoul(words[2], NULL, 0);
+            continue;
+        }
+        if (word_count == 3 && layout->name[0] && layout_add_field(layout, words[0], words[1], words[2]))
+            continue;
+
+        output_error(KERN_SUCCESS, "%s:%u: expected 'layout [name] [size]' or '[field] [offset] [type]'", path, line_number);
+        fclose(file);
+        free(layout);
+        layout_set_free(&parsed);
+        return -1;
+    }
+    fclose(file);
+    if (!failed && layout->name[0]) {
+        layout_finish(layout);
+        failed = !layout_add(&parsed, layout);
+    }
+    free(layout);
+
+    //everything parsed, only adding a new name to [set] can still fail
+    for (uint32_t i = 0; !failed && i < parsed.count; i++)
+        failed = !layout_add(set, parsed.layouts[i]);
+    loaded = failed ? -1 : (int) parsed.count;
+    if (failed)
+        output_error(KERN_SUCCESS, "Out of memory for the layouts in %s", path);
+    layout_set_free(&parsed);
+    return loaded;
+}
+
+//get the layouts, loading the layout file on first use so layouts carry over between sessions
+static LayoutSet* layout_set(Machium* machium) {
+    char path[1024];
+
+    if (machium->session->layouts)
+        return machium->session->layouts;
+    machium->session->layouts = (LayoutSet*) calloc(1, sizeof(LayoutSet));
+    if (symbol_cache_file(LAYOUT_FILE, path, sizeof(path), false) && access(path, R_OK) == 0)
+        layout_load_file(machium->session->layouts, path);
+    return machium->session->layouts;
+}
+
+Layout* layout_find(Machium* machium, const char* name) {
+    LayoutSet* set;
+
+    set = layout_set(machium);
+    for (uint32_t i = 0; i < set->count; i++) {
+        if (!strcmp(set->layouts[i]->name, name))
+            return set->layouts[i];
+    }
+    return NULL;
+}
+
+static const char* layout_type_name(const LayoutField* field, char* out, size_t size) {
+    static const char* prefixes[] = { "u", "i", "x", "f" };
+
+    if (field->type <= LAYOUT_FLOAT)
+        snprintf(out, size, "%s%u", prefixes[field->type], field->size * 8);
+    else if (field->type == LAYOUT_POINTER)
+        snprintf(out, size, "ptr");
+    else if (field->type == LAYOUT_BOOL)
+        snprintf(out, size, "bool");
+    else
+        snprintf(out, size, "%s[%u]", field->type == LAYOUT_CHAR ? "char" : "bytes", field->size);
+    return out;
+}
+
+//columns are as wide as the widest value of their type so rows line up without a second pass
+static int layout_width(const LayoutField* field) {
+    static const int decimal[] = { 0, 3, 5, 0, 10, 0, 0, 0, 20 };
+    int width;
+
+    switch (field->type) {
+        case LAYOUT_UNSIGNED: width = decimal[field->size]; break;
+        case LAYOUT_SIGNED: width = decimal[field->size] + 1; break;
+        case LAYOUT_HEX: width = 2 + 2 * field->size; break;
+        case LAYOUT_FLOAT: width = 13; break;
+        case LAYOUT_POINTER: width = 11; break;
+        case LAYOUT_BOOL: width = 5; break;
+        case LAYOUT_CHAR: width = field->size + 2; break;
+        default: width = 2 * field->size; break;
+    }
+    return width > (int) strlen(field->name) ? width : (int) strlen(field->name);
+}
+
+static void layout_print_field(LayoutOutput* output, const LayoutField* field, const uint8_t* data) {
+    char text[LAYOUT_CELL_MAX];
+    uint64_t value;
+    int64_t signed_value;
+    float single;
+    double real;
+    int width;
+    uint32_t length;
+
+    width = layout_width(field);
+    value = 0;
+    if (field->type <= LAYOUT_BOOL)
+        memcpy(&value, data, field->size);
+
+    switch (field->type) {
+        case LAYOUT_UNSIGNED:
+            layout_append(output, "%*llu", width, value);
+            break;
+        case LAYOUT_SIGNED:
+            signed_value = field->size == 8 ? (int64_t) value : (int64_t) (value << (64 - field->size * 8)) >> (64 - field->size * 8);
+            layout_append(output, "%*lld", width, signed_value);
+            break;
+        case LAYOUT_HEX:
+            layout_append(output, "%*s0x%0*llx", width - 2 - 2 * (int) field->size, "", 2 * (int) field->size, value);
+            break;
+        case LAYOUT_FLOAT:
+            if (field->size == 4) {
+                memcpy(&single, data, sizeof(single));
+                real = single;
+            }
+            else
+                memcpy(&real, data, sizeof(real));
+            layout_append(output, "%*.6g", width, real);
+            break;
+        case LAYOUT_POINTER:
+            snprintf(text, sizeof(text), "0x%llx", value & MACHIUM_PC_MASK);
+            layout_append(output, "%*s", width, text);
+            break;
+        case LAYOUT_BOOL:
+            layout_append(output, "%*s", width, value ? "true" : "false");
+            break;
+        case LAYOUT_CHAR:
+            //unprintable characters show up as '.' so one row stays one line
+            for (length = 0; length < field->size && data[length]; length++)
+                text[length] = data[length] >= 0x20 && data[length] <= 0x7e ? (char) data[length] : '.';
+            text[length] = '\0';
+            layout_append(output, "\"%s\"%*s", text, width - (int) length - 2, "");
+            break;
+        default:
+            for (length = 0; length < field->size; length++)
+                snprintf(text + length * 2, 3, "%02x", data[length]);
+            layout_append(output, "%-*s", width, text);
+            break;
+    }
+}
+
+void layout_print(const Layout* layout, uint64_t address, const uint8_t* data, uint32_t count, uint64_t stride) {
+    LayoutOutput output;
+    char prefix[64];
+    int prefix_width;
+
+    output.data = (char*) malloc(LAYOUT_FLUSH + LAYOUT_CELL_MAX);
+    output.used = 0;
+
+    //the last element has the longest address and index
+    prefix_width = snprintf(prefix, sizeof(prefix), "0x%llx [%u]", address + (uint64_t) (count - 1) * stride, count - 1);
+    layout_append(&output, YELLOW"%-*s "WHITE"|", prefix_width, layout->name);
+    for (uint32_t i = 0; i < layout->field_count; i++) {
+        //numbers are right aligned, char[] and bytes[] left aligned
+        if (layout->fields[i].type == LAYOUT_CHAR || layout->fields[i].type == LAYOUT_BYTES)
+            layout_append(&output, " "YELLOW"%-*s"WHITE, layout_width(&layout->fields[i]), layout->fields[i].name);
+        else
+            layout_append(&output, " "YELLOW"%*s"WHITE, layout_width(&layout->fields[i]), layout->fields[i].name);
+    }
+    layout_append(&output, "\n");
+
+    for (uint32_t i = 0; i < count; i++) {
+        snprintf(prefix, sizeof(prefix), "0x%llx [%u]", address + (uint64_t) i * stride, i);
+        layout_append(&output, BLUE"%-*s "WHITE"|", prefix_width, prefix);
+        for (uint32_t j = 0; j < layout->field_count; j++) {
+            layout_append(&output, " ");
+            layout_print_field(&output, &layout->fields[j], data + (uint64_t) i * stride + layout->fields[j].offset);
+        }
+        layout_append(&output, "\n");
+    }
+    layout_flush(&output);
+    free(output.data);
+}
+
+/*
+list layouts
+
+machium->args[0] -> layout
+machium->args[1] -> list
+*/
+static machium_command_t m_layout_list(Machium* machium) {
+    LayoutSet* set;
+
+    set = layout_set(machium);
+    if (set->count == 0) {
+        output_message(OUTPUT_LEVEL_WARNING, "No layouts, define one with 'layout define' or load a file with 'layout load'");
+        return MACHIUM_SUCCESS;
+    }
+    for (uint32_t i = 0; i < set->count; i++)
+        output_textf(YELLOW"%s "WHITE"- %u fields, %u bytes\n", set->layouts[i]->name, set->layouts[i]->field_count, set->layouts[i]->size);
+    return MACHIUM_SUCCESS;
+}
+
+/*
+print the fields of a layout
+
+machium->args[0] -> layout
+machium->args[1] -> show
+machium->args[2] -> [name]
+*/
+static machium_command_t m_layout_show(Machium* machium) {
+    char type[32];
+    Layout* layout;
+
+    if (machium->args_count != 3) {
+        output_error(KERN_SUCCESS, "Usage: layout show [name]");
+        return MACHIUM_FAILURE;
+    }
+    layout = layout_find(machium, machium->args[2]);
+    if (layout == NULL) {
+        output_error(KERN_SUCCESS, "No layout called %s", machium->args[2]);
+        return MACHIUM_FAILURE;
+    }
+    output_message(OUTPUT_LEVEL_GOOD, "%s, %u bytes", layout->name, layout->size);
+    for (uint32_t i = 0; i < layout->field_count; i++)
+        output_textf("    +0x%-4x %-24s %s\n", layout->fields[i].offset, layout->fields[i].name, layout_type_name(&layout->fields[i], type, sizeof(type)));
+    return MACHIUM_SUCCESS;
+}
+
+/*
+load layouts from a file
+
+machium->args[0] -> layout
+machium->args[1] -> load
+machium->args[2] -> [file]
+*/
+static machium_command_t m_layout_load(Machium* machium) {
+    int loaded;
+
+    if (machium->args_count != 3) {
+        output_error(KERN_SUCCESS, "Usage: layout load [file]");
+        return MACHIUM_FAILURE;
+    }
+    loaded = layout_load_file(layout_set(machium), machium->args[2]);
+    if (loaded < 0)
+        return MACHIUM_FAILURE;
+    output_message(OUTPUT_LEVEL_GOOD, "Loaded %d layouts from %s", loaded, machium->args[2]);
+    return MACHIUM_SUCCESS;
+}
+
+/*
+define a layout and append it to the layout file so it's there next session
+
+machium->args[0] -> layout
+machium->args[1] -> define
+machium->args[2] -> [name]
+machium->args[3...] -> [field:offset:type]
+*/
+static machium_command_t m_layout_define(Machium* machium) {
+    char path[1024];
+    char field[MACHIUM_ARG_LENGTH];
+    char type[32];
+    char* offset;
+    char* type_text;
+    Layout* layout;
+    FILE* file;
+
+    if (machium->args_count < 4) {
+        output_error(KERN_SUCCESS, "Usage: layout define [name] [field:offset:type] ...");
+        return MACHIUM_FAILURE;
+    }
+
+    layout = (Layout*) calloc(1, sizeof(Layout));
+    strcpy(layout->name, machium->args[2]);
+    for (uint8_t i = 3; i < machium->args_count; i++) {
+        strcpy(field, machium->args[i]);
+        offset = strchr(field, ':');
+        type_text = offset ? strchr(offset + 1, ':') : NULL;
+        if (type_text)
+            *offset++ = *type_text++ = '\0';
+        if (type_text == NULL || !layout_add_field(layout, field, offset, type_text)) {
+            output_error(KERN_SUCCESS, "Invalid field %s, expected [field:offset:type]", machium->args[i]);
+            free(layout);
+            return MACHIUM_FAILURE;
+        }
+    }
+    layout_finish(layout);
+    if (!layout_add(layout_set(machium), layout)) {
+        output_error(KERN_SUCCESS, "Out of memory for %s", layout->name);
+        free(layout);
+        return MACHIUM_FAILURE;
+    }
+
+    if (!symbol_cache_file(LAYOUT_FILE, path, sizeof(path), true) || (file = fopen(path, "a")) == NULL) {
+        output_message(OUTPUT_LEVEL_WARNING, "Defined %s for this session only, the layout file couldn't be opened", layout->name);
+        free(layout);
+        return MACHIUM_SUCCESS;
+    }
+    fprintf(file, "layout %s\n", layout->name);
+    for (uint32_t i = 0; i < layout->field_count; i++)
+        fprintf(file, "%s 0x%x %s\n", layout->fields[i].name, layout->fields[i].offset, layout_type_name(&layout->fields[i], type, sizeof(type)));
+    fclose(file);
+
+    output_message(OUTPUT_LEVEL_GOOD, "Defined %s (%u bytes), saved to %s", layout->name, layout->size, path);
+    free(layout);
+    return MACHIUM_SUCCESS;
+}
+
+/*
+handle layout commands
+
+machium->args[0] -> layout
+machium->args[1] -> [command]
+*/
+machium_command_t m_layout(Machium* machium) {
+    if (machium->args_count < 2 || !strcmp(machium->args[1], "list") || !strcmp(machium->args[1], "l")) return m_layout_list(machium);
+    else if (!strcmp(machium->args[1], "show") || !strcmp(machium->args[1], "s")) return m_layout_show(machium);
+    //both can move the layouts a 'read array' job is printing with
+    else if (!job_idle("layout")) return MACHIUM_FAILURE;
+    else if (!strcmp(machium->args[1], "load")) return m_layout_load(machium);
+    else if (!strcmp(machium->args[1], "define") || !strcmp(machium->args[1], "d")) return m_layout_define(machium);
+
+    output_error(KERN_SUCCESS, "Invalid argument for 'layout', %s", machium->args[1]);
+    return MACHIUM_FAILURE;
+}
@@ -0,0 +1,64 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include "Machium.h"
+
+#define LAYOUT_FIELDS_MAX 64 //fields of one layout
+#define LAYOUT_CELL_MAX 160 //longest cell a field prints, char[] and bytes[] are capped to fit
+#define LAYOUT_ARRAY_MAX 64 //longest char[] / bytes[] field
+#define LAYOUT_FLUSH (64 * 1024) //rows are formatted into a buffer and handed to the output layer this many bytes at a time
+
+//layouts defined with 'layout define' are appended here (next to the symbol cache) and loaded on first use
+#define LAYOUT_FILE "layouts"
+
+//field types
+#define LAYOUT_UNSIGNED 0 //u8 u16 u32 u64
+#define LAYOUT_SIGNED 1 //i8 i16 i32 i64
+#define LAYOUT_HEX 2 //x8 x16 x32 x64
+#define LAYOUT_FLOAT 3 //f32 f64
+#define LAYOUT_POINTER 4 //ptr, hex without pointer authentication bits
+#define LAYOUT_BOOL 5 //bool
+#define LAYOUT_CHAR 6 //char[N], printed up to the first '\0'
+#define LAYOUT_BYTES 7 //bytes[N], printed as hex
+
+typedef struct LayoutField {
+    char name[MACHIUM_ARG_LENGTH];
+    uint32_t offset;
+    uint32_t size;
+    uint8_t type;
+} LayoutField;
+
+/*
+a struct layout for 'read array'. in a layout file every layout starts with a 'layout' line and
+every field after it is a line of name, offset and type, # starts a comment:
+
+layout CGRect
+x 0 f64
+y 8 f64
+width 16 f64
+height 24 f64
+*/
+typedef struct Layout {
+    char name[MACHIUM_ARG_LENGTH];
+    LayoutField fields[LAYOUT_FIELDS_MAX];
+    uint32_t field_count;
+    uint32_t size; //default stride, the end of the last field rounded up to the alignment of the biggest one
+    uint32_t end; //end of the last field, what a read of one element needs
+} Layout;
+
+typedef struct LayoutSet {
+    Layout** layouts; //allocated one by one so a Layout* stays put while more are added
+    uint32_t count;
+} LayoutSet;
+
+//find the layout called [name], the layout file is loaded the first time
+//the pointer stays valid for the session, redefining the layout changes what it points to in place
+Layout* layout_find(Machium* machium, const char* name);
+
+//print [count] elements of [layout] every [stride] bytes from [data], which was read from [address]
+void layout_print(const Layout* layout, uint64_t address, const uint8_t* data, uint32_t count, uint64_t stride);
+
+//handle layout commands
+machium_command_t m_layout(Machium* machium);
+
+#endif /* LAYOUT_H */
@@ -0,0 +1,476 @@
+#include "MachO.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//fat headers are big endian no matter what the host is
+static uint32_t read_be32(const void* data) {
+    const uint8_t* bytes = (const uint8_t*) data;
+    return ((uint32_t) bytes[0] << 24) | ((uint32_t) bytes[1] << 16) | ((uint32_t) bytes[2] << 8) | (uint32_t) bytes[3];
+}
+
+/*
+parses the mach header and load commands of an image
+for an image loaded in a task [address] is the slid header address, for files it's 0
+*/
+bool macho_parse_header(MachOImage* image, macho_read_t read, void* context, uint64_t address) {
+    struct mach_header_64 header;
+    struct load_command* command;
+    struct segment_command_64* segment;
+    uint8_t* commands;
+    uint32_t command_offset;
+    uint64_t end;
+
+    memset(image, 0, sizeof(MachOImage));
+
+    if (!read(context, address, &header, sizeof(header)) || header.magic != MH_MAGIC_64)
+        return false;
+
+    commands = (uint8_t*) malloc(header.sizeofcmds);
+    if (commands == NULL)
+        return false;
+
+    if (!read(context, address + sizeof(header), commands, header.sizeofcmds)) {
+        free(commands);
+        return false;
+    }
+
+    image->flags = header.flags;
+    image->segments = (MachOSegment*) calloc(header.ncmds, sizeof(MachOSegment));
+    if (image->segments == NULL) {
+        free(commands);
+        return false;
+    }
+
+    command_offset = 0;
+    for (uint32_t i = 0; i < header.ncmds; i++) {
+        //a load command that runs off the end means the header is garbage, bail out with what we have
+        if (command_offset + sizeof(struct load_command) > header.sizeofcmds)
+            break;
+        command = (struct load_command*) (commands + command_offset);
+        if (command->cmdsize < sizeof(struct load_command) || command_offset + command->cmdsize > header.sizeofcmds)
+            break;
+
+        if (command->cmd == LC_SEGMENT_64 && command->cmdsize >= sizeof(struct segment_command_64)) {
+            segment = (struct segment_command_64*) command;
+            MachOSegment* out = &image->segments[image->segment_count++];
+            memcpy(out->name, segment->segname, 16);
+            out->name[16] = '\0';
+            out->vmaddr = segment->vmaddr;
+            out->vmsize = segment->vmsize;
+            out->fileoff = segment->fileoff;
+            out->filesize = segment->filesize;
+            out->prot = segment->initprot;
+            if (!strcmp(out->name, "__TEXT"))
+                image->text_vmaddr = segment->vmaddr;
+        }
+        else if (command->cmd == LC_SYMTAB && command->cmdsize >= sizeof(struct symtab_command)) {
+            memcpy(&image->symtab, command, sizeof(struct symtab_command));
+        }
+        else if (command->cmd == LC_FUNCTION_STARTS && command->cmdsize >= sizeof(struct linkedit_data_command)) {
+            memcpy(&image->function_starts, command, sizeof(struct linkedit_data_command));
+        }
+        else if (command->cmd == LC_UUID && command->cmdsize >= sizeof(struct uuid_command)) {
+            memcpy(image->uuid, ((struct uuid_command*) command)->uuid, 16);
+            image->has_uuid = true;
+        }
+        command_offset += command->cmdsize;
+    }
+    free(commands);
+
+    //the image spans from __TEXT to the end of the last segment that isn't __PAGEZERO or __LINKEDIT
+    end = image->text_vmaddr;
+    for (uint32_t i = 0; i < image->segment_count; i++) {
+        if (!strcmp(image->segments[i].name, "__PAGEZERO") || !strcmp(image->segments[i].name, "__LINKEDIT"))
+            continue;
+        if (image->segments[i].vmaddr + image->segments[i].vmsize > end)
+            end = image->segments[i].vmaddr + image->segments[i].vmsize;
+    }
+    image->size = end - image->text_vmaddr;
+
+    return true;
+}
+
+bool macho_find_section(macho_read_t read, void* context, uint64_t address, const char* name, uint64_t* vmaddr, uint64_t* size) {
+    struct mach_header_64 header;
+    struct load_command* command;
+    struct segment_command_64* segment;
+    struct section_64* section;
+    uint8_t* commands;
+    uint32_t command_offset;
+    bool found;
+
+    //sections aren't kept around after macho_parse_header, they're rarely needed
+    if (!read(context, address, &header, sizeof(header)) || header.magic != MH_MAGIC_64)
+        return false;
+    commands = (uint8_t*) malloc(header.sizeofcmds);
+    if (commands == NULL)
+        return false;
+    if (!read(context, address + sizeof(header), commands, header.sizeofcmds)) {
+        free(commands);
+        return false;
+    }
+
+    found = false;
+    command_offset = 0;
+    for (uint32_t i = 0; i < header.ncmds && !found; i++) {
+        if (command_offset + sizeof(struct load_command) > header.sizeofcmds)
+            break;
+        command = (struct load_command*) (commands + command_offset);
+        if (command->cmdsize < sizeof(struct load_command) || command_offset + command->cmdsize > header.sizeofcmds)
+            break;
+
+        if (command->cmd == LC_SEGMENT_64 && command->cmdsize >= sizeof(struct segment_command_64)) {
+            segment = (struct segment_command_64*) command;
+            section = (struct section_64*) (segment + 1);
+            for (uint32_t j = 0; j < segment->nsects && (uint8_t*) (section + j + 1) <= (uint8_t*) command + command->cmdsize; j++) {
+                if (strncmp(section[j].sectname, name, 16))
+                    continue;
+                *vmaddr = section[j].addr;
+                *size = section[j].size;
+                found = true;
+                break;
+            }
+        }
+        command_offset += command->cmdsize;
+    }
+    free(commands);
+    return found;
+}
+
+/*
+find where a file offset lives
+in a file that's just the offset, in memory it's wherever the segment holding that offset got mapped
+*/
+uint64_t macho_file_to_address(const MachOImage* image, uint64_t fileoff, uint64_t address, bool in_memory) {
+    const MachOSegment* segment;
+
+    if (!in_memory)
+        return address + fileoff;
+
+    for (uint32_t i = 0; i < image->segment_count; i++) {
+        segment = &image->segments[i];
+        if (fileoff >= segment->fileoff && fileoff < segment->fileoff + segment->filesize)
+            return segment->vmaddr + (address - image->text_vmaddr) + (fileoff - segment->fileoff);
+    }
+    return UINT64_MAX;
+}
+
+//sort by offset and put named symbols in front of function starts at the same offset
+static int compare_symbols(const void* a, const void* b) {
+    const MachOSymbol* left = (const MachOSymbol*) a;
+    const MachOSymbol* right = (const MachOSymbol*) b;
+
+    if (left->offset != right->offset)
+        return left->offset < right->offset ? -1 : 1;
+    if ((left->name == MACHO_UNNAMED) != (right->name == MACHO_UNNAMED))
+        return left->name == MACHO_UNNAMED ? 1 : -1;
+    return 0;
+}
+
+//read a whole linkedit blob at [fileoff]
+static void* read_linkedit(const MachOImage* image, macho_read_t read, void* context, uint64_t address, bool in_memory, uint64_t fileoff, size_t size) {
+    uint64_t where;
+    void* out;
+
+    where = macho_file_to_address(image, fileoff, address, in_memory);
+    if (where == UINT64_MAX || size == 0)
+        return NULL;
+
+    out = malloc(size);
+    if (out == NULL)
+        return NULL;
+    if (!read(context, where, out, size)) {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+uint32_t macho_function_starts(const MachOImage* image, macho_read_t read, void* context, uint64_t address, bool in_memory, uint32_t** out) {
+    uint8_t* starts;
+    uint8_t* cursor;
+    uint8_t* starts_end;
+    uint32_t* functions;
+    uint32_t count;
+    uint64_t function;
+    uint64_t delta;
+    uint32_t shift;
+
+    *out = NULL;
+    if (image->function_starts.datasize == 0)
+        return 0;
+    starts = (uint8_t*) read_linkedit(image, read, context, address, in_memory, image->function_starts.dataoff, image->function_starts.datasize);
+    if (starts == NULL)
+        return 0;
+
+    //every start takes at least a byte
+    functions = (uint32_t*) malloc((size_t) image->function_starts.datasize * sizeof(uint32_t));
+    if (functions == NULL) {
+        free(starts);
+        return 0;
+    }
+    count = 0;
+
+    //function starts are a list of uleb128 deltas, the first one is relative to __TEXT and a 0 ends the list
+    cursor = starts;
+    starts_end = starts + image->function_starts.datasize;
+    function = 0;
+    while (cursor < starts_end) {
+        delta = 0;
+        shift = 0;
+        do {
+            delta |= (uint64_t) (*cursor & 0x7f) << shift;
+            shift += 7;
+        } while (*cursor++ & 0x80 && cursor < starts_end && shift < 64);
+        if (delta == 0)
+            break;
+        function += delta;
+        if (function >= image->size)
+            break;
+        functions[count++] = (uint32_t) function;
+    }
+
+    free(starts);
+    *out = functions;
+    return count;
+}
+
+/*
+builds the sorted symbol array from LC_SYMTAB and LC_FUNCTION_STARTS
+stripped app binaries barely have any symbols left, function starts at least tell us where every function begins
+*/
+bool macho_parse_symbols(MachOImage* image, macho_read_t read, void* context, uint64_t address, bool in_memory) {
+    struct nlist_64* nlist;
+    uint32_t* functions;
+    uint32_t function_count;
+    uint32_t capacity;
+    uint32_t count;
+
+    nlist = NULL;
+    count = 0;
+
+    if (image->symtab.nsyms) {
+        nlist = (struct nlist_64*) read_linkedit(image, read, context, address, in_memory, image->symtab.symoff, (size_t) image->symtab.nsyms * sizeof(struct nlist_64));
+        image->strings = (char*) read_linkedit(image, read, context, address, in_memory, image->symtab.stroff, image->symtab.strsize);
+        if (nlist == NULL || image->strings == NULL) {
+            free(nlist);
+            free(image->strings);
+            image->strings = NULL;
+            nlist = NULL;
+        }
+        else {
+            image->strings_size = image->symtab.strsize;
+            image->strings[image->strings_size - 1] = '\0'; //never trust a string table to be terminated
+        }
+    }
+
+    function_count = macho_function_starts(image, read, context, address, in_memory, &functions);
+
+    //worst case every symbol and every function start is unique
+    capacity = (nlist ? image->symtab.nsyms : 0) + function_count;
+    if (capacity == 0) {
+        free(nlist);
+        free(functions);
+        return image->symtab.nsyms == 0 && image->function_starts.datasize == 0;
+    }
+
+    image->symbols = (MachOSymbol*) malloc((size_t) capacity * sizeof(MachOSymbol));
+    if (image->symbols == NULL) {
+        free(nlist);
+        free(functions);
+        return false;
+    }
+
+    if (nlist) {
+        for (uint32_t i = 0; i < image->symtab.nsyms; i++) {
+            //skip debugger entries and anything that isn't defined in a section
+            if (nlist[i].n_type & N_STAB || (nlist[i].n_type & N_TYPE) != N_SECT)
+                continue;
+            if (nlist[i].n_value < image->text_vmaddr || nlist[i].n_value - image->text_vmaddr >= image->size)
+                continue;
+            if (nlist[i].n_strx == 0 || nlist[i].n_strx >= image->strings_size)
+                continue;
+            image->symbols[count].offset = (uint32_t) (nlist[i].n_value - image->text_vmaddr);
+            image->symbols[count].name = nlist[i].n_strx;
+            count++;
+        }
+    }
+
+    for (uint32_t i = 0; i < function_count; i++) {
+        image->symbols[count].offset = functions[i];
+        image->symbols[count].name = MACHO_UNNAMED;
+        count++;
+    }
+
+    free(nlist);
+    free(functions);
+
+    qsort(image->symbols, count, sizeof(MachOSymbol), compare_symbols);
+
+    //drop duplicates, the named one of each offset is first after sorting
+    image->symbol_count = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (image->symbol_count && image->symbols[image->symbol_count - 1].offset == image->symbols[i].offset)
+            continue;
+        image->symbols[image->symbol_count++] = image->symbols[i];
+    }
+
+    return true;
+}
+
+//binary search for the last symbol at or before [offset]
+const MachOSegment* macho_segment_at(const MachOImage* image, uint64_t offset) {
+    uint64_t address;
+
+    address = image->text_vmaddr + offset;
+    for (uint32_t i = 0; i < image->segment_count; i++) {
+        if (!strcmp(image->segments[i].name, "__PAGEZERO") || !strcmp(image->segments[i].name, "__LINKEDIT"))
+            continue;
+        if (address - image->segments[i].vmaddr < image->segments[i].vmsize)
+            return &image->segments[i];
+    }
+    return NULL;
+}
+
+const MachOSymbol* macho_lookup(const MachOImage* image, uint64_t offset) {
+    uint32_t low;
+    uint32_t high;
+    uint32_t middle;
+
+    if (image->symbol_count == 0 || offset < image->symbols[0].offset)
+        return NULL;
+
+    low = 0;
+    high = image->symbol_count;
+    while (high - low > 1) {
+        middle = low + (high - low) / 2;
+        if (image->symbols[middle].offset <= offset)
+            low = middle;
+        else
+            high = middle;
+    }
+    return &image->symbols[low];
+}
+
+uint64_t macho_find_symbol(const MachOImage* image, const char* name) {
+    const char* symbol_name;
+
+    for (uint32_t i = 0; i < image->symbol_count; i++) {
+        symbol_name = macho_symbol_name(image, &image->symbols[i]);
+        if (symbol_name && !strcmp(symbol_name, name))
+            return image->symbols[i].offset;
+    }
+    return UINT64_MAX;
+}
+
+const char* macho_symbol_name(const MachOImage* image, const MachOSymbol* symbol) {
+    const char* name;
+
+    if (symbol->name == MACHO_UNNAMED || image->strings == NULL)
+        return NULL;
+    name = image->strings + symbol->name;
+    if (name[0] == '_')
+        name++;
+    return name;
+}
+
+void macho_free(MachOImage* image) {
+    free(image->segments);
+    if (image->mapping) {
+        munmap(image->mapping, image->mapping_size);
+    }
+    else {
+        free(image->symbols);
+        free(image->strings);
+    }
+    memset(image, 0, sizeof(MachOImage));
+}
+
+/*
+mmap a Mach-O file read only
+fat files get narrowed down to their arm64 slice
+*/
+bool macho_file_open(MachOFile* file, const char* path) {
+    struct stat info;
+    struct fat_header* fat;
+    struct fat_arch* arch;
+    uint32_t magic;
+    uint32_t arch_count;
+    int fd;
+
+    memset(file, 0, sizeof(MachOFile));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    if (fstat(fd, &info) || info.st_size < (off_t) sizeof(struct mach_header_64)) {
+        close(fd);
+        return false;
+    }
+
+    file->map = (uint8_t*) mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); //the mapping keeps the file alive
+    if (file->map == MAP_FAILED) {
+        file->map = NULL;
+        return false;
+    }
+    file->map_size = (size_t) info.st_size;
+    file->slice_offset = 0;
+    file->slice_size = file->map_size;
+
+    memcpy(&magic, file->map, sizeof(magic));
+    if (magic == FAT_MAGIC || magic == FAT_CIGAM) {
+        fat = (struct fat_header*) file->map;
+        arch_count = read_be32(&fat->nfat_arch);
+        file->slice_size = 0;
+        for (uint32_t i = 0; i < arch_count; i++) {
+            arch = (struct fat_arch*) (file->map + sizeof(struct fat_header)) + i;
+            if ((uint8_t*) (arch + 1) > file->map + file->map_size)
+                break;
+            if (read_be32(&arch->cputype) != CPU_TYPE_ARM64)
+                continue;
+            file->slice_offset = read_be32(&arch->offset);
+            file->slice_size = read_be32(&arch->size);
+            break;
+        }
+        if (file->slice_size == 0 || file->slice_offset + file->slice_size > file->map_size) {
+            macho_file_close(file);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void macho_file_close(MachOFile* file) {
+    if (file->map)
+        munmap(file->map, file->map_size);
+    memset(file, 0, sizeof(MachOFile));
+}
+
+bool macho_file_read(void* context, uint64_t offset, void* out, size_t size) {
+    MachOFile* file = (MachOFile*) context;
+
+    if (offset > file->slice_size || size > file->slice_size - offset)
+        return false;
+    memcpy(out, file->map + file->slice_offset + offset, size);
+    return true;
+}
+
+bool macho_parse_file(MachOImage* image, const char* path) {
+    MachOFile file;
+    bool parsed;
+
+    if (!macho_file_open(&file, path))
+        return false;
+
+    parsed = macho_parse_header(image, macho_file_read, &file, 0) && macho_parse_symbols(image, macho_file_read, &file, 0, false);
+    macho_file_close(&file);
+    return parsed;
+}
@@ -0,0 +1,222 @@
+#ifndef MACHO_H
+#define MACHO_H
+
+//this file doesn't include Machium.h on purpose.
+//the Mach-O parser only needs libc so it can be built and poked at on linux against files copied off a device.
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __APPLE__
+#include <mach-o/loader.h>
+#include <mach-o/nlist.h>
+#include <mach-o/fat.h>
+#else
+//just enough of <mach-o/loader.h>, <mach-o/nlist.h> and <mach-o/fat.h> for the parser
+#define MH_MAGIC_64 0xfeedfacf
+#define FAT_MAGIC 0xcafebabe
+#define FAT_CIGAM 0xbebafeca
+#define CPU_TYPE_ARM64 0x0100000c
+
+#define LC_SEGMENT_64 0x19
+#define LC_SYMTAB 0x2
+#define LC_UUID 0x1b
+#define LC_FUNCTION_STARTS 0x26
+
+#define N_STAB 0xe0
+#define N_TYPE 0x0e
+#define N_SECT 0xe
+
+struct mach_header_64 {
+    uint32_t magic;
+    int32_t cputype;
+    int32_t cpusubtype;
+    uint32_t filetype;
+    uint32_t ncmds;
+    uint32_t sizeofcmds;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+struct load_command {
+    uint32_t cmd;
+    uint32_t cmdsize;
+};
+
+struct segment_command_64 {
+    uint32_t cmd;
+    uint32_t cmdsize;
+    char segname[16];
+    uint64_t vmaddr;
+    uint64_t vmsize;
+    uint64_t fileoff;
+    uint64_t filesize;
+    int32_t maxprot;
+    int32_t initprot;
+    uint32_t nsects;
+    uint32_t flags;
+};
+
+struct section_64 {
+    char sectname[16];
+    char segname[16];
+    uint64_t addr;
+    uint64_t size;
+    uint32_t offset;
+    uint32_t align;
+    uint32_t reloff;
+    uint32_t nreloc;
+    uint32_t flags;
+    uint32_t reserved1;
+    uint32_t reserved2;
+    uint32_t reserved3;
+};
+
+struct symtab_command {
+    uint32_t cmd;
+    uint32_t cmdsize;
+    uint32_t symoff;
+    uint32_t nsyms;
+    uint32_t stroff;
+    uint32_t strsize;
+};
+
+struct linkedit_data_command {
+    uint32_t cmd;
+    uint32_t cmdsize;
+    uint32_t dataoff;
+    uint32_t datasize;
+};
+
+struct uuid_command {
+    uint32_t cmd;
+    uint32_t cmdsize;
+    uint8_t uuid[16];
+};
+
+struct nlist_64 {
+    uint32_t n_strx;
+    uint8_t n_type;
+    uint8_t n_sect;
+    uint16_t n_desc;
+    uint64_t n_value;
+};
+
+//fat headers are always big endian
+struct fat_header {
+    uint32_t magic;
+    uint32_t nfat_arch;
+};
+
+struct fat_arch {
+    int32_t cputype;
+    int32_t cpusubtype;
+    uint32_t offset;
+    uint32_t size;
+    uint32_t align;
+};
+#endif
+
+//older SDKs don't have this one yet
+#ifndef MH_DYLIB_IN_CACHE
+#define MH_DYLIB_IN_CACHE 0x80000000
+#endif
+
+//name value for symbols that only come from LC_FUNCTION_STARTS
+#define MACHO_UNNAMED UINT32_MAX
+
+/*
+reads [size] bytes at [address] into [out]
+for files [address] is a file offset, for images in a task it's the slid virtual address
+*/
+typedef bool (*macho_read_t)(void* context, uint64_t address, void* out, size_t size);
+
+typedef struct MachOSegment {
+    char name[17];
+    uint64_t vmaddr; //unslid
+    uint64_t vmsize;
+    uint64_t fileoff;
+    uint64_t filesize;
+    int32_t prot;
+} MachOSegment;
+
+//8 bytes so a binary search touches as few cache lines as possible
+typedef struct MachOSymbol {
+    uint32_t offset; //offset from the start of __TEXT
+    uint32_t name; //offset into MachOImage.strings or MACHO_UNNAMED
+} MachOSymbol;
+
+typedef struct MachOImage {
+    uint8_t uuid[16];
+    bool has_uuid;
+    uint32_t flags; //mach_header_64 flags
+
+    uint64_t text_vmaddr; //unslid address of __TEXT
+    uint64_t size; //span from __TEXT to the end of the last mapped segment (__LINKEDIT excluded)
+
+    MachOSegment* segments;
+    uint32_t segment_count;
+
+    MachOSymbol* symbols; //sorted by offset
+    uint32_t symbol_count;
+    char* strings;
+    uint32_t strings_size;
+
+    //symbols and strings point straight into this when they came out of a symbol cache file (see SymbolCache.h)
+    void* mapping;
+    size_t mapping_size;
+
+    struct symtab_command symtab;
+    struct linkedit_data_command function_starts;
+} MachOImage;
+
+//a Mach-O file on disk, mapped with mmap
+typedef struct MachOFile {
+    uint8_t* map;
+    size_t map_size;
+    uint64_t slice_offset; //offset of the arm64 slice for fat files
+    uint64_t slice_size;
+} MachOFile;
+
+//parse the header and load commands at [address] (the slid header for images in a task, 0 for files)
+bool macho_parse_header(MachOImage* image, macho_read_t read, void* context, uint64_t address);
+
+//parse the symbol table and function starts into a sorted symbol array. needs macho_parse_header first
+bool macho_parse_symbols(MachOImage* image, macho_read_t read, void* context, uint64_t address, bool in_memory);
+
+//decode LC_FUNCTION_STARTS into offsets from the start of __TEXT, in order. returns the count, [out] has to be freed
+uint32_t macho_function_starts(const MachOImage* image, macho_read_t read, void* context, uint64_t address, bool in_memory, uint32_t** out);
+
+//find the section named [name] in any segment (__objc_classlist lives in __DATA, __DATA_CONST or __AUTH_CONST). [vmaddr] is unslid
+bool macho_find_section(macho_read_t read, void* context, uint64_t address, const char* name, uint64_t* vmaddr, uint64_t* size);
+
+//translate a file offset inside the image to the address read through macho_read_t
+uint64_t macho_file_to_address(const MachOImage* image, uint64_t fileoff, uint64_t address, bool in_memory);
+
+//find the segment [offset] (from the start of __TEXT) is in, NULL when it's in none. __PAGEZERO and __LINKEDIT don't count
+//images in the shared cache have their segments spread out between other images, so offset < size doesn't mean it's ours
+const MachOSegment* macho_segment_at(const MachOImage* image, uint64_t offset);
+
+//find the closest symbol at or below [offset] (offset from the start of __TEXT)
+const MachOSymbol* macho_lookup(const MachOImage* image, uint64_t offset);
+
+//find a named symbol, returns its offset or UINT64_MAX. linear since it's only used for one-off lookups
+uint64_t macho_find_symbol(const MachOImage* image, const char* name);
+
+//get the name of a symbol (leading underscore stripped)
+const char* macho_symbol_name(const MachOImage* image, const MachOSymbol* symbol);
+
+//free everything macho_parse_* allocated (or unmap the symbol cache it came from)
+void macho_free(MachOImage* image);
+
+//mmap a Mach-O file and find its arm64 slice
+bool macho_file_open(MachOFile* file, const char* path);
+void macho_file_close(MachOFile* file);
+
+//macho_read_t for a MachOFile. context is the MachOFile
+bool macho_file_read(void* context, uint64_t offset, void* out, size_t size);
+
+//open, parse and close a file in one go
+bool macho_parse_file(MachOImage* image, const char* path);
+
+#endif /* MACHO_H */
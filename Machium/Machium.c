@@ -2,13 +2,28 @@
 #include "Memory.h"
 #include "Register.h"
 #include "Breakpoint.h"
-
-machium_command_t machium_exit() {
+#include "Image.h"
+#include "Target.h"
+#include "Job.h"
+#include "Heap.h"
+#include "Strings.h"
+#include "Snapshot.h"
+#include "Core.h"
+#include "Hook.h"
+#include "Coverage.h"
+#include "Integrity.h"
+#include "Step.h"
+#include "ObjC.h"
+#include "Layout.h"
+#include "Output.h"
+
+machium_command_t machium_exit(Machium* machium) {
     MACHIUM_EXIT;
 }
 
-void invalid_arg(Machium* machium) {
-    printf(ERROR"Invalid argument: \'%s\'\n", machium->args[0]);
+machium_command_t invalid_arg(Machium* machium) {
+    output_error(KERN_SUCCESS, "Invalid argument: \'%s\'", machium->args[0]);
+    return MACHIUM_FAILURE;
 }
 
 /*
@@ -19,60 +34,203 @@ machium->args[1] -> [command]
 */
 machium_command_t m_help(Machium* machium) {
     if (machium->args_count == 1) {
-        printf(GOOD"List of commands. Type help [command] for more info:\n");
-        printf(YELLOW "write "WHITE"- write to memory\n");
-        printf(YELLOW"read "WHITE"- read from memory\n");
-        printf(YELLOW"register "WHITE"- read/write registers\n");
-        printf(YELLOW"breakpoint "WHITE"- set/remove breakpoints\n");
-        printf(YELLOW"watchpoint "WHITE"- set/remove watchpoints\n");
-        printf(YELLOW"pause "WHITE"- pauses debug task\n");
-        printf(YELLOW"continue "WHITE"- continues debug task\n");
-        printf(YELLOW"pid "WHITE"- lists pid or changes the process id\n");
-        printf(YELLOW"exit "WHITE"- quits Machium debugger\n");
+        output_message(OUTPUT_LEVEL_GOOD, "List of commands. Type help [command] for more info:");
+        output_textf(YELLOW "write "WHITE"- write to memory\n");
+        output_textf(YELLOW"read "WHITE"- read from memory\n");
+        output_textf(YELLOW"layout "WHITE"- define struct layouts for 'read array'\n");
+        output_textf(YELLOW"register "WHITE"- read/write registers\n");
+        output_textf(YELLOW"breakpoint "WHITE"- set/remove breakpoints\n");
+        output_textf(YELLOW"watchpoint "WHITE"- set/remove watchpoints\n");
+        output_textf(YELLOW"hook "WHITE"- count calls of a function and record their arguments without stopping the task\n");
+        output_textf(YELLOW"coverage "WHITE"- record which basic blocks run with one-shot breakpoints\n");
+        output_textf(YELLOW"integrity "WHITE"- watch executable memory for patches in the background\n");
+        output_textf(YELLOW"step "WHITE"- single step one instruction of thread 0\n");
+        output_textf(YELLOW"next "WHITE"- step one instruction of thread 0, running over calls\n");
+        output_textf(YELLOW"trace "WHITE"- single step thread 0 many times and save every pc to a file\n");
+        output_textf(YELLOW"pause "WHITE"- pauses debug task\n");
+        output_textf(YELLOW"continue "WHITE"- continues debug task\n");
+        output_textf(YELLOW"pid "WHITE"- lists pid or changes the process id\n");
+        output_textf(YELLOW"image "WHITE"- list images and symbolicate addresses\n");
+        output_textf(YELLOW"objc "WHITE"- list Objective-C classes and inspect objects\n");
+        output_textf(YELLOW"target "WHITE"- attach to and switch between processes\n");
+        output_textf(YELLOW"all "WHITE"- run a command on every target\n");
+        output_textf(YELLOW"dump "WHITE"- dump memory to a file\n");
+        output_textf(YELLOW"load "WHITE"- write a file to memory\n");
+        output_textf(YELLOW"snapshot "WHITE"- snapshot memory to diff later\n");
+        output_textf(YELLOW"diff "WHITE"- show what changed between two snapshots\n");
+        output_textf(YELLOW"strings "WHITE"- find ASCII and UTF-16 strings in memory\n");
+        output_textf(YELLOW"heap "WHITE"- census of the malloc heap by size and class\n");
+        output_textf(YELLOW"coredump "WHITE"- write a core file of the debug task\n");
+        output_textf(YELLOW"output "WHITE"- switch between text, json lines and binary output\n");
+        output_textf(YELLOW"jobs "WHITE"- list background jobs, end any command with '&' to start one\n");
+        output_textf(YELLOW"kill "WHITE"- cancel a background job\n");
+        output_textf(YELLOW"wait "WHITE"- wait for background jobs to finish\n");
+        output_textf(YELLOW"exit "WHITE"- quits Machium debugger\n");
         return MACHIUM_SUCCESS;
     }
     if (!strcmp(machium->args[1], "help")) {
-        printf("Thought I wouldn't program in this edge case?\n");
+        output_textf("Thought I wouldn't program in this edge case?\n");
     }
     else if (!strcmp(machium->args[1], "exit")) {
-        printf(YELLOW"[exit/q/quit] "WHITE"- exits Machium debugger\n");
+        output_textf(YELLOW"[exit/q/quit] "WHITE"- exits Machium debugger\n");
     }
     else if (!strcmp(machium->args[1], "pid")) {
-        printf(YELLOW"pid "WHITE"- lists process ID of debug task\n");
-        printf(YELLOW"pid [pid] "WHITE"- changes process ID of debug task to [pid]\n");
+        output_textf(YELLOW"pid "WHITE"- lists process ID of debug task\n");
+        output_textf(YELLOW"pid [pid] "WHITE"- changes process ID of debug task to [pid]\n");
     }
     else if (!strcmp(machium->args[1], "write")) {
-        printf(YELLOW"[write/w] [0xaddress] [0xdata]"WHITE" - writes [0xdata] to [address]\n");
+        output_textf(YELLOW"[write/w] [0xaddress] [0xdata]"WHITE" - writes [0xdata] to [address]\n");
     }
     else if (!strcmp(machium->args[1], "read")) {
-        printf(YELLOW"[read/r] [bytes/b] [0xaddress] [size]"WHITE" - reads [size] amount of bytes at [0xaddress]\n");
-        printf(YELLOW"[read/r] [value/v] [0xaddress] [size]"WHITE" - reads [size <= 8] value at [0xaddress]\n");
-        printf(YELLOW"[read/r] [lines/l] char [0xaddress] [lines]"WHITE" - reads [lines] amount of lines of memory as ASCII at [0xaddress]\n");
-        printf(YELLOW"[read/r] [lines/l] bytes [0xaddress] [lines]"WHITE" - reads [lines] amount of lines of memory as bytes at [0xaddress]\n");
+        output_textf(YELLOW"[read/r] [bytes/b] [0xaddress] [size]"WHITE" - reads [size] amount of bytes at [0xaddress]\n");
+        output_textf(YELLOW"[read/r] [value/v] [0xaddress] [size]"WHITE" - reads [size <= 8] value at [0xaddress]\n");
+        output_textf(YELLOW"[read/r] [lines/l] char [0xaddress] [lines]"WHITE" - reads [lines] amount of lines of memory as ASCII at [0xaddress]\n");
+        output_textf(YELLOW"[read/r] [lines/l] bytes [0xaddress] [lines]"WHITE" - reads [lines] amount of lines of memory as bytes at [0xaddress]\n");
+        output_textf(YELLOW"[read/r] [array/a] [layout] [0xaddress] [count] [stride]"WHITE" - reads [count] structs of [layout] at [0xaddress] in one read and prints them as columns\n");
+        output_textf("[stride] is optional, the size of the layout by default\n");
+    }
+    else if (!strcmp(machium->args[1], "output")) {
+        output_textf(YELLOW"output"WHITE" - prints the output mode\n");
+        output_textf(YELLOW"output [text/json/binary]"WHITE" - switches the output mode, MACHIUM_OUTPUT=[mode] picks it at launch\n");
+        output_textf("json prints one object per line with a \"type\", binary prints an OutputBinaryHeader and its payload per record (see Output.h)\n");
+        output_textf("Commands that don't emit records yet have their text wrapped into \"text\" records, so the stream stays parseable\n");
+    }
+    else if (!strcmp(machium->args[1], "layout")) {
+        output_textf(YELLOW"layout [list/l]"WHITE" - lists layouts\n");
+        output_textf(YELLOW"layout [show/s] [name]"WHITE" - prints the fields of layout [name]\n");
+        output_textf(YELLOW"layout [define/d] [name] [field:offset:type] ..."WHITE" - defines layout [name] and saves it for later sessions\n");
+        output_textf(YELLOW"layout load [file]"WHITE" - loads the layouts in [file], see Layout.h for the format\n");
+        output_textf("Types -> u8-u64, i8-i64, x8-x64 (hex), f32, f64, ptr, bool, char[N], bytes[N]\n");
     }
     else if (!strcmp(machium->args[1], "register")) {
-        printf(YELLOW"[register/reg] write [register] [0xdata]"WHITE" - writes [0xdata] to [register]\n");
-        printf(YELLOW"[register/reg] read"WHITE" - prints all registers\n");
-        printf("Valid registers -> x0-x28, pc, lr, cpsr, pad\n");
+        output_textf(YELLOW"[register/reg] write [register] [0xdata]"WHITE" - writes [0xdata] to [register]\n");
+        output_textf(YELLOW"[register/reg] read"WHITE" - prints all registers\n");
+        output_textf("Valid registers -> x0-x28, pc, lr, cpsr, pad\n");
     }
     else if (!strcmp(machium->args[1], "breakpoint")) {
-        printf(YELLOW"[breakpoint/br] [set/s] [0xaddress]"WHITE" - sets breakpoint at [0xaddress]\n");
-        printf(YELLOW"[breakpoint/br] [remove/r]"WHITE" - removes breakpoint\n");
-        printf("Max number of breakpoints is 6!\n");
+        output_textf(YELLOW"[breakpoint/br] [set/s] [0xaddress]"WHITE" - sets breakpoint at [0xaddress]\n");
+        output_textf(YELLOW"[breakpoint/br] [remove/r]"WHITE" - removes breakpoint\n");
+        output_textf("Max number of breakpoints is 6!\n");
     }
     else if (!strcmp(machium->args[1], "watchpoint")) {
-        printf(YELLOW"[watchpoint/wa] [set/s] [0xaddress]"WHITE" - sets watchpoint at [0xaddress]\n");
-        printf(YELLOW"[watchpoint/wa] [remove/r]"WHITE" - removes watchpoint\n");
-        printf("Max number of watchpoints is 6!\n");
+        output_textf(YELLOW"[watchpoint/wa] [set/s] [0xaddress]"WHITE" - sets watchpoint at [0xaddress]\n");
+        output_textf(YELLOW"[watchpoint/wa] [remove/r]"WHITE" - removes watchpoint\n");
+        output_textf("Max number of watchpoints is 6!\n");
+    }
+    else if (!strcmp(machium->args[1], "hook")) {
+        output_textf(YELLOW"[hook/hk] [0xaddress]"WHITE" - hooks the function at [0xaddress] and counts its calls\n");
+        output_textf(YELLOW"[hook/hk] [0xaddress] args"WHITE" - same, and records x0-x7, lr, sp and the thread of the last %d calls\n", HOOK_RING_ENTRIES);
+        output_textf(YELLOW"[hook/hk] [list/l]"WHITE" - lists hooks with their call counts\n");
+        output_textf(YELLOW"[hook/hk] log [id] [count]"WHITE" - prints the last [count] recorded calls of hook [id]\n");
+        output_textf(YELLOW"[hook/hk] [remove/rm] [id]"WHITE" - removes hook [id]\n");
+        output_textf(YELLOW"[hook/hk] clear"WHITE" - removes every hook\n");
+        output_textf("The first %d bytes of the function are replaced by a jump to a trampoline, they can't contain a call\n", HOOK_PATCH_SIZE);
+        output_textf("or be jumped back into, and x16 / x17 get clobbered on entry like any call through a stub does\n");
+    }
+    else if (!strcmp(machium->args[1], "coverage")) {
+        output_textf(YELLOW"[coverage/cov] start [file]"WHITE" - puts a one-shot breakpoint on every block address in [file] (hex, one per line)\n");
+        output_textf(YELLOW"[coverage/cov] start image [name]"WHITE" - same for every function start of image [name]\n");
+        output_textf(YELLOW"[coverage/cov] [status]"WHITE" - prints how many blocks were hit\n");
+        output_textf(YELLOW"[coverage/cov] stop"WHITE" - takes the breakpoints of blocks that weren't hit out again\n");
+        output_textf(YELLOW"[coverage/cov] save [file]"WHITE" - writes the hit blocks to [file] as drcov\n");
+        output_textf(YELLOW"[coverage/cov] save [file] raw"WHITE" - writes the hit bitmap instead, bit i is the i-th lowest block address\n");
+        output_textf("Every block traps once, gets its instruction back and runs on, the CLI is never woken up for a hit\n");
+    }
+    else if (!strcmp(machium->args[1], "integrity")) {
+        output_textf(YELLOW"[integrity/ic] start [interval] [shared]"WHITE" - hashes every executable region and re-checks it every [interval] ms (default %d)\n", INTEGRITY_INTERVAL);
+        output_textf(YELLOW"[integrity/ic] [status]"WHITE" - prints how long passes take and every change found\n");
+        output_textf(YELLOW"[integrity/ic] stop"WHITE" - stops checking, the changes stay for 'integrity status'\n");
+        output_textf("Regions are hashed in %d MB blocks, only a block whose hash changed is compared with the baseline byte by byte\n", INTEGRITY_BLOCK / (1024 * 1024));
+        output_textf("New changes are printed before the next prompt. 'shared' watches the shared cache as well\n");
+    }
+    else if (!strcmp(machium->args[1], "step") || !strcmp(machium->args[1], "next")) {
+        output_textf(YELLOW"[step/si]"WHITE" - runs one instruction of thread 0 and prints the registers it changed\n");
+        output_textf(YELLOW"[next/ni]"WHITE" - same, but a bl / blr runs until the call returns (every thread runs meanwhile)\n");
+        output_textf("The task is left paused, 'continue' resumes it\n");
+    }
+    else if (!strcmp(machium->args[1], "trace")) {
+        output_textf(YELLOW"[trace/tr] [count] [file]"WHITE" - single steps thread 0 [count] times and saves every pc to [file]\n");
+        output_textf(YELLOW"[trace/tr] [count] [file] regs"WHITE" - also saves the registers each step changed\n");
+        output_textf("pcs and registers are stored as zigzag varint deltas, see StepTraceHeader in Step.h for the format\n");
+    }
+    else if (!strcmp(machium->args[1], "image")) {
+        output_textf(YELLOW"[image/im] [list/l]"WHITE" - lists loaded images\n");
+        output_textf(YELLOW"[image/im] [lookup/lo] [0xaddress]"WHITE" - prints image`symbol+offset of [0xaddress]\n");
+        output_textf(YELLOW"[image/im] [lookup/lo] [symbol]"WHITE" - prints the address of [symbol]\n");
+        output_textf(YELLOW"[image/im] reload"WHITE" - reloads the image list after new images were loaded\n");
+        output_textf(YELLOW"[image/im] shared"WHITE" - prints the shared cache file symbols of images in the cache come from\n");
+        output_textf(YELLOW"[image/im] shared [path]"WHITE" - uses the cache file at [path] when none was found, it has to be the task's\n");
+        output_textf("The shared cache file is indexed once in the background, locals included, and mapped with its slide\n");
+    }
+    else if (!strcmp(machium->args[1], "objc")) {
+        output_textf(YELLOW"[objc/oc] [classes]"WHITE" - lists how many classes every image has\n");
+        output_textf(YELLOW"[objc/oc] classes [image]"WHITE" - lists the classes of [image] with their sizes\n");
+        output_textf(YELLOW"[objc/oc] [inspect/i] [0xaddress]"WHITE" - prints the class, superclasses, ivar values and methods of the object at [0xaddress]\n");
+        output_textf("Classes are decoded once per target and cached, inspecting an object after that is a single read\n");
+    }
+    else if (!strcmp(machium->args[1], "target")) {
+        output_textf(YELLOW"[target/t] [list/l]"WHITE" - lists attached targets, * marks the selected one\n");
+        output_textf(YELLOW"[target/t] [add/a] [pid] [name]"WHITE" - attaches to [pid], optionally naming it [name]\n");
+        output_textf(YELLOW"[target/t] [select/s] [name/pid]"WHITE" - makes every command work on [name/pid]\n");
+        output_textf(YELLOW"[target/t] [remove/r] [name/pid]"WHITE" - detaches from [name/pid]\n");
+        output_textf("Max number of targets is %d!\n", MACHIUM_MAX_TARGETS);
+    }
+    else if (!strcmp(machium->args[1], "all")) {
+        output_textf(YELLOW"all [command] ..."WHITE" - runs a command on every target, results are tagged by pid\n");
+    }
+    else if (!strcmp(machium->args[1], "dump")) {
+        output_textf(YELLOW"dump [0xaddress] [size] [file]"WHITE" - writes [size] bytes at [0xaddress] to [file]\n");
+    }
+    else if (!strcmp(machium->args[1], "load")) {
+        output_textf(YELLOW"load [file] [0xaddress]"WHITE" - writes the contents of [file] to [0xaddress] and checks them by hash\n");
+        output_textf("Pages that aren't writable are only made writable while they're written\n");
+    }
+    else if (!strcmp(machium->args[1], "snapshot")) {
+        output_textf(YELLOW"snapshot"WHITE" - snapshots every writable region\n");
+        output_textf(YELLOW"snapshot [0xaddress] [size]"WHITE" - snapshots [size] bytes at [0xaddress]\n");
+        output_textf(YELLOW"snapshot [list/l]"WHITE" - lists snapshots\n");
+        output_textf(YELLOW"snapshot clear"WHITE" - frees every snapshot\n");
+        output_textf("Pages that didn't change since the previous snapshot aren't stored again\n");
+    }
+    else if (!strcmp(machium->args[1], "diff")) {
+        output_textf(YELLOW"diff"WHITE" - prints what changed between the two newest snapshots\n");
+        output_textf(YELLOW"diff [old] [new]"WHITE" - prints what changed from snapshot [old] to [new], the newest if [new] is missing\n");
+    }
+    else if (!strcmp(machium->args[1], "strings")) {
+        output_textf(YELLOW"strings all [options]"WHITE" - scans every readable region for strings\n");
+        output_textf(YELLOW"strings image [name] [options]"WHITE" - scans the image [name]\n");
+        output_textf(YELLOW"strings [0xaddress] [size] [options]"WHITE" - scans [size] bytes at [0xaddress]\n");
+        output_textf("Options -> min [length] (default %d), find [text], regex [pattern], out [file]\n", STRINGS_MIN_LENGTH);
+        output_textf("Lines are [address] [a/u] [string], a for ASCII and u for UTF-16\n");
+    }
+    else if (!strcmp(machium->args[1], "heap")) {
+        output_textf(YELLOW"heap"WHITE" - walks every malloc zone and prints allocations by size class and the top 20 objc classes\n");
+        output_textf(YELLOW"heap [classes]"WHITE" - same, printing the top [classes] objc classes\n");
+    }
+    else if (!strcmp(machium->args[1], "coredump")) {
+        output_textf(YELLOW"coredump [file]"WHITE" - writes a Mach-O core of the task to [file], the task is only paused while memory is read\n");
+        output_textf(YELLOW"coredump [file] full"WHITE" - same, including the shared cache\n");
+        output_textf("Zero pages aren't written, open the core with lldb -c [file]\n");
+    }
+    else if (!strcmp(machium->args[1], "jobs")) {
+        output_textf(YELLOW"[command] &"WHITE" - runs [command] in the background\n");
+        output_textf(YELLOW"jobs"WHITE" - lists background jobs with their progress\n");
+    }
+    else if (!strcmp(machium->args[1], "kill")) {
+        output_textf(YELLOW"kill [job]"WHITE" - cancels background job [job]\n");
+    }
+    else if (!strcmp(machium->args[1], "wait")) {
+        output_textf(YELLOW"wait"WHITE" - waits for every background job\n");
+        output_textf(YELLOW"wait [job]"WHITE" - waits for background job [job]\n");
     }
     else if (!strcmp(machium->args[1], "pause")) {
-        printf(YELLOW"[pause/p] "WHITE"- pauses debug task\n");
+        output_textf(YELLOW"[pause/p] "WHITE"- pauses debug task\n");
     }
     else if (!strcmp(machium->args[1], "continue")) {
-        printf(YELLOW"[continue/c] "WHITE"- resumes debug task\n");
+        output_textf(YELLOW"[continue/c] "WHITE"- resumes debug task\n");
     }
     else {
-        printf(ERROR"Unknown command!\n");
+        output_error(KERN_SUCCESS, "Unknown command!");
     }
 
     return MACHIUM_SUCCESS;
@@ -81,10 +239,10 @@ machium_command_t m_help(Machium* machium) {
 //pause target task
 machium_command_t m_pause(Machium* machium) {
     kern_return_t kret;
-    kret = task_suspend(machium->debug_task);
-    printf(GOOD"Pausing task...\n");
+    kret = task_suspend(machium->target->debug_task);
+    output_message(OUTPUT_LEVEL_GOOD, "Pausing task...");
     if (kret != KERN_SUCCESS) {
-        printf(ERROR"Unable to pause debug task!\n");
+        output_error(KERN_SUCCESS, "Unable to pause debug task!");
         return MACHIUM_FAILURE;
     }
     return MACHIUM_SUCCESS;
@@ -93,10 +251,10 @@ machium_command_t m_pause(Machium* machium) {
 //resume target task
 machium_command_t m_continue(Machium* machium) {
     kern_return_t kret;
-    kret = task_resume(machium->debug_task); //unpauses task
-    printf(GOOD"Resuming task...\n");
+    kret = task_resume(machium->target->debug_task); //unpauses task
+    output_message(OUTPUT_LEVEL_GOOD, "Resuming task...");
     if (kret != KERN_SUCCESS) {
-        printf(ERROR"Unable to resume debug task!\n");
+        output_error(KERN_SUCCESS, "Unable to resume debug task!");
         return MACHIUM_FAILURE;
     }
     return MACHIUM_SUCCESS;
@@ -139,25 +297,110 @@ void* get_machium_command(Machium* machium) {
     else if (!strcmp(machium->args[0], "watchpoint")) return m_watchpoint;
     else if (!strcmp(machium->args[0], "wa")) return m_watchpoint;
 
+    //m_hook
+    else if (!strcmp(machium->args[0], "hook")) return m_hook;
+    else if (!strcmp(machium->args[0], "hk")) return m_hook;
+
+    //m_step / m_next / m_trace
+    else if (!strcmp(machium->args[0], "step")) return m_step;
+    else if (!strcmp(machium->args[0], "si")) return m_step;
+    else if (!strcmp(machium->args[0], "next")) return m_next;
+    else if (!strcmp(machium->args[0], "ni")) return m_next;
+    else if (!strcmp(machium->args[0], "trace")) return m_trace;
+    else if (!strcmp(machium->args[0], "tr")) return m_trace;
+
+    //m_coverage
+    else if (!strcmp(machium->args[0], "coverage")) return m_coverage;
+    else if (!strcmp(machium->args[0], "cov")) return m_coverage;
+
+    //m_integrity
+    else if (!strcmp(machium->args[0], "integrity")) return m_integrity;
+    else if (!strcmp(machium->args[0], "ic")) return m_integrity;
+
+    //m_image
+    else if (!strcmp(machium->args[0], "image")) return m_image;
+    else if (!strcmp(machium->args[0], "im")) return m_image;
+
+    //m_output
+    else if (!strcmp(machium->args[0], "output")) return m_output;
+
+    //m_layout
+    else if (!strcmp(machium->args[0], "layout")) return m_layout;
+
+    //m_objc
+    else if (!strcmp(machium->args[0], "objc")) return m_objc;
+    else if (!strcmp(machium->args[0], "oc")) return m_objc;
+
+    //m_target
+    else if (!strcmp(machium->args[0], "target")) return m_target;
+    else if (!strcmp(machium->args[0], "t")) return m_target;
+
+    //m_all
+    else if (!strcmp(machium->args[0], "all")) return m_all;
+
+    //m_dump
+    else if (!strcmp(machium->args[0], "dump")) return m_dump;
+
+    //m_load
+    else if (!strcmp(machium->args[0], "load")) return m_load;
+
+    //m_snapshot
+    else if (!strcmp(machium->args[0], "snapshot")) return m_snapshot;
+    else if (!strcmp(machium->args[0], "diff")) return m_diff;
+
+    //m_strings
+    else if (!strcmp(machium->args[0], "strings")) return m_strings;
+
+    //m_heap
+    else if (!strcmp(machium->args[0], "heap")) return m_heap;
+
+    //m_coredump
+    else if (!strcmp(machium->args[0], "coredump")) return m_coredump;
+
+    //background jobs
+    else if (!strcmp(machium->args[0], "jobs")) return m_jobs;
+    else if (!strcmp(machium->args[0], "kill")) return m_kill;
+    else if (!strcmp(machium->args[0], "wait")) return m_wait;
+
     //m_help
     else if (!strcmp(machium->args[0], "help")) return m_help;
     return &invalid_arg;
 }
 
+/*
+commands that only read the task and leave Machium's state alone, the only ones that can be ended with '&'
+anything else could change what a running job is looking at, or have it changed under itself
+*/
+static bool background_allowed(Machium* machium) {
+    static const char* allowed[] = { "read", "r", "dump", "strings", "heap", "coredump", "diff" };
+
+    for (size_t i = 0; i < sizeof(allowed) / sizeof(allowed[0]); i++) {
+        if (!strcmp(machium->args[0], allowed[i]))
+            return true;
+    }
+    return false;
+}
+
 //command line interface
 void machium_cli(Machium* machium) {
-    char input[40]; //store direct input
+    char input[MACHIUM_INPUT_LENGTH]; //store direct input
     uint8_t args_index; //store index of each arguments
+    bool background; //command ended with '&'
 
-    machium_command_t* (*machium_call)(); //call function returned by get_machium_command
+    job_command_t machium_call; //call function returned by get_machium_command
 
-    printf(GOOD"For a list of commands, type 'help'\n");
+    output_message(OUTPUT_LEVEL_GOOD, "For a list of commands, type 'help'");
 
     while (1) {
-        memset(machium->args, 0, sizeof(char)*5*20); //fix end-of-line for arguments
+        memset(machium->args, 0, sizeof(machium->args)); //fix end-of-line for arguments
 
-        printf(NAME);
-        fgets(input, 40, stdin); //get user input
+        job_report(); //let the user know about background jobs that finished
+        integrity_report(machium); //and about code the integrity monitor saw change
+        if (output_mode() == OUTPUT_TEXT)
+            output_textf(NAME);
+        output_flush();
+        if (fgets(input, MACHIUM_INPUT_LENGTH, stdin) == NULL) //get user input
+            machium_exit(machium); //stdin closed, automation is done with us
 
         machium->args_count = 0; //reset arg values
         args_index = 0;
@@ -165,65 +408,170 @@ void machium_cli(Machium* machium) {
         for (int input_index = 0; input_index < strlen(input) + 1; input_index++) {
             if (input[input_index] == ' ' || input[input_index] == '\n') { //see if theres a space indicating a new argument or end of line
                 machium->args_count++; //increase argument count if true
-                if (machium->args_count > 4) {
-                    break; //don't store more than 5 arguments
+                if (machium->args_count > MACHIUM_MAX_ARGS - 1) {
+                    break; //don't store more than MACHIUM_MAX_ARGS arguments
                 }
                 args_index = 0; //reset index of args
                 input_index++;
             }
             machium->args[machium->args_count][args_index] = input[input_index]; //store input
-            if (args_index < 20) {
+            if (args_index < MACHIUM_ARG_LENGTH - 2) {
                 args_index++; //buffer overflows aren't cool.
             }
         }
+        //a trailing '&' runs the command in the background
+        background = false;
+        if (machium->args_count > 1 && !strcmp(machium->args[machium->args_count - 1], "&")) {
+            machium->args_count--;
+            memset(machium->args[machium->args_count], 0, MACHIUM_ARG_LENGTH);
+            background = true;
+        }
+
         machium_call = get_machium_command(machium);
-        machium_call(machium); //get command and call function for it
+        if (background && !background_allowed(machium))
+            output_error(KERN_SUCCESS, "'%s' can't run in the background, only read, dump, strings, heap, coredump and diff can", machium->args[0]);
+        else if (background)
+            job_start(machium, machium_call, input);
+        else
+            machium_call(machium); //get command and call function for it
+        output_flush(); //everything a command outputs goes out in one write
+    }
+}
+
+
+//startup phases --timing prints
+typedef struct StartupTiming {
+    struct {
+        const char* name;
+        double time; //seconds since the phase before
+    } phases[8];
+    uint8_t count;
+    double last;
+    double launched; //seconds from launch to main, -1 if unknown
+} StartupTiming;
+
+static void startup_phase(StartupTiming* timing, const char* name) {
+    double now = job_time();
+
+    timing->phases[timing->count].name = name;
+    timing->phases[timing->count++].time = now - timing->last;
+    timing->last = now;
+}
+
+static void startup_print(StartupTiming* timing) {
+    double total;
+
+    total = timing->launched > 0 ? timing->launched : 0;
+    output_message(OUTPUT_LEVEL_GOOD, "Startup timing:");
+    if (timing->launched >= 0)
+        output_textf("  %-18s" YELLOW "%8.2fms\n" WHITE, "launch -> main", timing->launched * 1000.0);
+    for (uint8_t i = 0; i < timing->count; i++) {
+        output_textf("  %-18s" YELLOW "%8.2fms\n" WHITE, timing->phases[i].name, timing->phases[i].time * 1000.0);
+        total += timing->phases[i].time;
     }
+    output_textf("  %-18s" YELLOW "%8.2fms" WHITE " to the first prompt\n", "total", total * 1000.0);
 }
 
+static void machium_usage(const char* path) {
+    output_message(OUTPUT_LEVEL_GOOD, "Usage: %s [pid] [--timing]", path);
+    output_message(OUTPUT_LEVEL_GOOD, "       %s [--timing] --spawn [path] [args]", path);
+    output_message(OUTPUT_LEVEL_GOOD, "       %s [--timing] --wait-for [name]", path);
+}
 
+/*
+nothing optional starts up here: images, symbols, views, the thread pool and the exception servers
+all wait for the first command that needs them, so the prompt is up as soon as the task port is
+*/
 int main(int argc, char *argv[]) {
     Machium* machium;
-    kern_return_t kret; //hold debug task (obtained via tfp());
+    StartupTiming timing;
+    char** spawn;
+    const char* wait_for;
+    bool show_timing;
+    bool have_pid;
+    pid_t pid;
+
+    memset(&timing, 0, sizeof(timing));
+    timing.last = job_time();
+
+    pid = 0;
+    spawn = NULL;
+    wait_for = NULL;
+    show_timing = false;
+    have_pid = false;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--timing"))
+            show_timing = true;
+        else if (!strcmp(argv[i], "--spawn") && i + 1 < argc) {
+            spawn = &argv[i + 1]; //everything after the path belongs to the program
+            break;
+        }
+        else if (!strcmp(argv[i], "--wait-for") && i + 1 < argc)
+            wait_for = argv[++i];
+        else if (argv[i][0] != '-' && !have_pid) {
+            pid = strtol(argv[i], NULL, 0);
+            have_pid = true;
+        }
+        else {
+            machium_usage(argv[0]);
+            return 1;
+        }
+    }
+    timing.launched = show_timing ? target_age(getpid()) : -1;
+
+    machium = (Machium*) calloc(1, sizeof(struct Machium));
+    if (machium)
+        machium->session = (MachiumSession*) calloc(1, sizeof(MachiumSession));
+    if (machium == NULL || machium->session == NULL) {
+        output_error(KERN_SUCCESS, "Out of memory");
+        return 1;
+    }
 
-    machium = (Machium*) malloc(sizeof(struct Machium));
+    //automation can pick json / binary before the first line is printed
+    if (getenv(OUTPUT_MODE_ENV) && !strcmp(getenv(OUTPUT_MODE_ENV), "json"))
+        output_set_mode(OUTPUT_JSON);
+    else if (getenv(OUTPUT_MODE_ENV) && !strcmp(getenv(OUTPUT_MODE_ENV), "binary"))
+        output_set_mode(OUTPUT_BINARY);
 
-    printf(YELLOW "# " WHITE "Welcome to Machium Debugger!\n" WHITE);
+    output_textf(YELLOW "# " WHITE "Welcome to Machium Debugger!\n" WHITE);
 
     //test if we're running as root
     if (geteuid() && getuid()) {
-        printf(ERROR"Run Machium as root!\n");
-        machium_exit();
+        output_error(KERN_SUCCESS, "Run Machium as root!");
+        machium_exit(machium);
     }
+    startup_phase(&timing, "setup");
 
-    if (argc == 1) {
-        //get pid to attach
-        printf(GOOD"PID to attach: ");
-        scanf("%d", &machium->pid);
-        getchar();
+    //the first target starts out selected, more can be attached with 'target add'
+    if (spawn) {
+        machium->target = target_spawn(machium, spawn);
+        startup_phase(&timing, "spawn + attach");
     }
-    else if (argc == 2) {
-        machium->pid = strtol(argv[1], NULL, 0);
+    else if (wait_for) {
+        machium->target = target_wait_for(machium, wait_for);
+        startup_phase(&timing, "wait + attach");
     }
-
-    if (machium->pid == 0) {
-        printf(ERROR"Machium doesn't support debugging on kernel_task! (task_for_pid(0))\n");
-        printf(ERROR"You don't want any unwanted kernel panics, right?\n");
-        machium_exit();
+    else {
+        if (!have_pid) {
+            //get pid to attach
+            output_textf(GOOD"PID to attach: ");
+            output_flush();
+            scanf("%d", &pid);
+            getchar();
+            startup_phase(&timing, "pid prompt");
+        }
+        machium->target = target_attach(machium, pid, NULL);
+        if (machium->target)
+            output_message(OUTPUT_LEVEL_GOOD, "Obtained task_for_pid(%d)", machium->target->pid);
+        startup_phase(&timing, "attach");
+    }
+    if (machium->target == NULL) {
+        machium_exit(machium);
     }
 
+    if (show_timing)
+        startup_print(&timing);
 
-    //task_for_pid gets a send right to the task of the process ID indicated by the second argument and stores it in the third argument
-    //send rights can be stored in mach_port_t variables
-    kret = task_for_pid(mach_task_self(), machium->pid, &machium->debug_task);
-    if (kret != KERN_SUCCESS) {
-        printf(ERROR"Couldn't obtain task_for_pid(%d)!\n", machium->pid);
-        printf(ERROR"Do you have proper entitlements?\n");
-        machium_exit();
-    }
-    else {
-        printf(GOOD"Obtained task_for_pid(%d)\n", machium->pid);
-    }
     machium_cli(machium); //start CLI
     return 0;
 }
@@ -23,19 +23,52 @@
 #define ERROR RED "# " WHITE
 #define WARNING YELLOW "# " WHITE
 #define MACHIUM_EXIT\
-                    printf(ERROR"Exiting Machium...\n");\
+                    output_error(KERN_SUCCESS, "Exiting Machium...");\
                     exit(0);
 #define NAME BLUE "(Machium) " WHITE
 
 #define MACHIUM_FAILURE 0
 #define MACHIUM_SUCCESS 1
 
+#define MACHIUM_MAX_TARGETS 16 //max processes attached at once
+#define MACHIUM_MAX_ARGS 8 //max arguments of a CLI command
+#define MACHIUM_ARG_LENGTH 64 //max length of one argument
+#define MACHIUM_INPUT_LENGTH 256 //max length of a CLI line
+#define MACHIUM_PC_MASK 0x0000000fffffffffULL //pc without pointer authentication bits
+
 typedef int8_t machium_command_t;
 
-typedef struct Machium {
+//everything Machium knows about one attached process
+typedef struct MachiumTarget {
+    char name[MACHIUM_ARG_LENGTH]; //name given with 'target add', the pid by default
     pid_t pid; //process ID of application being debugged
     mach_port_t debug_task; //task port of application being debugged
-    char args[5][20]; //command line arguments of user
+    struct ImageIndex* images; //loaded images of the debug task, see Image.h. NULL until first used
+    struct SnapshotSet* snapshots; //memory snapshots for 'diff', see Snapshot.h. NULL until the first snapshot
+    struct ViewCache* views; //task memory mapped into Machium, see View.h. NULL until first used
+    struct HookSet* hooks; //inline hooks placed in the task, see Hook.h. NULL until the first hook
+    struct Coverage* coverage; //block coverage of the task, see Coverage.h. NULL until the first 'coverage start'
+    struct ObjCCache* objc; //decoded Objective-C classes of the task, see ObjC.h. NULL until first used
+    struct Integrity* integrity; //code integrity monitor of the task, see Integrity.h. NULL until the first 'integrity start'
+
+    //hardware breakpoint / watchpoint state, see Breakpoint.c
+    uint8_t br_count; //breakpoint count
+    uint8_t wa_count; //watchpoint count
+    bool started_exception_server;
+} MachiumTarget;
+
+//state of the whole debugger, the CLI and every background job see the same one
+typedef struct MachiumSession {
+    MachiumTarget targets[MACHIUM_MAX_TARGETS]; //every attached process, see Target.h
+    uint8_t target_count;
+    struct LayoutSet* layouts; //struct layouts for 'read array', see Layout.h. NULL until first used
+} MachiumSession;
+
+//what a command runs with. a background job gets its own copy so the CLI can parse the next command meanwhile
+typedef struct Machium {
+    MachiumSession* session;
+    MachiumTarget* target; //selected target, every command works on this one
+    char args[MACHIUM_MAX_ARGS][MACHIUM_ARG_LENGTH]; //command line arguments of user
     uint8_t args_count; //argument count of CLI inputs
 } Machium;
 
@@ -49,10 +82,10 @@ machium_command_t m_pause(Machium* machium);
 machium_command_t m_continue(Machium* machium);
 
 //exit machium;
-machium_command_t machium_exit();
+machium_command_t machium_exit(Machium* machium);
 
 //handle invalid CLI argument
-void invalid_arg(Machium* machium);
+machium_command_t invalid_arg(Machium* machium);
 
 //return the function pointer of the machium function about to be called
 void* get_machium_command(Machium* machium);
@@ -63,4 +96,5 @@ void machium_cli(Machium* machium);
 
 
 
+
 #endif /* MACHIUM_H */
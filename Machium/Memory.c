@@ -1,234 +1,501 @@
 #include "Memory.h"
+#include "Image.h"
+#include "Target.h"
+#include "Job.h"
+#include "Region.h"
+#include "Hash.h"
+#include "Output.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /*
-m_pid handles the process id of the Debugger
+m_pid handles the process id of the selected target
 
 machium->args[0] -> pid
 machium->args[1] -> [change pid] (OPTIONAL)
 */
 machium_command_t m_pid(Machium* machium) {
     kern_return_t kret;
+    mach_port_t task;
     pid_t pid;
 
     if (machium->args_count == 1) {
-        printf(GOOD"PID of debugging task: %d\n", machium->pid);
+        output_message(OUTPUT_LEVEL_GOOD, "PID of debugging task: %d", machium->target->pid);
         return MACHIUM_SUCCESS;
     }
     else if (machium->args_count == 2) {
+        if (!target_detachable(machium->target, "pid"))
+            return MACHIUM_FAILURE;
         pid = strtol(machium->args[1], NULL, 0);
-        //task_for_pid gets a send right to the task of the process ID indicated by the second argument and stores it in the third argument
-        //send rights can be stored in mach_port_t variables
-        kret = task_for_pid(mach_task_self(), pid, &machium->debug_task);
         if (pid == 0) {
-            printf(ERROR"Machium doesn't support debugging on kernel_task! (task_for_pid(0))\n");
-            printf(ERROR"You don't want any unwanted kernel panics, right?\n");
+            output_error(KERN_SUCCESS, "Machium doesn't support debugging on kernel_task! (task_for_pid(0))");
+            output_error(KERN_SUCCESS, "You don't want any unwanted kernel panics, right?");
             return MACHIUM_FAILURE;
         }
+        //task_for_pid gets a send right to the task of the process ID indicated by the second argument and stores it in the third argument
+        //send rights can be stored in mach_port_t variables
+        kret = task_for_pid(mach_task_self(), pid, &task);
         if (kret != KERN_SUCCESS) {
-            printf(ERROR"Unable to obtain task_for_pid(%d)!\n", pid);
+            output_error(KERN_SUCCESS, "Unable to obtain task_for_pid(%d)!", pid);
             return MACHIUM_FAILURE;
         }
         else {
-            machium->pid = pid;
-            printf(GOOD"Changed debugging task to task_for_pid(%d)\n", pid);
+            target_reset(machium->target); //images and breakpoints belong to the old task
+            mach_port_deallocate(mach_task_self(), machium->target->debug_task);
+            machium->target->pid = pid;
+            machium->target->debug_task = task;
+            output_message(OUTPUT_LEVEL_GOOD, "Changed debugging task to task_for_pid(%d)", pid);
         }
     }
     else {
-        printf(ERROR"Too many arguments for 'pid', 2 max.\n");
+        output_error(KERN_SUCCESS, "Too many arguments for 'pid', 2 max.");
         return MACHIUM_FAILURE;
     }
     return MACHIUM_SUCCESS;
 }
 
 /*
-read a certain number of bytes out at a memory address
+parse read bytes
 
 machium->args[0] -> read
 machium->args[1] -> bytes
 machium->args[2] -> [address]
 machium->args[3] -> [size]
 */
-machium_command_t m_read_bytes(Machium* machium) {
-    kern_return_t kret;
-    uint64_t address;
-    size_t size;
-    uint8_t* read_out;
-
+static bool parse_read_bytes(Machium* machium, MemoryRead* read) {
     if (machium->args_count < 4) {
-        printf(ERROR"Not enough arguments for 'read bytes', 4 required\n");
-        return MACHIUM_FAILURE;
+        output_error(KERN_SUCCESS, "Not enough arguments for 'read bytes', 4 required");
+        return false;
     }
     else if (machium->args_count > 4) {
-        printf(ERROR"Too many arguments for 'read bytes', 4 required\n");
-        return MACHIUM_FAILURE;
+        output_error(KERN_SUCCESS, "Too many arguments for 'read bytes', 4 required");
+        return false;
     }
 
-    address = (uint64_t) strtol(machium->args[2], NULL, 0);
-    size = (size_t) strtol(machium->args[3], NULL, 0);
+    read->kind = READ_BYTES;
+    read->address = (uint64_t) strtol(machium->args[2], NULL, 0);
+    read->size = (size_t) strtoull(machium->args[3], NULL, 0);
+    if (read->size == 0 || read->size > MEMORY_READ_MAX) {
+        output_error(KERN_SUCCESS, "Size has to be between 1 and 0x%x, use 'dump' for bigger reads", MEMORY_READ_MAX);
+        return false;
+    }
+    return true;
+}
 
-    read_out = (uint8_t*) malloc(size); //create readout buffer
+/*
+parse read lines
 
-    printf(GOOD"Reading %zu bytes from memory address 0x%llx...\n", size, address);
+machium->args[0] -> read
+machium->args[1] -> lines
+machium->args[2] -> [type]
+machium->args[3] -> [address]
+machium->args[4] -> [lines]
+*/
+static bool parse_read_lines(Machium* machium, MemoryRead* read) {
+    if (machium->args_count < 5) {
+        output_error(KERN_SUCCESS, "Not enough arguments for 'read lines', 5 required");
+        return false;
+    }
+    else if (machium->args_count > 5) {
+        output_error(KERN_SUCCESS, "Too many arguments for 'read lines', 5 required");
+        return false;
+    }
 
-    //reads [size] data from [address] in the debug task and stores it in read_out
-    kret = vm_read_overwrite(machium->debug_task, address, size, (vm_offset_t) read_out, &size);
-    if (kret != KERN_SUCCESS) {
-        printf(ERROR"Failed to read bytes from memory!\nError: %s\n", mach_error_string(kret));
-        return MACHIUM_FAILURE;
+    if (!strcmp(machium->args[2], "char")) {
+        read->is_reading_char = true;
+    } else if (!strcmp(machium->args[2], "bytes")) {
+        read->is_reading_char = false;
+    } else {
+        output_error(KERN_SUCCESS, "Invalid type for 'read lines', %s", machium->args[2]);
+        return false;
     }
 
-    //print out read data
-    printf("0x");
-    for (int i = 0; i < size; i++)
-        printf("%x", (uint8_t) read_out[i]);
-    printf("\n");
+    read->kind = READ_LINES;
+    read->address = (uint64_t) strtol(machium->args[3], NULL, 0);
+    read->total_lines = (int) strtol(machium->args[4], NULL, 0);
 
-    free(read_out); //free readout buffer
+    if (read->total_lines <= 0) {
+        output_error(KERN_SUCCESS, "Lines has to be bigger than 0");
+        return false;
+    }
+    if (read->total_lines > 20) {
+        read->total_lines = 20; //lazy way to stop memory corruption
+        output_message(OUTPUT_LEVEL_WARNING, "Max lines to print is 20!");
+    }
 
-    return MACHIUM_SUCCESS;
+    //the amount of bytes we're reading
+    read->size = 16 * read->total_lines;
+
+    //align our bytes to 0xf so we can readout evenly at a line value
+    read->alignment_value = read->address % 16;
+    read->address = read->address - read->alignment_value;
+    return true;
 }
 
 /*
-read lines of memory at a given memory address
+parse read value
 
-machium->args[0] -> read
-machium->args[1] -> lines
-machium->args[2] -> [type]
-machium->args[3] -> [address]
-machium->args[4] -> [lines]
+machium->arg[0] -> read
+machium->arg[1] -> value
+machium->arg[2] -> [address]
+machium->arg[3] -> [size] (MAX 8)
 */
-machium_command_t m_read_lines(Machium* machium) {
-    kern_return_t kret;
+static bool parse_read_value(Machium* machium, MemoryRead* read) {
+    if (machium->args_count < 4) {
+        output_error(KERN_SUCCESS, "Not enough arguments for 'read value', 4 required");
+        return false;
+    }
+    else if (machium->args_count > 4) {
+        output_error(KERN_SUCCESS, "Too many arguments for 'read value', 4 required");
+        return false;
+    }
 
-    uint64_t address;
-    uint8_t alignment_value;
+    read->kind = READ_VALUE;
+    read->address = (uint64_t) strtol(machium->args[2], NULL, 0);
+    read->size = (size_t) strtol(machium->args[3], NULL, 0);
 
-    int total_lines;
-    bool is_reading_char;
-    char* read_out;
-    size_t size;
+    if (read->size > 8) {
+        read->size = 8; //sizeof(vm_offset_t) == 8
+        output_message(OUTPUT_LEVEL_WARNING, "Max read out size is 8!");
+    }
+    return true;
+}
 
+/*
+parse read array
+
+machium->args[0] -> read
+machium->args[1] -> array
+machium->args[2] -> [layout]
+machium->args[3] -> [address]
+machium->args[4] -> [count]
+machium->args[5] -> [stride] (OPTIONAL, size of the layout by default)
+*/
+static bool parse_read_array(Machium* machium, MemoryRead* read) {
     if (machium->args_count < 5) {
-        printf(ERROR"Not enough arguments for 'read lines', 5 required\n");
-        return MACHIUM_FAILURE;
+        output_error(KERN_SUCCESS, "Not enough arguments for 'read array', 5 required");
+        return false;
     }
-    else if (machium->args_count > 5) {
-        printf(ERROR"Too many arguments for 'read lines', 5 required\n");
-        return MACHIUM_FAILURE;
+    else if (machium->args_count > 6) {
+        output_error(KERN_SUCCESS, "Too many arguments for 'read array', 6 max");
+        return false;
     }
 
-    address = (uint64_t) strtol(machium->args[3], NULL, 0);
-    total_lines = (int) strtol(machium->args[4], NULL, 0);
+    read->layout = layout_find(machium, machium->args[2]);
+    if (read->layout == NULL) {
+        output_error(KERN_SUCCESS, "No layout called %s, see 'layout list'", machium->args[2]);
+        return false;
+    }
 
-    if (total_lines > 20) {
-        total_lines = 20; //lazy way to stop memory corruption
-        printf(WARNING"Max lines to print is 20!\n");
+    read->kind = READ_ARRAY;
+    read->address = (uint64_t) strtoull(machium->args[3], NULL, 0);
+    read->count = (uint32_t) strtoul(machium->args[4], NULL, 0);
+    read->stride = machium->args_count == 6 ? (uint64_t) strtoull(machium->args[5], NULL, 0) : read->layout->size;
+    if (read->count == 0 || read->stride == 0 || read->layout->end == 0) {
+        output_error(KERN_SUCCESS, "Count, stride and the layout's size have to be bigger than 0");
+        return false;
+    }
+    if (read->count > 1 && read->stride > (SIZE_MAX - read->layout->end) / (read->count - 1)) {
+        output_error(KERN_SUCCESS, "%u elements %llu bytes apart don't fit in memory", read->count, read->stride);
+        return false;
     }
 
-    printf(GOOD"Reading %d %s lines from memory address 0x%llx...\n", total_lines, machium->args[2], address);
+    //the whole span is one read, the last element only needs its fields
+    read->size = (read->count - 1) * read->stride + read->layout->end;
+    if (read->size > MEMORY_READ_MAX) {
+        output_error(KERN_SUCCESS, "%u elements %llu bytes apart span 0x%zx bytes, 0x%x max", read->count, read->stride, read->size, MEMORY_READ_MAX);
+        return false;
+    }
+    return true;
+}
 
-    //the amount of bytes we're reading
-    size = 16 * total_lines;
+bool memory_read_parse(Machium* machium, MemoryRead* read) {
+    memset(read, 0, sizeof(MemoryRead));
 
-    read_out = (char*) malloc(size); //create readout buffer
+    if (!strcmp(machium->args[1], "bytes") || !strcmp(machium->args[1], "b")) return parse_read_bytes(machium, read);
+    else if (!strcmp(machium->args[1], "lines") || !strcmp(machium->args[1], "l")) return parse_read_lines(machium, read);
+    else if (!strcmp(machium->args[1], "value") || !strcmp(machium->args[1], "v")) return parse_read_value(machium, read);
+    else if (!strcmp(machium->args[1], "array") || !strcmp(machium->args[1], "a")) return parse_read_array(machium, read);
 
-    //align our bytes to 0xf so we can readout evenly at a line value
-    alignment_value = address % 16;
-    address = address - alignment_value;
+    output_error(KERN_SUCCESS, "Invalid argument for 'read', %s", machium->args[1]);
+    return false;
+}
 
-    //reads [size] data from [address] in the debug task and stores it in read_out
-    kret = vm_read_overwrite(machium->debug_task, address, size, (vm_offset_t) read_out, &size);
+//shared by every chunk of a big read
+typedef struct FetchContext {
+    mach_port_t task;
+    uint64_t address;
+    uint8_t* read_out;
+    kern_return_t kret;
+} FetchContext;
 
-    if (kret != KERN_SUCCESS) {
-        printf(ERROR"Failed to read from memory!\nError: %s\n", mach_error_string(kret));
-        return MACHIUM_FAILURE;
+static bool fetch_chunk(void* context, uint64_t address, uint64_t size) {
+    FetchContext* fetch = (FetchContext*) context;
+    kern_return_t kret;
+    vm_size_t read_size;
+
+    read_size = size;
+    kret = vm_read_overwrite(fetch->task, address, size, (vm_address_t) (fetch->read_out + (address - fetch->address)), &read_size);
+    if (kret != KERN_SUCCESS)
+        fetch->kret = kret;
+    return kret == KERN_SUCCESS;
+}
+
+void memory_read_fetch(MachiumTarget* target, MemoryRead* read) {
+    FetchContext fetch;
+    mach_port_t task;
+    vm_size_t size;
+
+    //bytes, lines and arrays print straight out of the task's pages, nothing gets copied
+    if (read->kind != READ_VALUE && view_map(view_cache(target), read->address, read->size, &read->view)) {
+        read->read_out = read->view.data;
+        read->kret = KERN_SUCCESS;
+        return;
     }
 
-    printf(GREEN "0x%llx " WHITE "| ", address + alignment_value);
+    //values are read into a zeroed 8 byte buffer so they can be printed as a uint64_t
+    read->read_out = (uint8_t*) calloc(read->size > 8 ? read->size : 8, 1); //create readout buffer
+    if (read->read_out == NULL) {
+        read->kret = KERN_RESOURCE_SHORTAGE;
+        return;
+    }
+    task = target->debug_task;
+    size = read->size;
 
-    if (!strcmp(machium->args[2], "char")) {
-        is_reading_char = true;
-        printf(YELLOW "0 1 2 3 4 5 6 7 8 9 A B C D E F \n");
-    } else if (!strcmp(machium->args[2], "bytes")) {
-        is_reading_char = false;
-        printf(YELLOW "00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F \n");
-    }
-
-    //print all of the lines being read
-    for (int read_lines = 0; read_lines < total_lines; read_lines++) {
-        //create starter of new line
-        printf(BLUE "0x%llx " WHITE "| ", address);
-        for (int i = (16 * read_lines); i < (16 * (read_lines + 1)); i++) {
-            if (!is_reading_char) {
-                //make sure the readout is aligned
-                if ((uint8_t) read_out[i] <= 0xf) {
-                    printf("0%x ", (uint8_t) read_out[i]);
-                } else {
-                    printf("%x ", (uint8_t) read_out[i]);
-                }
-            }
-            else {
+    if (size <= MEMORY_CHUNK_SIZE) {
+        //reads [size] data from [address] in the debug task and stores it in read_out
+        read->kret = vm_read_overwrite(task, read->address, size, (vm_address_t) read->read_out, &size);
+        return;
+    }
+
+    //big reads get split up so every core pulls pages out of the task at once
+    fetch.task = task;
+    fetch.address = read->address;
+    fetch.read_out = read->read_out;
+    fetch.kret = KERN_SUCCESS;
+    if (!job_for_each_chunk(read->address, read->size, MEMORY_CHUNK_SIZE, fetch_chunk, &fetch) && fetch.kret == KERN_SUCCESS)
+        fetch.kret = KERN_ABORTED; //killed
+    read->kret = fetch.kret;
+}
+
+//free the buffer or the view of a fetched read
+static void memory_read_free(MemoryRead* read) {
+    if (read->view.data)
+        view_release(&read->view);
+    else
+        free(read->read_out);
+    read->read_out = NULL;
+}
+
+//print a fetched read of the selected target
+machium_command_t memory_read_print(Machium* machium, MemoryRead* read) {
+    char annotation[IMAGE_DESCRIPTION_MAX];
+    char symbol[IMAGE_DESCRIPTION_MAX];
+    char line[256];
+    uint64_t address;
+    uint64_t value;
+    int length;
+
+    if (read->kind == READ_BYTES) {
+        output_message(OUTPUT_LEVEL_GOOD, "Reading %zu bytes from memory address 0x%llx%s...", read->size, read->address, image_annotate(machium, read->address, annotation, sizeof(annotation)));
+        if (read->kret != KERN_SUCCESS) {
+            output_error(read->kret, "Failed to read bytes from memory!");
+            memory_read_free(read);
+            return MACHIUM_FAILURE;
+        }
+        output_bytes(read->address, read->read_out, read->size);
+    }
+    else if (read->kind == READ_LINES) {
+        address = read->address;
+        output_message(OUTPUT_LEVEL_GOOD, "Reading %d %s lines from memory address 0x%llx...", read->total_lines, read->is_reading_char ? "char" : "bytes", address + read->alignment_value);
+        if (read->kret != KERN_SUCCESS) {
+            output_error(read->kret, "Failed to read from memory!");
+            memory_read_free(read);
+            return MACHIUM_FAILURE;
+        }
+
+        //the grid is only for people, automation gets the bytes
+        if (output_mode() != OUTPUT_TEXT) {
+            output_bytes(address, read->read_out, read->size);
+            memory_read_free(read);
+            return MACHIUM_SUCCESS;
+        }
+
+        length = snprintf(line, sizeof(line), GREEN "0x%llx" WHITE "%s | %s", address + read->alignment_value, image_annotate(machium, address + read->alignment_value, annotation, sizeof(annotation)),
+                          read->is_reading_char ? YELLOW "0 1 2 3 4 5 6 7 8 9 A B C D E F \n" : YELLOW "00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F \n");
+        output_text(line, length < (int) sizeof(line) ? length : sizeof(line) - 1);
+
+        //print all of the lines being read
+        for (int read_lines = 0; read_lines < read->total_lines; read_lines++) {
+            //create starter of new line
+            length = snprintf(line, sizeof(line), BLUE "0x%llx " WHITE "| ", address);
+            for (int i = (16 * read_lines); i < (16 * (read_lines + 1)); i++) {
+                if (!read->is_reading_char)
+                    length += snprintf(line + length, sizeof(line) - length, "%02x ", read->read_out[i]);
                 //only read out valid ascii characters
-                if ((uint8_t) read_out[i] >= 33 && (uint8_t) read_out[i] <= 126) {
-                    printf("%c ", read_out[i]);
-                } else {
-                    printf(RED"? "WHITE);
-                }
+                else if (read->read_out[i] >= 33 && read->read_out[i] <= 126)
+                    length += snprintf(line + length, sizeof(line) - length, "%c ", read->read_out[i]);
+                else
+                    length += snprintf(line + length, sizeof(line) - length, RED"? "WHITE);
             }
+            line[length++] = '\n';
+            output_text(line, length);
+            address += 16; //new line starts
         }
-
-        printf("\n");
-        address += 16; //new line starts
+    }
+    else if (read->kind == READ_ARRAY) {
+        output_message(OUTPUT_LEVEL_GOOD, "Reading %u %s (%llu bytes apart) from memory address 0x%llx%s...", read->count, read->layout->name, read->stride, read->address, image_annotate(machium, read->address, annotation, sizeof(annotation)));
+        if (read->kret != KERN_SUCCESS) {
+            output_error(read->kret, "Failed to read array from memory!");
+            memory_read_free(read);
+            return MACHIUM_FAILURE;
+        }
+        layout_print(read->layout, read->address, read->read_out, read->count, read->stride);
+    }
+    else {
+        output_message(OUTPUT_LEVEL_GOOD, "Reading size %zu value from memory address 0x%llx%s...", read->size, read->address, image_annotate(machium, read->address, annotation, sizeof(annotation)));
+        if (read->kret != KERN_SUCCESS) {
+            output_error(read->kret, "Failed to read value from memory!");
+            memory_read_free(read);
+            return MACHIUM_FAILURE;
+        }
+        memcpy(&value, read->read_out, sizeof(value));
+        //values that point into an image are usually function or data pointers
+        output_value(read->address, read->size, value, image_describe(machium, value, symbol, sizeof(symbol)) ? symbol : NULL);
     }
 
-    free(read_out); //free readout
-
+    memory_read_free(read); //free readout buffer
     return MACHIUM_SUCCESS;
 }
 
-/*
-reads value from memory address
+//read bytes from memory
+machium_command_t m_read_bytes(Machium* machium) {
+    MemoryRead read;
 
-machium->arg[0] -> read
-machium->arg[1] -> value
-machium->arg[2] -> [address]
-machium->arg[3] -> [size] (MAX 8)
-*/
+    memset(&read, 0, sizeof(read));
+    if (!parse_read_bytes(machium, &read))
+        return MACHIUM_FAILURE;
+    memory_read_fetch(machium->target, &read);
+    return memory_read_print(machium, &read);
+}
+
+//read lines from memory
+machium_command_t m_read_lines(Machium* machium) {
+    MemoryRead read;
+
+    memset(&read, 0, sizeof(read));
+    if (!parse_read_lines(machium, &read))
+        return MACHIUM_FAILURE;
+    memory_read_fetch(machium->target, &read);
+    return memory_read_print(machium, &read);
+}
+
+//read value from memory
 machium_command_t m_read_value(Machium* machium) {
-    kern_return_t kret;
+    MemoryRead read;
+
+    memset(&read, 0, sizeof(read));
+    if (!parse_read_value(machium, &read))
+        return MACHIUM_FAILURE;
+    memory_read_fetch(machium->target, &read);
+    return memory_read_print(machium, &read);
+}
+
+//read an array of structs from memory
+machium_command_t m_read_array(Machium* machium) {
+    MemoryRead read;
+
+    memset(&read, 0, sizeof(read));
+    if (!parse_read_array(machium, &read))
+        return MACHIUM_FAILURE;
+    memory_read_fetch(machium->target, &read);
+    return memory_read_print(machium, &read);
+}
+
+//shared by every chunk of a dump
+typedef struct DumpContext {
+    ViewCache* views;
     uint64_t address;
-    size_t size;
-    uint64_t read_out;
+    int fd;
+    uint64_t unreadable;
+} DumpContext;
+
+static bool dump_chunk(void* context, uint64_t address, uint64_t size) {
+    DumpContext* dump = (DumpContext*) context;
+    MemoryView view;
+    uint8_t* zeros;
+    bool written;
+
+    //the task's pages go to the file straight from the mapping
+    if (view_acquire(dump->views, address, size, &view)) {
+        written = pwrite(dump->fd, view.data, size, (off_t) (address - dump->address)) == (ssize_t) size;
+        view_release(&view);
+        return written;
+    }
+
+    //keep the file offsets lined up with addresses, holes just become zeros
+    __atomic_fetch_add(&dump->unreadable, size, __ATOMIC_RELAXED);
+    zeros = (uint8_t*) calloc(size, 1);
+    written = pwrite(dump->fd, zeros, size, (off_t) (address - dump->address)) == (ssize_t) size;
+    free(zeros);
+    return written;
+}
+
+/*
+dump memory to a file, one chunk per core at a time
+
+machium->args[0] -> dump
+machium->args[1] -> [address]
+machium->args[2] -> [size]
+machium->args[3] -> [file]
+*/
+machium_command_t m_dump(Machium* machium) {
+    DumpContext dump;
+    uint64_t size;
+    double started;
+    double seconds;
+    bool finished;
 
     if (machium->args_count < 4) {
-        printf(ERROR"Not enough arguments for 'read value', 4 required\n");
+        output_error(KERN_SUCCESS, "Not enough arguments for 'dump', 4 required");
         return MACHIUM_FAILURE;
     }
     else if (machium->args_count > 4) {
-        printf(ERROR"Too many arguments for 'read value', 4 required\n");
+        output_error(KERN_SUCCESS, "Too many arguments for 'dump', 4 required");
         return MACHIUM_FAILURE;
     }
 
-    read_out = 0;
+    dump.views = view_cache(machium->target);
+    dump.address = (uint64_t) strtoull(machium->args[1], NULL, 0);
+    dump.unreadable = 0;
+    size = (uint64_t) strtoull(machium->args[2], NULL, 0);
 
-    address = (uint64_t) strtol(machium->args[2], NULL, 0);
-    size = (size_t) strtol(machium->args[3], NULL, 0);
-
-    if (size > 8) {
-        size = 8; //sizeof(vm_offset_t) == 8
-        printf(WARNING"Max read out size is 8!\n");
+    dump.fd = open(machium->args[3], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dump.fd < 0) {
+        output_error(KERN_SUCCESS, "Could not open %s", machium->args[3]);
+        return MACHIUM_FAILURE;
     }
 
-    printf(GOOD"Reading size %zu value from memory address 0x%llx...\n", size, address);
+    output_message(OUTPUT_LEVEL_GOOD, "Dumping %llu bytes from memory address 0x%llx to %s...", size, dump.address, machium->args[3]);
 
-    //reads [size] data from [address] in the debug task and stores it in read_out
-    kret = vm_read_overwrite(machium->debug_task, address, size, (uint64_t) &read_out, &size);
-    if (kret != KERN_SUCCESS) {
-        printf(ERROR"Failed to read value from memory!\nError: %s\n", mach_error_string(kret));
+    started = job_time();
+    finished = job_for_each_chunk(dump.address, size, MEMORY_CHUNK_SIZE, dump_chunk, &dump);
+    seconds = job_time() - started;
+    close(dump.fd);
+
+    if (job_cancelled()) {
+        output_message(OUTPUT_LEVEL_WARNING, "Dump to %s was killed, the file is incomplete", machium->args[3]);
+        return MACHIUM_FAILURE;
+    }
+    if (!finished) {
+        output_error(KERN_SUCCESS, "Failed to write %s!", machium->args[3]);
         return MACHIUM_FAILURE;
     }
-    printf("0x%llx\n", read_out);
+    if (dump.unreadable)
+        output_message(OUTPUT_LEVEL_WARNING, "%llu bytes were unreadable and got written as zeros", dump.unreadable);
 
+    output_message(OUTPUT_LEVEL_GOOD, "Dumped %llu bytes in %.2fs (%.1f MB/s)", size, seconds, seconds > 0 ? (double) size / seconds / 1e6 : 0.0);
     return MACHIUM_SUCCESS;
 }
 
@@ -247,8 +514,11 @@ machium_command_t m_read(Machium* machium) {
 
     else if (!strcmp(machium->args[1], "value")) m_read_value(machium);
     else if (!strcmp(machium->args[1], "v")) m_read_value(machium);
+
+    else if (!strcmp(machium->args[1], "array")) m_read_array(machium);
+    else if (!strcmp(machium->args[1], "a")) m_read_array(machium);
     else {
-        printf(ERROR"Invalid argument for 'read', %s\n", machium->args[1]);
+        output_error(KERN_SUCCESS, "Invalid argument for 'read', %s", machium->args[1]);
         return MACHIUM_FAILURE;
     }
 
@@ -256,8 +526,112 @@ machium_command_t m_read(Machium* machium) {
 }
 
 
+//shared by every chunk of a write
+typedef struct WriteContext {
+    mach_port_t task;
+    ViewCache* views;
+    uint64_t address;
+    const uint8_t* data;
+    kern_return_t kret;
+    uint64_t mismatched;
+} WriteContext;
+
+static bool write_chunk(void* context, uint64_t address, uint64_t size) {
+    WriteContext* write = (WriteContext*) context;
+    const uint8_t* data;
+    MemoryView view;
+    kern_return_t kret;
+
+    data = write->data + (address - write->address);
+    kret = vm_write(write->task, (vm_address_t) address, (vm_offset_t) data, (mach_msg_type_number_t) size);
+    if (kret != KERN_SUCCESS) {
+        write->kret = kret;
+        return false;
+    }
+
+    //read the chunk back while its source is still in the cache and compare hashes
+    if (!view_acquire(write->views, address, size, &view)) {
+        __atomic_fetch_add(&write->mismatched, size, __ATOMIC_RELAXED);
+        return true;
+    }
+    if (hash64(view.data, size, 0) != hash64(data, size, 0))
+        __atomic_fetch_add(&write->mismatched, size, __ATOMIC_RELAXED);
+    view_release(&view);
+    return true;
+}
+
+kern_return_t memory_write(MachiumTarget* target, uint64_t address, const void* data, uint64_t size, uint64_t* mismatched) {
+    WriteContext write;
+    MemoryRegion* regions;
+    uint32_t region_count;
+    uint32_t changed;
+    uint64_t start;
+    uint64_t end;
+    kern_return_t kret;
+
+    *mismatched = 0;
+    if (size == 0)
+        return KERN_SUCCESS;
+    if (address + size < address || address + size > UINT64_MAX - vm_page_mask)
+        return KERN_INVALID_ADDRESS;
+
+    //only the pages being written get their protection changed
+    start = address & ~(uint64_t) vm_page_mask;
+    end = (address + size + vm_page_mask) & ~(uint64_t) vm_page_mask;
+    region_count = region_list(target->debug_task, start, end, VM_PROT_NONE, &regions);
+    for (uint32_t i = 0; i < region_count; i++) {
+        if (regions[i].address != (i ? regions[i - 1].address + regions[i - 1].size : start)) {
+            free(regions);
+            return KERN_INVALID_ADDRESS; //hole in the range
+        }
+    }
+    if (region_count == 0 || regions[region_count - 1].address + regions[region_count - 1].size != end) {
+        free(regions);
+        return KERN_INVALID_ADDRESS;
+    }
+
+    //VM_PROT_COPY gives the task its own copy of pages it can't normally write (code, the shared cache)
+    kret = KERN_SUCCESS;
+    for (changed = 0; changed < region_count; changed++) {
+        if (regions[changed].protection & VM_PROT_WRITE)
+            continue;
+        kret = vm_protect(target->debug_task, (vm_address_t) regions[changed].address, (vm_size_t) regions[changed].size, false, VM_PROT_READ | VM_PROT_WRITE | VM_PROT_COPY);
+        if (kret != KERN_SUCCESS)
+            break;
+    }
+
+    memset(&write, 0, sizeof(write));
+    write.task = target->debug_task;
+    write.views = view_cache(target);
+    write.address = address;
+    write.data = (const uint8_t*) data;
+    write.kret = KERN_SUCCESS;
+    if (kret == KERN_SUCCESS) {
+        if (!job_for_each_chunk(address, size, MEMORY_CHUNK_SIZE, write_chunk, &write) && write.kret == KERN_SUCCESS)
+            write.kret = KERN_ABORTED; //killed
+        kret = write.kret;
+    }
+
+    //restore original protections
+    for (uint32_t i = 0; i < changed; i++) {
+        if (!(regions[i].protection & VM_PROT_WRITE))
+            vm_protect(target->debug_task, (vm_address_t) regions[i].address, (vm_size_t) regions[i].size, false, regions[i].protection);
+    }
+
+    free(regions);
+    *mismatched = write.mismatched;
+    return kret;
+}
+
+void memory_flush_code(mach_port_t task, uint64_t address, uint64_t size) {
+    vm_machine_attribute_val_t value;
+
+    value = MATTR_VAL_CACHE_FLUSH;
+    vm_machine_attribute(task, (vm_address_t) address, (vm_size_t) size, MATTR_CACHE, &value);
+}
+
 /*
-handle read command
+handle write command
 
 machium->args[0] -> write
 machium->args[1] -> [address]
@@ -265,68 +639,109 @@ machium->args[2] -> [data]
 */
 machium_command_t m_write(Machium* machium) {
     kern_return_t kret;
-    vm_address_t address;
-    size_t size;
-    vm_address_t data;
-
-    vm_address_t region_address;
-    vm_size_t region_size;
-    vm_region_flavor_t flavor;
-    vm_region_basic_info_data_64_t info;
-    mach_msg_type_number_t count;
-    mach_port_t object;
-
-    vm_prot_t prot;
-
+    uint64_t address;
+    uint64_t data;
+    uint64_t mismatched;
 
     if (machium->args_count < 3) {
-        printf(ERROR"Not enough arguments for 'write', 3 required\n");
+        output_error(KERN_SUCCESS, "Not enough arguments for 'write', 3 required");
         return MACHIUM_FAILURE;
     }
     else if (machium->args_count > 3) {
-        printf(ERROR"Too many arguments for 'write', 3 required\n");
+        output_error(KERN_SUCCESS, "Too many arguments for 'write', 3 required");
         return MACHIUM_FAILURE;
     }
 
-    address = (vm_address_t) strtol(machium->args[1], NULL, 0);
-    data = (vm_offset_t) strtol(machium->args[2], NULL, 0);
-    size = sizeof(data);
+    address = (uint64_t) strtoull(machium->args[1], NULL, 0);
+    data = (uint64_t) strtoull(machium->args[2], NULL, 0);
 
-    region_address = address;
-    flavor = VM_REGION_BASIC_INFO_64;
-    count = VM_REGION_BASIC_INFO_COUNT_64;
+    output_message(OUTPUT_LEVEL_GOOD, "Writing %llx to memory address 0x%llx...", data, address);
 
-    //im not explaining the use of vm_region_64 but i literally just use this to get the protection at memory address region_address
-    kret = vm_region_64(machium->debug_task, &region_address, &region_size, flavor, (vm_region_info_64_t) &info, &count, &object);
+    //write [data] of [size] to [address]
+    kret = memory_write(machium->target, address, &data, sizeof(data), &mismatched);
     if (kret != KERN_SUCCESS) {
-        printf(ERROR"vm_region_64 failure with error: %s\n", mach_error_string(kret));
+        output_error(kret, "Failed to write value to memory!");
+        return MACHIUM_FAILURE;
+    }
+    if (mismatched) {
+        output_error(KERN_SUCCESS, "Wrote the value but it doesn't read back the same!");
         return MACHIUM_FAILURE;
     }
-    prot = info.protection; //save protection
 
-    //vm_protect for vm_write-ing data to memory
-    kret = vm_protect(machium->debug_task, address, region_size, false, VM_PROT_READ | VM_PROT_WRITE | VM_PROT_COPY);
-    if (kret != KERN_SUCCESS) {
-        printf(ERROR"vm_protect failure with error: %s", mach_error_string(kret));
+    output_message(OUTPUT_LEVEL_GOOD, "Successfully wrote data!");
+
+    return MACHIUM_SUCCESS;
+}
+
+/*
+load a file into memory, the file is mapped and written in chunks on every core
+
+machium->args[0] -> load
+machium->args[1] -> [file]
+machium->args[2] -> [address]
+*/
+machium_command_t m_load(Machium* machium) {
+    char annotation[IMAGE_DESCRIPTION_MAX];
+    kern_return_t kret;
+    struct stat info;
+    uint64_t address;
+    uint64_t mismatched;
+    uint8_t* data;
+    double started;
+    double seconds;
+    int fd;
+
+    if (machium->args_count < 3) {
+        output_error(KERN_SUCCESS, "Not enough arguments for 'load', 3 required");
+        return MACHIUM_FAILURE;
+    }
+    else if (machium->args_count > 3) {
+        output_error(KERN_SUCCESS, "Too many arguments for 'load', 3 required");
         return MACHIUM_FAILURE;
     }
 
-    printf(GOOD"Writing %lx to memory address 0x%lx...\n", data, address);
+    address = (uint64_t) strtoull(machium->args[2], NULL, 0);
 
-    //write [data] of [size] to [address]
-    kret = vm_write(machium->debug_task, address, (vm_offset_t) data, size);
-    if (kret != KERN_SUCCESS) {
-        printf(ERROR"Failed to write value to memory!\nError: %s\n", mach_error_string(kret));
+    fd = open(machium->args[1], O_RDONLY);
+    if (fd < 0) {
+        output_error(KERN_SUCCESS, "Could not open %s", machium->args[1]);
+        return MACHIUM_FAILURE;
+    }
+    if (fstat(fd, &info) || info.st_size == 0) {
+        output_error(KERN_SUCCESS, "%s is empty", machium->args[1]);
+        close(fd);
+        return MACHIUM_FAILURE;
     }
 
-    //restore original protections
-    kret = vm_protect(machium->debug_task, address, region_size, false, prot);
-    if (kret != KERN_SUCCESS) {
-        printf(ERROR"vm_protect failure with error: %s", mach_error_string(kret));
+    //vm_write sends the pages of the mapping out of line, so the file is never copied into a buffer first
+    data = (uint8_t*) mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        output_error(KERN_SUCCESS, "Could not map %s", machium->args[1]);
         return MACHIUM_FAILURE;
     }
+    madvise(data, (size_t) info.st_size, MADV_SEQUENTIAL);
 
-    printf(GOOD"Successfully wrote data!\n");
+    output_message(OUTPUT_LEVEL_GOOD, "Loading %llu bytes from %s to memory address 0x%llx%s...", (uint64_t) info.st_size, machium->args[1], address, image_annotate(machium, address, annotation, sizeof(annotation)));
+
+    started = job_time();
+    kret = memory_write(machium->target, address, data, (uint64_t) info.st_size, &mismatched);
+    seconds = job_time() - started;
+    munmap(data, (size_t) info.st_size);
+
+    if (job_cancelled()) {
+        output_message(OUTPUT_LEVEL_WARNING, "Load of %s was killed, memory is partly written", machium->args[1]);
+        return MACHIUM_FAILURE;
+    }
+    if (kret != KERN_SUCCESS) {
+        output_error(kret, "Failed to load %s!", machium->args[1]);
+        return MACHIUM_FAILURE;
+    }
+    if (mismatched) {
+        output_error(KERN_SUCCESS, "%llu bytes don't read back the same as %s!", mismatched, machium->args[1]);
+        return MACHIUM_FAILURE;
+    }
 
+    output_message(OUTPUT_LEVEL_GOOD, "Loaded and verified %llu bytes in %.2fs (%.1f MB/s)", (uint64_t) info.st_size, seconds, seconds > 0 ? (double) info.st_size / seconds / 1e6 : 0.0);
     return MACHIUM_SUCCESS;
 }
@@ -2,6 +2,36 @@
 #define MEMORY_H
 
 #include "Machium.h"
+#include "View.h"
+#include "Layout.h"
+
+//reads bigger than this get split up and run on every core
+#define MEMORY_CHUNK_SIZE (1024 * 1024)
+
+//biggest 'read', anything bigger is for 'dump'
+#define MEMORY_READ_MAX (256 * 1024 * 1024)
+
+//the kinds of 'read'
+#define READ_BYTES 0
+#define READ_LINES 1
+#define READ_VALUE 2
+#define READ_ARRAY 3
+
+//a parsed read command. fetching is split from printing so 'all read' can fetch from every target at once
+typedef struct MemoryRead {
+    uint8_t kind;
+    uint64_t address; //aligned down to 16 for lines
+    uint8_t alignment_value; //lines only
+    size_t size;
+    int total_lines; //lines only
+    bool is_reading_char; //lines only
+    const Layout* layout; //array only
+    uint32_t count; //array only, elements
+    uint64_t stride; //array only
+    uint8_t* read_out;
+    MemoryView view; //bytes and lines point read_out straight into the task's pages when they can be mapped
+    kern_return_t kret;
+} MemoryRead;
 
 //get and change pid
 machium_command_t m_pid(Machium* machium);
@@ -11,9 +41,33 @@ machium_command_t m_read(Machium* machium);
 machium_command_t m_read_bytes(Machium* machium); //read bytes from memory
 machium_command_t m_read_lines(Machium* machium); //read lines from memory
 machium_command_t m_read_value(Machium* machium); //read value from memory
+machium_command_t m_read_array(Machium* machium); //read an array of structs from memory
+
+//parse the arguments of a read command, errors are printed
+bool memory_read_parse(Machium* machium, MemoryRead* read);
+//fetch a parsed read, mapped when possible and copied with vm_read_overwrite otherwise. safe to call from any thread
+void memory_read_fetch(MachiumTarget* target, MemoryRead* read);
+//print a fetched read for the selected target and free its buffer
+machium_command_t memory_read_print(Machium* machium, MemoryRead* read);
+
+/*
+write [size] bytes of [data] to [address], in chunks on every core
+pages that aren't writable are made writable only while they're written. every chunk is read back and
+checked by hash, [mismatched] counts the bytes of chunks that didn't match
+*/
+kern_return_t memory_write(MachiumTarget* target, uint64_t address, const void* data, uint64_t size, uint64_t* mismatched);
+
+//make sure the cpu doesn't run stale instructions out of the task's instruction cache after patching code
+void memory_flush_code(mach_port_t task, uint64_t address, uint64_t size);
 
 //write to memory (vm_write wrapper)
 machium_command_t m_write(Machium* machium);
 
+//write a file to memory
+machium_command_t m_load(Machium* machium);
+
+//dump memory to a file
+machium_command_t m_dump(Machium* machium);
+
 
 #endif /* MEMORY_H */
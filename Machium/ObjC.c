@@ -0,0 +1,497 @@
+#include "ObjC.h"
+#include "Image.h"
+#include "Output.h"
+
+//a page of the task, metadata of one image sits on a handful of them
+typedef struct ObjCPage {
+    uint64_t address;
+    uint64_t used;
+    uint8_t* data;
+} ObjCPage;
+
+//reads of one command. every read comes out of a cached page so decoding a class costs a few vm_reads, not dozens
+typedef struct ObjCReader {
+    mach_port_t task;
+    ObjCPage pages[OBJC_PAGES];
+    uint64_t clock;
+} ObjCReader;
+
+static void objc_reader_free(ObjCReader* reader) {
+    for (uint32_t i = 0; i < OBJC_PAGES; i++)
+        free(reader->pages[i].data);
+}
+
+static uint8_t* objc_page(ObjCReader* reader, uint64_t address) {
+    ObjCPage* page;
+    ObjCPage* oldest;
+    vm_size_t read_size;
+
+    address &= ~(uint64_t) vm_page_mask;
+    oldest = &reader->pages[0];
+    for (uint32_t i = 0; i < OBJC_PAGES; i++) {
+        page = &reader->pages[i];
+        if (page->data && page->address == address) {
+            page->used = ++reader->clock;
+            return page->data;
+        }
+        if (page->used < oldest->used)
+            oldest = page;
+    }
+
+    if (oldest->data == NULL)
+        oldest->data = (uint8_t*) malloc(vm_page_size);
+    read_size = vm_page_size;
+    if (vm_read_overwrite(reader->task, (vm_address_t) address, vm_page_size, (vm_address_t) oldest->data, &read_size) != KERN_SUCCESS) {
+        oldest->used = 0;
+        oldest->address = 0;
+        return NULL;
+    }
+    oldest->address = address;
+    oldest->used = ++reader->clock;
+    return oldest->data;
+}
+
+static bool objc_read(ObjCReader* reader, uint64_t address, void* out, size_t size) {
+    uint8_t* page;
+    size_t chunk;
+
+    while (size) {
+        page = objc_page(reader, address);
+        if (page == NULL)
+            return false;
+        chunk = vm_page_size - (address & vm_page_mask);
+        chunk = chunk < size ? chunk : size;
+        memcpy(out, page + (address & vm_page_mask), chunk);
+        out = (uint8_t*) out + chunk;
+        address += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+static uint64_t objc_read_pointer(ObjCReader* reader, uint64_t address) {
+    uint64_t pointer;
+
+    if (!objc_read(reader, address, &pointer, sizeof(pointer)))
+        return 0;
+    return pointer & OBJC_POINTER_MASK;
+}
+
+//copy of the string at [address], NULL if it can't be read or isn't printable
+static char* objc_read_string(ObjCReader* reader, uint64_t address) {
+    char name[OBJC_NAME_MAX];
+    uint8_t* page;
+    size_t length;
+
+    for (length = 0; length < OBJC_NAME_MAX - 1; length++) {
+        page = objc_page(reader, address + length);
+        if (page == NULL)
+            return NULL;
+        name[length] = (char) page[(address + length) & vm_page_mask];
+        if (name[length] == '\0')
+            break;
+        if ((uint8_t) name[length] < 0x20 || (uint8_t) name[length] > 0x7e)
+            return NULL;
+    }
+    name[length] = '\0';
+    return length ? strdup(name) : NULL;
+}
+
+static void objc_class_free(ObjCClass* class) {
+    for (uint32_t i = 0; i < class->ivar_count; i++) {
+        free(class->ivars[i].name);
+        free(class->ivars[i].type);
+    }
+    for (uint32_t i = 0; i < class->method_count; i++)
+        free(class->methods[i].name);
+    free(class->ivars);
+    free(class->methods);
+    free(class->name);
+    free(class);
+}
+
+void objc_cache_free(ObjCCache* cache) {
+    if (cache == NULL)
+        return;
+    for (uint32_t i = 0; i < cache->capacity; i++) {
+        if (cache->slots[i])
+            objc_class_free(cache->slots[i]);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->slots);
+    free(cache);
+}
+
+static ObjCCache* objc_cache(MachiumTarget* target) {
+    ObjCCache* cache;
+    ObjCCache* expected;
+
+    cache = __atomic_load_n(&target->objc, __ATOMIC_ACQUIRE);
+    if (cache)
+        return cache;
+
+    cache = (ObjCCache*) calloc(1, sizeof(ObjCCache));
+    cache->capacity = OBJC_CACHE_SLOTS;
+    cache->slots = (ObjCClass**) calloc(cache->capacity, sizeof(ObjCClass*));
+    pthread_mutex_init(&cache->lock, NULL);
+
+    //background jobs can get here at the same time, the loser throws its cache away
+    expected = NULL;
+    if (!__atomic_compare_exchange_n(&target->objc, &expected, cache, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        objc_cache_free(cache);
+        return expected;
+    }
+    return cache;
+}
+
+static uint32_t objc_slot(ObjCClass** slots, uint32_t capacity, uint64_t address) {
+    uint32_t index;
+
+    index = (uint32_t) (((address >> 3) * 0x9e3779b97f4a7c15ULL) >> 32) & (capacity - 1);
+    while (slots[index] && slots[index]->address != address)
+        index = (index + 1) & (capacity - 1);
+    return index;
+}
+
+//must hold the lock. keeps the table at most 3/4 full
+static void objc_cache_insert(ObjCCache* cache, ObjCClass* class) {
+    ObjCClass** slots;
+    uint32_t capacity;
+
+    if ((cache->count + 1) * 4 > cache->capacity * 3) {
+        capacity = cache->capacity * 2;
+        slots = (ObjCClass**) calloc(capacity, sizeof(ObjCClass*));
+        for (uint32_t i = 0; i < cache->capacity; i++) {
+            if (cache->slots[i])
+                slots[objc_slot(slots, capacity, cache->slots[i]->address)] = cache->slots[i];
+        }
+        free(cache->slots);
+        cache->slots = slots;
+        cache->capacity = capacity;
+    }
+    cache->slots[objc_slot(cache->slots, cache->capacity, class->address)] = class;
+    cache->count++;
+}
+
+static void objc_decode_ivars(ObjCReader* reader, ObjCClass* class, uint64_t list) {
+    ObjCIvarEntry entry;
+    uint32_t header[2];
+    uint32_t entsize;
+    uint32_t offset;
+
+    if (list == 0 || !objc_read(reader, list, header, sizeof(header)))
+        return;
+    entsize = header[0] & OBJC_LIST_ENTSIZE;
+    if (entsize < sizeof(ObjCIvarEntry) || header[1] == 0 || header[1] > 0x10000)
+        return;
+
+    class->ivars = (ObjCIvar*) calloc(header[1], sizeof(ObjCIvar));
+    for (uint32_t i = 0; i < header[1]; i++) {
+        if (!objc_read(reader, list + sizeof(header) + (uint64_t) i * entsize, &entry, sizeof(entry)))
+            break;
+        //offset is 0 for anonymous bitfields
+        if ((entry.offset & OBJC_POINTER_MASK) == 0 || !objc_read(reader, entry.offset & OBJC_POINTER_MASK, &offset, sizeof(offset)))
+            continue;
+        class->ivars[class->ivar_count].offset = offset;
+        class->ivars[class->ivar_count].size = entry.size;
+        class->ivars[class->ivar_count].name = objc_read_string(reader, entry.name & OBJC_POINTER_MASK);
+        class->ivars[class->ivar_count].type = objc_read_string(reader, entry.type & OBJC_POINTER_MASK);
+        class->ivar_count++;
+    }
+}
+
+/*
+small method lists (every image built for iOS 14 and up) store offsets from the entry instead of pointers
+outside of the shared cache the name offset points to a selector reference. lists in the shared cache flag theirs as
+relative to a selector base only the runtime knows, those names come out as NULL and get printed as their imp
+*/
+static void objc_decode_methods(ObjCReader* reader, ObjCClass* class, uint64_t list) {
+    uint32_t header[2];
+    uint32_t entsize;
+    uint64_t entry;
+    int32_t small[3];
+    uint64_t big[3];
+    bool is_small;
+    bool is_direct;
+
+    if (list == 0 || !objc_read(reader, list, header, sizeof(header)))
+        return;
+    is_small = header[0] & OBJC_SMALL_METHODS;
+    is_direct = header[0] & OBJC_DIRECT_SELECTORS;
+    entsize = header[0] & OBJC_LIST_ENTSIZE;
+    if (entsize < (is_small ? sizeof(small) : sizeof(big)) || header[1] == 0 || header[1] > 0x10000)
+        return;
+
+    class->methods = (ObjCMethod*) calloc(header[1], sizeof(ObjCMethod));
+    for (uint32_t i = 0; i < header[1]; i++) {
+        entry = list + sizeof(header) + (uint64_t) i * entsize;
+        if (is_small) {
+            if (!objc_read(reader, entry, small, sizeof(small)))
+                break;
+            if (!is_direct)
+                class->methods[i].name = objc_read_string(reader, objc_read_pointer(reader, entry + (uint64_t) (int64_t) small[0]));
+            class->methods[i].imp = entry + 8 + (uint64_t) (int64_t) small[2];
+        }
+        else {
+            if (!objc_read(reader, entry, big, sizeof(big)))
+                break;
+            class->methods[i].name = objc_read_string(reader, big[0] & OBJC_POINTER_MASK);
+            class->methods[i].imp = big[2] & OBJC_POINTER_MASK;
+        }
+        class->method_count++;
+    }
+}
+
+//read everything Machium shows about the class at [address] out of the task
+static ObjCClass* objc_decode(ObjCReader* reader, uint64_t address) {
+    ObjCClassHeader header;
+    ObjCClassRO ro;
+    ObjCClass* class;
+    uint64_t data;
+    uint64_t ro_or_ext;
+    uint32_t flags;
+
+    if (!objc_read(reader, address, &header, sizeof(header)))
+        return NULL;
+    data = header.bits & OBJC_FAST_DATA_MASK;
+    if (data == 0 || !objc_read(reader, data, &flags, sizeof(flags)))
+        return NULL;
+
+    //realized classes point at a class_rw_t, which points at the class_ro_t (or at a class_rw_ext_t that does)
+    if (flags & OBJC_RW_REALIZED) {
+        ro_or_ext = objc_read_pointer(reader, data + 8);
+        data = (ro_or_ext & 1) ? objc_read_pointer(reader, ro_or_ext & ~1ULL) : ro_or_ext;
+    }
+    if (data == 0 || !objc_read(reader, data, &ro, sizeof(ro)))
+        return NULL;
+
+    class = (ObjCClass*) calloc(1, sizeof(ObjCClass));
+    class->address = address;
+    class->superclass = header.superclass & OBJC_POINTER_MASK;
+    class->name = objc_read_string(reader, ro.name & OBJC_POINTER_MASK);
+    class->instance_size = ro.instance_size;
+    class->meta = ro.flags & OBJC_RO_META;
+    if (class->name == NULL) {
+        free(class);
+        return NULL; //not a class after all
+    }
+    objc_decode_ivars(reader, class, ro.ivars & OBJC_POINTER_MASK);
+    objc_decode_methods(reader, class, ro.base_methods & OBJC_POINTER_MASK);
+    return class;
+}
+
+//the class at [address], decoded the first time it's asked for
+static ObjCClass* objc_class(ObjCCache* cache, ObjCReader* reader, uint64_t address) {
+    ObjCClass* class;
+    ObjCClass* decoded;
+
+    pthread_mutex_lock(&cache->lock);
+    class = cache->slots[objc_slot(cache->slots, cache->capacity, address)];
+    pthread_mutex_unlock(&cache->lock);
+    if (class)
+        return class;
+
+    decoded = objc_decode(reader, address);
+    if (decoded == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    class = cache->slots[objc_slot(cache->slots, cache->capacity, address)];
+    if (class == NULL) {
+        objc_cache_insert(cache, decoded);
+        class = decoded;
+        decoded = NULL;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    if (decoded)
+        objc_class_free(decoded); //another job got there first
+    return class;
+}
+
+/*
+list classes from every image's __objc_classlist, or the classes of one image
+
+machium->args[0] -> objc
+machium->args[1] -> classes
+machium->args[2] -> [image] (OPTIONAL)
+*/
+static machium_command_t m_objc_classes(Machium* machium) {
+    ObjCCache* cache;
+    ObjCReader reader;
+    ImageIndex* index;
+    ImageEntry* entry;
+    ObjCClass* class;
+    uint64_t* list;
+    uint64_t address;
+    uint64_t size;
+    uint64_t total;
+    uint32_t images;
+    uint32_t count;
+
+    index = image_index(machium);
+    if (index == NULL) {
+        output_error(KERN_SUCCESS, "Couldn't get the image list of the task");
+        return MACHIUM_FAILURE;
+    }
+
+    total = 0;
+    images = 0;
+    cache = objc_cache(machium->target);
+    memset(&reader, 0, sizeof(reader));
+    reader.task = machium->target->debug_task;
+    for (uint32_t i = 0; i < index->count; i++) {
+        entry = &index->images[i];
+        if (machium->args_count == 3 && strcmp(entry->name, machium->args[2]))
+            continue;
+        if (!image_find_section(machium, entry, "__objc_classlist", &address, &size) || size < sizeof(uint64_t))
+            continue;
+        count = (uint32_t) (size / sizeof(uint64_t));
+        total += count;
+        images++;
+        if (machium->args_count != 3) {
+            output_textf("%8u  %s\n", count, entry->name);
+            continue;
+        }
+
+        //the list itself is a single read, the classes mostly share a few pages
+        list = (uint64_t*) malloc(count * sizeof(uint64_t));
+        if (objc_read(&reader, address, list, count * sizeof(uint64_t))) {
+            for (uint32_t j = 0; j < count; j++) {
+                class = objc_class(cache, &reader, list[j] & OBJC_POINTER_MASK);
+                if (class)
+                    output_textf(YELLOW"0x%llx "WHITE"%s (%u bytes, %u ivars, %u methods)\n", class->address, class->name, class->instance_size, class->ivar_count, class->method_count);
+                else
+                    output_textf(YELLOW"0x%llx "WHITE"(not readable)\n", list[j] & OBJC_POINTER_MASK);
+            }
+        }
+        free(list);
+    }
+    objc_reader_free(&reader);
+
+    if (images == 0) {
+        output_error(KERN_SUCCESS, "No classes found%s%s", machium->args_count == 3 ? " in " : "", machium->args_count == 3 ? machium->args[2] : "");
+        return MACHIUM_FAILURE;
+    }
+    output_message(OUTPUT_LEVEL_GOOD, "%llu classes in %u images", total, images);
+    return MACHIUM_SUCCESS;
+}
+
+//print an ivar's value out of the bytes of the object
+static void objc_print_ivar(ObjCIvar* ivar, const uint8_t* object, uint32_t object_size) {
+    uint64_t value;
+
+    output_textf("    +0x%-4x %-28s %-24s", ivar->offset, ivar->name ? ivar->name : "?", ivar->type ? ivar->type : "?");
+    if (ivar->size == 0 || ivar->size > 8 || (ivar->size & (ivar->size - 1)) || ivar->offset + ivar->size > object_size) {
+        output_textf(" (%u bytes)\n", ivar->size);
+        return;
+    }
+    value = 0;
+    memcpy(&value, object + ivar->offset, ivar->size);
+    output_textf(" = 0x%llx\n", value);
+}
+
+/*
+print the class, ivars (with their values) and methods of the object at [address]
+with the classes cached this is a single read of the object
+
+machium->args[0] -> objc
+machium->args[1] -> inspect
+machium->args[2] -> [0xaddress]
+*/
+static machium_command_t m_objc_inspect(Machium* machium) {
+    char annotation[IMAGE_DESCRIPTION_MAX];
+    ObjCCache* cache;
+    ObjCReader reader;
+    ObjCClass* chain[OBJC_SUPERCLASS_MAX];
+    ObjCClass* class;
+    uint8_t* object;
+    vm_size_t read_size;
+    uint64_t address;
+    uint64_t isa;
+    uint32_t object_size;
+    uint32_t depth;
+
+    if (machium->args_count != 3) {
+        output_error(KERN_SUCCESS, "Usage: objc inspect [0xaddress]");
+        return MACHIUM_FAILURE;
+    }
+    address = strtoull(machium->args[2], NULL, 0);
+    if (address >> 63) {
+        output_message(OUTPUT_LEVEL_WARNING, "0x%llx is a tagged pointer, the value lives in the pointer itself", address);
+        return MACHIUM_SUCCESS;
+    }
+
+    //most objects fit in the first read, a read that crosses into an unmapped page gets shortened to the isa
+    object_size = OBJC_OBJECT_READ;
+    object = (uint8_t*) malloc(object_size);
+    read_size = object_size;
+    if (vm_read_overwrite(machium->target->debug_task, (vm_address_t) address, object_size, (vm_address_t) object, &read_size) != KERN_SUCCESS) {
+        object_size = sizeof(uint64_t);
+        read_size = object_size;
+        if (vm_read_overwrite(machium->target->debug_task, (vm_address_t) address, object_size, (vm_address_t) object, &read_size) != KERN_SUCCESS) {
+            output_error(KERN_SUCCESS, "Failed to read 0x%llx", address);
+            free(object);
+            return MACHIUM_FAILURE;
+        }
+    }
+    memcpy(&isa, object, sizeof(isa));
+
+    cache = objc_cache(machium->target);
+    memset(&reader, 0, sizeof(reader));
+    reader.task = machium->target->debug_task;
+    depth = 0;
+    class = objc_class(cache, &reader, isa & OBJC_ISA_MASK);
+    while (class && depth < OBJC_SUPERCLASS_MAX) {
+        chain[depth++] = class;
+        class = class->superclass ? objc_class(cache, &reader, class->superclass) : NULL;
+    }
+    objc_reader_free(&reader);
+    if (depth == 0) {
+        output_error(KERN_SUCCESS, "0x%llx doesn't look like an object, isa 0x%llx isn't a class", address, isa);
+        free(object);
+        return MACHIUM_FAILURE;
+    }
+
+    if (chain[0]->instance_size > object_size) {
+        object = (uint8_t*) realloc(object, chain[0]->instance_size);
+        read_size = chain[0]->instance_size;
+        if (vm_read_overwrite(machium->target->debug_task, (vm_address_t) address, chain[0]->instance_size, (vm_address_t) object, &read_size) == KERN_SUCCESS)
+            object_size = chain[0]->instance_size;
+    }
+
+    output_textf(GOOD"0x%llx is %s %s", address, chain[0]->meta ? "the class" : "an instance of", chain[0]->name);
+    for (uint32_t i = 1; i < depth; i++)
+        output_textf(" : %s", chain[i]->name);
+    output_textf(", %u bytes\n", chain[0]->instance_size);
+
+    //ivars from the root class down, in memory order
+    for (uint32_t i = depth; i-- > 0;) {
+        if (chain[i]->ivar_count == 0)
+            continue;
+        output_textf(YELLOW"  %s\n"WHITE, chain[i]->name);
+        for (uint32_t j = 0; j < chain[i]->ivar_count; j++)
+            objc_print_ivar(&chain[i]->ivars[j], object, object_size);
+    }
+    free(object);
+
+    output_message(OUTPUT_LEVEL_GOOD, "%u methods of %s:", chain[0]->method_count, chain[0]->name);
+    for (uint32_t i = 0; i < chain[0]->method_count; i++) {
+        output_textf("    %c[%s %s] 0x%llx%s\n", chain[0]->meta ? '+' : '-', chain[0]->name, chain[0]->methods[i].name ? chain[0]->methods[i].name : "?",
+               chain[0]->methods[i].imp, image_annotate(machium, chain[0]->methods[i].imp, annotation, sizeof(annotation)));
+    }
+    return MACHIUM_SUCCESS;
+}
+
+/*
+handle objc commands
+
+machium->args[0] -> objc
+machium->args[1] -> [command]
+*/
+machium_command_t m_objc(Machium* machium) {
+    if (machium->args_count < 2 || !strcmp(machium->args[1], "classes")) return m_objc_classes(machium);
+    else if (!strcmp(machium->args[1], "inspect") || !strcmp(machium->args[1], "i")) return m_objc_inspect(machium);
+
+    output_error(KERN_SUCCESS, "Invalid argument for 'objc', %s", machium->args[1]);
+    return MACHIUM_FAILURE;
+}
@@ -0,0 +1,90 @@
+#ifndef OBJC_H
+#define OBJC_H
+
+#include "Machium.h"
+#include <pthread.h>
+
+#define OBJC_ISA_MASK 0x0000000ffffffff8ULL //class bits of a non-pointer isa
+#define OBJC_POINTER_MASK 0x0000000fffffffffULL //pointers without pointer authentication bits
+#define OBJC_FAST_DATA_MASK 0x00007ffffffffff8ULL //class_rw_t (or class_ro_t before realizing) out of objc_class.bits
+#define OBJC_RW_REALIZED (1U << 31) //class_rw_t.flags, never set in a class_ro_t
+#define OBJC_RO_META 1 //class_ro_t.flags
+#define OBJC_SMALL_METHODS 0x80000000 //method_list_t flag, entries are 3 int32 offsets instead of 3 pointers
+#define OBJC_DIRECT_SELECTORS 0x40000000 //method_list_t flag, small names are offsets from the selector base instead of to a selector reference
+#define OBJC_LIST_ENTSIZE 0x0000fffc //entsize bits of method_list_t / ivar_list_t.entsizeAndFlags
+
+#define OBJC_PAGES 32 //pages one command keeps while it decodes metadata
+#define OBJC_NAME_MAX 256 //longest class, ivar or selector name
+#define OBJC_OBJECT_READ 256 //bytes of an object read up front, most objects fit
+#define OBJC_SUPERCLASS_MAX 64 //deepest class hierarchy 'objc inspect' walks
+#define OBJC_CACHE_SLOTS 1024 //first size of the class cache, has to be a power of 2
+
+//the parts of the runtime's structs Machium reads, see objc-runtime-new.h
+typedef struct ObjCClassHeader {
+    uint64_t isa;
+    uint64_t superclass;
+    uint64_t cache[2];
+    uint64_t bits;
+} ObjCClassHeader;
+
+typedef struct ObjCClassRO {
+    uint32_t flags;
+    uint32_t instance_start;
+    uint32_t instance_size;
+    uint32_t reserved;
+    uint64_t ivar_layout;
+    uint64_t name;
+    uint64_t base_methods;
+    uint64_t base_protocols;
+    uint64_t ivars;
+    uint64_t weak_ivar_layout;
+    uint64_t base_properties;
+} ObjCClassRO;
+
+typedef struct ObjCIvarEntry {
+    uint64_t offset; //int32_t* to the real offset, the runtime slides it when a superclass grows
+    uint64_t name;
+    uint64_t type;
+    uint32_t alignment;
+    uint32_t size;
+} ObjCIvarEntry;
+
+typedef struct ObjCIvar {
+    char* name;
+    char* type;
+    uint32_t offset;
+    uint32_t size;
+} ObjCIvar;
+
+typedef struct ObjCMethod {
+    char* name;
+    uint64_t imp;
+} ObjCMethod;
+
+//a class decoded once and kept for the rest of the session, metadata of a loaded class doesn't change
+typedef struct ObjCClass {
+    uint64_t address;
+    uint64_t superclass;
+    char* name;
+    uint32_t instance_size;
+    bool meta;
+    ObjCIvar* ivars;
+    uint32_t ivar_count;
+    ObjCMethod* methods; //from class_ro_t, methods categories add later aren't in here
+    uint32_t method_count;
+} ObjCClass;
+
+//decoded classes of a target by address
+typedef struct ObjCCache {
+    ObjCClass** slots;
+    uint32_t capacity;
+    uint32_t count;
+    pthread_mutex_t lock;
+} ObjCCache;
+
+void objc_cache_free(ObjCCache* cache);
+
+//handle objc commands
+machium_command_t m_objc(Machium* machium);
+
+#endif /* OBJC_H */
@@ -0,0 +1,519 @@
+#include "Output.h"
+#include "Job.h"
+
+#include <stdarg.h>
+#include <errno.h>
+
+static const char* output_mode_names[] = { "text", "json", "binary" };
+static const char* output_type_names[] = { "text", "message", "error", "address", "bytes", "value", "registers" };
+static const char* output_level_names[] = { "none", "good", "warning", "error" };
+static const char* output_level_prefixes[] = { "", GOOD, WARNING, ERROR };
+
+static volatile uint8_t current_mode = OUTPUT_TEXT;
+
+//what the CLI outputs, also what pool workers helping a foreground command and other threads outside of jobs output
+//every job has a writer of its own, see Job.h, so a job never ends up in the middle of a command
+static OutputWriter cli_output;
+static OutputWriter cli_printed; //text that isn't a whole line yet
+static pthread_mutex_t cli_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t stdout_lock = PTHREAD_MUTEX_INITIALIZER; //the CLI and jobs drain into stdout in one piece each
+static pthread_once_t exit_once = PTHREAD_ONCE_INIT;
+
+uint8_t output_mode(void) {
+    return current_mode;
+}
+
+void output_set_mode(uint8_t mode) {
+    output_flush(); //what's already in there was rendered for the old mode
+    current_mode = mode;
+}
+
+//write out what [writer] holds in one piece
+static void output_drain(OutputWriter* writer) {
+    ssize_t written;
+    size_t done;
+
+    pthread_mutex_lock(&stdout_lock);
+    for (done = 0; done < writer->used; done += (size_t) written) {
+        written = write(STDOUT_FILENO, writer->data + done, writer->used - done);
+        if (written < 0 && errno == EINTR)
+            written = 0;
+        else if (written <= 0)
+            break;
+    }
+    pthread_mutex_unlock(&stdout_lock);
+    writer->used = 0;
+}
+
+//room for [size] more bytes, false when there's no memory for them
+static bool output_reserve(OutputWriter* writer, size_t size) {
+    char* data;
+    size_t capacity;
+
+    if (writer->used + size <= writer->capacity)
+        return true;
+    capacity = writer->used + size > OUTPUT_BUFFER ? writer->used + size : OUTPUT_BUFFER;
+    data = (char*) realloc(writer->data, capacity);
+    if (data == NULL)
+        return false;
+    writer->data = data;
+    writer->capacity = capacity;
+    return true;
+}
+
+static void output_write(OutputWriter* writer, const void* data, size_t size) {
+    if (writer->used + size > writer->capacity && writer->used && writer->used + size > OUTPUT_BUFFER)
+        output_drain(writer);
+    if (!output_reserve(writer, size))
+        return;
+    memcpy(writer->data + writer->used, data, size);
+    writer->used += size;
+}
+
+static void output_printf(OutputWriter* writer, const char* format, ...) __attribute__((format(printf, 2, 3)));
+static void output_printf(OutputWriter* writer, const char* format, ...) {
+    char small[512];
+    char* large;
+    va_list args;
+    int length;
+
+    va_start(args, format);
+    length = vsnprintf(small, sizeof(small), format, args);
+    va_end(args);
+    if (length < 0)
+        return;
+    if ((size_t) length < sizeof(small)) {
+        output_write(writer, small, length);
+        return;
+    }
+
+    large = (char*) malloc(length + 1);
+    if (large == NULL)
+        return;
+    va_start(args, format);
+    vsnprintf(large, length + 1, format, args);
+    va_end(args);
+    output_write(writer, large, length);
+    free(large);
+}
+
+//[size] bytes as hex digits, a block at a time
+static void output_hex(OutputWriter* writer, const uint8_t* data, uint64_t size) {
+    static const char digits[] = "0123456789abcdef";
+    char block[512];
+    uint64_t chunk;
+
+    while (size) {
+        chunk = size < sizeof(block) / 2 ? size : sizeof(block) / 2;
+        for (uint64_t i = 0; i < chunk; i++) {
+            block[i * 2] = digits[data[i] >> 4];
+            block[i * 2 + 1] = digits[data[i] & 0xf];
+        }
+        output_write(writer, block, chunk * 2);
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+//level of a line going by its GOOD / WARNING / ERROR prefix, [text] is moved past the prefix
+static uint8_t output_line_level(const char** text, size_t* size) {
+    size_t length;
+
+    for (uint8_t level = OUTPUT_LEVEL_GOOD; level <= OUTPUT_LEVEL_ERROR; level++) {
+        length = strlen(output_level_prefixes[level]);
+        if (*size >= length && !memcmp(*text, output_level_prefixes[level], length)) {
+            *text += length;
+            *size -= length;
+            return level;
+        }
+    }
+    return OUTPUT_LEVEL_NONE;
+}
+
+/*
+text sink, looks the same as the printf'd output of every other command
+*/
+static void output_text_sink(OutputWriter* writer, const OutputRecord* record) {
+    const arm_thread_state64_t* state;
+
+    switch (record->type) {
+        case RECORD_TEXT:
+            output_write(writer, record->text, record->size);
+            break;
+        case RECORD_MESSAGE:
+            output_printf(writer, "%s%s\n", output_level_prefixes[record->level], record->text);
+            break;
+        case RECORD_ERROR:
+            if (record->kret != KERN_SUCCESS)
+                output_printf(writer, ERROR"%s\nError: %s\n", record->text, mach_error_string(record->kret));
+            else
+                output_printf(writer, ERROR"%s\n", record->text);
+            break;
+        case RECORD_ADDRESS:
+            output_printf(writer, "0x%llx%s%s%s\n", record->address, record->symbol ? " (" : "", record->symbol ? record->symbol : "", record->symbol ? ")" : "");
+            break;
+        case RECORD_BYTES:
+            output_write(writer, "0x", 2);
+            output_hex(writer, (const uint8_t*) record->data, record->size);
+            output_write(writer, "\n", 1);
+            break;
+        case RECORD_VALUE:
+            output_printf(writer, "0x%llx%s%s%s\n", record->value, record->symbol ? " (" : "", record->symbol ? record->symbol : "", record->symbol ? ")" : "");
+            break;
+        case RECORD_REGISTERS:
+            state = (const arm_thread_state64_t*) record->data;
+            for (int i = 0; i < 29; i++)
+                output_printf(writer, GREEN "x%d " WHITE "= 0x%llx\n", i, state->__x[i]);
+            output_printf(writer, YELLOW "fp " WHITE "= 0x%llx\n", state->__fp);
+            output_printf(writer, YELLOW "lr " WHITE "= 0x%llx%s%s%s\n", state->__lr, record->link_symbol ? " (" : "", record->link_symbol ? record->link_symbol : "", record->link_symbol ? ")" : "");
+            output_printf(writer, YELLOW "sp " WHITE "= 0x%llx\n", state->__sp);
+            output_printf(writer, RED "pc " WHITE "= 0x%llx%s%s%s\n", state->__pc, record->symbol ? " (" : "", record->symbol ? record->symbol : "", record->symbol ? ")" : "");
+            output_printf(writer, YELLOW "cpsr " WHITE "= 0x%x\n", state->__cpsr);
+            output_printf(writer, YELLOW "pad " WHITE "= 0x%x\n", state->__pad);
+            break;
+    }
+}
+
+//a JSON string of [size] bytes of [text], colour escapes are dropped
+static void output_json_string(OutputWriter* writer, const char* text, size_t size) {
+    char escaped[8];
+    size_t start;
+    size_t i;
+
+    output_write(writer, "\"", 1);
+    start = 0;
+    for (i = 0; i < size; i++) {
+        if ((uint8_t) text[i] >= 0x20 && text[i] != '"' && text[i] != '\\')
+            continue;
+        output_write(writer, text + start, i - start);
+        if (text[i] == '\033' && i + 1 < size && text[i + 1] == '[') {
+            //skip \033[..m
+            while (i < size && text[i] != 'm')
+                i++;
+        }
+        else if (text[i] == '"' || text[i] == '\\') {
+            escaped[0] = '\\';
+            escaped[1] = text[i];
+            output_write(writer, escaped, 2);
+        }
+        else {
+            snprintf(escaped, sizeof(escaped), "\\u%04x", (uint8_t) text[i]);
+            output_write(writer, escaped, 6);
+        }
+        start = i + 1;
+    }
+    if (start < size)
+        output_write(writer, text + start, size - start);
+    output_write(writer, "\"", 1);
+}
+
+static void output_json_symbol(OutputWriter* writer, const char* key, const char* symbol) {
+    if (symbol == NULL)
+        return;
+    output_printf(writer, ",\"%s\":", key);
+    output_json_string(writer, symbol, strlen(symbol));
+}
+
+/*
+json lines sink, every record is an object on its own line with a "type"
+addresses and values are strings of hex so nothing gets rounded through a double
+*/
+static void output_json_sink(OutputWriter* writer, const OutputRecord* record) {
+    const arm_thread_state64_t* state;
+    const char* line;
+    const char* next;
+    const char* end;
+    const char* text;
+    size_t length;
+    uint8_t level;
+
+    if (record->type == RECORD_TEXT) {
+        //one record per line
+        line = record->text;
+        end = record->text + record->size;
+        while (line < end) {
+            next = (const char*) memchr(line, '\n', end - line);
+            text = line;
+            length = (size_t) ((next ? next : end) - line);
+            if (length) {
+                level = output_line_level(&text, &length);
+                output_printf(writer, "{\"type\":\"text\",\"level\":\"%s\",\"text\":", output_level_names[level]);
+                output_json_string(writer, text, length);
+                output_write(writer, "}\n", 2);
+            }
+            line = next ? next + 1 : end;
+        }
+        return;
+    }
+
+    output_printf(writer, "{\"type\":\"%s\"", output_type_names[record->type]);
+    switch (record->type) {
+        case RECORD_MESSAGE:
+            output_printf(writer, ",\"level\":\"%s\",\"text\":", output_level_names[record->level]);
+            output_json_string(writer, record->text, strlen(record->text));
+            break;
+        case RECORD_ERROR:
+            output_write(writer, ",\"text\":", 8);
+            output_json_string(writer, record->text, strlen(record->text));
+            output_printf(writer, ",\"kret\":%d,\"kret_string\":", record->kret);
+            output_json_string(writer, mach_error_string(record->kret), strlen(mach_error_string(record->kret)));
+            break;
+        case RECORD_ADDRESS:
+            output_printf(writer, ",\"address\":\"0x%llx\"", record->address);
+            output_json_symbol(writer, "symbol", record->symbol);
+            break;
+        case RECORD_BYTES:
+            output_printf(writer, ",\"address\":\"0x%llx\",\"size\":%llu,\"data\":\"", record->address, record->size);
+            output_hex(writer, (const uint8_t*) record->data, record->size);
+            output_write(writer, "\"", 1);
+            break;
+        case RECORD_VALUE:
+            output_printf(writer, ",\"address\":\"0x%llx\",\"size\":%llu,\"value\":\"0x%llx\"", record->address, record->size, record->value);
+            output_json_symbol(writer, "symbol", record->symbol);
+            break;
+        case RECORD_REGISTERS:
+            state = (const arm_thread_state64_t*) record->data;
+            output_write(writer, ",\"x\":[", 6);
+            for (int i = 0; i < 29; i++)
+                output_printf(writer, "%s\"0x%llx\"", i ? "," : "", state->__x[i]);
+            output_printf(writer, "],\"fp\":\"0x%llx\",\"lr\":\"0x%llx\",\"sp\":\"0x%llx\",\"pc\":\"0x%llx\",\"cpsr\":\"0x%x\",\"pad\":\"0x%x\"",
+                          state->__fp, state->__lr, state->__sp, state->__pc, state->__cpsr, state->__pad);
+            output_json_symbol(writer, "pc_symbol", record->symbol);
+            output_json_symbol(writer, "lr_symbol", record->link_symbol);
+            break;
+    }
+    output_write(writer, "}\n", 2);
+}
+
+/*
+binary sink, see OutputBinaryHeader
+text isn't split into lines, automation reading binary wants the bytes and not the formatting
+*/
+static void output_binary_sink(OutputWriter* writer, const OutputRecord* record) {
+    OutputBinaryHeader header;
+    const void* payload;
+    size_t size;
+
+    memset(&header, 0, sizeof(header));
+    header.type = record->type;
+    header.level = record->level;
+    header.kret = record->kret;
+    header.address = record->address;
+    header.value = record->value;
+
+    payload = NULL;
+    size = 0;
+    switch (record->type) {
+        case RECORD_TEXT:
+            payload = record->text;
+            size = record->size;
+            break;
+        case RECORD_MESSAGE:
+        case RECORD_ERROR:
+            payload = record->text;
+            size = strlen(record->text);
+            break;
+        case RECORD_BYTES:
+            payload = record->data;
+            size = record->size;
+            break;
+        case RECORD_REGISTERS:
+            payload = record->data;
+            size = sizeof(arm_thread_state64_t);
+            break;
+        case RECORD_VALUE:
+            header.value_size = (uint32_t) record->size;
+            //fall through
+        case RECORD_ADDRESS:
+            payload = record->symbol;
+            size = record->symbol ? strlen(record->symbol) : 0;
+            break;
+    }
+    header.size = (uint32_t) (sizeof(header) + size);
+    output_write(writer, &header, sizeof(header));
+    if (size)
+        output_write(writer, payload, size);
+}
+
+static const output_sink_t output_sinks[] = { output_text_sink, output_json_sink, output_binary_sink };
+
+/*
+turn the text in [printed] into text records in [output], so it lands in front of the next record like it would have on a terminal
+a line that isn't finished yet stays unless [whole]
+*/
+static void output_pending(OutputWriter* output, OutputWriter* printed, bool whole) {
+    size_t size;
+
+    size = printed->used;
+    while (!whole && size && printed->data[size - 1] != '\n')
+        size--;
+    if (size == 0)
+        return;
+    output_sinks[current_mode](output, &(OutputRecord) { .type = RECORD_TEXT, .text = printed->data, .size = size });
+    memmove(printed->data, printed->data + size, printed->used - size);
+    printed->used -= size;
+}
+
+//machium_exit can run in the middle of a command, what it output still has to come out
+static void output_exit(void) {
+    output_flush();
+}
+
+static void output_register_exit(void) {
+    atexit(output_exit);
+}
+
+//get the writers of the job running on this thread, or the CLI's when there's none. returns the lock it took
+static pthread_mutex_t* output_begin(OutputWriter** output, OutputWriter** printed) {
+    Job* job;
+
+    pthread_once(&exit_once, output_register_exit);
+    job = job_current();
+    if (job == NULL) {
+        *output = &cli_output;
+        *printed = &cli_printed;
+        pthread_mutex_lock(&cli_lock);
+        return &cli_lock;
+    }
+    //pieces of a job run on several workers, they share its writer
+    *output = &job->output;
+    *printed = &job->printed;
+    pthread_mutex_lock(&job->output_lock);
+    return &job->output_lock;
+}
+
+void output_record(const OutputRecord* record) {
+    OutputWriter* output;
+    OutputWriter* printed;
+    pthread_mutex_t* lock;
+
+    lock = output_begin(&output, &printed);
+    output_pending(output, printed, true);
+    output_sinks[current_mode](output, record);
+    pthread_mutex_unlock(lock);
+}
+
+void output_text(const char* text, size_t size) {
+    OutputWriter* output;
+    OutputWriter* printed;
+    pthread_mutex_t* lock;
+
+    if (size == 0)
+        return;
+    lock = output_begin(&output, &printed);
+    if (output_reserve(printed, size)) {
+        memcpy(printed->data + printed->used, text, size);
+        printed->used += size;
+    }
+    if (printed->used > OUTPUT_BUFFER)
+        output_pending(output, printed, false);
+    pthread_mutex_unlock(lock);
+}
+
+void output_textf(const char* format, ...) {
+    char small[512];
+    char* large;
+    va_list args;
+    int length;
+
+    va_start(args, format);
+    length = vsnprintf(small, sizeof(small), format, args);
+    va_end(args);
+    if (length < 0)
+        return;
+    if ((size_t) length < sizeof(small)) {
+        output_text(small, length);
+        return;
+    }
+
+    large = (char*) malloc(length + 1);
+    if (large == NULL)
+        return;
+    va_start(args, format);
+    vsnprintf(large, length + 1, format, args);
+    va_end(args);
+    output_text(large, length);
+    free(large);
+}
+
+void output_message(uint8_t level, const char* format, ...) {
+    char text[1024];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    output_record(&(OutputRecord) { .type = RECORD_MESSAGE, .level = level, .text = text });
+}
+
+void output_error(kern_return_t kret, const char* format, ...) {
+    char text[1024];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    output_record(&(OutputRecord) { .type = RECORD_ERROR, .level = OUTPUT_LEVEL_ERROR, .kret = kret, .text = text });
+}
+
+void output_address(uint64_t address, const char* symbol) {
+    output_record(&(OutputRecord) { .type = RECORD_ADDRESS, .address = address, .symbol = symbol });
+}
+
+void output_bytes(uint64_t address, const void* data, uint64_t size) {
+    output_record(&(OutputRecord) { .type = RECORD_BYTES, .address = address, .data = data, .size = size });
+}
+
+void output_value(uint64_t address, uint64_t size, uint64_t value, const char* symbol) {
+    output_record(&(OutputRecord) { .type = RECORD_VALUE, .address = address, .size = size, .value = value, .symbol = symbol });
+}
+
+void output_registers(const arm_thread_state64_t* state, const char* pc_symbol, const char* lr_symbol) {
+    output_record(&(OutputRecord) { .type = RECORD_REGISTERS, .data = state, .symbol = pc_symbol, .link_symbol = lr_symbol });
+}
+
+void output_flush(void) {
+    pthread_mutex_lock(&cli_lock);
+    output_pending(&cli_output, &cli_printed, true);
+    if (cli_output.used)
+        output_drain(&cli_output);
+    pthread_mutex_unlock(&cli_lock);
+}
+
+void output_job_flush(Job* job) {
+    pthread_mutex_lock(&job->output_lock);
+    output_pending(&job->output, &job->printed, true);
+    if (job->output.used)
+        output_drain(&job->output);
+    free(job->output.data);
+    free(job->printed.data);
+    job->output.data = NULL;
+    job->output.capacity = 0;
+    job->printed.data = NULL;
+    job->printed.used = 0;
+    job->printed.capacity = 0;
+    pthread_mutex_unlock(&job->output_lock);
+}
+
+/*
+change the output mode
+
+machium->args[0] -> output
+machium->args[1] -> [text/json/binary] (OPTIONAL)
+*/
+machium_command_t m_output(Machium* machium) {
+    if (machium->args_count == 1) {
+        output_message(OUTPUT_LEVEL_GOOD, "Output mode is %s", output_mode_names[current_mode]);
+        return MACHIUM_SUCCESS;
+    }
+    for (uint8_t mode = OUTPUT_TEXT; mode <= OUTPUT_BINARY; mode++) {
+        if (strcmp(machium->args[1], output_mode_names[mode]))
+            continue;
+        output_set_mode(mode);
+        output_message(OUTPUT_LEVEL_GOOD, "Output mode is %s", output_mode_names[mode]);
+        return MACHIUM_SUCCESS;
+    }
+    output_error(KERN_SUCCESS, "Invalid output mode %s, text, json or binary", machium->args[1]);
+    return MACHIUM_FAILURE;
+}
@@ -0,0 +1,96 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "Machium.h"
+
+//output modes, 'output [mode]' or MACHIUM_OUTPUT=[mode] picks one
+#define OUTPUT_TEXT 0 //coloured text like every other command prints
+#define OUTPUT_JSON 1 //one JSON object per line
+#define OUTPUT_BINARY 2 //OutputBinaryHeader followed by its payload, for every record
+#define OUTPUT_MODE_ENV "MACHIUM_OUTPUT"
+
+#define OUTPUT_BUFFER (256 * 1024) //a command writing more than this gets flushed early, the rest goes out when it returns
+
+//record types
+#define RECORD_TEXT 0 //preformatted text from output_text / output_textf. lines starting with GOOD / WARNING / ERROR get that level
+#define RECORD_MESSAGE 1 //[text] with a [level]
+#define RECORD_ERROR 2 //[text] and the [kret] that caused it, KERN_SUCCESS when it wasn't a mach call
+#define RECORD_ADDRESS 3 //[address] and its [symbol]
+#define RECORD_BYTES 4 //[size] bytes of [data] read from [address]
+#define RECORD_VALUE 5 //[size] byte [value] read from [address], [symbol] when the value points into an image
+#define RECORD_REGISTERS 6 //[data] is an arm_thread_state64_t, [symbol] is for pc and [link_symbol] for lr
+
+#define OUTPUT_LEVEL_NONE 0
+#define OUTPUT_LEVEL_GOOD 1
+#define OUTPUT_LEVEL_WARNING 2
+#define OUTPUT_LEVEL_ERROR 3
+
+typedef struct OutputRecord {
+    uint8_t type;
+    uint8_t level;
+    kern_return_t kret;
+    uint64_t address;
+    uint64_t value;
+    uint64_t size;
+    const void* data;
+    const char* text;
+    const char* symbol; //image`symbol+0xoffset without the parentheses, NULL when there's none
+    const char* link_symbol;
+} OutputRecord;
+
+//the records of the CLI's command (or of one job), written out in a single write when the command is done
+typedef struct OutputWriter {
+    char* data;
+    size_t used;
+    size_t capacity;
+} OutputWriter;
+
+//renders a record into the writer, one per mode
+typedef void (*output_sink_t)(OutputWriter* writer, const OutputRecord* record);
+
+/*
+a record in binary mode, little endian like the device
+[size] covers the header and the payload after it: the text of text / message / error, the bytes of bytes,
+an arm_thread_state64_t for registers, the symbol of address / value
+*/
+typedef struct OutputBinaryHeader {
+    uint32_t size;
+    uint8_t type;
+    uint8_t level;
+    uint16_t reserved;
+    int32_t kret;
+    uint32_t value_size; //bytes of a value
+    uint64_t address;
+    uint64_t value;
+} OutputBinaryHeader;
+
+uint8_t output_mode(void);
+void output_set_mode(uint8_t mode);
+
+//render [record] with the sink of the current mode into the CLI's writer, or the writer of the job running on this thread
+void output_record(const OutputRecord* record);
+
+//shorthands for output_record
+void output_message(uint8_t level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+void output_error(kern_return_t kret, const char* format, ...) __attribute__((format(printf, 2, 3)));
+void output_address(uint64_t address, const char* symbol);
+void output_bytes(uint64_t address, const void* data, uint64_t size);
+void output_value(uint64_t address, uint64_t size, uint64_t value, const char* symbol);
+void output_registers(const arm_thread_state64_t* state, const char* pc_symbol, const char* lr_symbol);
+
+//free form text, what commands print when there's no record for it. text is held until its line is done
+//so a line put together by several calls is still one record, and it goes out in order with the records around it
+void output_text(const char* text, size_t size);
+void output_textf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+//write out everything the CLI's writer holds, the CLI calls it once per command and before it waits on anything
+void output_flush(void);
+
+//write out what [job] output and printed, job_run calls it when the job is done
+struct Job;
+void output_job_flush(struct Job* job);
+
+//change the output mode
+machium_command_t m_output(Machium* machium);
+
+#endif /* OUTPUT_H */
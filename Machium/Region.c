@@ -0,0 +1,57 @@
+#include "Region.h"
+
+uint32_t region_list(mach_port_t task, uint64_t start, uint64_t end, vm_prot_t protection, MemoryRegion** out) {
+    kern_return_t kret;
+    vm_region_submap_info_data_64_t info;
+    mach_msg_type_number_t count;
+    vm_address_t address;
+    vm_size_t size;
+    natural_t depth;
+    MemoryRegion* regions;
+    uint32_t region_count;
+    uint32_t capacity;
+    uint64_t low;
+    uint64_t high;
+
+    regions = NULL;
+    region_count = 0;
+    capacity = 0;
+    depth = 0;
+    address = (vm_address_t) start;
+
+    while (address < end) {
+        count = VM_REGION_SUBMAP_INFO_COUNT_64;
+        kret = vm_region_recurse_64(task, &address, &size, &depth, (vm_region_recurse_info_t) &info, &count);
+        if (kret != KERN_SUCCESS || address >= end)
+            break; //no more regions
+
+        //the shared cache is one big submap, go down into it to get at the real regions
+        if (info.is_submap) {
+            depth++;
+            continue;
+        }
+
+        low = address > start ? address : start;
+        high = address + size < end ? address + size : end;
+        if ((info.protection & protection) == protection && low < high) {
+            if (region_count && regions[region_count - 1].address + regions[region_count - 1].size == low && regions[region_count - 1].protection == info.protection && regions[region_count - 1].depth == depth) {
+                regions[region_count - 1].size += high - low;
+            }
+            else {
+                if (region_count == capacity) {
+                    capacity = capacity ? capacity * 2 : 64;
+                    regions = (MemoryRegion*) realloc(regions, capacity * sizeof(MemoryRegion));
+                }
+                regions[region_count].address = low;
+                regions[region_count].size = high - low;
+                regions[region_count].protection = info.protection;
+                regions[region_count].depth = depth;
+                region_count++;
+            }
+        }
+        address += size;
+    }
+
+    *out = regions;
+    return region_count;
+}
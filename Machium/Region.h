@@ -0,0 +1,21 @@
+#ifndef REGION_H
+#define REGION_H
+
+#include "Machium.h"
+
+//a range of the task's address space with one protection
+typedef struct MemoryRegion {
+    uint64_t address;
+    uint64_t size;
+    vm_prot_t protection;
+    uint32_t depth; //0 for regions of the task itself, more for regions inside a submap (the shared cache)
+} MemoryRegion;
+
+/*
+list the regions between [start] and [end] that have at least [protection]
+submaps (the shared cache) are looked into, neighbouring regions with the same protection and depth are merged
+and the first and last region are clipped to [start, end). returns the count, [out] has to be freed
+*/
+uint32_t region_list(mach_port_t task, uint64_t start, uint64_t end, vm_prot_t protection, MemoryRegion** out);
+
+#endif /* REGION_H */
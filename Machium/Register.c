@@ -1,4 +1,6 @@
 #include "Register.h"
+#include "Image.h"
+#include "Output.h"
 
 
 /*
@@ -17,19 +19,22 @@ machium_command_t m_register_read(Machium* machium) {
     arm_thread_state64_t state;
     mach_msg_type_number_t state_count;
 
+    char pc_symbol[IMAGE_DESCRIPTION_MAX];
+    char lr_symbol[IMAGE_DESCRIPTION_MAX];
+
     if (machium->args_count < 2) {
-        printf(ERROR"Not enough arguments for 'register read', 2 minimum\n");
+        output_error(KERN_SUCCESS, "Not enough arguments for 'register read', 2 minimum");
         return MACHIUM_FAILURE;
     }
     else if (machium->args_count > 3) {
-        printf(ERROR"Too many arguments for 'register read', 3 maximum\n");
+        output_error(KERN_SUCCESS, "Too many arguments for 'register read', 3 maximum");
         return MACHIUM_FAILURE;
     }
 
     //task_threads gets an array of active threads for the task indicated by the first argument
-    kret = task_threads(machium->debug_task, &thread_list, &thread_count);
+    kret = task_threads(machium->target->debug_task, &thread_list, &thread_count);
     if (kret != KERN_SUCCESS) {
-        printf(ERROR"Could not get task_threads with error: %s\n", mach_error_string(kret));
+        output_error(kret, "Could not get task_threads");
         return MACHIUM_FAILURE;
     }
 
@@ -42,21 +47,15 @@ machium_command_t m_register_read(Machium* machium) {
     state_count = ARM_THREAD_STATE64_COUNT;
     kret = thread_get_state(thread_list[0], ARM_THREAD_STATE64, (thread_state_t) &state, &state_count);
     if (kret != KERN_SUCCESS) {
-        printf(ERROR"Could not get thread_get_state with error: %s\n", mach_error_string(kret));
+        output_error(kret, "Could not get thread_get_state");
+        thread_resume(thread_list[0]);
         return MACHIUM_FAILURE;
     }
 
     //all states here are defined in the xnu kernel in the struct in the typedef arm_thread_state64_t
     if (machium->args[2][0] == '\0' || !strcmp(machium->args[2], "all")) {
-        for (int i = 0; i < 30; i++) {
-            printf(GREEN "x%d " WHITE "= 0x%llx\n", i, state.__x[i]);
-        }
-        printf(YELLOW "fp " WHITE "= 0x%llx\n", state.__fp);
-        printf(YELLOW "lr " WHITE "= 0x%llx\n", state.__lr);
-        printf(YELLOW "sp " WHITE "= 0x%llx\n", state.__sp);
-        printf(RED "pc " WHITE "= 0x%llx\n", state.__pc);
-        printf(YELLOW "cpsr " WHITE "= 0x%x\n", state.__cpsr);
-        printf(YELLOW "pad " WHITE "= 0x%x\n", state.__pad);
+        output_registers(&state, image_describe(machium, state.__pc, pc_symbol, sizeof(pc_symbol)) ? pc_symbol : NULL,
+                         image_describe(machium, state.__lr, lr_symbol, sizeof(lr_symbol)) ? lr_symbol : NULL);
     }
 
     //resume first thread
@@ -84,18 +83,18 @@ machium_command_t m_register_write(Machium* machium) {
     uint64_t val;
 
     if (machium->args_count < 4) {
-        printf(ERROR"Not enough arguments for 'register write', 4 minimum\n");
+        output_error(KERN_SUCCESS, "Not enough arguments for 'register write', 4 minimum");
         return MACHIUM_FAILURE;
     }
     else if (machium->args_count > 4) {
-        printf(ERROR"Too many arguments for 'register write', 4 maximum\n");
+        output_error(KERN_SUCCESS, "Too many arguments for 'register write', 4 maximum");
         return MACHIUM_FAILURE;
     }
 
     //task_threads gets an array of active threads for the task indicated by the first argument
-    kret = task_threads(machium->debug_task, &thread_list, &thread_count);
+    kret = task_threads(machium->target->debug_task, &thread_list, &thread_count);
     if (kret != KERN_SUCCESS) {
-        printf(ERROR"Could not get task_threads with error: %s\n", mach_error_string(kret));
+        output_error(kret, "Could not get task_threads");
         return MACHIUM_FAILURE;
     }
 
@@ -108,12 +107,12 @@ machium_command_t m_register_write(Machium* machium) {
     state_count = ARM_THREAD_STATE64_COUNT;
     kret = thread_get_state(thread_list[0], ARM_THREAD_STATE64, (thread_state_t) &state, &state_count);
     if (kret != KERN_SUCCESS) {
-        printf(ERROR"Could not get thread_get_state with error: %s\n", mach_error_string(kret));
+        output_error(kret, "Could not get thread_get_state");
         return MACHIUM_FAILURE;
     }
 
     val = strtol(machium->args[3], NULL, 0);
-    printf(GREEN"%s " WHITE " = 0x%llx", machium->args[2], val);
+    output_textf(GREEN"%s " WHITE " = 0x%llx", machium->args[2], val);
 
     //this is beyond ugly but there's probably not a better way to do this
     //all states here are defined in the xnu kernel in the struct in the typedef arm_thread_state64_t
@@ -150,12 +149,12 @@ machium_command_t m_register_write(Machium* machium) {
     else if (!strcmp(machium->args[2], "pc")) state.__pc = val;     // pc
     else if (!strcmp(machium->args[2], "cpsr")) state.__cpsr = val; // cpsr
     else if (!strcmp(machium->args[2], "pc")) state.__pad = val;    // pad
-    else { printf(ERROR"Invalid register.\n"); }
+    else { output_error(KERN_SUCCESS, "Invalid register."); }
 
     //thread_set_state is basically just thread_get_state but it sets the values we changed
     kret = thread_set_state(thread_list[0], ARM_THREAD_STATE64, (thread_state_t)&state, state_count);
     if (kret != KERN_SUCCESS) {
-        printf(ERROR"Could not call thread_set_state with error: %s\n", mach_error_string(kret));
+        output_error(kret, "Could not call thread_set_state");
     }
     //resume first thread
     thread_resume(thread_list[0]);
@@ -176,7 +175,7 @@ machium_command_t m_register(Machium* machium) {
     else if (!strcmp(machium->args[1], "w")) m_register_write(machium);
 
     else {
-        printf(ERROR"Invalid argument for 'register', %s\n", machium->args[1]);
+        output_error(KERN_SUCCESS, "Invalid argument for 'register', %s", machium->args[1]);
         return MACHIUM_FAILURE;
     }
     return MACHIUM_SUCCESS;
@@ -0,0 +1,484 @@
+#include "SharedCache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//local symbols of one image, found before the images are walked
+typedef struct SharedCacheLocals {
+    const struct nlist_64* nlist;
+    uint32_t count;
+    const char* strings;
+    uint32_t strings_size;
+    uint8_t file;
+} SharedCacheLocals;
+
+/*
+mmap one file of the cache and check it's a cache
+the header is copied out since older caches have shorter ones, whatever they don't have reads as 0
+*/
+static bool shared_cache_map(SharedCacheFile* file, const char* path, SharedCacheHeader* header) {
+    struct stat info;
+    uint32_t header_size;
+    int fd;
+
+    memset(file, 0, sizeof(SharedCacheFile));
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    if (fstat(fd, &info) || info.st_size < (off_t) offsetof(SharedCacheHeader, dyld_base)) {
+        close(fd);
+        return false;
+    }
+    file->map = (uint8_t*) mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); //the mapping keeps the file alive
+    if (file->map == MAP_FAILED) {
+        file->map = NULL;
+        return false;
+    }
+    file->map_size = (size_t) info.st_size;
+
+    memset(header, 0, sizeof(SharedCacheHeader));
+    memcpy(header, file->map, offsetof(SharedCacheHeader, dyld_base));
+    if (strncmp(header->magic, "dyld_v1", 7) || header->mapping_offset > file->map_size ||
+        (uint64_t) header->mapping_count * sizeof(SharedCacheMapping) > file->map_size - header->mapping_offset) {
+        munmap(file->map, file->map_size);
+        memset(file, 0, sizeof(SharedCacheFile));
+        return false;
+    }
+    header_size = header->mapping_offset < sizeof(SharedCacheHeader) ? header->mapping_offset : sizeof(SharedCacheHeader);
+    memcpy(header, file->map, header_size);
+
+    file->mappings = (const SharedCacheMapping*) (file->map + header->mapping_offset);
+    file->mapping_count = header->mapping_count;
+    return true;
+}
+
+//open a subcache or .symbols file and make sure it's the one the main file expects
+static bool shared_cache_add(SharedCache* cache, const char* path, const uint8_t uuid[16], SharedCacheHeader* header) {
+    SharedCacheFile* file;
+
+    if (cache->file_count == SHARED_CACHE_FILES_MAX)
+        return false;
+    file = &cache->files[cache->file_count];
+    if (!shared_cache_map(file, path, header))
+        return false;
+    if (memcmp(header->uuid, uuid, 16)) {
+        munmap(file->map, file->map_size);
+        memset(file, 0, sizeof(SharedCacheFile));
+        return false;
+    }
+    cache->file_count++;
+    return true;
+}
+
+//find the bytes of unslid [address, address + size) in whichever file maps them
+static const uint8_t* shared_cache_resolve(const SharedCache* cache, uint64_t address, uint64_t size, uint8_t* file_index) {
+    const SharedCacheFile* file;
+    const SharedCacheMapping* mapping;
+    uint64_t offset;
+
+    for (uint32_t i = 0; i < cache->file_count; i++) {
+        file = &cache->files[i];
+        for (uint32_t j = 0; j < file->mapping_count; j++) {
+            mapping = &file->mappings[j];
+            if (address < mapping->address || address - mapping->address > mapping->size || size > mapping->size - (address - mapping->address))
+                continue;
+            offset = mapping->file_offset + (address - mapping->address);
+            if (offset > file->map_size || size > file->map_size - offset)
+                return NULL;
+            if (file_index)
+                *file_index = (uint8_t) i;
+            return file->map + offset;
+        }
+    }
+    return NULL;
+}
+
+bool shared_cache_read(void* context, uint64_t address, void* out, size_t size) {
+    const uint8_t* data;
+
+    data = shared_cache_resolve((const SharedCache*) context, address, size, NULL);
+    if (data == NULL)
+        return false;
+    memcpy(out, data, size);
+    return true;
+}
+
+static int compare_images(const void* a, const void* b) {
+    const SharedCacheImage* left = (const SharedCacheImage*) a;
+    const SharedCacheImage* right = (const SharedCacheImage*) b;
+
+    if (left->address == right->address)
+        return 0;
+    return left->address < right->address ? -1 : 1;
+}
+
+//same order as macho_parse_symbols: by address, named symbols in front of function starts
+static int compare_symbols(const void* a, const void* b) {
+    const SharedCacheSymbol* left = (const SharedCacheSymbol*) a;
+    const SharedCacheSymbol* right = (const SharedCacheSymbol*) b;
+
+    if (left->address != right->address)
+        return left->address < right->address ? -1 : 1;
+    if ((left->name == MACHO_UNNAMED) != (right->name == MACHO_UNNAMED))
+        return left->name == MACHO_UNNAMED ? 1 : -1;
+    return 0;
+}
+
+static bool shared_cache_load_images(SharedCache* cache, const SharedCacheHeader* header) {
+    const SharedCacheFile* main = &cache->files[0];
+    const SharedCacheImageInfo* infos;
+    const char* path;
+    const char* slash;
+    uint32_t offset;
+    uint32_t count;
+
+    offset = header->images_count ? header->images_offset : header->images_offset_old;
+    count = header->images_count ? header->images_count : header->images_count_old;
+    if (count == 0 || offset > main->map_size || (uint64_t) count * sizeof(SharedCacheImageInfo) > main->map_size - offset)
+        return false;
+
+    infos = (const SharedCacheImageInfo*) (main->map + offset);
+    cache->images = (SharedCacheImage*) calloc(count, sizeof(SharedCacheImage));
+    if (cache->images == NULL)
+        return false;
+    for (uint32_t i = 0; i < count; i++) {
+        if (infos[i].path_offset >= main->map_size || memchr(main->map + infos[i].path_offset, '\0', main->map_size - infos[i].path_offset) == NULL)
+            continue;
+        path = (const char*) main->map + infos[i].path_offset;
+        slash = strrchr(path, '/');
+        cache->images[cache->image_count].address = infos[i].address;
+        cache->images[cache->image_count].path = path;
+        cache->images[cache->image_count].name = slash ? slash + 1 : path;
+        cache->image_count++;
+    }
+    qsort(cache->images, cache->image_count, sizeof(SharedCacheImage), compare_images);
+    return cache->image_count != 0;
+}
+
+/*
+the locals of every image are in one blob, in the main file of older caches and in .symbols of split ones
+each entry points at a dylib and a range of the blob's nlists
+*/
+static void shared_cache_find_locals(SharedCache* cache, uint8_t file_index, const SharedCacheHeader* header, SharedCacheLocals* locals) {
+    const SharedCacheFile* file = &cache->files[file_index];
+    const SharedCacheLocalsInfo* info;
+    const uint8_t* blob;
+    uint64_t dylib;
+    uint64_t address;
+    uint32_t start;
+    uint32_t count;
+    int64_t image;
+    bool wide;
+
+    if (header->local_symbols_offset == 0 || header->local_symbols_offset > file->map_size || header->local_symbols_size > file->map_size - header->local_symbols_offset ||
+        header->local_symbols_size < sizeof(SharedCacheLocalsInfo))
+        return;
+    blob = file->map + header->local_symbols_offset;
+    info = (const SharedCacheLocalsInfo*) blob;
+    if (info->nlist_offset > header->local_symbols_size || (uint64_t) info->nlist_count * sizeof(struct nlist_64) > header->local_symbols_size - info->nlist_offset ||
+        info->strings_offset > header->local_symbols_size || info->strings_size > header->local_symbols_size - info->strings_offset || info->strings_size == 0)
+        return;
+
+    //headers that know about .symbols use 64-bit entries with addresses instead of file offsets
+    wide = header->mapping_offset >= offsetof(SharedCacheHeader, symbols_uuid);
+    if (info->entries_offset > header->local_symbols_size ||
+        (uint64_t) info->entries_count * (wide ? sizeof(SharedCacheLocalsEntry64) : sizeof(SharedCacheLocalsEntry)) > header->local_symbols_size - info->entries_offset)
+        return;
+
+    for (uint32_t i = 0; i < info->entries_count; i++) {
+        if (wide) {
+            const SharedCacheLocalsEntry64* entry = (const SharedCacheLocalsEntry64*) (blob + info->entries_offset) + i;
+            dylib = entry->dylib_offset;
+            start = entry->nlist_start;
+            count = entry->nlist_count;
+            address = cache->base + dylib;
+        }
+        else {
+            const SharedCacheLocalsEntry* entry = (const SharedCacheLocalsEntry*) (blob + info->entries_offset) + i;
+            dylib = entry->dylib_offset;
+            start = entry->nlist_start;
+            count = entry->nlist_count;
+
+            //a file offset into the main file, the only file these caches have
+            address = UINT64_MAX;
+            for (uint32_t j = 0; j < cache->files[0].mapping_count; j++) {
+                const SharedCacheMapping* mapping = &cache->files[0].mappings[j];
+                if (dylib >= mapping->file_offset && dylib - mapping->file_offset < mapping->size)
+                    address = mapping->address + (dylib - mapping->file_offset);
+            }
+        }
+        if (start > info->nlist_count || count > info->nlist_count - start)
+            continue;
+        image = shared_cache_find_image(cache, address);
+        if (image < 0)
+            continue;
+        locals[image].nlist = (const struct nlist_64*) (blob + info->nlist_offset) + start;
+        locals[image].count = count;
+        locals[image].strings = (const char*) blob + info->strings_offset;
+        locals[image].strings_size = info->strings_size;
+        locals[image].file = file_index;
+    }
+}
+
+//true when [address] is in one of the image's segments, __LINKEDIT is shared by every image so it doesn't count
+static bool shared_cache_image_contains(const MachOImage* macho, uint64_t address) {
+    for (uint32_t i = 0; i < macho->segment_count; i++) {
+        if (address - macho->segments[i].vmaddr < macho->segments[i].vmsize && strcmp(macho->segments[i].name, "__LINKEDIT"))
+            return true;
+    }
+    return false;
+}
+
+static bool shared_cache_push(SharedCache* cache, uint32_t* capacity, uint64_t address, uint32_t name, uint16_t image, uint8_t file, uint8_t local) {
+    SharedCacheSymbol* symbols;
+
+    if (cache->symbol_count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 1 << 16;
+        symbols = (SharedCacheSymbol*) realloc(cache->symbols, (size_t) *capacity * sizeof(SharedCacheSymbol));
+        if (symbols == NULL)
+            return false;
+        cache->symbols = symbols;
+    }
+    cache->symbols[cache->symbol_count].address = address;
+    cache->symbols[cache->symbol_count].name = name;
+    cache->symbols[cache->symbol_count].image = image;
+    cache->symbols[cache->symbol_count].file = file;
+    cache->symbols[cache->symbol_count].local = local;
+    cache->symbol_count++;
+    return true;
+}
+
+//add the nlists of one image that are defined in one of its sections
+static bool shared_cache_add_nlist(SharedCache* cache, uint32_t* capacity, const MachOImage* macho, uint16_t image, const struct nlist_64* nlist, uint32_t count,
+                                   const char* strings, uint32_t strings_size, uint8_t file, uint8_t local) {
+    uint64_t name; //names are offsets into the file's map
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (nlist[i].n_type & N_STAB || (nlist[i].n_type & N_TYPE) != N_SECT)
+            continue;
+        if (nlist[i].n_strx == 0 || nlist[i].n_strx >= strings_size || memchr(strings + nlist[i].n_strx, '\0', strings_size - nlist[i].n_strx) == NULL)
+            continue;
+        if (!shared_cache_image_contains(macho, nlist[i].n_value))
+            continue;
+        name = (uint64_t) ((const uint8_t*) strings + nlist[i].n_strx - cache->files[file].map);
+        if (name >= MACHO_UNNAMED)
+            continue;
+        if (!shared_cache_push(cache, capacity, nlist[i].n_value, (uint32_t) name, image, file, local))
+            return false;
+    }
+    return true;
+}
+
+/*
+every image's exported symbols, locals and function starts go into one array
+the nlists and strings are read right out of the mapping, only the 16 byte entries get allocated
+*/
+static bool shared_cache_index(SharedCache* cache, SharedCacheLocals* locals) {
+    MachOImage macho;
+    const struct nlist_64* nlist;
+    const char* strings;
+    uint32_t* functions;
+    uint32_t function_count;
+    uint32_t capacity;
+    uint32_t count;
+    uint8_t nlist_file;
+    uint8_t strings_file;
+
+    capacity = 0;
+    for (uint32_t i = 0; i < cache->image_count && i <= UINT16_MAX; i++) {
+        if (!macho_parse_header(&macho, shared_cache_read, cache, cache->images[i].address))
+            continue;
+
+        if (macho.symtab.nsyms && macho.symtab.strsize) {
+            nlist = (const struct nlist_64*) shared_cache_resolve(cache, macho_file_to_address(&macho, macho.symtab.symoff, cache->images[i].address, true),
+                                                                  (uint64_t) macho.symtab.nsyms * sizeof(struct nlist_64), &nlist_file);
+            strings = (const char*) shared_cache_resolve(cache, macho_file_to_address(&macho, macho.symtab.stroff, cache->images[i].address, true), macho.symtab.strsize, &strings_file);
+            if (nlist && strings && !shared_cache_add_nlist(cache, &capacity, &macho, (uint16_t) i, nlist, macho.symtab.nsyms, strings, macho.symtab.strsize, strings_file, 0)) {
+                macho_free(&macho);
+                return false;
+            }
+        }
+
+        count = cache->symbol_count;
+        if (locals[i].count && !shared_cache_add_nlist(cache, &capacity, &macho, (uint16_t) i, locals[i].nlist, locals[i].count, locals[i].strings, locals[i].strings_size, locals[i].file, 1)) {
+            macho_free(&macho);
+            return false;
+        }
+        cache->local_count += cache->symbol_count - count;
+
+        function_count = macho_function_starts(&macho, shared_cache_read, cache, cache->images[i].address, true, &functions);
+        for (uint32_t j = 0; j < function_count; j++) {
+            if (!shared_cache_push(cache, &capacity, macho.text_vmaddr + functions[j], MACHO_UNNAMED, (uint16_t) i, 0, 0)) {
+                free(functions);
+                macho_free(&macho);
+                return false;
+            }
+        }
+        free(functions);
+        macho_free(&macho);
+    }
+
+    if (cache->symbol_count == 0)
+        return true;
+    qsort(cache->symbols, cache->symbol_count, sizeof(SharedCacheSymbol), compare_symbols);
+
+    //drop duplicates, the named one of each address is first after sorting
+    count = 0;
+    for (uint32_t i = 0; i < cache->symbol_count; i++) {
+        if (count && cache->symbols[count - 1].address == cache->symbols[i].address)
+            continue;
+        cache->symbols[count++] = cache->symbols[i];
+    }
+    cache->symbol_count = count;
+    return true;
+}
+
+/*
+split caches (iOS 15 / macOS 12 and later) keep most of their mappings in subcaches next to the main file
+and the locals in .symbols. a missing subcache only costs the symbols that live in it
+*/
+bool shared_cache_open(SharedCache* cache, const char* path, const uint8_t* uuid) {
+    SharedCacheHeader header;
+    SharedCacheHeader sub_header;
+    SharedCacheSubcache subcache;
+    SharedCacheLocals* locals;
+    char sub_path[1024];
+    uint64_t entry_size;
+    uint32_t file_count;
+    bool indexed;
+
+    memset(cache, 0, sizeof(SharedCache));
+    if (!shared_cache_map(&cache->files[0], path, &header))
+        return false;
+    cache->file_count = 1;
+    memcpy(cache->uuid, header.uuid, 16);
+    if (uuid && memcmp(uuid, header.uuid, 16)) {
+        shared_cache_close(cache);
+        return false;
+    }
+    if (header.mapping_count)
+        cache->base = cache->files[0].mappings[0].address;
+
+    //entries only have a suffix from the header that has sub_type on
+    entry_size = header.mapping_offset <= offsetof(SharedCacheHeader, sub_type) ? offsetof(SharedCacheSubcache, suffix) : sizeof(SharedCacheSubcache);
+    if (header.subcache_offset > cache->files[0].map_size || header.subcache_count * entry_size > cache->files[0].map_size - header.subcache_offset)
+        header.subcache_count = 0;
+    for (uint32_t i = 0; i < header.subcache_count; i++) {
+        memset(&subcache, 0, sizeof(subcache));
+        memcpy(&subcache, cache->files[0].map + header.subcache_offset + i * entry_size, entry_size);
+        if (entry_size < sizeof(SharedCacheSubcache))
+            snprintf(subcache.suffix, sizeof(subcache.suffix), ".%u", i + 1);
+        subcache.suffix[sizeof(subcache.suffix) - 1] = '\0';
+        snprintf(sub_path, sizeof(sub_path), "%s%s", path, subcache.suffix);
+        if (!shared_cache_add(cache, sub_path, subcache.uuid, &sub_header))
+            cache->missing_files++;
+    }
+
+    if (!shared_cache_load_images(cache, &header)) {
+        shared_cache_close(cache);
+        return false;
+    }
+    locals = (SharedCacheLocals*) calloc(cache->image_count, sizeof(SharedCacheLocals));
+    if (locals == NULL) {
+        shared_cache_close(cache);
+        return false;
+    }
+
+    //the locals of split caches live in .symbols, older caches have them in the main file
+    shared_cache_find_locals(cache, 0, &header, locals);
+    if (memcmp(header.symbols_uuid, (uint8_t[16]) { 0 }, 16)) {
+        file_count = cache->file_count;
+        snprintf(sub_path, sizeof(sub_path), "%s.symbols", path);
+        if (shared_cache_add(cache, sub_path, header.symbols_uuid, &sub_header)) {
+            cache->files[file_count].mapping_count = 0; //it maps nothing, it's only here for its locals
+            shared_cache_find_locals(cache, (uint8_t) file_count, &sub_header, locals);
+        }
+        else
+            cache->missing_files++;
+    }
+
+    indexed = shared_cache_index(cache, locals);
+    free(locals);
+    if (!indexed) {
+        shared_cache_close(cache);
+        return false;
+    }
+    return true;
+}
+
+void shared_cache_close(SharedCache* cache) {
+    for (uint32_t i = 0; i < cache->file_count; i++)
+        munmap(cache->files[i].map, cache->files[i].map_size);
+    free(cache->images);
+    free(cache->symbols);
+    memset(cache, 0, sizeof(SharedCache));
+}
+
+int64_t shared_cache_find_image(const SharedCache* cache, uint64_t address) {
+    uint32_t low;
+    uint32_t high;
+    uint32_t middle;
+
+    low = 0;
+    high = cache->image_count;
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (cache->images[middle].address < address)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if (low < cache->image_count && cache->images[low].address == address)
+        return low;
+    return -1;
+}
+
+const SharedCacheSymbol* shared_cache_lookup(const SharedCache* cache, uint64_t address) {
+    uint32_t low;
+    uint32_t high;
+    uint32_t middle;
+
+    if (cache->symbol_count == 0 || address < cache->symbols[0].address)
+        return NULL;
+
+    low = 0;
+    high = cache->symbol_count;
+    while (high - low > 1) {
+        middle = low + (high - low) / 2;
+        if (cache->symbols[middle].address <= address)
+            low = middle;
+        else
+            high = middle;
+    }
+    return &cache->symbols[low];
+}
+
+uint64_t shared_cache_find_symbol(const SharedCache* cache, int64_t image, const char* name) {
+    const char* symbol_name;
+
+    for (uint32_t i = 0; i < cache->symbol_count; i++) {
+        if (image >= 0 && cache->symbols[i].image != image)
+            continue;
+        symbol_name = shared_cache_symbol_name(cache, &cache->symbols[i]);
+        if (symbol_name && !strcmp(symbol_name, name))
+            return cache->symbols[i].address;
+    }
+    return UINT64_MAX;
+}
+
+const char* shared_cache_symbol_name(const SharedCache* cache, const SharedCacheSymbol* symbol) {
+    const char* name;
+
+    if (symbol->name == MACHO_UNNAMED)
+        return NULL;
+    name = (const char*) cache->files[symbol->file].map + symbol->name;
+    if (name[0] == '_')
+        name++;
+    return name;
+}
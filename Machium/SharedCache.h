@@ -0,0 +1,139 @@
+#ifndef SHAREDCACHE_H
+#define SHAREDCACHE_H
+
+//like MachO.h this only needs libc, a cache copied off a device can be indexed and checked on linux too
+#include "MachO.h"
+
+#define SHARED_CACHE_FILES_MAX 128 //the main file, its subcaches and .symbols
+
+//overrides which cache file the symbols come from
+#define SHARED_CACHE_PATH_ENV "MACHIUM_SHARED_CACHE"
+
+//the start of dyld_cache_header. a field only exists when mapping_offset is past it, older caches have shorter headers
+typedef struct SharedCacheHeader {
+    char magic[16]; //"dyld_v1   arm64e"
+    uint32_t mapping_offset;
+    uint32_t mapping_count;
+    uint32_t images_offset_old;
+    uint32_t images_count_old;
+    uint64_t dyld_base;
+    uint64_t code_signature_offset;
+    uint64_t code_signature_size;
+    uint64_t slide_info_offset;
+    uint64_t slide_info_size;
+    uint64_t local_symbols_offset; //file offset of the local symbols, in .symbols for split caches
+    uint64_t local_symbols_size;
+    uint8_t uuid[16];
+    uint8_t reserved[0x120];
+    uint32_t subcache_offset; //0x188
+    uint32_t subcache_count;
+    uint8_t symbols_uuid[16]; //0x190, uuid of the .symbols file
+    uint64_t rosetta[4];
+    uint32_t images_offset; //0x1c0
+    uint32_t images_count;
+    uint32_t sub_type; //0x1c8, subcache entries have a file suffix from here on
+} SharedCacheHeader;
+
+typedef struct SharedCacheMapping {
+    uint64_t address;
+    uint64_t size;
+    uint64_t file_offset;
+    uint32_t max_prot;
+    uint32_t init_prot;
+} SharedCacheMapping;
+
+typedef struct SharedCacheImageInfo {
+    uint64_t address;
+    uint64_t mod_time;
+    uint64_t inode;
+    uint32_t path_offset;
+    uint32_t pad;
+} SharedCacheImageInfo;
+
+typedef struct SharedCacheSubcache {
+    uint8_t uuid[16];
+    uint64_t offset; //from the main cache's base
+    char suffix[32]; //only in headers that have sub_type, ".1" ".2" ... before that
+} SharedCacheSubcache;
+
+typedef struct SharedCacheLocalsInfo {
+    uint32_t nlist_offset;
+    uint32_t nlist_count;
+    uint32_t strings_offset;
+    uint32_t strings_size;
+    uint32_t entries_offset;
+    uint32_t entries_count;
+} SharedCacheLocalsInfo;
+
+//locals of one dylib. headers with symbols_uuid give its address as an offset from the base, older ones the file offset of its header
+typedef struct SharedCacheLocalsEntry {
+    uint32_t dylib_offset;
+    uint32_t nlist_start;
+    uint32_t nlist_count;
+} SharedCacheLocalsEntry;
+
+typedef struct SharedCacheLocalsEntry64 {
+    uint64_t dylib_offset;
+    uint32_t nlist_start;
+    uint32_t nlist_count;
+} SharedCacheLocalsEntry64;
+
+//one mmap'd file of the cache
+typedef struct SharedCacheFile {
+    uint8_t* map;
+    size_t map_size;
+    const SharedCacheMapping* mappings;
+    uint32_t mapping_count;
+} SharedCacheFile;
+
+typedef struct SharedCacheImage {
+    uint64_t address; //unslid mach header
+    const char* path; //points into the main file
+    const char* name; //last component of path
+} SharedCacheImage;
+
+//16 bytes, every symbol of every image in one array sorted by address
+typedef struct SharedCacheSymbol {
+    uint64_t address; //unslid
+    uint32_t name; //offset into the map of [file] or MACHO_UNNAMED for function starts
+    uint16_t image; //index into SharedCache.images
+    uint8_t file;
+    uint8_t local; //came from the local symbols
+} SharedCacheSymbol;
+
+typedef struct SharedCache {
+    SharedCacheFile files[SHARED_CACHE_FILES_MAX];
+    uint32_t file_count;
+    uint32_t missing_files; //subcaches that couldn't be opened, their images have fewer or no symbols
+    uint8_t uuid[16];
+    uint64_t base; //unslid address of the first mapping
+
+    SharedCacheImage* images; //sorted by address
+    uint32_t image_count;
+
+    SharedCacheSymbol* symbols; //sorted by address
+    uint32_t symbol_count;
+    uint32_t local_count;
+} SharedCache;
+
+//mmap the cache at [path] (and the subcaches and .symbols next to it) and build the symbol index
+//with a [uuid] a cache that isn't that one is turned down before anything gets indexed
+bool shared_cache_open(SharedCache* cache, const char* path, const uint8_t* uuid);
+void shared_cache_close(SharedCache* cache);
+
+//macho_read_t over the cache, [address] is unslid. context is the SharedCache
+bool shared_cache_read(void* context, uint64_t address, void* out, size_t size);
+
+//find the image whose header is at unslid [address], -1 if there's none
+int64_t shared_cache_find_image(const SharedCache* cache, uint64_t address);
+
+//binary search for the last symbol at or before unslid [address]
+const SharedCacheSymbol* shared_cache_lookup(const SharedCache* cache, uint64_t address);
+
+//find a named symbol of image [image] (every image with -1), returns its unslid address or UINT64_MAX. linear like macho_find_symbol
+uint64_t shared_cache_find_symbol(const SharedCache* cache, int64_t image, const char* name);
+
+//get the name of a symbol (leading underscore stripped), NULL for function starts
+const char* shared_cache_symbol_name(const SharedCache* cache, const SharedCacheSymbol* symbol);
+
+#endif /* SHAREDCACHE_H */
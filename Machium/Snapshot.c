@@ -0,0 +1,456 @@
+#include "Snapshot.h"
+#include "Memory.h"
+#include "View.h"
+#include "Region.h"
+#include "Image.h"
+#include "Hash.h"
+#include "Job.h"
+#include "Output.h"
+#include <sys/mman.h>
+
+//shared by every chunk of a snapshot being taken
+typedef struct SnapshotTake {
+    mach_port_t task;
+    ViewCache* views;
+    SnapshotArena* arena;
+    Snapshot* snapshot;
+    Snapshot* previous; //pages that didn't change since this one share its contents, NULL for the first snapshot
+    MemoryRegion* regions;
+    uint64_t* first_page; //index of the first page of every region in snapshot->pages
+    uint32_t region_count;
+} SnapshotTake;
+
+//running totals of a diff
+typedef struct SnapshotDiff {
+    Machium* machium;
+    uint64_t ranges;
+    uint64_t bytes;
+    uint64_t pages;
+} SnapshotDiff;
+
+//get room for one page, SNAPSHOT_UNREADABLE when the arena is full
+static uint64_t arena_alloc(SnapshotArena* arena) {
+    uint64_t offset;
+    uint64_t block;
+    void* map;
+
+    pthread_mutex_lock(&arena->lock);
+    offset = arena->used;
+    block = offset / SNAPSHOT_ARENA_BLOCK;
+    if (block >= SNAPSHOT_ARENA_BLOCKS) {
+        pthread_mutex_unlock(&arena->lock);
+        return SNAPSHOT_UNREADABLE;
+    }
+    if (arena->blocks[block] == NULL) {
+        map = mmap(NULL, SNAPSHOT_ARENA_BLOCK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (map == MAP_FAILED) {
+            pthread_mutex_unlock(&arena->lock);
+            return SNAPSHOT_UNREADABLE;
+        }
+        arena->blocks[block] = (uint8_t*) map;
+    }
+    arena->used += vm_page_size;
+    pthread_mutex_unlock(&arena->lock);
+    return offset;
+}
+
+static uint8_t* arena_page(SnapshotArena* arena, uint64_t offset) {
+    return arena->blocks[offset / SNAPSHOT_ARENA_BLOCK] + offset % SNAPSHOT_ARENA_BLOCK;
+}
+
+static void snapshot_free(Snapshot* snapshot) {
+    free(snapshot->pages);
+    free(snapshot);
+}
+
+void snapshot_set_free(SnapshotSet* set) {
+    if (set == NULL)
+        return;
+    for (uint32_t i = 0; i < set->count; i++)
+        snapshot_free(set->snapshots[i]);
+    for (uint32_t i = 0; i < SNAPSHOT_ARENA_BLOCKS && set->arena.blocks[i]; i++)
+        munmap(set->arena.blocks[i], SNAPSHOT_ARENA_BLOCK);
+    pthread_mutex_destroy(&set->arena.lock);
+    free(set);
+}
+
+//first page of [snapshot] at or above [address]
+static SnapshotPage* snapshot_find_page(Snapshot* snapshot, uint64_t address) {
+    uint64_t low;
+    uint64_t high;
+    uint64_t middle;
+
+    low = 0;
+    high = snapshot->page_count;
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (snapshot->pages[middle].address < address)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return snapshot->pages + low;
+}
+
+/*
+hash every page of a chunk and store the ones that changed since the previous snapshot
+unchanged pages still have to be read to be hashed, but they don't take any new memory
+the view shows the live pages, so each page is copied out once and the copy is what gets hashed and stored.
+hashing the view and then copying it could store bytes the task wrote in between under the older hash
+*/
+static bool snapshot_chunk(void* context, uint64_t address, uint64_t size) {
+    SnapshotTake* take = (SnapshotTake*) context;
+    Snapshot* snapshot = take->snapshot;
+    SnapshotPage* page;
+    SnapshotPage* previous;
+    SnapshotPage* previous_end;
+    MemoryView view;
+    bool readable;
+    uint8_t* data;
+    uint8_t* copy;
+    uint64_t index;
+    uint64_t stored;
+    uint64_t unreadable;
+    uint32_t low;
+    uint32_t high;
+    uint32_t middle;
+
+    //the region this chunk is in tells where its pages go
+    low = 0;
+    high = take->region_count;
+    while (high - low > 1) {
+        middle = low + (high - low) / 2;
+        if (take->regions[middle].address <= address)
+            low = middle;
+        else
+            high = middle;
+    }
+    index = take->first_page[low] + (address - take->regions[low].address) / vm_page_size;
+
+    //pages come straight out of the task's mapping, only the ones that changed are kept in the arena
+    copy = (uint8_t*) malloc(vm_page_size);
+    if (copy == NULL)
+        return false;
+    readable = view_acquire(take->views, address, size, &view);
+    data = view.data;
+
+    previous = NULL;
+    previous_end = NULL;
+    if (take->previous) {
+        previous = snapshot_find_page(take->previous, address);
+        previous_end = take->previous->pages + take->previous->page_count;
+    }
+
+    stored = 0;
+    unreadable = 0;
+    for (uint64_t offset = 0; offset < size; offset += vm_page_size) {
+        page = &snapshot->pages[index++];
+        page->address = address + offset;
+        if (!readable) {
+            page->hash = 0;
+            page->offset = SNAPSHOT_UNREADABLE;
+            unreadable++;
+            continue;
+        }
+
+        memcpy(copy, data + offset, vm_page_size);
+        page->hash = hash64(copy, vm_page_size, 0);
+        while (previous && previous < previous_end && previous->address < page->address)
+            previous++;
+        if (previous && previous < previous_end && previous->address == page->address && previous->hash == page->hash && previous->offset != SNAPSHOT_UNREADABLE) {
+            page->offset = previous->offset;
+            continue;
+        }
+
+        page->offset = arena_alloc(take->arena);
+        if (page->offset == SNAPSHOT_UNREADABLE) {
+            unreadable++;
+            continue;
+        }
+        memcpy(arena_page(take->arena, page->offset), copy, vm_page_size);
+        stored++;
+    }
+    free(copy);
+
+    __atomic_fetch_add(&snapshot->stored, stored, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&snapshot->unreadable, unreadable, __ATOMIC_RELAXED);
+    if (readable)
+        view_release(&view);
+    return true;
+}
+
+//take a snapshot of [start, end), only writable regions when [writable]
+static machium_command_t snapshot_take(Machium* machium, uint64_t start, uint64_t end, bool writable) {
+    SnapshotSet* set;
+    SnapshotTake take;
+    Snapshot* snapshot;
+    JobRange* ranges;
+    double started;
+    bool finished;
+
+    set = machium->target->snapshots;
+    if (set == NULL) {
+        set = (SnapshotSet*) calloc(1, sizeof(SnapshotSet));
+        pthread_mutex_init(&set->arena.lock, NULL);
+        set->next_id = 1;
+        machium->target->snapshots = set;
+    }
+    if (set->count == SNAPSHOT_MAX) {
+        output_error(KERN_SUCCESS, "Max amount of snapshots taken! (%d) Use 'snapshot clear'", SNAPSHOT_MAX);
+        return MACHIUM_FAILURE;
+    }
+
+    memset(&take, 0, sizeof(take));
+    take.task = machium->target->debug_task;
+    take.views = view_cache(machium->target);
+    take.arena = &set->arena;
+    take.previous = set->count ? set->snapshots[set->count - 1] : NULL;
+    //whole pages only
+    start &= ~(uint64_t) vm_page_mask;
+    end = end > UINT64_MAX - vm_page_mask ? UINT64_MAX : (end + vm_page_mask) & ~(uint64_t) vm_page_mask;
+    take.region_count = region_list(take.task, start, end, writable ? VM_PROT_READ | VM_PROT_WRITE : VM_PROT_READ, &take.regions);
+    if (take.region_count == 0) {
+        output_error(KERN_SUCCESS, "No readable memory to snapshot");
+        return MACHIUM_FAILURE;
+    }
+
+    snapshot = (Snapshot*) calloc(1, sizeof(Snapshot));
+    take.snapshot = snapshot;
+    take.first_page = (uint64_t*) malloc(take.region_count * sizeof(uint64_t));
+    ranges = (JobRange*) malloc(take.region_count * sizeof(JobRange));
+    for (uint32_t i = 0; i < take.region_count; i++) {
+        take.first_page[i] = snapshot->page_count;
+        snapshot->page_count += take.regions[i].size / vm_page_size;
+        ranges[i].address = take.regions[i].address;
+        ranges[i].size = take.regions[i].size;
+    }
+    snapshot->pages = (SnapshotPage*) malloc(snapshot->page_count * sizeof(SnapshotPage));
+
+    started = job_time();
+    finished = job_for_each_range(ranges, take.region_count, MEMORY_CHUNK_SIZE, snapshot_chunk, &take);
+
+    free(ranges);
+    free(take.first_page);
+    free(take.regions);
+
+    if (!finished) {
+        //the arena space it got is lost until 'snapshot clear', but a half taken snapshot is no use to diff against
+        output_message(OUTPUT_LEVEL_WARNING, "Snapshot was killed");
+        snapshot_free(snapshot);
+        return MACHIUM_FAILURE;
+    }
+
+    snapshot->id = set->next_id++;
+    set->snapshots[set->count++] = snapshot;
+
+    output_message(OUTPUT_LEVEL_GOOD, "Snapshot #%u: %llu pages (%.1f MB) in %.2fs", snapshot->id, snapshot->page_count, (double) (snapshot->page_count * vm_page_size) / 1e6, job_time() - started);
+    if (take.previous)
+        output_message(OUTPUT_LEVEL_GOOD, "%llu pages changed since #%u and were stored (%.1f MB)", snapshot->stored, take.previous->id, (double) (snapshot->stored * vm_page_size) / 1e6);
+    if (snapshot->unreadable)
+        output_message(OUTPUT_LEVEL_WARNING, "%llu pages couldn't be read or stored", snapshot->unreadable);
+    return MACHIUM_SUCCESS;
+}
+
+/*
+list snapshots of the selected target
+
+machium->args[0] -> snapshot
+machium->args[1] -> list
+*/
+static machium_command_t snapshot_list(Machium* machium) {
+    SnapshotSet* set = machium->target->snapshots;
+    Snapshot* snapshot;
+
+    if (set == NULL || set->count == 0) {
+        output_message(OUTPUT_LEVEL_GOOD, "No snapshots taken");
+        return MACHIUM_SUCCESS;
+    }
+
+    output_message(OUTPUT_LEVEL_GOOD, "%u snapshots, %.1f MB of page contents stored:", set->count, (double) set->arena.used / 1e6);
+    for (uint32_t i = 0; i < set->count; i++) {
+        snapshot = set->snapshots[i];
+        output_textf(YELLOW"#%-4u "WHITE"%10llu pages %10llu stored\n", snapshot->id, snapshot->page_count, snapshot->stored);
+    }
+    return MACHIUM_SUCCESS;
+}
+
+static Snapshot* snapshot_find(SnapshotSet* set, uint32_t id) {
+    for (uint32_t i = 0; set && i < set->count; i++) {
+        if (set->snapshots[i]->id == id)
+            return set->snapshots[i];
+    }
+    return NULL;
+}
+
+/*
+handle snapshot commands
+
+machium->args[0] -> snapshot
+machium->args[1] -> list / clear / [0xaddress] (OPTIONAL, every writable region if missing)
+machium->args[2] -> [size] (only with [0xaddress])
+*/
+machium_command_t m_snapshot(Machium* machium) {
+    uint64_t address;
+
+    if (machium->args_count == 1)
+        return snapshot_take(machium, 0, UINT64_MAX, true);
+
+    if (!strcmp(machium->args[1], "list") || !strcmp(machium->args[1], "l"))
+        return snapshot_list(machium);
+
+    if (!strcmp(machium->args[1], "clear")) {
+        if (!job_idle("snapshot clear"))
+            return MACHIUM_FAILURE;
+        snapshot_set_free(machium->target->snapshots);
+        machium->target->snapshots = NULL;
+        output_message(OUTPUT_LEVEL_GOOD, "Cleared snapshots");
+        return MACHIUM_SUCCESS;
+    }
+
+    if (machium->args_count != 3) {
+        output_error(KERN_SUCCESS, "'snapshot [0xaddress] [size]' takes 3 arguments");
+        return MACHIUM_FAILURE;
+    }
+    address = (uint64_t) strtoull(machium->args[1], NULL, 0);
+    return snapshot_take(machium, address, address + (uint64_t) strtoull(machium->args[2], NULL, 0), false);
+}
+
+//print up to 16 bytes of a changed range
+static void diff_print_bytes(const uint8_t* bytes, uint64_t length) {
+    for (uint64_t i = 0; i < length && i < 16; i++)
+        output_textf("%02x", bytes[i]);
+    if (length > 16)
+        output_textf("...");
+}
+
+//find and print the changed ranges of one page
+static void diff_page(SnapshotDiff* diff, SnapshotArena* arena, SnapshotPage* old_page, SnapshotPage* new_page) {
+    char annotation[IMAGE_DESCRIPTION_MAX];
+    const uint8_t* old_bytes;
+    const uint8_t* new_bytes;
+    uint64_t position;
+    uint64_t start;
+    uint64_t last;
+    uint64_t old_word;
+    uint64_t new_word;
+
+    old_bytes = arena_page(arena, old_page->offset);
+    new_bytes = arena_page(arena, new_page->offset);
+    diff->pages++;
+
+    position = 0;
+    while (position < vm_page_size) {
+        //skip equal words, most of a changed page is usually still the same
+        memcpy(&old_word, old_bytes + position, sizeof(old_word));
+        memcpy(&new_word, new_bytes + position, sizeof(new_word));
+        if (old_word == new_word) {
+            position += sizeof(uint64_t);
+            continue;
+        }
+        while (old_bytes[position] == new_bytes[position])
+            position++;
+
+        //grow the range until there's a run of SNAPSHOT_DIFF_GAP equal bytes
+        start = position;
+        last = position;
+        while (position < vm_page_size && position - last < SNAPSHOT_DIFF_GAP) {
+            if (old_bytes[position] != new_bytes[position])
+                last = position;
+            position++;
+        }
+        position = (last + sizeof(uint64_t)) & ~(uint64_t) (sizeof(uint64_t) - 1); //back onto a word boundary past the range
+
+        diff->ranges++;
+        diff->bytes += last + 1 - start;
+        if (diff->ranges > SNAPSHOT_DIFF_MAX)
+            continue;
+
+        output_textf(BLUE"0x%llx "WHITE"(+%llu)%s: ", new_page->address + start, last + 1 - start, image_annotate(diff->machium, new_page->address + start, annotation, sizeof(annotation)));
+        diff_print_bytes(old_bytes + start, last + 1 - start);
+        output_textf(" -> ");
+        diff_print_bytes(new_bytes + start, last + 1 - start);
+        output_textf("\n");
+    }
+}
+
+/*
+compare two snapshots. hashes are compared first, bytes only for pages whose hash changed
+
+machium->args[0] -> diff
+machium->args[1] -> [old snapshot] (OPTIONAL, the two newest snapshots if missing)
+machium->args[2] -> [new snapshot] (OPTIONAL, the newest snapshot if missing)
+*/
+machium_command_t m_diff(Machium* machium) {
+    SnapshotSet* set = machium->target->snapshots;
+    SnapshotDiff diff;
+    Snapshot* old_snapshot;
+    Snapshot* new_snapshot;
+    SnapshotPage* old_page;
+    SnapshotPage* new_page;
+    uint64_t i;
+    uint64_t j;
+    uint64_t gone;
+    uint64_t added;
+
+    if (machium->args_count > 3) {
+        output_error(KERN_SUCCESS, "Too many arguments for 'diff', 3 maximum");
+        return MACHIUM_FAILURE;
+    }
+    if (set == NULL || (set->count < 2 && machium->args_count == 1)) {
+        output_error(KERN_SUCCESS, "Take two snapshots before diffing");
+        return MACHIUM_FAILURE;
+    }
+
+    if (machium->args_count == 1) {
+        old_snapshot = set->snapshots[set->count - 2];
+        new_snapshot = set->snapshots[set->count - 1];
+    }
+    else {
+        old_snapshot = snapshot_find(set, (uint32_t) strtoul(machium->args[1], NULL, 0));
+        new_snapshot = machium->args_count == 3 ? snapshot_find(set, (uint32_t) strtoul(machium->args[2], NULL, 0)) : set->snapshots[set->count - 1];
+    }
+    if (old_snapshot == NULL || new_snapshot == NULL) {
+        output_error(KERN_SUCCESS, "No such snapshot, see 'snapshot list'");
+        return MACHIUM_FAILURE;
+    }
+
+    output_message(OUTPUT_LEVEL_GOOD, "Changes from #%u to #%u:", old_snapshot->id, new_snapshot->id);
+    memset(&diff, 0, sizeof(diff));
+    diff.machium = machium;
+    gone = 0;
+    added = 0;
+
+    //both page lists are sorted, walk them side by side
+    i = 0;
+    j = 0;
+    while (i < old_snapshot->page_count || j < new_snapshot->page_count) {
+        old_page = i < old_snapshot->page_count ? &old_snapshot->pages[i] : NULL;
+        new_page = j < new_snapshot->page_count ? &new_snapshot->pages[j] : NULL;
+
+        if (new_page == NULL || (old_page && old_page->address < new_page->address)) {
+            gone++;
+            i++;
+            continue;
+        }
+        if (old_page == NULL || new_page->address < old_page->address) {
+            added++;
+            j++;
+            continue;
+        }
+
+        i++;
+        j++;
+        if (old_page->offset == SNAPSHOT_UNREADABLE || new_page->offset == SNAPSHOT_UNREADABLE)
+            continue;
+        if (old_page->offset == new_page->offset || old_page->hash == new_page->hash)
+            continue;
+        diff_page(&diff, &set->arena, old_page, new_page);
+    }
+
+    if (diff.ranges > SNAPSHOT_DIFF_MAX)
+        output_message(OUTPUT_LEVEL_WARNING, "%llu more ranges not printed", diff.ranges - SNAPSHOT_DIFF_MAX);
+    output_message(OUTPUT_LEVEL_GOOD, "%llu changed ranges (%llu bytes) on %llu pages", diff.ranges, diff.bytes, diff.pages);
+    if (added || gone)
+        output_message(OUTPUT_LEVEL_GOOD, "%llu pages were mapped and %llu unmapped in between", added, gone);
+    return MACHIUM_SUCCESS;
+}
@@ -0,0 +1,56 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "Machium.h"
+#include <pthread.h>
+
+#define SNAPSHOT_MAX 64 //snapshots kept per target
+#define SNAPSHOT_ARENA_BLOCK (64 * 1024 * 1024) //page contents are stored in blocks this big
+#define SNAPSHOT_ARENA_BLOCKS 1024 //so an arena holds up to 64GB
+#define SNAPSHOT_UNREADABLE UINT64_MAX //arena offset of a page that couldn't be read
+#define SNAPSHOT_DIFF_GAP 8 //changed bytes closer together than this print as one range
+#define SNAPSHOT_DIFF_MAX 256 //ranges printed by one diff, the rest are only counted
+
+//one page of a snapshot
+typedef struct SnapshotPage {
+    uint64_t address;
+    uint64_t hash;
+    uint64_t offset; //where the contents are in the arena, shared with the previous snapshot when the page didn't change
+} SnapshotPage;
+
+/*
+append-only storage for page contents, shared by every snapshot of a target
+blocks are mmap'd so they only cost memory once pages actually get written into them
+*/
+typedef struct SnapshotArena {
+    uint8_t* blocks[SNAPSHOT_ARENA_BLOCKS];
+    uint64_t used;
+    pthread_mutex_t lock;
+} SnapshotArena;
+
+typedef struct Snapshot {
+    uint32_t id;
+    SnapshotPage* pages; //sorted by address
+    uint64_t page_count;
+    uint64_t stored; //pages that needed new space in the arena
+    uint64_t unreadable;
+} Snapshot;
+
+//every snapshot of a target
+typedef struct SnapshotSet {
+    Snapshot* snapshots[SNAPSHOT_MAX]; //oldest first
+    uint32_t count;
+    uint32_t next_id;
+    SnapshotArena arena;
+} SnapshotSet;
+
+//free every snapshot of a target
+void snapshot_set_free(SnapshotSet* set);
+
+//take / list / clear snapshots
+machium_command_t m_snapshot(Machium* machium);
+
+//compare two snapshots
+machium_command_t m_diff(Machium* machium);
+
+#endif /* SNAPSHOT_H */
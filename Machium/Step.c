@@ -0,0 +1,528 @@
+#include "Step.h"
+#include "Image.h"
+#include "Job.h"
+#include "Output.h"
+
+//thread 0 of the task, set up to be stepped. the other threads stay suspended unless a 'next' lets them run
+typedef struct StepSession {
+    mach_port_t task;
+    thread_act_port_array_t threads;
+    mach_msg_type_number_t thread_count;
+    thread_act_t thread;
+    integer_t paused; //pauses the task had before, put back at the end
+    bool others_suspended;
+    bool started; //the task was resumed for the first step
+    bool waiting; //the thread sits in an exception until [reply] goes out
+    bool has_debug; //[debug] was read, step_end puts it back
+    uint32_t forwarded; //brk traps of the thread passed on to the task's handler
+
+    mach_port_t port; //exception port of the thread
+    exception_mask_t old_masks[EXC_TYPES_COUNT];
+    mach_port_t old_ports[EXC_TYPES_COUNT];
+    exception_behavior_t old_behaviors[EXC_TYPES_COUNT];
+    thread_state_flavor_t old_flavors[EXC_TYPES_COUNT];
+    mach_msg_type_number_t old_count;
+
+    arm_debug_state64_t debug; //debug state of the thread before the session
+    arm_thread_state64_t state; //thread state before the first step
+    ExceptionRequest request;
+    ExceptionReply reply;
+} StepSession;
+
+static void step_end(StepSession* session);
+
+/*
+suspend the task and take thread 0 over: every other thread is suspended and breakpoint exceptions of the thread come
+to a port of its own, so hardware breakpoints of the rest of the task keep working
+brk traps of the thread itself are failed back to the task's handler (coverage, or the crash the task would get anyway)
+*/
+static StepSession* step_begin(MachiumTarget* target) {
+    StepSession* session;
+    kern_return_t kret;
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count;
+
+    session = (StepSession*) calloc(1, sizeof(StepSession));
+    session->task = target->debug_task;
+
+    kret = task_suspend(session->task);
+    if (kret != KERN_SUCCESS) {
+        output_error(kret, "Failed to suspend the task!");
+        free(session);
+        return NULL;
+    }
+    count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(session->task, MACH_TASK_BASIC_INFO, (task_info_t) &info, &count) == KERN_SUCCESS)
+        session->paused = info.suspend_count - 1;
+
+    kret = task_threads(session->task, &session->threads, &session->thread_count);
+    if (kret != KERN_SUCCESS || session->thread_count == 0) {
+        output_error(kret, "Could not get task_threads");
+        session->threads = NULL;
+        session->thread_count = 0;
+        step_end(session);
+        return NULL;
+    }
+    session->thread = session->threads[0];
+    for (mach_msg_type_number_t i = 1; i < session->thread_count; i++)
+        thread_suspend(session->threads[i]);
+    session->others_suspended = true;
+
+    count = ARM_THREAD_STATE64_COUNT;
+    kret = thread_get_state(session->thread, ARM_THREAD_STATE64, (thread_state_t) &session->state, &count);
+    if (kret == KERN_SUCCESS) {
+        count = ARM_DEBUG_STATE64_COUNT;
+        kret = thread_get_state(session->thread, ARM_DEBUG_STATE64, (thread_state_t) &session->debug, &count);
+        session->has_debug = kret == KERN_SUCCESS;
+    }
+    if (kret == KERN_SUCCESS)
+        kret = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &session->port);
+    if (kret == KERN_SUCCESS)
+        kret = mach_port_insert_right(mach_task_self(), session->port, session->port, MACH_MSG_TYPE_MAKE_SEND);
+    if (kret == KERN_SUCCESS) {
+        session->old_count = EXC_TYPES_COUNT;
+        kret = thread_swap_exception_ports(session->thread, EXC_MASK_BREAKPOINT, session->port, EXCEPTION_STATE | MACH_EXCEPTION_CODES, ARM_THREAD_STATE64,
+                                           session->old_masks, &session->old_count, session->old_ports, session->old_behaviors, session->old_flavors);
+        if (kret != KERN_SUCCESS)
+            session->old_count = 0;
+    }
+    if (kret != KERN_SUCCESS) {
+        output_error(kret, "Failed to take over thread 0!");
+        step_end(session);
+        return NULL;
+    }
+    return session;
+}
+
+static bool step_set_debug(StepSession* session, arm_debug_state64_t* debug) {
+    kern_return_t kret;
+
+    kret = thread_set_state(session->thread, ARM_DEBUG_STATE64, (thread_state_t) debug, ARM_DEBUG_STATE64_COUNT);
+    if (kret != KERN_SUCCESS) {
+        output_error(kret, "Could not thread_set_state");
+        return false;
+    }
+    return true;
+}
+
+//let the other threads run until the session ends, a call 'next' runs over can need them
+static void step_release_others(StepSession* session) {
+    if (!session->others_suspended)
+        return;
+    for (mach_msg_type_number_t i = 1; i < session->thread_count; i++)
+        thread_resume(session->threads[i]);
+    session->others_suspended = false;
+}
+
+static bool step_instruction(mach_port_t task, uint64_t pc, uint32_t* instruction) {
+    vm_size_t read_size;
+
+    read_size = sizeof(uint32_t);
+    return vm_read_overwrite(task, (vm_address_t) (pc & MACHIUM_PC_MASK), sizeof(uint32_t), (vm_address_t) instruction, &read_size) == KERN_SUCCESS;
+}
+
+/*
+true when the exception in [request] is a brk the thread ran into rather than our step or breakpoint
+xnu sends a finished step with a subcode of 0 and a brk with its address, and the pc is still on the brk
+*/
+static bool step_foreign(mach_port_t task, const ExceptionRequest* request, const arm_thread_state64_t* state) {
+    uint32_t instruction;
+
+    if (request->code_count < 2 || request->code[1] == 0)
+        return false;
+    return step_instruction(task, state->__pc, &instruction) && (instruction & 0xffe0001f) == 0xd4200000;
+}
+
+/*
+let the thread go until its next breakpoint exception and return the state it stopped with, NULL if none came in time
+the reply to the last exception and the wait for the next one are a single mach_msg
+a brk the thread hits on the way is failed, so the task's own handler gets it, and the wait goes on
+*/
+static arm_thread_state64_t* step_wait(StepSession* session, mach_msg_timeout_t timeout) {
+    arm_thread_state64_t* state;
+    mach_msg_return_t kret;
+
+    if (!session->started) {
+        //the pauses the task had are taken off too, they come back with step_end
+        for (integer_t i = 0; i <= session->paused; i++)
+            task_resume(session->task);
+        session->started = true;
+    }
+
+    while (1) {
+        if (session->waiting)
+            kret = mach_msg_overwrite(&session->reply.head, MACH_SEND_MSG | MACH_RCV_MSG | MACH_RCV_TIMEOUT, session->reply.head.msgh_size, sizeof(ExceptionRequest),
+                                      session->port, timeout, MACH_PORT_NULL, &session->request.head, sizeof(ExceptionRequest));
+        else
+            kret = mach_msg(&session->request.head, MACH_RCV_MSG | MACH_RCV_TIMEOUT, 0, sizeof(ExceptionRequest), session->port, timeout, MACH_PORT_NULL);
+        session->waiting = false;
+        if (kret != KERN_SUCCESS)
+            return NULL;
+
+        session->waiting = true;
+        state = exception_state(&session->request, &session->reply);
+        if (state && step_foreign(session->task, &session->request, state)) {
+            session->forwarded++; //the reply stays a failure
+            continue;
+        }
+        if (state)
+            exception_reply_state(&session->request, &session->reply);
+        return state;
+    }
+}
+
+//give the thread back: no stepping, its own exception ports, the other threads as they were and the task paused
+static void step_end(StepSession* session) {
+    ExceptionRequest* request;
+    ExceptionReply* reply;
+    arm_thread_state64_t* state;
+    integer_t suspends;
+    integer_t wanted;
+
+    //the thread can't run another instruction once the task is suspended, not even after the reply
+    suspends = session->started ? 0 : session->paused + 1;
+    if (task_suspend(session->task) == KERN_SUCCESS)
+        suspends++;
+    if (session->waiting)
+        mach_msg(&session->reply.head, MACH_SEND_MSG, session->reply.head.msgh_size, 0, MACH_PORT_NULL, MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+    if (session->has_debug)
+        step_set_debug(session, &session->debug);
+    for (mach_msg_type_number_t i = 0; i < session->old_count; i++) {
+        thread_set_exception_ports(session->thread, session->old_masks[i], session->old_ports[i], session->old_behaviors[i], session->old_flavors[i]);
+        if (MACH_PORT_VALID(session->old_ports[i]))
+            mach_port_deallocate(mach_task_self(), session->old_ports[i]);
+    }
+
+    //an exception that came in after the last wait would be lost with the port, answer it
+    if (MACH_PORT_VALID(session->port)) {
+        request = &session->request;
+        reply = &session->reply;
+        while (mach_msg(&request->head, MACH_RCV_MSG | MACH_RCV_TIMEOUT, 0, sizeof(ExceptionRequest), session->port, 0, MACH_PORT_NULL) == KERN_SUCCESS) {
+            state = exception_state(request, reply);
+            if (state && !step_foreign(session->task, request, state))
+                exception_reply_state(request, reply);
+            mach_msg(&reply->head, MACH_SEND_MSG, reply->head.msgh_size, 0, MACH_PORT_NULL, MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+        }
+        mach_port_deallocate(mach_task_self(), session->port);
+        mach_port_mod_refs(mach_task_self(), session->port, MACH_PORT_RIGHT_RECEIVE, -1);
+    }
+
+    if (session->forwarded)
+        output_message(OUTPUT_LEVEL_WARNING, "Thread 0 ran into %u brk traps on the way, they went to the task's own handler", session->forwarded);
+
+    step_release_others(session);
+    for (mach_msg_type_number_t i = 0; i < session->thread_count; i++)
+        mach_port_deallocate(mach_task_self(), session->threads[i]);
+    if (session->threads)
+        vm_deallocate(mach_task_self(), (vm_address_t) session->threads, session->thread_count * sizeof(thread_act_t));
+
+    //stepping leaves the task paused, 'continue' lets it go. pauses it had before are all still there
+    wanted = session->paused > 1 ? session->paused : 1;
+    for (; suspends < wanted; suspends++)
+        task_suspend(session->task);
+    for (; suspends > wanted; suspends--)
+        task_resume(session->task);
+    free(session);
+}
+
+//run one instruction
+static arm_thread_state64_t* step_one(StepSession* session, arm_debug_state64_t* debug) {
+    debug->__mdscr_el1 |= STEP_MDSCR_SS;
+    if (!step_set_debug(session, debug))
+        return NULL;
+    return step_wait(session, STEP_TIMEOUT);
+}
+
+//bl, blr and the pointer authentication versions of blr
+static bool step_is_call(uint32_t instruction) {
+    return (instruction & 0xfc000000) == 0x94000000 || (instruction & 0xfffffc1f) == 0xd63f0000 || (instruction & 0xfefff800) == 0xd63f0800;
+}
+
+//x0-x28, fp, lr, sp and cpsr of a state, in the order of the trace register mask
+static void step_registers(const arm_thread_state64_t* state, uint64_t* values) {
+    for (uint32_t i = 0; i < 29; i++)
+        values[i] = state->__x[i];
+    values[29] = state->__fp;
+    values[30] = state->__lr;
+    values[31] = state->__sp;
+    values[32] = state->__cpsr;
+}
+
+//print where the thread ended up and every register that changed on the way
+static void step_print(Machium* machium, const arm_thread_state64_t* before, const arm_thread_state64_t* after) {
+    static const char* names[] = { "fp", "lr", "sp", "cpsr" };
+    char annotation[IMAGE_DESCRIPTION_MAX];
+    uint64_t old_values[33];
+    uint64_t new_values[33];
+    uint32_t instruction;
+
+    step_registers(before, old_values);
+    step_registers(after, new_values);
+    for (uint32_t i = 0; i < 33; i++) {
+        if (old_values[i] == new_values[i])
+            continue;
+        if (i < 29)
+            output_textf(GREEN "x%u " WHITE "= 0x%llx (was 0x%llx)\n", i, new_values[i], old_values[i]);
+        else
+            output_textf(YELLOW "%s " WHITE "= 0x%llx (was 0x%llx)\n", names[i - 29], new_values[i], old_values[i]);
+    }
+
+    if (step_instruction(machium->target->debug_task, after->__pc, &instruction))
+        output_textf(RED "pc " WHITE "= 0x%llx%s: %08x\n", after->__pc & MACHIUM_PC_MASK, image_annotate(machium, after->__pc & MACHIUM_PC_MASK, annotation, sizeof(annotation)), instruction);
+    else
+        output_textf(RED "pc " WHITE "= 0x%llx%s\n", after->__pc & MACHIUM_PC_MASK, image_annotate(machium, after->__pc & MACHIUM_PC_MASK, annotation, sizeof(annotation)));
+}
+
+/*
+single step one instruction of thread 0, the task stays paused after it
+
+machium->args[0] -> step
+*/
+machium_command_t m_step(Machium* machium) {
+    StepSession* session;
+    arm_debug_state64_t debug;
+    arm_thread_state64_t* state;
+    arm_thread_state64_t before;
+    arm_thread_state64_t after;
+
+    session = step_begin(machium->target);
+    if (session == NULL)
+        return MACHIUM_FAILURE;
+
+    before = session->state;
+    debug = session->debug;
+    state = step_one(session, &debug);
+    if (state)
+        after = *state;
+    else
+        output_error(KERN_SUCCESS, "Thread 0 didn't finish the instruction, it's probably blocked in the kernel");
+    step_end(session);
+
+    if (state == NULL)
+        return MACHIUM_FAILURE;
+    step_print(machium, &before, &after);
+    return MACHIUM_SUCCESS;
+}
+
+/*
+step one instruction of thread 0, a call runs until it returns
+the call gets a hardware breakpoint on the instruction after it and every thread runs while it's in there,
+the same breakpoint hit by a deeper (recursive) call is stepped over
+
+machium->args[0] -> next
+*/
+machium_command_t m_next(Machium* machium) {
+    StepSession* session;
+    arm_debug_state64_t debug;
+    arm_thread_state64_t* state;
+    arm_thread_state64_t before;
+    arm_thread_state64_t after;
+    uint64_t pc;
+    uint64_t stopped;
+    uint32_t instruction;
+    uint32_t slot;
+    double deadline;
+    bool stuck;
+
+    session = step_begin(machium->target);
+    if (session == NULL)
+        return MACHIUM_FAILURE;
+    before = session->state;
+    pc = before.__pc & MACHIUM_PC_MASK;
+    debug = session->debug;
+
+    if (!step_instruction(session->task, pc, &instruction) || !step_is_call(instruction)) {
+        state = step_one(session, &debug);
+        if (state == NULL)
+            output_error(KERN_SUCCESS, "Thread 0 didn't finish the instruction, it's probably blocked in the kernel");
+    }
+    else {
+        for (slot = 0; slot < STEP_BREAKPOINTS && (debug.__bcr[slot] & 1); slot++);
+        if (slot == STEP_BREAKPOINTS) {
+            output_error(KERN_SUCCESS, "Every hardware breakpoint is in use, 'next' needs one to run over a call");
+            step_end(session);
+            return MACHIUM_FAILURE;
+        }
+        debug.__bvr[slot] = pc + 4;
+        debug.__bcr[slot] = BREAKPOINT_ENABLE;
+        state = NULL;
+        if (step_set_debug(session, &debug)) {
+            step_release_others(session);
+            state = step_wait(session, STEP_NEXT_TIMEOUT);
+        }
+
+        //sp below ours means a deeper call, step that one over the breakpoint and wait again
+        //a step that leaves the pc where it was would go around forever, so that stops the loop too
+        deadline = job_time() + STEP_NEXT_TIMEOUT / 1000.0;
+        stuck = false;
+        while (state && ((state->__pc & MACHIUM_PC_MASK) != pc + 4 || state->__sp < before.__sp)) {
+            stopped = state->__pc & MACHIUM_PC_MASK;
+            debug.__bcr[slot] = BREAKPOINT_DISABLE;
+            state = step_one(session, &debug);
+            debug.__bcr[slot] = BREAKPOINT_ENABLE;
+            debug.__mdscr_el1 &= ~(uint64_t) STEP_MDSCR_SS;
+            if (state && (state->__pc & MACHIUM_PC_MASK) == stopped) {
+                stuck = true;
+                state = NULL;
+            }
+            else if (state && job_time() < deadline && step_set_debug(session, &debug))
+                state = step_wait(session, STEP_NEXT_TIMEOUT);
+            else
+                state = NULL;
+        }
+        if (stuck)
+            output_error(KERN_SUCCESS, "Thread 0 doesn't get past 0x%llx inside the call at 0x%llx, it was stopped there", stopped, pc);
+        else if (state == NULL)
+            output_error(KERN_SUCCESS, "The call at 0x%llx didn't return within %ds, thread 0 was stopped where it is", pc, STEP_NEXT_TIMEOUT / 1000);
+    }
+    if (state)
+        after = *state;
+    step_end(session);
+
+    if (state == NULL)
+        return MACHIUM_FAILURE;
+    step_print(machium, &before, &after);
+    return MACHIUM_SUCCESS;
+}
+
+static void step_trace_varint(StepTrace* trace, uint64_t value) {
+    uint8_t byte;
+
+    if (trace->size + 10 > trace->capacity) {
+        trace->capacity = trace->capacity ? trace->capacity * 2 : 65536;
+        trace->data = (uint8_t*) realloc(trace->data, trace->capacity);
+    }
+    do {
+        byte = value & 0x7f;
+        value >>= 7;
+        trace->data[trace->size++] = byte | (value ? 0x80 : 0);
+    } while (value);
+}
+
+//zigzag so small negative deltas stay small
+static void step_trace_signed(StepTrace* trace, int64_t value) {
+    step_trace_varint(trace, ((uint64_t) value << 1) ^ (uint64_t) (value >> 63));
+}
+
+static void step_trace_add(StepTrace* trace, const arm_thread_state64_t* state) {
+    uint64_t old_values[33];
+    uint64_t new_values[33];
+    uint64_t mask;
+
+    step_trace_signed(trace, (int64_t) ((state->__pc & MACHIUM_PC_MASK) - ((trace->last.__pc & MACHIUM_PC_MASK) + 4)));
+    if (trace->registers) {
+        step_registers(&trace->last, old_values);
+        step_registers(state, new_values);
+        mask = 0;
+        for (uint32_t i = 0; i < 33; i++) {
+            if (old_values[i] != new_values[i])
+                mask |= 1ULL << i;
+        }
+        step_trace_varint(trace, mask);
+        for (uint32_t i = 0; i < 33; i++) {
+            if (mask & (1ULL << i))
+                step_trace_signed(trace, (int64_t) (new_values[i] - old_values[i]));
+        }
+    }
+    trace->last = *state;
+    trace->steps++;
+}
+
+static bool step_trace_save(StepTrace* trace, const char* path) {
+    StepTraceHeader header;
+    FILE* file;
+    bool saved;
+
+    file = fopen(path, "wb");
+    if (file == NULL)
+        return false;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, STEP_TRACE_MAGIC, 4);
+    header.version = STEP_TRACE_VERSION;
+    header.flags = trace->registers ? STEP_TRACE_REGISTERS : 0;
+    header.steps = trace->steps;
+    header.size = trace->size;
+    header.state = trace->first;
+    saved = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(trace->data, 1, trace->size, file) == trace->size;
+    return !fclose(file) && saved;
+}
+
+/*
+single step thread 0 [count] times and write every pc (and optionally the registers that changed) to [file]
+the exceptions are answered right here, one mach_msg per step, the task stays paused after it
+
+machium->args[0] -> trace
+machium->args[1] -> [count]
+machium->args[2] -> [file]
+machium->args[3] -> regs (OPTIONAL)
+*/
+machium_command_t m_trace(Machium* machium) {
+    char annotation[IMAGE_DESCRIPTION_MAX];
+    StepSession* session;
+    StepTrace trace;
+    arm_debug_state64_t debug;
+    arm_thread_state64_t* state;
+    uint64_t count;
+    uint32_t instruction;
+    double started;
+    double elapsed;
+
+    if (machium->args_count < 3 || machium->args_count > 4 || (machium->args_count == 4 && strcmp(machium->args[3], "regs"))) {
+        output_error(KERN_SUCCESS, "Usage: trace [count] [file] [regs]");
+        return MACHIUM_FAILURE;
+    }
+    count = strtoull(machium->args[1], NULL, 0);
+    if (count == 0) {
+        output_error(KERN_SUCCESS, "Invalid step count, %s", machium->args[1]);
+        return MACHIUM_FAILURE;
+    }
+
+    session = step_begin(machium->target);
+    if (session == NULL)
+        return MACHIUM_FAILURE;
+
+    memset(&trace, 0, sizeof(trace));
+    trace.registers = machium->args_count == 4;
+    trace.first = session->state;
+    trace.last = session->state;
+
+    debug = session->debug;
+    debug.__mdscr_el1 |= STEP_MDSCR_SS;
+    state = NULL;
+    started = job_time();
+    if (step_set_debug(session, &debug)) {
+        while (trace.steps < count) {
+            state = step_wait(session, STEP_TIMEOUT);
+            if (state == NULL) {
+                output_message(OUTPUT_LEVEL_WARNING, "Thread 0 stopped stepping after %llu steps, it's probably blocked in the kernel", trace.steps);
+                break;
+            }
+            //a brk traps without moving on, stepping it again would never end
+            if ((state->__pc & MACHIUM_PC_MASK) == (trace.last.__pc & MACHIUM_PC_MASK) && step_instruction(session->task, state->__pc, &instruction) && (instruction & 0xffe0001f) == 0xd4200000) {
+                output_message(OUTPUT_LEVEL_WARNING, "Thread 0 is stuck on a brk at 0x%llx", state->__pc & MACHIUM_PC_MASK);
+                break;
+            }
+            step_trace_add(&trace, state);
+            if (trace.steps % STEP_TRACE_CANCEL == 0 && job_cancelled())
+                break;
+        }
+    }
+    elapsed = job_time() - started;
+    step_end(session);
+
+    if (trace.steps == 0) {
+        free(trace.data);
+        return MACHIUM_FAILURE;
+    }
+    output_message(OUTPUT_LEVEL_GOOD, "Traced %llu steps in %.2fs (" YELLOW "%.0f steps/s" WHITE "), %llu bytes, %.2f per step", trace.steps, elapsed, trace.steps / (elapsed > 0 ? elapsed : 1e-9), trace.size, (double) trace.size / trace.steps);
+    output_textf(RED "pc " WHITE "= 0x%llx%s\n", trace.last.__pc & MACHIUM_PC_MASK, image_annotate(machium, trace.last.__pc & MACHIUM_PC_MASK, annotation, sizeof(annotation)));
+
+    if (!step_trace_save(&trace, machium->args[2])) {
+        output_error(KERN_SUCCESS, "Failed to write %s", machium->args[2]);
+        free(trace.data);
+        return MACHIUM_FAILURE;
+    }
+    output_message(OUTPUT_LEVEL_GOOD, "Saved the trace to %s", machium->args[2]);
+    free(trace.data);
+    return MACHIUM_SUCCESS;
+}
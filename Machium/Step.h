@@ -0,0 +1,53 @@
+#ifndef STEP_H
+#define STEP_H
+
+#include "Machium.h"
+#include "Breakpoint.h"
+
+#define STEP_MDSCR_SS 1 //MDSCR_EL1.SS, the thread traps after every instruction while it's set
+#define STEP_TIMEOUT 2000 //ms one step can take before the thread counts as stuck (blocked in a syscall)
+#define STEP_NEXT_TIMEOUT 30000 //ms 'next' waits for a call to come back
+#define STEP_BREAKPOINTS 6 //hardware breakpoints the cpu has, 'next' takes a free one
+
+#define STEP_TRACE_MAGIC "MTRC"
+#define STEP_TRACE_VERSION 1
+#define STEP_TRACE_REGISTERS 1 //flag, every step carries the registers it changed
+#define STEP_TRACE_CANCEL 4096 //steps between checks for 'kill'
+
+/*
+header of a trace file, the steps follow it
+every step is a zigzag varint of pc - (previous pc + 4) so straight-line code costs one byte. with STEP_TRACE_REGISTERS
+it's followed by a varint mask of the registers that changed (bit 0-28 x0-x28, 29 fp, 30 lr, 31 sp, 32 cpsr) and a
+zigzag varint of new - old for each of them, lowest bit first. [state] is the thread before the first step
+*/
+typedef struct StepTraceHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t reserved;
+    uint64_t steps;
+    uint64_t size; //bytes of steps after the header
+    arm_thread_state64_t state;
+} StepTraceHeader;
+
+//a trace being recorded
+typedef struct StepTrace {
+    uint8_t* data;
+    uint64_t size;
+    uint64_t capacity;
+    uint64_t steps;
+    bool registers;
+    arm_thread_state64_t first;
+    arm_thread_state64_t last;
+} StepTrace;
+
+//single step one instruction of thread 0
+machium_command_t m_step(Machium* machium);
+
+//step one instruction of thread 0, running calls until they return
+machium_command_t m_next(Machium* machium);
+
+//single step thread 0 [count] times and write the pcs (and registers) to a file
+machium_command_t m_trace(Machium* machium);
+
+#endif /* STEP_H */
@@ -0,0 +1,458 @@
+#include "Strings.h"
+#include "Region.h"
+#include "Image.h"
+#include "Job.h"
+#include "Output.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//output of one chunk, written out in one go when the chunk is done
+typedef struct StringsOutput {
+    char* data;
+    size_t length;
+    size_t capacity;
+    bool failed; //ran out of memory, what's in data is still good
+} StringsOutput;
+
+#if defined(__ARM_NEON)
+//one bit per byte of 64 bytes of compare results, neon has no movemask so add up weighted lanes instead
+static inline uint64_t strings_neon_bits(uint8x16_t a, uint8x16_t b, uint8x16_t c, uint8x16_t d) {
+    const uint8x16_t weights = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t ab;
+    uint8x16_t cd;
+
+    ab = vpaddq_u8(vandq_u8(a, weights), vandq_u8(b, weights));
+    cd = vpaddq_u8(vandq_u8(c, weights), vandq_u8(d, weights));
+    ab = vpaddq_u8(ab, cd);
+    ab = vpaddq_u8(ab, ab);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(ab), 0);
+}
+
+static inline uint8x16_t strings_neon_printable(uint8x16_t v) {
+    //v - 0x20 <= 0x5e is 0x20-0x7e in one compare
+    return vorrq_u8(vcleq_u8(vsubq_u8(v, vdupq_n_u8(0x20)), vdupq_n_u8(0x5e)), vceqq_u8(v, vdupq_n_u8('\t')));
+}
+#elif defined(__SSE2__)
+static inline uint32_t strings_sse_printable(__m128i v) {
+    //sse2 only compares signed, so shift 0x20-0x7e down to -128..-34 and compare once
+    __m128i shifted = _mm_add_epi8(v, _mm_set1_epi8(0x60));
+    __m128i printable = _mm_cmplt_epi8(shifted, _mm_set1_epi8(-33));
+    return (uint32_t) _mm_movemask_epi8(_mm_or_si128(printable, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))));
+}
+#endif
+
+/*
+set bit i of [printable] for every printable ASCII byte (space to ~ and tab) and bit i of [zero] for every 0 byte
+[size] is a multiple of 64
+*/
+static void strings_classify(const uint8_t* data, size_t size, uint64_t* printable, uint64_t* zero) {
+    for (size_t i = 0; i < size; i += 64) {
+#if defined(__ARM_NEON)
+        uint8x16_t a = vld1q_u8(data + i);
+        uint8x16_t b = vld1q_u8(data + i + 16);
+        uint8x16_t c = vld1q_u8(data + i + 32);
+        uint8x16_t d = vld1q_u8(data + i + 48);
+        uint8x16_t nothing = vdupq_n_u8(0);
+
+        printable[i / 64] = strings_neon_bits(strings_neon_printable(a), strings_neon_printable(b), strings_neon_printable(c), strings_neon_printable(d));
+        zero[i / 64] = strings_neon_bits(vceqq_u8(a, nothing), vceqq_u8(b, nothing), vceqq_u8(c, nothing), vceqq_u8(d, nothing));
+#elif defined(__SSE2__)
+        uint64_t bits = 0;
+        uint64_t zeros = 0;
+        __m128i v;
+
+        for (uint32_t j = 0; j < 64; j += 16) {
+            v = _mm_loadu_si128((const __m128i*) (data + i + j));
+            bits |= (uint64_t) strings_sse_printable(v) << j;
+            zeros |= (uint64_t) (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) << j;
+        }
+        printable[i / 64] = bits;
+        zero[i / 64] = zeros;
+#else
+        uint64_t bits = 0;
+        uint64_t zeros = 0;
+
+        for (uint32_t j = 0; j < 64; j++) {
+            bits |= (uint64_t) ((data[i + j] >= 0x20 && data[i + j] <= 0x7e) || data[i + j] == '\t') << j;
+            zeros |= (uint64_t) (data[i + j] == 0) << j;
+        }
+        printable[i / 64] = bits;
+        zero[i / 64] = zeros;
+#endif
+    }
+}
+
+//find the next bit that is [set] at or after [position], [bits] if there is none
+static uint64_t strings_next_bit(const uint64_t* bitmap, uint64_t bits, uint64_t position, bool set) {
+    uint64_t word;
+
+    while (position < bits) {
+        word = set ? bitmap[position / 64] : ~bitmap[position / 64];
+        word &= ~0ULL << (position % 64);
+        if (word) {
+            position = (position & ~63ULL) + __builtin_ctzll(word);
+            return position < bits ? position : bits;
+        }
+        position = (position & ~63ULL) + 64;
+    }
+    return bits;
+}
+
+static void strings_append(StringsOutput* output, const char* text, size_t length) {
+    char* grown;
+
+    if (output->failed)
+        return;
+    if (output->length + length > output->capacity) {
+        grown = (char*) realloc(output->data, (output->length + length) * 2);
+        if (grown == NULL) {
+            output->failed = true;
+            return;
+        }
+        output->data = grown;
+        output->capacity = (output->length + length) * 2;
+    }
+    memcpy(output->data + output->length, text, length);
+    output->length += length;
+}
+
+//filter and print one run. [step] is 1 for ASCII, 2 for UTF-16 (every other byte is the 0 high byte)
+static void strings_emit(StringsScan* scan, StringsOutput* output, uint64_t address, const uint8_t* run, uint64_t length, uint32_t step, char kind) {
+    char text[STRINGS_MAX_LENGTH + 1];
+    char line[64];
+    uint64_t count;
+    int line_length;
+
+    count = length / step;
+    if (count > STRINGS_MAX_LENGTH)
+        count = STRINGS_MAX_LENGTH;
+    for (uint64_t i = 0; i < count; i++)
+        text[i] = (char) run[i * step];
+    text[count] = '\0';
+
+    if (scan->find && strstr(text, scan->find) == NULL)
+        return;
+    if (scan->has_regex && regexec(&scan->regex, text, 0, NULL, 0))
+        return;
+
+    if (scan->color)
+        line_length = snprintf(line, sizeof(line), YELLOW"0x%llx "WHITE"%c ", address, kind);
+    else
+        line_length = snprintf(line, sizeof(line), "0x%llx %c ", address, kind);
+    strings_append(output, line, (size_t) line_length);
+    strings_append(output, text, count);
+    strings_append(output, "\n", 1);
+    __atomic_fetch_add(&scan->found, 1, __ATOMIC_RELAXED);
+}
+
+/*
+scan [size] bytes at [address]
+the chunk also reads a couple of bytes before it and up to STRINGS_MAX_LENGTH after it, and only prints runs that start inside it,
+so a string crossing into the next chunk comes out once and whole
+*/
+static bool strings_chunk(void* context, uint64_t address, uint64_t size) {
+    StringsScan* scan = (StringsScan*) context;
+    StringsOutput output;
+    MemoryView view;
+    kern_return_t kret;
+    vm_size_t read_size;
+    uint8_t* data;
+    uint64_t* printable;
+    uint64_t* zero;
+    uint64_t* wide;
+    uint64_t before;
+    uint64_t after;
+    uint64_t padded;
+    uint64_t words;
+    uint64_t base;
+    uint64_t even;
+    uint64_t start;
+    uint64_t end;
+
+    before = address >= 2 ? 2 : 0;
+    base = address - before;
+    padded = (before + size + STRINGS_MAX_LENGTH + 63) & ~63ULL;
+    words = padded / 64;
+    printable = (uint64_t*) malloc(words * sizeof(uint64_t) * 3);
+    if (printable == NULL)
+        return false;
+    zero = printable + words;
+    wide = zero + words;
+
+    //when the chunk and the bytes around it map as one piece they get scanned in place
+    if (view_map(scan->views, base, padded, &view)) {
+        data = view.data;
+    }
+    else {
+        data = (uint8_t*) calloc(padded, 1);
+        if (data == NULL) {
+            free(printable);
+            return false;
+        }
+        read_size = size;
+        kret = vm_read_overwrite(scan->task, (vm_address_t) address, size, (vm_address_t) (data + before), &read_size);
+        if (kret != KERN_SUCCESS) {
+            __atomic_fetch_add(&scan->unreadable, size, __ATOMIC_RELAXED);
+            free(data);
+            free(printable);
+            return true; //a page going away under us isn't worth failing the whole scan over
+        }
+
+        //the bytes around the chunk are best effort, they stay 0 (which ends any string) if they can't be read
+        read_size = before;
+        if (before && vm_read_overwrite(scan->task, (vm_address_t) base, before, (vm_address_t) data, &read_size) != KERN_SUCCESS)
+            memset(data, 0, before);
+        after = STRINGS_MAX_LENGTH;
+        read_size = after;
+        if (vm_read_overwrite(scan->task, (vm_address_t) (address + size), after, (vm_address_t) (data + before + size), &read_size) != KERN_SUCCESS)
+            memset(data + before + size, 0, after);
+    }
+
+    strings_classify(data, padded, printable, zero);
+
+    //a UTF-16 character is a printable byte at an even address followed by a 0 byte
+    //setting the bit of the 0 byte as well makes a whole UTF-16 string one run of set bits
+    even = (base & 1) ? 0xaaaaaaaaaaaaaaaaULL : 0x5555555555555555ULL;
+    for (uint64_t i = 0; i < words; i++)
+        wide[i] = printable[i] & ((zero[i] >> 1) | (i + 1 < words ? zero[i + 1] << 63 : 0)) & even;
+    for (uint64_t i = words; i-- > 0;)
+        wide[i] |= (wide[i] << 1) | (i ? wide[i - 1] >> 63 : 0);
+
+    memset(&output, 0, sizeof(output));
+
+    start = strings_next_bit(printable, padded, 0, true);
+    while (start < padded) {
+        end = strings_next_bit(printable, padded, start, false);
+        if (start >= before && start < before + size && end - start >= scan->min_length)
+            strings_emit(scan, &output, base + start, data + start, end - start, 1, 'a');
+        start = strings_next_bit(printable, padded, end, true);
+    }
+
+    start = strings_next_bit(wide, padded, 0, true);
+    while (start < padded) {
+        end = strings_next_bit(wide, padded, start, false);
+        if (start >= before && start < before + size && (end - start) / 2 >= scan->min_length)
+            strings_emit(scan, &output, base + start, data + start, end - start, 2, 'u');
+        start = strings_next_bit(wide, padded, end, true);
+    }
+
+    if (output.length) {
+        pthread_mutex_lock(&scan->lock);
+        //the terminal goes through Output.c so a 'strings &' keeps its lines with the job
+        if (scan->out == stdout)
+            output_text(output.data, output.length);
+        else
+            fwrite(output.data, 1, output.length, scan->out);
+        pthread_mutex_unlock(&scan->lock);
+    }
+
+    free(output.data);
+    if (view.data)
+        view_release(&view);
+    else
+        free(data);
+    free(printable);
+    return !output.failed;
+}
+
+//find an image by name with its header parsed
+static ImageEntry* strings_image(Machium* machium, const char* name) {
+    ImageIndex* index;
+
+    index = image_index(machium);
+    if (index == NULL)
+        return NULL;
+
+    for (uint32_t i = 0; i < index->count; i++) {
+        if (!strcmp(index->images[i].name, name))
+            return image_find(machium, index->images[i].base); //parses the header if it wasn't yet
+    }
+    return NULL;
+}
+
+/*
+the readable regions of every segment of [entry]. images in the shared cache have other images between their segments,
+so the span from __TEXT to the last segment isn't all theirs
+*/
+static uint32_t strings_image_regions(mach_port_t task, const ImageEntry* entry, MemoryRegion** out) {
+    const MachOSegment* segment;
+    MemoryRegion* regions;
+    MemoryRegion* grown;
+    MemoryRegion* found;
+    uint32_t found_count;
+    uint32_t count;
+    uint64_t start;
+
+    regions = NULL;
+    count = 0;
+    for (uint32_t i = 0; i < entry->macho.segment_count; i++) {
+        segment = &entry->macho.segments[i];
+        if (segment->vmsize == 0 || !strcmp(segment->name, "__PAGEZERO") || !strcmp(segment->name, "__LINKEDIT"))
+            continue;
+        start = entry->base + (segment->vmaddr - entry->macho.text_vmaddr);
+        found_count = region_list(task, start, start + segment->vmsize, VM_PROT_READ, &found);
+        if (found_count == 0)
+            continue;
+        grown = (MemoryRegion*) realloc(regions, (count + found_count) * sizeof(MemoryRegion));
+        if (grown == NULL) {
+            free(found);
+            break;
+        }
+        regions = grown;
+        memcpy(regions + count, found, found_count * sizeof(MemoryRegion));
+        count += found_count;
+        free(found);
+    }
+    *out = regions;
+    return count;
+}
+
+/*
+scan readable memory for ASCII ('a') and UTF-16 ('u') strings
+regions are split up and scanned on every core, results stream out as chunks finish so they aren't in address order
+
+machium->args[0] -> strings
+machium->args[1] -> all / image / [0xaddress]
+machium->args[2] -> [image name] / [size] (not for all)
+machium->args[...] -> options: min [length], find [text], regex [pattern], out [file] (OPTIONAL)
+*/
+machium_command_t m_strings(Machium* machium) {
+    StringsScan scan;
+    ImageEntry* image;
+    MemoryRegion* regions;
+    JobRange* ranges;
+    uint32_t region_count;
+    uint64_t start;
+    uint64_t end;
+    uint64_t total;
+    uint8_t option;
+    const char* file;
+    const char* pattern;
+    double started;
+    double seconds;
+    bool finished;
+
+    if (machium->args_count < 2) {
+        output_error(KERN_SUCCESS, "Not enough arguments for 'strings', 2 minimum");
+        return MACHIUM_FAILURE;
+    }
+
+    memset(&scan, 0, sizeof(scan));
+    image = NULL;
+    scan.task = machium->target->debug_task;
+    scan.views = view_cache(machium->target);
+    scan.min_length = STRINGS_MIN_LENGTH;
+    file = NULL;
+
+    if (!strcmp(machium->args[1], "all")) {
+        start = 0;
+        end = UINT64_MAX;
+        option = 2;
+    }
+    else if (!strcmp(machium->args[1], "image")) {
+        image = machium->args_count < 3 ? NULL : strings_image(machium, machium->args[2]);
+        if (image == NULL) {
+            output_error(KERN_SUCCESS, "No image named '%s'", machium->args[2]);
+            return MACHIUM_FAILURE;
+        }
+        start = 0;
+        end = 0;
+        option = 3;
+    }
+    else {
+        if (machium->args_count < 3) {
+            output_error(KERN_SUCCESS, "Not enough arguments for 'strings [0xaddress] [size]', 3 minimum");
+            return MACHIUM_FAILURE;
+        }
+        start = (uint64_t) strtoull(machium->args[1], NULL, 0);
+        end = start + (uint64_t) strtoull(machium->args[2], NULL, 0);
+        option = 3;
+    }
+
+    pattern = NULL;
+    for (; option < machium->args_count; option += 2) {
+        if (option + 1 >= machium->args_count) {
+            output_error(KERN_SUCCESS, "Option '%s' of 'strings' needs a value", machium->args[option]);
+            return MACHIUM_FAILURE;
+        }
+        if (!strcmp(machium->args[option], "min"))
+            scan.min_length = (uint32_t) strtoul(machium->args[option + 1], NULL, 0);
+        else if (!strcmp(machium->args[option], "find"))
+            scan.find = machium->args[option + 1];
+        else if (!strcmp(machium->args[option], "regex"))
+            pattern = machium->args[option + 1];
+        else if (!strcmp(machium->args[option], "out"))
+            file = machium->args[option + 1];
+        else {
+            output_error(KERN_SUCCESS, "Invalid option for 'strings', %s", machium->args[option]);
+            return MACHIUM_FAILURE;
+        }
+    }
+    if (pattern) {
+        if (regcomp(&scan.regex, pattern, REG_EXTENDED | REG_NOSUB)) {
+            output_error(KERN_SUCCESS, "Invalid regex '%s'", pattern);
+            return MACHIUM_FAILURE;
+        }
+        scan.has_regex = true;
+    }
+    if (scan.min_length == 0)
+        scan.min_length = 1;
+
+    if (file) {
+        scan.out = fopen(file, "w");
+        if (scan.out == NULL) {
+            output_error(KERN_SUCCESS, "Could not open %s", file);
+            if (scan.has_regex)
+                regfree(&scan.regex);
+            return MACHIUM_FAILURE;
+        }
+    }
+    else {
+        scan.out = stdout;
+        scan.color = true;
+    }
+    pthread_mutex_init(&scan.lock, NULL);
+
+    if (image)
+        region_count = strings_image_regions(scan.task, image, &regions);
+    else
+        region_count = region_list(scan.task, start, end, VM_PROT_READ, &regions);
+    ranges = (JobRange*) malloc((region_count ? region_count : 1) * sizeof(JobRange));
+    if (ranges == NULL)
+        region_count = 0; //nothing gets scanned, reported as running out of memory below
+    total = 0;
+    for (uint32_t i = 0; i < region_count; i++) {
+        ranges[i].address = regions[i].address;
+        ranges[i].size = regions[i].size;
+        total += regions[i].size;
+    }
+
+    started = job_time();
+    finished = ranges && job_for_each_range(ranges, region_count, STRINGS_CHUNK_SIZE, strings_chunk, &scan);
+    seconds = job_time() - started;
+    fflush(scan.out);
+
+    if (file)
+        fclose(scan.out);
+    if (scan.has_regex)
+        regfree(&scan.regex);
+    pthread_mutex_destroy(&scan.lock);
+    free(regions);
+    free(ranges);
+
+    if (job_cancelled()) {
+        output_message(OUTPUT_LEVEL_WARNING, "String scan was killed, results are incomplete");
+        return MACHIUM_FAILURE;
+    }
+    if (!finished)
+        output_message(OUTPUT_LEVEL_WARNING, "Ran out of memory, results are incomplete");
+    if (scan.unreadable)
+        output_message(OUTPUT_LEVEL_WARNING, "%llu bytes couldn't be read and were skipped", scan.unreadable);
+    output_message(OUTPUT_LEVEL_GOOD, "Found %llu strings in %u regions (%.1f MB) in %.2fs (%.1f MB/s)%s%s", scan.found, region_count, (double) total / 1e6, seconds,
+           seconds > 0 ? (double) total / seconds / 1e6 : 0.0, file ? ", written to " : "", file ? file : "");
+    return finished ? MACHIUM_SUCCESS : MACHIUM_FAILURE;
+}
@@ -0,0 +1,33 @@
+#ifndef STRINGS_H
+#define STRINGS_H
+
+#include "Machium.h"
+#include "View.h"
+#include <pthread.h>
+#include <regex.h>
+
+#define STRINGS_MIN_LENGTH 4 //shortest run printed unless 'min' says otherwise
+#define STRINGS_MAX_LENGTH 4096 //longer runs get cut. also how far a chunk reads past its end to finish a string
+#define STRINGS_CHUNK_SIZE (1024 * 1024) //piece of a region one worker scans at a time
+
+//state shared by every chunk of a 'strings' scan
+typedef struct StringsScan {
+    mach_port_t task;
+    ViewCache* views; //chunks are scanned right out of the task's pages when they can be mapped
+    uint32_t min_length;
+    const char* find; //substring filter, NULL for none
+    regex_t regex;
+    bool has_regex;
+
+    FILE* out; //stdout or the 'out' file
+    bool color;
+    pthread_mutex_t lock; //chunks write their whole output at once so lines never interleave
+
+    uint64_t found;
+    uint64_t unreadable;
+} StringsScan;
+
+//scan memory for ASCII and UTF-16 strings
+machium_command_t m_strings(Machium* machium);
+
+#endif /* STRINGS_H */
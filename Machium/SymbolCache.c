@@ -0,0 +1,214 @@
+#include "SymbolCache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//mkdir -p
+static bool make_directories(const char* path) {
+    char partial[1024];
+    size_t length;
+
+    length = strlen(path);
+    if (length >= sizeof(partial))
+        return false;
+
+    memcpy(partial, path, length + 1);
+    for (size_t i = 1; i <= length; i++) {
+        if (partial[i] != '/' && partial[i] != '\0')
+            continue;
+        partial[i] = '\0';
+        if (mkdir(partial, 0755) && errno != EEXIST)
+            return false;
+        partial[i] = path[i];
+    }
+    return true;
+}
+
+static bool symbol_cache_directory(char* out, size_t size) {
+    const char* directory;
+    const char* home;
+
+    directory = getenv(SYMBOL_CACHE_DIR_ENV);
+    if (directory && directory[0])
+        return snprintf(out, size, "%s", directory) < (int) size;
+
+    home = getenv("HOME");
+    if (home == NULL || home[0] == '\0')
+        home = "/tmp";
+    return snprintf(out, size, "%s/Library/Caches/Machium", home) < (int) size;
+}
+
+bool symbol_cache_file(const char* name, char* out, size_t size, bool create) {
+    char directory[1024];
+    int written;
+
+    if (!symbol_cache_directory(directory, sizeof(directory)) || (create && !make_directories(directory)))
+        return false;
+    written = snprintf(out, size, "%s/%s", directory, name);
+    return written > 0 && written < (int) size;
+}
+
+bool symbol_cache_path(const uint8_t uuid[16], char* out, size_t size) {
+    char directory[1024];
+    int written;
+
+    if (!symbol_cache_directory(directory, sizeof(directory)))
+        return false;
+
+    written = snprintf(out, size, "%s/%02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-%02X%02X%02X%02X%02X%02X.msym", directory,
+        uuid[0], uuid[1], uuid[2], uuid[3], uuid[4], uuid[5], uuid[6], uuid[7],
+        uuid[8], uuid[9], uuid[10], uuid[11], uuid[12], uuid[13], uuid[14], uuid[15]);
+    return written > 0 && written < (int) size;
+}
+
+/*
+one mmap and the symbols are ready, a binary search runs right on the mapped pages
+anything that doesn't add up is treated as a miss so the caller rebuilds the file
+*/
+bool symbol_cache_load(MachOImage* image) {
+    char path[1024];
+    struct stat info;
+    SymbolCacheHeader* header;
+    MachOSymbol* symbols;
+    uint8_t* map;
+    size_t needed;
+    int fd;
+
+    if (!image->has_uuid || !symbol_cache_path(image->uuid, path, sizeof(path)))
+        return false;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    if (fstat(fd, &info) || info.st_size < (off_t) sizeof(SymbolCacheHeader)) {
+        close(fd);
+        return false;
+    }
+
+    map = (uint8_t*) mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    header = (SymbolCacheHeader*) map;
+    needed = sizeof(SymbolCacheHeader) + (size_t) header->symbol_count * sizeof(MachOSymbol) + header->strings_size;
+    if (header->magic != SYMBOL_CACHE_MAGIC || header->version != SYMBOL_CACHE_VERSION
+        || memcmp(header->uuid, image->uuid, 16) || header->image_size != image->size
+        || needed != (size_t) info.st_size || header->strings_size == 0
+        || map[info.st_size - 1] != '\0') {
+        munmap(map, (size_t) info.st_size);
+        return false;
+    }
+
+    //a truncated or corrupt file could still add up, every name has to be in the pool and lookups binary search the offsets
+    symbols = (MachOSymbol*) (map + sizeof(SymbolCacheHeader));
+    for (uint32_t i = 0; i < header->symbol_count; i++) {
+        if ((symbols[i].name != MACHO_UNNAMED && symbols[i].name >= header->strings_size)
+            || (i && symbols[i].offset < symbols[i - 1].offset)) {
+            munmap(map, (size_t) info.st_size);
+            return false;
+        }
+    }
+
+    image->mapping = map;
+    image->mapping_size = (size_t) info.st_size;
+    image->symbols = symbols;
+    image->symbol_count = header->symbol_count;
+    image->strings = (char*) (image->symbols + header->symbol_count);
+    image->strings_size = header->strings_size;
+    return true;
+}
+
+//symbol [index] has the same name as the one before it
+static bool symbol_cache_alias(const MachOImage* image, uint32_t index) {
+    return index && image->symbols[index].name == image->symbols[index - 1].name;
+}
+
+/*
+the string table of an image holds every name it has, but we only keep the ones our symbols point at
+so the pool gets rebuilt and the symbols get renumbered into it
+*/
+bool symbol_cache_store(const MachOImage* image) {
+    char path[1024];
+    char temporary[1100];
+    char directory[1024];
+    SymbolCacheHeader header;
+    MachOSymbol* symbols;
+    char* strings;
+    uint32_t strings_size;
+    uint64_t pool_size;
+    size_t name_length;
+    FILE* file;
+    bool written;
+
+    if (!image->has_uuid || !symbol_cache_directory(directory, sizeof(directory)) || !make_directories(directory))
+        return false;
+    if (!symbol_cache_path(image->uuid, path, sizeof(path)))
+        return false;
+
+    //aliases share a name, one right after the other since they share an address. they get one copy, any other
+    //repeat gets its own, so the pool is sized from the copies and not from the string table
+    pool_size = 1;
+    for (uint32_t i = 0; i < image->symbol_count; i++) {
+        if (image->symbols[i].name != MACHO_UNNAMED && !symbol_cache_alias(image, i))
+            pool_size += strlen(image->strings + image->symbols[i].name) + 1;
+    }
+    if (pool_size > UINT32_MAX)
+        return false;
+
+    symbols = (MachOSymbol*) malloc((image->symbol_count ? image->symbol_count : 1) * sizeof(MachOSymbol));
+    strings = (char*) malloc(pool_size);
+    if (symbols == NULL || strings == NULL) {
+        free(symbols);
+        free(strings);
+        return false;
+    }
+
+    strings[0] = '\0';
+    strings_size = 1;
+    for (uint32_t i = 0; i < image->symbol_count; i++) {
+        symbols[i] = image->symbols[i];
+        if (symbols[i].name == MACHO_UNNAMED)
+            continue;
+        if (symbol_cache_alias(image, i)) {
+            symbols[i].name = symbols[i - 1].name;
+            continue;
+        }
+        name_length = strlen(image->strings + image->symbols[i].name) + 1;
+        memcpy(strings + strings_size, image->strings + image->symbols[i].name, name_length);
+        symbols[i].name = strings_size;
+        strings_size += (uint32_t) name_length;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = SYMBOL_CACHE_MAGIC;
+    header.version = SYMBOL_CACHE_VERSION;
+    memcpy(header.uuid, image->uuid, 16);
+    header.image_size = image->size;
+    header.symbol_count = image->symbol_count;
+    header.strings_size = strings_size;
+
+    snprintf(temporary, sizeof(temporary), "%s.%d", path, getpid());
+    file = fopen(temporary, "wb");
+    written = file != NULL;
+    if (written) {
+        written = fwrite(&header, sizeof(header), 1, file) == 1
+            && (image->symbol_count == 0 || fwrite(symbols, sizeof(MachOSymbol), image->symbol_count, file) == image->symbol_count)
+            && fwrite(strings, 1, strings_size, file) == strings_size;
+        written = !fclose(file) && written;
+    }
+    free(symbols);
+    free(strings);
+
+    if (!written || rename(temporary, path)) {
+        unlink(temporary);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,43 @@
+#ifndef SYMBOLCACHE_H
+#define SYMBOLCACHE_H
+
+//like MachO.h this only needs libc, cache files can be built and checked on linux too
+#include "MachO.h"
+
+/*
+a symbol cache file is flat so it can be searched right out of the mapping:
+
+SymbolCacheHeader
+MachOSymbol symbols[symbol_count] (sorted by offset, same as MachOImage.symbols)
+char strings[strings_size] (only the names the symbols use, starts with '\0')
+
+everything is an offset so there's nothing to fix up after the mmap
+*/
+#define SYMBOL_CACHE_MAGIC 0x4d59534d //"MSYM"
+#define SYMBOL_CACHE_VERSION 1
+
+//overrides where cache files go, otherwise $HOME/Library/Caches/Machium
+#define SYMBOL_CACHE_DIR_ENV "MACHIUM_CACHE_DIR"
+
+typedef struct SymbolCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint8_t uuid[16];
+    uint64_t image_size; //MachOImage.size, a mismatch means the file doesn't belong to this image
+    uint32_t symbol_count;
+    uint32_t strings_size;
+} SymbolCacheHeader;
+
+//get the path of Machium's own file [name] next to the cache files, [create] makes the directory if it's missing
+bool symbol_cache_file(const char* name, char* out, size_t size, bool create);
+
+//get the cache file path of an image UUID
+bool symbol_cache_path(const uint8_t uuid[16], char* out, size_t size);
+
+//map the cache file of [image] (needs uuid and size from macho_parse_header) and point its symbols into it
+bool symbol_cache_load(MachOImage* image);
+
+//write the symbols of [image] to its cache file. the file is renamed into place so readers never see half of one
+bool symbol_cache_store(const MachOImage* image);
+
+#endif /* SYMBOLCACHE_H */
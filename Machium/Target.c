@@ -0,0 +1,495 @@
+#include "Target.h"
+#include "Memory.h"
+#include "Image.h"
+#include "ThreadPool.h"
+#include "Snapshot.h"
+#include "View.h"
+#include "Coverage.h"
+#include "Integrity.h"
+#include "ObjC.h"
+#include "Output.h"
+#include "Job.h"
+#include "Hook.h"
+#include <spawn.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/sysctl.h>
+#include <sys/time.h>
+
+extern char** environ;
+
+//libproc.h isn't in the iOS SDK, the functions are in libSystem all the same
+int proc_listallpids(void* buffer, int size);
+int proc_name(int pid, void* buffer, uint32_t size);
+
+MachiumTarget* target_attach(Machium* machium, pid_t pid, const char* name) {
+    kern_return_t kret;
+    MachiumTarget* target;
+    mach_port_t task;
+
+    if (pid == 0) {
+        output_error(KERN_SUCCESS, "Machium doesn't support debugging on kernel_task! (task_for_pid(0))");
+        output_error(KERN_SUCCESS, "You don't want any unwanted kernel panics, right?");
+        return NULL;
+    }
+    if (machium->session->target_count == MACHIUM_MAX_TARGETS) {
+        output_error(KERN_SUCCESS, "Max amount of targets attached! (%d)", MACHIUM_MAX_TARGETS);
+        return NULL;
+    }
+    for (uint8_t i = 0; i < machium->session->target_count; i++) {
+        if (machium->session->targets[i].pid == pid) {
+            output_error(KERN_SUCCESS, "Already attached to %d as '%s'", pid, machium->session->targets[i].name);
+            return NULL;
+        }
+    }
+
+    //task_for_pid gets a send right to the task of the process ID indicated by the second argument and stores it in the third argument
+    //send rights can be stored in mach_port_t variables
+    kret = task_for_pid(mach_task_self(), pid, &task);
+    if (kret != KERN_SUCCESS) {
+        output_error(KERN_SUCCESS, "Couldn't obtain task_for_pid(%d)!", pid);
+        output_error(KERN_SUCCESS, "Do you have proper entitlements?");
+        return NULL;
+    }
+
+    target = &machium->session->targets[machium->session->target_count++];
+    memset(target, 0, sizeof(MachiumTarget));
+    target->pid = pid;
+    target->debug_task = task;
+    if (name)
+        snprintf(target->name, sizeof(target->name), "%s", name);
+    else
+        snprintf(target->name, sizeof(target->name), "%d", pid);
+    return target;
+}
+
+/*
+the task is created suspended, dyld hasn't run yet when we attach
+nobody else would ever resume it, so it's killed if attaching fails
+*/
+MachiumTarget* target_spawn(Machium* machium, char** argv) {
+    MachiumTarget* target;
+    posix_spawnattr_t attributes;
+    const char* name;
+    pid_t pid;
+    int error;
+
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_START_SUSPENDED);
+    output_flush(); //what we output so far goes out before anything the target prints
+    error = posix_spawnp(&pid, argv[0], NULL, &attributes, argv, environ);
+    posix_spawnattr_destroy(&attributes);
+    if (error) {
+        output_error(KERN_SUCCESS, "Couldn't spawn %s: %s", argv[0], strerror(error));
+        return NULL;
+    }
+
+    name = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0];
+    target = target_attach(machium, pid, name);
+    if (target == NULL) {
+        kill(pid, SIGKILL);
+        return NULL;
+    }
+    output_message(OUTPUT_LEVEL_GOOD, "Spawned %s (%d) suspended before its first instruction, 'continue' starts it", name, pid);
+    return target;
+}
+
+static bool pid_seen(const uint64_t* bitmap, pid_t pid) {
+    return (bitmap[pid / 64] >> (pid % 64)) & 1;
+}
+
+/*
+poll the process list until a new process called [name] shows up
+only pids that weren't there the last time get their name looked at, for TARGET_WAIT_YOUNG seconds since a shell forks
+under its own name before it execs. processes that were already running when we started don't count
+*/
+MachiumTarget* target_wait_for(Machium* machium, const char* name) {
+    MachiumTarget* target;
+    char wanted[2 * MAXCOMLEN + 1];
+    char comm[2 * MAXCOMLEN + 1];
+    uint64_t* seen;
+    uint64_t* previous;
+    uint64_t* swap;
+    pid_t* pids;
+    pid_t young[256];
+    double young_since[256];
+    uint32_t young_count;
+    int capacity;
+    int count;
+    bool first;
+    double now;
+    double age;
+    pid_t pid;
+
+    //proc_name gives p_name, cut off at 2 * MAXCOMLEN, or p_comm, cut off at MAXCOMLEN
+    snprintf(wanted, sizeof(wanted), "%s", strrchr(name, '/') ? strrchr(name, '/') + 1 : name);
+
+    capacity = 4096;
+    pids = (pid_t*) malloc(capacity * sizeof(pid_t));
+    seen = (uint64_t*) calloc(TARGET_PID_MAX / 64 + 1, sizeof(uint64_t));
+    previous = (uint64_t*) calloc(TARGET_PID_MAX / 64 + 1, sizeof(uint64_t));
+    young_count = 0;
+    first = true;
+    pid = 0;
+
+    output_message(OUTPUT_LEVEL_GOOD, "Waiting for %s to launch...", wanted);
+    output_flush();
+    while (pid == 0) {
+        count = proc_listallpids(pids, capacity * sizeof(pid_t));
+        if (count >= capacity) {
+            capacity *= 2;
+            pids = (pid_t*) realloc(pids, capacity * sizeof(pid_t));
+            continue;
+        }
+
+        now = job_time();
+        memset(seen, 0, (TARGET_PID_MAX / 64 + 1) * sizeof(uint64_t));
+        for (int i = 0; i < count; i++) {
+            if (pids[i] <= 0 || pids[i] >= TARGET_PID_MAX)
+                continue;
+            seen[pids[i] / 64] |= 1ULL << (pids[i] % 64);
+            if (!first && !pid_seen(previous, pids[i]) && young_count < sizeof(young) / sizeof(young[0])) {
+                young[young_count] = pids[i];
+                young_since[young_count++] = now;
+            }
+        }
+        swap = previous;
+        previous = seen;
+        seen = swap;
+        first = false;
+
+        for (uint32_t i = 0; i < young_count && pid == 0;) {
+            if (now - young_since[i] > TARGET_WAIT_YOUNG) {
+                young_count--;
+                young[i] = young[young_count];
+                young_since[i] = young_since[young_count];
+                continue;
+            }
+            if (proc_name(young[i], comm, sizeof(comm)) > 0 && (!strcmp(comm, wanted) || (strlen(comm) == MAXCOMLEN && !strncmp(comm, wanted, MAXCOMLEN))))
+                pid = young[i];
+            i++;
+        }
+        if (pid == 0)
+            usleep(TARGET_WAIT_INTERVAL);
+    }
+    free(pids);
+    free(seen);
+    free(previous);
+
+    target = target_attach(machium, pid, wanted);
+    if (target == NULL)
+        return NULL;
+    if (task_suspend(target->debug_task) != KERN_SUCCESS)
+        output_message(OUTPUT_LEVEL_WARNING, "Couldn't suspend %d, it keeps running", pid);
+    age = target_age(pid);
+    if (age >= 0)
+        output_message(OUTPUT_LEVEL_GOOD, "Attached to %s (%d) %.1fms after it launched, 'continue' resumes it", wanted, pid, age * 1000.0);
+    else
+        output_message(OUTPUT_LEVEL_GOOD, "Attached to %s (%d), 'continue' resumes it", wanted, pid);
+    return target;
+}
+
+double target_age(pid_t pid) {
+    struct kinfo_proc info;
+    struct timeval now;
+    size_t size;
+    int name[4] = { CTL_KERN, KERN_PROC, KERN_PROC_PID, pid };
+
+    size = sizeof(info);
+    if (sysctl(name, 4, &info, &size, NULL, 0) || size == 0)
+        return -1;
+    gettimeofday(&now, NULL);
+    return (double) (now.tv_sec - info.kp_proc.p_starttime.tv_sec) + (double) (now.tv_usec - info.kp_proc.p_starttime.tv_usec) / 1e6;
+}
+
+MachiumTarget* target_find(Machium* machium, const char* name) {
+    for (uint8_t i = 0; i < machium->session->target_count; i++) {
+        if (!strcmp(machium->session->targets[i].name, name))
+            return &machium->session->targets[i];
+    }
+    for (uint8_t i = 0; i < machium->session->target_count; i++) {
+        if (machium->session->targets[i].pid == (pid_t) strtol(name, NULL, 0))
+            return &machium->session->targets[i];
+    }
+    return NULL;
+}
+
+bool target_detachable(MachiumTarget* target, const char* command) {
+    if (!job_idle(command))
+        return false;
+    //nothing could find the trampolines again to take them out, but a task that's gone took them with it
+    if (hook_count(target) && (kill(target->pid, 0) == 0 || errno == EPERM)) {
+        output_error(KERN_SUCCESS, "%u hooks are still patched into pid %d, 'hook clear' first", hook_count(target), target->pid);
+        return false;
+    }
+    return true;
+}
+
+void target_reset(MachiumTarget* target) {
+    coverage_free(target); //first, taking the breakpoints out goes through the target's views
+    integrity_free(target);
+    image_index_free(target->images);
+    target->images = NULL;
+    snapshot_set_free(target->snapshots);
+    target->snapshots = NULL;
+    view_cache_free(target->views);
+    target->views = NULL;
+    objc_cache_free(target->objc);
+    target->objc = NULL;
+    free(target->hooks); //target_detachable made sure the task has none left or is gone
+    target->hooks = NULL;
+    target->br_count = 0;
+    target->wa_count = 0;
+    target->started_exception_server = false;
+}
+
+/*
+list attached targets, the selected one is marked with a *
+
+machium->args[0] -> target
+machium->args[1] -> list (OPTIONAL)
+*/
+machium_command_t m_target_list(Machium* machium) {
+    MachiumTarget* target;
+
+    output_message(OUTPUT_LEVEL_GOOD, "%d targets attached:", machium->session->target_count);
+    for (uint8_t i = 0; i < machium->session->target_count; i++) {
+        target = &machium->session->targets[i];
+        output_textf("%s" YELLOW "%-16s " WHITE "pid %d\n", target == machium->target ? GREEN"* "WHITE : "  ", target->name, target->pid);
+    }
+    return MACHIUM_SUCCESS;
+}
+
+/*
+attach to another process. the selected target stays the same
+
+machium->args[0] -> target
+machium->args[1] -> add
+machium->args[2] -> [pid]
+machium->args[3] -> [name] (OPTIONAL)
+*/
+machium_command_t m_target_add(Machium* machium) {
+    MachiumTarget* target;
+    pid_t pid;
+
+    if (machium->args_count < 3) {
+        output_error(KERN_SUCCESS, "Not enough arguments for 'target add', 3 minimum");
+        return MACHIUM_FAILURE;
+    }
+    else if (machium->args_count > 4) {
+        output_error(KERN_SUCCESS, "Too many arguments for 'target add', 4 maximum");
+        return MACHIUM_FAILURE;
+    }
+
+    if (machium->args_count == 4 && target_find(machium, machium->args[3])) {
+        output_error(KERN_SUCCESS, "A target named '%s' already exists", machium->args[3]);
+        return MACHIUM_FAILURE;
+    }
+
+    pid = strtol(machium->args[2], NULL, 0);
+    target = target_attach(machium, pid, machium->args_count == 4 ? machium->args[3] : NULL);
+    if (target == NULL)
+        return MACHIUM_FAILURE;
+
+    output_message(OUTPUT_LEVEL_GOOD, "Obtained task_for_pid(%d) as '%s'", pid, target->name);
+    return MACHIUM_SUCCESS;
+}
+
+/*
+change the target every command works on
+
+machium->args[0] -> target
+machium->args[1] -> select
+machium->args[2] -> [name / pid]
+*/
+machium_command_t m_target_select(Machium* machium) {
+    MachiumTarget* target;
+
+    if (machium->args_count != 3) {
+        output_error(KERN_SUCCESS, "'target select' takes 3 arguments");
+        return MACHIUM_FAILURE;
+    }
+
+    target = target_find(machium, machium->args[2]);
+    if (target == NULL) {
+        output_error(KERN_SUCCESS, "No target named '%s'", machium->args[2]);
+        return MACHIUM_FAILURE;
+    }
+
+    machium->target = target;
+    output_message(OUTPUT_LEVEL_GOOD, "Selected '%s' (pid %d)", target->name, target->pid);
+    return MACHIUM_SUCCESS;
+}
+
+/*
+detach from a target
+
+machium->args[0] -> target
+machium->args[1] -> remove
+machium->args[2] -> [name / pid]
+*/
+machium_command_t m_target_remove(Machium* machium) {
+    MachiumTarget* target;
+    uint8_t index;
+    uint8_t selected;
+
+    if (machium->args_count != 3) {
+        output_error(KERN_SUCCESS, "'target remove' takes 3 arguments");
+        return MACHIUM_FAILURE;
+    }
+
+    target = target_find(machium, machium->args[2]);
+    if (target == NULL) {
+        output_error(KERN_SUCCESS, "No target named '%s'", machium->args[2]);
+        return MACHIUM_FAILURE;
+    }
+    if (machium->session->target_count == 1) {
+        output_error(KERN_SUCCESS, "Can't remove the last target, use 'pid' to switch processes instead");
+        return MACHIUM_FAILURE;
+    }
+    //jobs point into the target table, which gets packed below
+    if (!target_detachable(target, "target remove"))
+        return MACHIUM_FAILURE;
+
+    output_message(OUTPUT_LEVEL_GOOD, "Removing '%s' (pid %d)", target->name, target->pid);
+
+    index = target - machium->session->targets;
+    selected = machium->target - machium->session->targets;
+
+    target_reset(target);
+    mach_port_deallocate(mach_task_self(), target->debug_task);
+
+    //keep the array packed and the selection pointing at the same target
+    memmove(&machium->session->targets[index], &machium->session->targets[index + 1], (machium->session->target_count - index - 1) * sizeof(MachiumTarget));
+    machium->session->target_count--;
+    if (selected == index)
+        selected = 0;
+    else if (selected > index)
+        selected--;
+    machium->target = &machium->session->targets[selected];
+    return MACHIUM_SUCCESS;
+}
+
+/*
+handle target commands
+
+machium->args[0] -> target
+machium->args[1] -> [command]
+*/
+machium_command_t m_target(Machium* machium) {
+    if (machium->args_count == 1) m_target_list(machium);
+    else if (!strcmp(machium->args[1], "list")) m_target_list(machium);
+    else if (!strcmp(machium->args[1], "l")) m_target_list(machium);
+
+    else if (!strcmp(machium->args[1], "add")) m_target_add(machium);
+    else if (!strcmp(machium->args[1], "a")) m_target_add(machium);
+
+    else if (!strcmp(machium->args[1], "select")) m_target_select(machium);
+    else if (!strcmp(machium->args[1], "s")) m_target_select(machium);
+
+    else if (!strcmp(machium->args[1], "remove")) m_target_remove(machium);
+    else if (!strcmp(machium->args[1], "r")) m_target_remove(machium);
+
+    else {
+        output_error(KERN_SUCCESS, "Invalid argument for 'target', %s", machium->args[1]);
+        return MACHIUM_FAILURE;
+    }
+    return MACHIUM_SUCCESS;
+}
+
+//one target's share of an 'all read'
+typedef struct TargetRead {
+    MachiumTarget* target;
+    MemoryRead read;
+} TargetRead;
+
+static void target_read_fetch(void* argument) {
+    TargetRead* target_read = (TargetRead*) argument;
+    memory_read_fetch(target_read->target, &target_read->read);
+}
+
+//commands that act on the session instead of a target, running them once per target makes no sense
+static bool target_session_command(const char* command) {
+    static const char* session[] = { "all", "target", "t", "pid", "exit", "quit", "q", "help", "output", "layout", "jobs", "kill", "wait" };
+
+    for (size_t i = 0; i < sizeof(session) / sizeof(session[0]); i++) {
+        if (!strcmp(command, session[i]))
+            return true;
+    }
+    return false;
+}
+
+/*
+run a command on every target
+reads happen on the thread pool at the same time, then the results get printed one target after the other
+every other command runs once per target with that target selected, in target order
+
+machium->args[0] -> all
+machium->args[1] -> [command]
+machium->args[...] -> [arguments of command]
+*/
+machium_command_t m_all(Machium* machium) {
+    TargetRead reads[MACHIUM_MAX_TARGETS];
+    char args[MACHIUM_MAX_ARGS][MACHIUM_ARG_LENGTH];
+    job_command_t command;
+    machium_command_t result;
+    MemoryRead read;
+    MachiumTarget* selected;
+    PoolGroup group;
+    uint8_t args_count;
+
+    if (machium->args_count < 2) {
+        output_error(KERN_SUCCESS, "Not enough arguments for 'all', 2 minimum");
+        return MACHIUM_FAILURE;
+    }
+
+    //drop 'all' so the command parses its arguments like it normally would
+    memmove(machium->args[0], machium->args[1], (MACHIUM_MAX_ARGS - 1) * MACHIUM_ARG_LENGTH);
+    memset(machium->args[MACHIUM_MAX_ARGS - 1], 0, MACHIUM_ARG_LENGTH);
+    machium->args_count--;
+
+    if (target_session_command(machium->args[0])) {
+        output_error(KERN_SUCCESS, "'%s' isn't about one target, it can't run with 'all'", machium->args[0]);
+        return MACHIUM_FAILURE;
+    }
+
+    //symbolication and printing go through machium->target, so point it at each target while it runs
+    selected = machium->target;
+    result = MACHIUM_SUCCESS;
+
+    if (strcmp(machium->args[0], "read") && strcmp(machium->args[0], "r")) {
+        command = (job_command_t) get_machium_command(machium);
+        //a command is free to scribble on its arguments, every target gets them fresh
+        memcpy(args, machium->args, sizeof(args));
+        args_count = machium->args_count;
+        for (uint8_t i = 0; i < machium->session->target_count; i++) {
+            machium->target = &machium->session->targets[i];
+            memcpy(machium->args, args, sizeof(args));
+            machium->args_count = args_count;
+            output_message(OUTPUT_LEVEL_NONE, YELLOW"[pid %d] "WHITE"%s", machium->target->pid, machium->target->name);
+            if (command(machium) != MACHIUM_SUCCESS)
+                result = MACHIUM_FAILURE;
+        }
+        machium->target = selected;
+        return result;
+    }
+
+    if (!memory_read_parse(machium, &read))
+        return MACHIUM_FAILURE;
+
+    memset(&group, 0, sizeof(group));
+    for (uint8_t i = 0; i < machium->session->target_count; i++) {
+        reads[i].target = &machium->session->targets[i];
+        reads[i].read = read;
+        pool_submit(machium_pool(), &group, target_read_fetch, &reads[i]);
+    }
+    pool_wait(machium_pool(), &group);
+
+    for (uint8_t i = 0; i < machium->session->target_count; i++) {
+        machium->target = reads[i].target;
+        output_message(OUTPUT_LEVEL_NONE, YELLOW"[pid %d] "WHITE"%s", reads[i].target->pid, reads[i].target->name);
+        memory_read_print(machium, &reads[i].read);
+    }
+    machium->target = selected;
+    return result;
+}
@@ -0,0 +1,41 @@
+#ifndef TARGET_H
+#define TARGET_H
+
+#include "Machium.h"
+
+#define TARGET_WAIT_INTERVAL 500 //us between looks at the process list for --wait-for
+#define TARGET_WAIT_YOUNG 0.25 //s a new process keeps getting its name checked, a fork takes a moment to exec into the one we want
+#define TARGET_PID_MAX 100000 //pids wrap at 99999
+
+//attach to [pid] and add it to the session. [name] can be NULL to name it after the pid
+MachiumTarget* target_attach(Machium* machium, pid_t pid, const char* name);
+
+//launch [argv] with posix_spawn suspended before its first instruction and attach to it
+MachiumTarget* target_spawn(Machium* machium, char** argv);
+
+//wait for a process called [name] to launch, attach and suspend it as soon as it shows up
+MachiumTarget* target_wait_for(Machium* machium, const char* name);
+
+//seconds since [pid] was launched, -1 if that can't be found out
+double target_age(pid_t pid);
+
+//find a target by name or pid
+MachiumTarget* target_find(Machium* machium, const char* name);
+
+//forget everything that belongs to the task of a target (images, views, breakpoint state). callers check target_detachable first
+void target_reset(MachiumTarget* target);
+
+//true when [target] can be reset for [command]: no job is using its state and no hook is left patched into a live task. errors are printed
+bool target_detachable(MachiumTarget* target, const char* command);
+
+//handle target commands
+machium_command_t m_target(Machium* machium);
+machium_command_t m_target_list(Machium* machium); //list attached targets
+machium_command_t m_target_add(Machium* machium); //attach to another process
+machium_command_t m_target_select(Machium* machium); //change the selected target
+machium_command_t m_target_remove(Machium* machium); //detach from a target
+
+//run a command on every target in parallel
+machium_command_t m_all(Machium* machium);
+
+#endif /* TARGET_H */
@@ -0,0 +1,276 @@
+#include "ThreadPool.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+//the worker running on this thread, NULL for threads outside of any pool
+static __thread PoolWorker* current_worker = NULL;
+
+static void deque_init(PoolDeque* deque) {
+    pthread_mutex_init(&deque->lock, NULL);
+    deque->tasks = (PoolTask*) malloc(64 * sizeof(PoolTask));
+    deque->capacity = deque->tasks ? 64 : 0; //the first push tries again
+    deque->head = 0;
+    deque->tail = 0;
+}
+
+//false when the deque is full and can't grow
+static bool deque_push(PoolDeque* deque, PoolTask* task) {
+    PoolTask* tasks;
+    uint32_t capacity;
+    uint32_t count;
+
+    pthread_mutex_lock(&deque->lock);
+    count = deque->tail - deque->head;
+    if (count == deque->capacity) {
+        //unroll the ring into a buffer twice the size
+        capacity = deque->capacity ? deque->capacity * 2 : 64;
+        tasks = (PoolTask*) malloc(capacity * sizeof(PoolTask));
+        if (tasks == NULL) {
+            pthread_mutex_unlock(&deque->lock);
+            return false;
+        }
+        for (uint32_t i = 0; i < count; i++)
+            tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+        deque->head = 0;
+        deque->tail = count;
+    }
+    deque->tasks[deque->tail % deque->capacity] = *task;
+    deque->tail++;
+    pthread_mutex_unlock(&deque->lock);
+    return true;
+}
+
+//owner side, newest task
+static bool deque_pop(PoolDeque* deque, PoolTask* task) {
+    bool found;
+
+    pthread_mutex_lock(&deque->lock);
+    found = deque->tail != deque->head;
+    if (found) {
+        deque->tail--;
+        *task = deque->tasks[deque->tail % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+//thief side, oldest task. without [block] a deque someone else has locked is skipped
+static bool deque_steal(PoolDeque* deque, PoolTask* task, bool block) {
+    bool found;
+
+    //don't queue up behind the owner, there's probably another deque worth trying
+    if (!block && pthread_mutex_trylock(&deque->lock))
+        return false;
+    if (block)
+        pthread_mutex_lock(&deque->lock);
+    found = deque->tail != deque->head;
+    if (found) {
+        *task = deque->tasks[deque->head % deque->capacity];
+        deque->head++;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+//grab a task from our own deque or steal one, [worker] is NULL for threads outside the pool
+static bool pool_take(ThreadPool* pool, PoolWorker* worker, PoolTask* task, bool block) {
+    uint32_t start;
+    bool found;
+
+    found = worker && deque_pop(&worker->deque, task);
+    start = worker ? worker->index + 1 : 0;
+    for (uint32_t i = 0; !found && i < pool->thread_count; i++)
+        found = deque_steal(&pool->workers[(start + i) % pool->thread_count].deque, task, block);
+
+    if (found)
+        __atomic_fetch_sub(&pool->queued, 1, __ATOMIC_SEQ_CST);
+    return found;
+}
+
+static void pool_run(ThreadPool* pool, PoolTask* task) {
+    task->function(task->argument);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--task->group->pending == 0)
+        pthread_cond_broadcast(&pool->done);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void* pool_worker(void* context) {
+    PoolWorker* worker = (PoolWorker*) context;
+    ThreadPool* pool = worker->pool;
+    PoolTask task;
+    uint64_t pushes;
+
+    current_worker = worker;
+    while (1) {
+        pushes = __atomic_load_n(&pool->pushes, __ATOMIC_SEQ_CST);
+        //a deque that was busy the first time around gets waited for before going to sleep
+        if (pool_take(pool, worker, &task, false) || pool_take(pool, worker, &task, true)) {
+            pool_run(pool, &task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (pool->stop && !__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST)) {
+            pthread_mutex_unlock(&pool->lock);
+            break; //stopping and nothing left to do
+        }
+        //queued can be ahead of the deques (counted before the push, or taken and not uncounted yet)
+        //so sleep until the next push instead of spinning on the count, unless one landed since we looked
+        if (!pool->stop && pool->pushes == pushes)
+            pthread_cond_wait(&pool->work, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+ThreadPool* pool_create(uint32_t threads) {
+    ThreadPool* pool;
+    long cpus;
+
+    if (threads == 0) {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (uint32_t) cpus : 1;
+    }
+
+    pool = (ThreadPool*) calloc(1, sizeof(ThreadPool));
+    if (pool == NULL)
+        return NULL;
+    pool->workers = (PoolWorker*) calloc(threads, sizeof(PoolWorker));
+    if (pool->workers == NULL) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    //deques have to exist before any worker starts stealing from them
+    pool->thread_count = threads;
+    for (uint32_t i = 0; i < threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        deque_init(&pool->workers[i].deque);
+    }
+    //a deque without a worker still gets emptied by thieves, as long as at least one worker started
+    for (uint32_t i = 0; i < threads; i++) {
+        if (pthread_create(&pool->workers[i].thread, NULL, pool_worker, &pool->workers[i]))
+            break;
+        pool->started++;
+    }
+    return pool;
+}
+
+void pool_destroy(ThreadPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (uint32_t i = 0; i < pool->started; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+
+    for (uint32_t i = 0; i < pool->thread_count; i++) {
+        pthread_mutex_destroy(&pool->workers[i].deque.lock);
+        free(pool->workers[i].deque.tasks);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+    free(pool);
+}
+
+void pool_submit(ThreadPool* pool, PoolGroup* group, pool_task_t function, void* argument) {
+    PoolTask task;
+    PoolWorker* worker;
+
+    //no workers means no parallelism, just run it
+    if (pool->started == 0) {
+        function(argument);
+        return;
+    }
+
+    task.function = function;
+    task.argument = argument;
+    task.group = group;
+
+    pthread_mutex_lock(&pool->lock);
+    group->pending++;
+    pthread_mutex_unlock(&pool->lock);
+
+    //tasks spawned by a task stay on that worker until someone steals them
+    worker = current_worker && current_worker->pool == pool ? current_worker : &pool->workers[__atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED) % pool->thread_count];
+    __atomic_fetch_add(&pool->queued, 1, __ATOMIC_SEQ_CST); //before the push so a thief can't take it first and underflow the count
+    if (!deque_push(&worker->deque, &task)) {
+        //out of memory for a bigger deque, run it here instead
+        __atomic_fetch_sub(&pool->queued, 1, __ATOMIC_SEQ_CST);
+        pool_run(pool, &task);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    __atomic_fetch_add(&pool->pushes, 1, __ATOMIC_SEQ_CST);
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_wait(ThreadPool* pool, PoolGroup* group) {
+    PoolWorker* worker;
+    PoolTask task;
+    struct timespec timeout;
+
+    worker = current_worker && current_worker->pool == pool ? current_worker : NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    while (group->pending) {
+        if (worker == NULL) {
+            pthread_cond_wait(&pool->done, &pool->lock);
+            continue;
+        }
+
+        //a worker blocking here could deadlock the pool if every worker ends up waiting, so keep working instead
+        pthread_mutex_unlock(&pool->lock);
+        if (pool_take(pool, worker, &task, false)) {
+            pool_run(pool, &task);
+            pthread_mutex_lock(&pool->lock);
+            continue;
+        }
+        pthread_mutex_lock(&pool->lock);
+        if (group->pending) {
+            //nothing to steal, the rest of the group is running on other workers
+            clock_gettime(CLOCK_REALTIME, &timeout);
+            timeout.tv_nsec += 1000000;
+            if (timeout.tv_nsec >= 1000000000) {
+                timeout.tv_sec++;
+                timeout.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&pool->done, &pool->lock, &timeout);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static ThreadPool* shared_pool = NULL;
+static pthread_once_t shared_pool_once = PTHREAD_ONCE_INIT;
+
+//a pool without workers runs every task on the thread that submits it
+static ThreadPool inline_pool = { .lock = PTHREAD_MUTEX_INITIALIZER, .done = PTHREAD_COND_INITIALIZER };
+
+static void create_shared_pool(void) {
+    shared_pool = pool_create(0);
+    if (shared_pool == NULL)
+        shared_pool = &inline_pool;
+}
+
+ThreadPool* machium_pool(void) {
+    pthread_once(&shared_pool_once, create_shared_pool);
+    return shared_pool;
+}
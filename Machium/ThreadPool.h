@@ -0,0 +1,68 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+typedef void (*pool_task_t)(void* argument);
+
+typedef struct PoolTask {
+    pool_task_t function;
+    void* argument;
+    struct PoolGroup* group;
+} PoolTask;
+
+//a set of tasks that can be waited on together
+typedef struct PoolGroup {
+    uint32_t pending;
+} PoolGroup;
+
+/*
+every worker has its own deque of tasks
+a worker pushes and pops at the tail of its own deque (newest first, still warm in cache)
+idle workers steal from the head of someone else's deque (oldest first, usually the biggest piece of work left)
+*/
+typedef struct PoolDeque {
+    pthread_mutex_t lock;
+    PoolTask* tasks; //ring buffer
+    uint32_t capacity;
+    uint32_t head;
+    uint32_t tail;
+} PoolDeque;
+
+typedef struct PoolWorker {
+    struct ThreadPool* pool;
+    pthread_t thread;
+    PoolDeque deque;
+    uint32_t index;
+} PoolWorker;
+
+typedef struct ThreadPool {
+    PoolWorker* workers;
+    uint32_t thread_count; //deques
+    uint32_t started; //workers that actually got a thread
+    uint32_t next; //round robin for tasks submitted from outside the pool
+
+    pthread_mutex_t lock;
+    pthread_cond_t work; //signalled when a task is queued
+    pthread_cond_t done; //signalled when a group runs out of tasks
+    uint32_t queued; //tasks sitting in deques
+    uint64_t pushes; //tasks that made it into a deque, an idle worker sleeps until this moves
+    bool stop;
+} ThreadPool;
+
+//create a pool with [threads] workers, 0 means one per CPU
+ThreadPool* pool_create(uint32_t threads);
+void pool_destroy(ThreadPool* pool);
+
+//queue [function]([argument]) as part of [group]
+void pool_submit(ThreadPool* pool, PoolGroup* group, pool_task_t function, void* argument);
+
+//block until every task in [group] finished. workers calling this run other tasks while they wait
+void pool_wait(ThreadPool* pool, PoolGroup* group);
+
+//the pool shared by all of Machium, created the first time it's needed
+ThreadPool* machium_pool(void);
+
+#endif /* THREADPOOL_H */
@@ -0,0 +1,269 @@
+#include "View.h"
+
+ViewCache* view_cache(MachiumTarget* target) {
+    ViewCache* cache;
+    ViewCache* expected;
+
+    cache = __atomic_load_n(&target->views, __ATOMIC_ACQUIRE);
+    if (cache)
+        return cache;
+
+    cache = (ViewCache*) calloc(1, sizeof(ViewCache));
+    cache->task = target->debug_task;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    //'all' and background jobs can get here at the same time, the loser throws its cache away
+    expected = NULL;
+    if (!__atomic_compare_exchange_n(&target->views, &expected, cache, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_destroy(&cache->lock);
+        free(cache);
+        return expected;
+    }
+    return cache;
+}
+
+//must hold the lock
+static void view_unmap(ViewCache* cache, ViewMapping* mapping) {
+    vm_deallocate(mach_task_self(), (vm_address_t) mapping->local, (vm_size_t) mapping->size);
+    cache->mapped -= mapping->size;
+    memset(mapping, 0, sizeof(ViewMapping));
+}
+
+void view_cache_free(ViewCache* cache) {
+    if (cache == NULL)
+        return;
+    for (uint32_t i = 0; i < VIEW_MAPPINGS; i++) {
+        if (cache->mappings[i].local)
+            view_unmap(cache, &cache->mappings[i]);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+//find the region [address] is in and the vm object behind it, looking into submaps like region_list does
+static bool view_region(mach_port_t task, uint64_t address, uint64_t* start, uint64_t* end, uint64_t* object_id, uint64_t* object_offset) {
+    kern_return_t kret;
+    vm_region_submap_info_data_64_t info;
+    mach_msg_type_number_t count;
+    vm_address_t region;
+    vm_size_t size;
+    natural_t depth;
+
+    depth = 0;
+    while (1) {
+        region = (vm_address_t) address;
+        count = VM_REGION_SUBMAP_INFO_COUNT_64;
+        kret = vm_region_recurse_64(task, &region, &size, &depth, (vm_region_recurse_info_t) &info, &count);
+        if (kret != KERN_SUCCESS || region > address)
+            return false; //nothing mapped at [address]
+        if (!info.is_submap)
+            break;
+        depth++;
+    }
+
+    *start = region;
+    *end = region + size;
+    *object_id = info.object_id;
+    *object_offset = info.offset + (address - region);
+    return true;
+}
+
+//is the task still showing the same vm object in the window
+static bool view_check(ViewCache* cache, ViewMapping* mapping) {
+    uint64_t start;
+    uint64_t end;
+    uint64_t object_id;
+    uint64_t object_offset;
+
+    if (!view_region(cache->task, mapping->address, &start, &end, &object_id, &object_offset))
+        return false;
+    return object_id == mapping->object_id && object_offset == mapping->object_offset && end >= mapping->address + mapping->size;
+}
+
+//map [size] bytes at [address] (both page aligned) of the task read-only into Machium, 0 if the task refused
+static uint64_t view_remap(mach_port_t task, uint64_t address, uint64_t size) {
+    kern_return_t kret;
+    vm_address_t local;
+    vm_prot_t protection;
+    vm_prot_t max_protection;
+
+    //copy == false shares the pages instead of making a copy-on-write copy of them
+    local = 0;
+    kret = vm_remap(mach_task_self(), &local, (vm_size_t) size, 0, VM_FLAGS_ANYWHERE, task, (vm_address_t) address, false, &protection, &max_protection, VM_INHERIT_NONE);
+    if (kret != KERN_SUCCESS)
+        return 0;
+
+    //writes through a shared mapping would land in the task, take write away so a stray one crashes Machium instead
+    if (!(protection & VM_PROT_READ) || vm_protect(mach_task_self(), local, (vm_size_t) size, false, VM_PROT_READ) != KERN_SUCCESS) {
+        vm_deallocate(mach_task_self(), local, (vm_size_t) size);
+        return 0;
+    }
+    return local;
+}
+
+//must hold the lock
+static void view_unref(ViewCache* cache, ViewMapping* mapping) {
+    mapping->refs--;
+    if (mapping->refs == 0 && mapping->stale)
+        view_unmap(cache, mapping);
+}
+
+//find a usable cached window that covers the range, with a reference taken on it
+static ViewMapping* view_lookup(ViewCache* cache, uint64_t address, uint64_t size) {
+    ViewMapping* mapping;
+
+    pthread_mutex_lock(&cache->lock);
+    for (uint32_t i = 0; i < VIEW_MAPPINGS; i++) {
+        mapping = &cache->mappings[i];
+        if (mapping->local && !mapping->stale && mapping->address <= address && address + size <= mapping->address + mapping->size) {
+            mapping->refs++;
+            mapping->used = ++cache->clock;
+            pthread_mutex_unlock(&cache->lock);
+            return mapping;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return NULL;
+}
+
+//keep a new window, unmapping the least recently used ones to make room. NULL if every slot is in use
+static ViewMapping* view_insert(ViewCache* cache, uint64_t local, uint64_t address, uint64_t size, uint64_t object_id, uint64_t object_offset) {
+    ViewMapping* mapping;
+    ViewMapping* oldest;
+    ViewMapping* free_slot;
+
+    pthread_mutex_lock(&cache->lock);
+    while (1) {
+        free_slot = NULL;
+        oldest = NULL;
+        for (uint32_t i = 0; i < VIEW_MAPPINGS; i++) {
+            mapping = &cache->mappings[i];
+            if (mapping->local == 0) {
+                if (free_slot == NULL)
+                    free_slot = mapping;
+            }
+            else if (mapping->refs == 0 && (oldest == NULL || mapping->used < oldest->used)) {
+                oldest = mapping;
+            }
+        }
+        if (free_slot && cache->mapped + size <= VIEW_CACHE_SIZE)
+            break;
+        if (oldest == NULL) {
+            pthread_mutex_unlock(&cache->lock);
+            return NULL;
+        }
+        view_unmap(cache, oldest);
+    }
+
+    free_slot->local = local;
+    free_slot->address = address;
+    free_slot->size = size;
+    free_slot->object_id = object_id;
+    free_slot->object_offset = object_offset;
+    free_slot->refs = 1;
+    free_slot->used = ++cache->clock;
+    cache->mapped += size;
+    pthread_mutex_unlock(&cache->lock);
+    return free_slot;
+}
+
+bool view_map(ViewCache* cache, uint64_t address, uint64_t size, MemoryView* view) {
+    ViewMapping* mapping;
+    uint64_t region_start;
+    uint64_t region_end;
+    uint64_t object_id;
+    uint64_t object_offset;
+    uint64_t start;
+    uint64_t end;
+    uint64_t local;
+
+    memset(view, 0, sizeof(MemoryView));
+    view->address = address;
+    view->size = size;
+    view->cache = cache;
+    if (size == 0 || address + size < address || address + size > UINT64_MAX - VIEW_WINDOW)
+        return false;
+
+    //a window that is already mapped, as long as the task didn't put something else there since
+    mapping = view_lookup(cache, address, size);
+    if (mapping) {
+        if (view_check(cache, mapping)) {
+            view->mapping = mapping;
+            view->data = (uint8_t*) (mapping->local + (address - mapping->address));
+            return true;
+        }
+        pthread_mutex_lock(&cache->lock);
+        mapping->stale = true;
+        view_unref(cache, mapping);
+        pthread_mutex_unlock(&cache->lock);
+    }
+
+    //inside one region a whole window gets mapped and kept, the reads after this one are usually close by
+    if (view_region(cache->task, address, &region_start, &region_end, &object_id, &object_offset) && address + size <= region_end) {
+        start = address & ~(uint64_t) (VIEW_WINDOW - 1);
+        end = (address + size + VIEW_WINDOW - 1) & ~(uint64_t) (VIEW_WINDOW - 1);
+        start = start > region_start ? start : region_start;
+        end = end < region_end ? end : region_end;
+
+        local = view_remap(cache->task, start, end - start);
+        //the task can get a new vm object for the region when it's shared, so look again after mapping it
+        if (local && view_region(cache->task, start, &region_start, &region_end, &object_id, &object_offset)) {
+            mapping = object_id ? view_insert(cache, local, start, end - start, object_id, object_offset) : NULL;
+            if (mapping) {
+                view->mapping = mapping;
+                view->data = (uint8_t*) (local + (address - start));
+                return true;
+            }
+        }
+        if (local)
+            vm_deallocate(mach_task_self(), (vm_address_t) local, (vm_size_t) (end - start));
+    }
+
+    //ranges over more than one region (or with no room left in the cache) get a mapping of their own
+    start = address & ~(uint64_t) vm_page_mask;
+    end = (address + size + vm_page_mask) & ~(uint64_t) vm_page_mask;
+    local = view_remap(cache->task, start, end - start);
+    if (local == 0)
+        return false;
+    view->local = local;
+    view->local_size = end - start;
+    view->data = (uint8_t*) (local + (address - start));
+    return true;
+}
+
+bool view_acquire(ViewCache* cache, uint64_t address, uint64_t size, MemoryView* view) {
+    kern_return_t kret;
+    vm_size_t read_size;
+
+    if (view_map(cache, address, size, view))
+        return true;
+    if (size == 0)
+        return false;
+
+    //not every range can be mapped (the task or a sandbox can refuse it), a plain read might still work
+    view->data = (uint8_t*) malloc(size);
+    read_size = (vm_size_t) size;
+    kret = vm_read_overwrite(cache->task, (vm_address_t) address, (vm_size_t) size, (vm_address_t) view->data, &read_size);
+    if (kret != KERN_SUCCESS) {
+        free(view->data);
+        view->data = NULL;
+        return false;
+    }
+    view->copied = true;
+    return true;
+}
+
+void view_release(MemoryView* view) {
+    if (view->mapping) {
+        pthread_mutex_lock(&view->cache->lock);
+        view_unref(view->cache, view->mapping);
+        pthread_mutex_unlock(&view->cache->lock);
+    }
+    else if (view->local) {
+        vm_deallocate(mach_task_self(), (vm_address_t) view->local, (vm_size_t) view->local_size);
+    }
+    else if (view->copied) {
+        free(view->data);
+    }
+    memset(view, 0, sizeof(MemoryView));
+}
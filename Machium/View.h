@@ -0,0 +1,65 @@
+#ifndef VIEW_H
+#define VIEW_H
+
+#include "Machium.h"
+#include <pthread.h>
+
+#define VIEW_WINDOW (4 * 1024 * 1024) //reads inside one region get mapped in aligned windows this big, so reads nearby share the mapping
+#define VIEW_MAPPINGS 64 //mappings kept per target
+#define VIEW_CACHE_SIZE (512ULL * 1024 * 1024) //most address space the kept mappings take up together
+
+//a window of the task's memory mapped into Machium
+typedef struct ViewMapping {
+    uint64_t local; //where it's mapped in Machium, 0 for a free slot
+    uint64_t address; //where it is in the task
+    uint64_t size;
+    uint64_t object_id; //vm object and offset the task had at [address] when it was mapped
+    uint64_t object_offset; //if they change the task mapped something else there and the window is stale
+    uint32_t refs; //views using it right now
+    uint64_t used; //when it was last used, the least recently used mapping is unmapped first
+    bool stale; //unmapped as soon as the last view lets go of it
+} ViewMapping;
+
+/*
+the mappings of one target
+the task's pages are shared with Machium, not copied, so a view always shows what's in the task right now
+*/
+typedef struct ViewCache {
+    mach_port_t task;
+    ViewMapping mappings[VIEW_MAPPINGS];
+    uint64_t mapped; //address space taken by the mappings
+    uint64_t clock;
+    pthread_mutex_t lock;
+} ViewCache;
+
+//a range of the task's memory that can be used like a plain pointer
+typedef struct MemoryView {
+    uint8_t* data; //read-only when mapped
+    uint64_t address;
+    uint64_t size;
+    ViewCache* cache;
+    ViewMapping* mapping; //cached window the view is in
+    uint64_t local; //a mapping only this view uses, when the range couldn't be cached
+    uint64_t local_size;
+    bool copied; //[data] is a malloc'd copy, the task refused to be mapped
+} MemoryView;
+
+//get the mappings of a target, made on first use. safe to call from any thread
+ViewCache* view_cache(MachiumTarget* target);
+
+//unmap everything and free the cache, no view can be in use. jobs read through views, see job_idle
+void view_cache_free(ViewCache* cache);
+
+/*
+map [size] bytes at [address] of the task into Machium, false if the task refused
+ranges inside one region go through the cache, anything else gets a mapping of its own
+*/
+bool view_map(ViewCache* cache, uint64_t address, uint64_t size, MemoryView* view);
+
+//same as view_map, but falls back to copying the range with vm_read_overwrite
+bool view_acquire(ViewCache* cache, uint64_t address, uint64_t size, MemoryView* view);
+
+//done with a view from view_map / view_acquire
+void view_release(MemoryView* view);
+
+#endif /* VIEW_H */
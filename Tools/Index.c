@@ -0,0 +1,185 @@
+/*
+index a Mach-O or dyld shared cache file the way Machium does and print what came out and how long it took
+only needs libc and the parsers, so it runs on linux against files copied off a device
+
+    cc -O2 -o machium-index Tools/Index.c Machium/MachO.c Machium/SharedCache.c
+    ./machium-index [file] [lookups] [0xADDRESS] ...
+
+[lookups] random lookups are timed (1000000 by default), every [0xADDRESS] (unslid) is symbolicated
+*/
+#include "../Machium/MachO.h"
+#include "../Machium/SharedCache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define INDEX_LOOKUPS 1000000 //random lookups timed when none are given
+
+static double index_time(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+//xorshift, the same addresses every run so timings compare
+static uint64_t index_random(uint64_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static int index_macho(const char* path, uint64_t lookups, char** addresses, int address_count) {
+    MachOImage image;
+    MachOFile file;
+    const MachOSymbol* symbol;
+    const char* name;
+    uint64_t random;
+    uint64_t offset;
+    uint64_t sum;
+    uint32_t named;
+    double started;
+    double opened;
+    double parsed;
+    double indexed;
+
+    memset(&image, 0, sizeof(image));
+    started = index_time();
+    if (!macho_file_open(&file, path)) {
+        printf("# %s isn't an arm64 Mach-O\n", path);
+        return 1;
+    }
+    opened = index_time();
+    if (!macho_parse_header(&image, macho_file_read, &file, 0)) {
+        printf("# Couldn't parse the load commands of %s\n", path);
+        macho_file_close(&file);
+        return 1;
+    }
+    parsed = index_time();
+    if (!macho_parse_symbols(&image, macho_file_read, &file, 0, false)) {
+        printf("# Couldn't parse the symbols of %s\n", path);
+        macho_free(&image);
+        macho_file_close(&file);
+        return 1;
+    }
+    indexed = index_time();
+
+    named = 0;
+    for (uint32_t i = 0; i < image.symbol_count; i++)
+        named += image.symbols[i].name != MACHO_UNNAMED;
+
+    printf("# %s: %u segments, %u symbols (%u named, %u function starts only), %u bytes of names, 0x%llx bytes from __TEXT\n", path,
+           image.segment_count, image.symbol_count, named, image.symbol_count - named, image.strings_size, (unsigned long long) image.size);
+    printf("# mmap %.3fms, load commands %.3fms, symbols %.3fms\n", (opened - started) * 1e3, (parsed - opened) * 1e3, (indexed - parsed) * 1e3);
+
+    if (image.symbol_count && image.size && lookups) {
+        random = 0x9e3779b97f4a7c15ULL;
+        sum = 0;
+        started = index_time();
+        for (uint64_t i = 0; i < lookups; i++) {
+            symbol = macho_lookup(&image, index_random(&random) % image.size);
+            sum += symbol ? symbol->offset : 0;
+        }
+        indexed = index_time() - started;
+        printf("# %llu lookups in %.3fms, %.1fns each (%llx)\n", (unsigned long long) lookups, indexed * 1e3, indexed * 1e9 / lookups, (unsigned long long) sum);
+    }
+
+    for (int i = 0; i < address_count; i++) {
+        offset = strtoull(addresses[i], NULL, 16) - image.text_vmaddr;
+        symbol = offset < image.size ? macho_lookup(&image, offset) : NULL;
+        if (symbol == NULL) {
+            printf("%s\n", addresses[i]);
+            continue;
+        }
+        name = macho_symbol_name(&image, symbol);
+        printf("%s %s+0x%llx\n", addresses[i], name ? name : "func", (unsigned long long) (offset - symbol->offset));
+    }
+
+    macho_free(&image);
+    macho_file_close(&file);
+    return 0;
+}
+
+//subcaches and .symbols are picked up next to [path] like on the device
+static int index_cache(const char* path, uint64_t lookups, char** addresses, int address_count) {
+    SharedCache* cache;
+    const SharedCacheSymbol* symbol;
+    const char* name;
+    uint64_t random;
+    uint64_t address;
+    uint64_t span;
+    uint64_t sum;
+    double started;
+    double indexed;
+
+    cache = (SharedCache*) calloc(1, sizeof(SharedCache));
+    started = index_time();
+    if (!shared_cache_open(cache, path, NULL)) {
+        printf("# Couldn't index the shared cache %s\n", path);
+        free(cache);
+        return 1;
+    }
+    indexed = index_time() - started;
+
+    printf("# %s: %u files (%u missing), %u images, %u symbols (%u local)\n", path,
+           cache->file_count, cache->missing_files, cache->image_count, cache->symbol_count, cache->local_count);
+    printf("# mmap and index %.3fms\n", indexed * 1e3);
+
+    if (cache->symbol_count && lookups) {
+        span = cache->symbols[cache->symbol_count - 1].address - cache->base + 1;
+        random = 0x9e3779b97f4a7c15ULL;
+        sum = 0;
+        started = index_time();
+        for (uint64_t i = 0; i < lookups; i++) {
+            symbol = shared_cache_lookup(cache, cache->base + index_random(&random) % span);
+            sum += symbol ? symbol->address : 0;
+        }
+        indexed = index_time() - started;
+        printf("# %llu lookups in %.3fms, %.1fns each (%llx)\n", (unsigned long long) lookups, indexed * 1e3, indexed * 1e9 / lookups, (unsigned long long) sum);
+    }
+
+    for (int i = 0; i < address_count; i++) {
+        address = strtoull(addresses[i], NULL, 16);
+        symbol = shared_cache_lookup(cache, address);
+        if (symbol == NULL) {
+            printf("%s\n", addresses[i]);
+            continue;
+        }
+        name = shared_cache_symbol_name(cache, symbol);
+        printf("%s %s`%s+0x%llx\n", addresses[i], cache->images[symbol->image].name, name ? name : "func", (unsigned long long) (address - symbol->address));
+    }
+
+    shared_cache_close(cache);
+    free(cache);
+    return 0;
+}
+
+//"dyld_v1" at the start, everything else goes to the Mach-O parser
+static bool index_is_cache(const char* path) {
+    char magic[7];
+    FILE* file;
+    bool is_cache;
+
+    file = fopen(path, "rb");
+    if (file == NULL)
+        return false;
+    is_cache = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && !memcmp(magic, "dyld_v1", sizeof(magic));
+    fclose(file);
+    return is_cache;
+}
+
+int main(int argc, char** argv) {
+    uint64_t lookups;
+
+    if (argc < 2) {
+        printf("usage: %s [file] [lookups] [0xADDRESS] ...\n", argv[0]);
+        return 1;
+    }
+    lookups = argc > 2 ? strtoull(argv[2], NULL, 0) : INDEX_LOOKUPS;
+    if (index_is_cache(argv[1]))
+        return index_cache(argv[1], lookups, argv + 3, argc > 3 ? argc - 3 : 0);
+    return index_macho(argv[1], lookups, argv + 3, argc > 3 ? argc - 3 : 0);
+}
@@ -0,0 +1,85 @@
+/*
+write a symbol cache file and load it back, symbols that share a name included
+only needs libc, exits 0 when everything came back the way it went in
+
+    cc -O1 -g -fsanitize=address -o symbol-cache-test Tools/SymbolCacheTest.c Machium/SymbolCache.c Machium/MachO.c
+    ./symbol-cache-test
+*/
+#include "../Machium/SymbolCache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int failures = 0;
+
+static void test_check(bool passed, const char* what) {
+    printf("%s %s\n", passed ? "ok  " : "FAIL", what);
+    failures += !passed;
+}
+
+//both aliases of one address and a name that comes back later point at the same entry of the string table
+static void test_shared_names(void) {
+    static char strings[] = "\0_a\0_b";
+    MachOSymbol symbols[] = {
+        { 0x100, 1 },
+        { 0x100, 1 },
+        { 0x200, 4 },
+        { 0x300, 1 },
+        { 0x400, MACHO_UNNAMED },
+        { 0x500, 1 },
+    };
+    MachOImage image;
+    MachOImage loaded;
+    const char* name;
+    bool same;
+
+    memset(&image, 0, sizeof(image));
+    memcpy(image.uuid, "symbolcachetest!", 16);
+    image.has_uuid = true;
+    image.size = 0x1000;
+    image.symbols = symbols;
+    image.symbol_count = sizeof(symbols) / sizeof(symbols[0]);
+    image.strings = strings;
+    image.strings_size = sizeof(strings);
+
+    test_check(symbol_cache_store(&image), "store symbols that share an n_strx");
+
+    memset(&loaded, 0, sizeof(loaded));
+    memcpy(loaded.uuid, image.uuid, 16);
+    loaded.has_uuid = true;
+    loaded.size = image.size;
+    test_check(symbol_cache_load(&loaded), "load them back");
+    test_check(loaded.symbol_count == image.symbol_count, "same symbol count");
+
+    same = loaded.symbol_count == image.symbol_count;
+    for (uint32_t i = 0; same && i < image.symbol_count; i++) {
+        name = macho_symbol_name(&loaded, &loaded.symbols[i]);
+        same = loaded.symbols[i].offset == symbols[i].offset
+            && (symbols[i].name == MACHO_UNNAMED ? name == NULL : name && !strcmp(name, strings + symbols[i].name + 1));
+    }
+    test_check(same, "same offsets and names");
+    test_check(loaded.symbols[0].name == loaded.symbols[1].name, "aliases share one copy of their name");
+    macho_free(&loaded);
+}
+
+int main(void) {
+    char directory[] = "/tmp/machium-symbol-cache-XXXXXX";
+    char path[1024];
+    uint8_t uuid[16];
+
+    if (mkdtemp(directory) == NULL) {
+        printf("FAIL couldn't make %s\n", directory);
+        return 1;
+    }
+    setenv(SYMBOL_CACHE_DIR_ENV, directory, 1);
+
+    test_shared_names();
+
+    memcpy(uuid, "symbolcachetest!", 16);
+    if (symbol_cache_path(uuid, path, sizeof(path)))
+        unlink(path);
+    rmdir(directory);
+    return failures != 0;
+}